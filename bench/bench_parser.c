@@ -0,0 +1,402 @@
+/*
+ * C-HTTP Payment Server - Parser/Serializer Microbenchmark
+ * Runs each stage of request parsing, header lookup and response
+ * rendering in a tight loop over a corpus of captured requests, and
+ * reports time, heap bytes and heap allocations per operation
+ *
+ * Corpus files (*.http) hold one raw request each, CRLF line endings
+ * included, exactly as it arrived on the wire.
+ *
+ * Usage: bench_parser [corpus-dir] [iterations]
+ */
+
+#include "arena.h"
+#include "connection.h"
+#include "http_parser.h"
+#include "http_response.h"
+#include "logger.h"
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Default operations per (request, stage) pair */
+#define BENCH_DEFAULT_ITERATIONS 200000
+
+/* Default corpus, relative to the repository root */
+#define BENCH_DEFAULT_CORPUS "bench/corpus"
+
+/* Most corpus files loaded */
+#define BENCH_MAX_CASES 64
+
+/* Largest corpus file accepted */
+#define BENCH_MAX_FILE (64 * 1024)
+
+/*
+ * Heap accounting
+ * malloc and friends are interposed (glibc exports the real ones as
+ * __libc_*), so every allocation made by the code under test is counted,
+ * including any hidden inside libc helpers it calls; the aligned entry
+ * points count too, since arenas and per-thread rings use them
+ */
+typedef struct {
+    size_t allocations;         /* malloc/calloc/realloc/aligned calls */
+    size_t bytes;               /* Bytes requested by those calls */
+} bench_heap_t;
+
+static bench_heap_t g_heap;
+
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *ptr);
+
+void *malloc(size_t size) {
+    __atomic_add_fetch(&g_heap.allocations, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&g_heap.bytes, size, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    __atomic_add_fetch(&g_heap.allocations, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&g_heap.bytes, count * size, __ATOMIC_RELAXED);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    __atomic_add_fetch(&g_heap.allocations, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&g_heap.bytes, size, __ATOMIC_RELAXED);
+    return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size) {
+    __atomic_add_fetch(&g_heap.allocations, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&g_heap.bytes, size, __ATOMIC_RELAXED);
+    return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    void *ptr = memalign(alignment, size);
+    if (ptr == NULL) {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+void free(void *ptr) {
+    __libc_free(ptr);
+}
+#define BENCH_HEAP_COUNTED 1
+#else
+#define BENCH_HEAP_COUNTED 0
+#endif
+
+/* Benchmark input: one corpus request, split at its line boundaries */
+typedef struct {
+    char name[64];
+    char *data;
+    size_t length;
+    size_t line_length;         /* Request line including its CRLF */
+    size_t header_length;       /* Up to and including the blank line */
+    http_request_t parsed;      /* Full parse, for the lookup stage */
+} bench_case_t;
+
+/* Per-operation cost of one stage */
+typedef struct {
+    double ns;
+    double bytes;
+    double allocations;
+} bench_cost_t;
+
+/* Stage under test; returns a value folded into a checksum, negative on failure */
+typedef long (*bench_stage_t)(const bench_case_t *bc);
+
+/*
+ * Helper function: Current monotonic time in nanoseconds
+ */
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/*
+ * Helper function: Load one corpus file and locate its request line and headers
+ * Returns 0 on success, -1 if the file is unreadable or not a complete request
+ */
+static int load_case(bench_case_t *bc, const char *dir, const char *file) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return -1;
+    }
+
+    bc->data = (char *)malloc(BENCH_MAX_FILE + 1);
+    if (bc->data == NULL) {
+        fclose(fp);
+        return -1;
+    }
+    bc->length = fread(bc->data, 1, BENCH_MAX_FILE + 1, fp);
+    fclose(fp);
+    if (bc->length > BENCH_MAX_FILE) {
+        fprintf(stderr, "%s: larger than %d bytes\n", path, BENCH_MAX_FILE);
+        free(bc->data);
+        return -1;
+    }
+
+    /* The server resets a request that does not fit its read buffer: timing it would mislead */
+    if (bc->length >= CONN_BUFFER_SIZE) {
+        fprintf(stderr, "%s: %zu bytes, the server only buffers %d\n", path, bc->length,
+                CONN_BUFFER_SIZE - 1);
+        free(bc->data);
+        return -1;
+    }
+    bc->data[bc->length] = '\0';
+
+    size_t name_length = strlen(file) - strlen(".http");
+    snprintf(bc->name, sizeof(bc->name), "%.*s", (int)name_length, file);
+
+    http_request_init(&bc->parsed);
+    if (http_parse_request(&bc->parsed, bc->data, bc->length) != HTTP_PARSE_DONE) {
+        fprintf(stderr, "%s: not a complete request (%s)\n", path,
+                bc->parsed.parse_error != NULL ? bc->parsed.parse_error : "truncated");
+        free(bc->data);
+        return -1;
+    }
+
+    const char *line_end = memchr(bc->data, '\n', bc->length);
+    bc->line_length = (size_t)(line_end - bc->data) + 1;
+    bc->header_length = bc->parsed.header_length;
+    return 0;
+}
+
+/*
+ * Helper function: Load every *.http file in a directory, sorted by name
+ * Returns the number of cases loaded
+ */
+static size_t load_corpus(const char *dir, bench_case_t *cases, size_t max_cases) {
+    struct dirent **names;
+    int count = scandir(dir, &names, NULL, alphasort);
+    if (count < 0) {
+        fprintf(stderr, "Cannot read corpus directory %s\n", dir);
+        return 0;
+    }
+
+    size_t loaded = 0;
+    for (int i = 0; i < count; i++) {
+        const char *file = names[i]->d_name;
+        size_t length = strlen(file);
+        if (loaded < max_cases && length > 5 && strcmp(file + length - 5, ".http") == 0 &&
+            load_case(&cases[loaded], dir, file) == 0) {
+            loaded++;
+        }
+        free(names[i]);
+    }
+    free(names);
+    return loaded;
+}
+
+/*
+ * Stage: request line only
+ */
+static long stage_request_line(const bench_case_t *bc) {
+    static http_request_t request;
+    if (parse_request_line(&request, bc->data, bc->line_length) != 0) {
+        return -1;
+    }
+    return (long)request.uri.len + (long)request.method;
+}
+
+/*
+ * Stage: header lines only (between the request line and the blank line)
+ */
+static long stage_headers(const bench_case_t *bc) {
+    /* Reused across calls: parse_headers() resets what it owns, the rest stays put */
+    static http_request_t request;
+    const char *section = bc->data + bc->line_length;
+    size_t length = bc->header_length - bc->line_length - 2;
+    if (parse_headers(&request, section, length) != 0) {
+        return -1;
+    }
+    return (long)request.header_count;
+}
+
+/*
+ * Stage: name lookups a handler typically makes on a parsed request
+ * (a header near the front, one near the end, and one that is absent)
+ */
+static long stage_lookup(const bench_case_t *bc) {
+    static const char *const names[] = { "host", "Accept-Language", "X-Missing-Header" };
+    long found = 0;
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        const http_str_t *value = http_get_header(&bc->parsed, names[i]);
+        found += value != NULL ? (long)value->len : 0;
+    }
+    return found;
+}
+
+/*
+ * Stage: the full incremental parse, as the connection layer runs it
+ */
+static long stage_parse(const bench_case_t *bc) {
+    http_request_t request;
+    http_request_init(&request);
+    if (http_parse_request(&request, bc->data, bc->length) != HTTP_PARSE_DONE) {
+        return -1;
+    }
+    return (long)request.header_length;
+}
+
+/*
+ * Stage: render the JSON answer a handler builds (pre-rendered block)
+ */
+static long stage_render_json(const bench_case_t *bc) {
+    static const char body[] = "{\"status\":\"ok\"}";
+    (void)bc;
+
+    http_response_t response;
+    http_output_t output;
+    if (http_response_init(&response, HTTP_OK) != 0 ||
+        http_response_add_block(&response, &HTTP_BLOCK_JSON) != 0 ||
+        http_response_set_body(&response, body, sizeof(body) - 1) != 0 ||
+        http_response_render(&response, &output) != 0) {
+        return -1;
+    }
+    long length = (long)output.length;
+    arena_reset(arena_thread());
+    return length;
+}
+
+/*
+ * Stage: render a response with per-request headers added one by one
+ */
+static long stage_render_headers(const bench_case_t *bc) {
+    static const char body[] =
+        "{\"id\":\"pay_7f9c2ba4e88f\",\"status\":\"created\",\"amount\":2599,\"currency\":\"USD\"}";
+    (void)bc;
+
+    http_response_t response;
+    http_output_t output;
+    if (http_response_init(&response, HTTP_OK) != 0 ||
+        http_response_add_header(&response, "Content-Type", "application/json") != 0 ||
+        http_response_add_header(&response, "Location", "/payments/pay_7f9c2ba4e88f") != 0 ||
+        http_response_add_header(&response, "X-Request-Id",
+                                 "4bf92f3577b34da6a3ce929d0e0e4736") != 0 ||
+        http_response_set_body(&response, body, sizeof(body) - 1) != 0 ||
+        http_response_render(&response, &output) != 0) {
+        return -1;
+    }
+    long length = (long)output.length;
+    arena_reset(arena_thread());
+    return length;
+}
+
+/*
+ * Helper function: Run one stage repeatedly
+ * Returns 0 with the per-operation cost filled in, -1 if the stage failed
+ */
+static int run_stage(bench_stage_t stage, const bench_case_t *bc, long iterations,
+                     bench_cost_t *cost) {
+    long checksum = 0;
+
+    /* Warm up: first-use allocations (arena chunk, Date line) are not steady state */
+    for (long i = 0; i < iterations / 10 + 1; i++) {
+        long value = stage(bc);
+        if (value < 0) {
+            return -1;
+        }
+        checksum += value;
+    }
+
+    bench_heap_t before = g_heap;
+    double start = now_ns();
+    for (long i = 0; i < iterations; i++) {
+        checksum += stage(bc);
+    }
+    double elapsed = now_ns() - start;
+    bench_heap_t after = g_heap;
+
+    /* Keep the loop from being optimized away */
+    if (checksum == 0) {
+        fprintf(stderr, "unexpected checksum\n");
+    }
+
+    cost->ns = elapsed / (double)iterations;
+    cost->bytes = (double)(after.bytes - before.bytes) / (double)iterations;
+    cost->allocations = (double)(after.allocations - before.allocations) / (double)iterations;
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *corpus = argc > 1 ? argv[1] : BENCH_DEFAULT_CORPUS;
+    long iterations = argc > 2 ? strtol(argv[2], NULL, 10) : BENCH_DEFAULT_ITERATIONS;
+    if (iterations <= 0) {
+        fprintf(stderr, "Usage: %s [corpus-dir] [iterations]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    /* Parser debug logging would dominate the measurement */
+    logger_set_level(LOG_ERROR);
+
+    static bench_case_t cases[BENCH_MAX_CASES];
+    size_t num_cases = load_corpus(corpus, cases, BENCH_MAX_CASES);
+    if (num_cases == 0) {
+        fprintf(stderr, "No *.http requests in %s\n", corpus);
+        return EXIT_FAILURE;
+    }
+
+    static const struct {
+        const char *name;
+        bench_stage_t run;
+        bool per_request;       /* Depends on the corpus request */
+    } stages[] = {
+        { "parse_request_line", stage_request_line, true },
+        { "parse_headers", stage_headers, true },
+        { "http_get_header x3", stage_lookup, true },
+        { "http_parse_request", stage_parse, true },
+        { "render json", stage_render_json, false },
+        { "render +3 headers", stage_render_headers, false },
+    };
+
+    printf("%ld iterations per cell (ns/op, B/op, allocs/op)%s\n\n", iterations,
+           BENCH_HEAP_COUNTED ? "" : "; heap counters need glibc");
+    printf("%-20s %7s %-20s %10s %10s %10s\n", "request", "bytes", "stage",
+           "ns/op", "B/op", "allocs/op");
+
+    for (size_t s = 0; s < sizeof(stages) / sizeof(stages[0]); s++) {
+        size_t rows = stages[s].per_request ? num_cases : 1;
+        for (size_t c = 0; c < rows; c++) {
+            bench_cost_t cost;
+            const char *name = stages[s].per_request ? cases[c].name : "-";
+            size_t bytes = stages[s].per_request ? cases[c].length : 0;
+
+            printf("%-20s %7zu %-20s", name, bytes, stages[s].name);
+            if (run_stage(stages[s].run, &cases[c], iterations, &cost) != 0) {
+                printf(" %10s\n", "failed");
+                continue;
+            }
+            printf(" %10.1f %10.1f %10.2f\n", cost.ns, cost.bytes, cost.allocations);
+        }
+    }
+
+    for (size_t c = 0; c < num_cases; c++) {
+        free(cases[c].data);
+    }
+
+    return EXIT_SUCCESS;
+}
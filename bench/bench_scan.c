@@ -0,0 +1,194 @@
+/*
+ * C-HTTP Payment Server - Header Scanning Benchmark
+ * Times http_parse_request() on realistic header sets with each scan kernel
+ *
+ * Usage: bench_scan [iterations]
+ */
+
+#include "http_parser.h"
+#include "http_scan.h"
+#include "logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Default parses per (request, kernel) pair */
+#define BENCH_DEFAULT_ITERATIONS 200000
+
+/* Benchmark input */
+typedef struct {
+    const char *name;
+    char *data;
+    size_t length;
+} bench_case_t;
+
+/*
+ * Helper function: Current monotonic time in nanoseconds
+ */
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/*
+ * Helper function: Build a request from a header block plus a padded header
+ * pad_name/pad_length add one large header (cookies, bearer tokens)
+ */
+static bench_case_t make_case(const char *name, const char *head,
+                              const char *pad_name, size_t pad_length) {
+    bench_case_t bc;
+    size_t head_length = strlen(head);
+    size_t pad_name_length = pad_name != NULL ? strlen(pad_name) : 0;
+
+    bc.name = name;
+    bc.data = (char *)malloc(head_length + pad_name_length + pad_length + 16);
+    if (bc.data == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    memcpy(bc.data, head, head_length);
+    bc.length = head_length;
+
+    if (pad_name != NULL) {
+        memcpy(bc.data + bc.length, pad_name, pad_name_length);
+        bc.length += pad_name_length;
+
+        /* Token-like filler: base64 alphabet with periodic separators */
+        static const char alphabet[] =
+            "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+        for (size_t i = 0; i < pad_length; i++) {
+            bc.data[bc.length++] = (i % 48 == 47) ? ';' : alphabet[(i * 7) % 64];
+        }
+        memcpy(bc.data + bc.length, "\r\n", 2);
+        bc.length += 2;
+    }
+
+    memcpy(bc.data + bc.length, "\r\n", 2);
+    bc.length += 2;
+    bc.data[bc.length] = '\0';
+    return bc;
+}
+
+/*
+ * Helper function: Parse one request repeatedly
+ * Returns nanoseconds per parse, negative if the request fails to parse
+ */
+static double run_case(const bench_case_t *bc, long iterations) {
+    http_request_t request;
+    size_t checksum = 0;
+
+    double start = now_ns();
+    for (long i = 0; i < iterations; i++) {
+        http_request_init(&request);
+        if (http_parse_request(&request, bc->data, bc->length) != HTTP_PARSE_DONE) {
+            return -1.0;
+        }
+        checksum += request.header_length + (size_t)request.header_count;
+    }
+    double elapsed = now_ns() - start;
+
+    /* Keep the loop from being optimized away */
+    if (checksum == 0) {
+        fprintf(stderr, "unexpected checksum\n");
+    }
+
+    return elapsed / (double)iterations;
+}
+
+int main(int argc, char *argv[]) {
+    long iterations = argc > 1 ? strtol(argv[1], NULL, 10) : BENCH_DEFAULT_ITERATIONS;
+    if (iterations <= 0) {
+        fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    /* Parser debug logging would dominate the measurement */
+    logger_set_level(LOG_ERROR);
+
+    bench_case_t cases[] = {
+        make_case("curl-get",
+                  "GET /health HTTP/1.1\r\n"
+                  "Host: localhost:8080\r\n"
+                  "User-Agent: curl/8.5.0\r\n"
+                  "Accept: */*\r\n",
+                  NULL, 0),
+        make_case("browser",
+                  "GET /dashboard/payments?page=2&sort=desc HTTP/1.1\r\n"
+                  "Host: pay.example.com\r\n"
+                  "Connection: keep-alive\r\n"
+                  "sec-ch-ua: \"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\"\r\n"
+                  "sec-ch-ua-mobile: ?0\r\n"
+                  "sec-ch-ua-platform: \"macOS\"\r\n"
+                  "Upgrade-Insecure-Requests: 1\r\n"
+                  "User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10_15_7) "
+                  "AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+                  "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,"
+                  "image/avif,image/webp,*/*;q=0.8\r\n"
+                  "Sec-Fetch-Site: same-origin\r\n"
+                  "Sec-Fetch-Mode: navigate\r\n"
+                  "Sec-Fetch-Dest: document\r\n"
+                  "Referer: https://pay.example.com/dashboard\r\n"
+                  "Accept-Encoding: gzip, deflate, br\r\n"
+                  "Accept-Language: en-US,en;q=0.9\r\n",
+                  "Cookie: ", 1200),
+        make_case("api-post",
+                  "POST /api/v1/payments HTTP/1.1\r\n"
+                  "Host: api.example.com\r\n"
+                  "Content-Type: application/json\r\n"
+                  "Content-Length: 128\r\n"
+                  "X-Idempotency-Key: 7f9c2ba4-e88f-11ee-8c90-0242ac120002\r\n"
+                  "X-Request-Id: 4bf92f3577b34da6a3ce929d0e0e4736\r\n"
+                  "Accept: application/json\r\n",
+                  "Authorization: Bearer ", 900),
+        make_case("big-cookie",
+                  "GET /account HTTP/1.1\r\n"
+                  "Host: pay.example.com\r\n"
+                  "Accept: */*\r\n",
+                  "Cookie: ", 6000),
+    };
+    size_t num_cases = sizeof(cases) / sizeof(cases[0]);
+
+    static const http_scan_kernel_t kernels[] = {
+        HTTP_SCAN_SCALAR, HTTP_SCAN_SSE2, HTTP_SCAN_AVX2, HTTP_SCAN_NEON
+    };
+
+    printf("http_parse_request, %ld iterations per cell (ns/request, MB/s)\n\n", iterations);
+    printf("%-12s %7s", "request", "bytes");
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+        if (http_scan_select(kernels[k]) == 0) {
+            printf(" %20s", http_scan_kernel_name(kernels[k]));
+        }
+    }
+    printf("\n");
+
+    for (size_t c = 0; c < num_cases; c++) {
+        printf("%-12s %7zu", cases[c].name, cases[c].length);
+
+        for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+            if (http_scan_select(kernels[k]) != 0) {
+                continue;
+            }
+
+            run_case(&cases[c], iterations / 10 + 1);    /* Warm up */
+            double ns = run_case(&cases[c], iterations);
+            if (ns < 0) {
+                printf(" %20s", "parse error");
+                continue;
+            }
+
+            char cell[32];
+            snprintf(cell, sizeof(cell), "%.0f (%.0f)", ns, (double)cases[c].length / ns * 1e3);
+            printf(" %20s", cell);
+        }
+        printf("\n");
+    }
+
+    for (size_t c = 0; c < num_cases; c++) {
+        free(cases[c].data);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,1074 @@
+/*
+ * C-HTTP Payment Server - Load Generator
+ * Drives a running server over N concurrent connections and reports
+ * throughput plus latency percentiles from an HDR histogram
+ *
+ * Closed loop by default: each connection keeps --pipeline requests in
+ * flight. With --rate, requests are scheduled at fixed intervals and
+ * latency is measured from the intended send time, so a stalled server
+ * is not hidden by the generator backing off (coordinated omission).
+ *
+ * Usage: loadgen [options]   (see --help)
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Most requests one connection keeps in flight */
+#define LOADGEN_MAX_PIPELINE 64
+
+/* Response bytes buffered per connection */
+#define LOADGEN_RECV_BUFFER (64 * 1024)
+
+/* Recent idempotency keys a worker may repeat (--dup-ratio) */
+#define LOADGEN_KEY_RING 1024
+#define LOADGEN_KEY_LENGTH 48
+
+/* Request headers without the body (upper bound) */
+#define LOADGEN_REQUEST_HEAD 512
+
+/* Pause before reconnecting after a failed connect */
+#define LOADGEN_RETRY_NS 10000000ULL
+
+/*
+ * HDR Histogram
+ * Log-linear buckets: 2^SUB_BUCKET_BITS sub-buckets per power of two keep
+ * ~3 significant digits at any magnitude; values are nanoseconds
+ */
+#define HIST_SUB_BUCKET_BITS 11
+#define HIST_SUB_BUCKET_COUNT (1u << HIST_SUB_BUCKET_BITS)
+#define HIST_SUB_BUCKET_HALF (HIST_SUB_BUCKET_COUNT / 2)
+#define HIST_BUCKET_COUNT 26        /* Up to 2^36 ns (~68 s) */
+#define HIST_COUNTS ((HIST_BUCKET_COUNT + 1) * HIST_SUB_BUCKET_HALF)
+#define HIST_MAX_VALUE ((1ULL << (HIST_BUCKET_COUNT + HIST_SUB_BUCKET_BITS - 1)) - 1)
+
+typedef struct {
+    uint64_t counts[HIST_COUNTS];
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    double sum;
+} histogram_t;
+
+/* Load settings */
+typedef struct {
+    const char *host;
+    const char *port;
+    int connections;
+    int threads;
+    double duration_s;          /* Measured time */
+    double warmup_s;            /* Unmeasured time before it */
+    uint64_t max_requests;      /* Stop after this many (0 = duration only) */
+    int pipeline;               /* Requests in flight per connection */
+    bool keepalive;             /* Reuse connections (else one request each) */
+    double post_ratio;          /* Fraction of requests that are POSTs */
+    double dup_ratio;           /* Fraction of POSTs that reuse a recent key */
+    const char *get_path;
+    const char *post_path;
+    size_t body_size;
+    double rate;                /* Requests/s across all connections (0 = closed loop) */
+    const char *out_path;       /* Append a JSON result line here */
+    const char *label;
+} loadgen_config_t;
+
+/* Counters (per worker, summed at the end) */
+typedef struct {
+    uint64_t completed;         /* Responses inside the measured window */
+    uint64_t warmup;            /* Responses during warmup */
+    uint64_t errors;            /* Requests lost to connect/read/parse failures */
+    uint64_t status[6];         /* By class: [2] = 2xx ... [5] = 5xx */
+    uint64_t conflicts;         /* 409 (duplicate while the original was in flight) */
+    uint64_t replayed;          /* X-Idempotent-Replayed responses */
+    uint64_t gets;
+    uint64_t posts;
+    uint64_t duplicates;        /* POSTs sent with a repeated key */
+    uint64_t connects;
+    uint64_t bytes_in;
+} loadgen_stats_t;
+
+struct worker;
+
+/* One client connection */
+typedef struct {
+    struct worker *worker;
+    int fd;
+    bool connecting;
+
+    char *out;                  /* Requests not yet written */
+    size_t out_length;
+    size_t out_sent;
+    size_t out_capacity;
+
+    char in[LOADGEN_RECV_BUFFER];
+    size_t in_length;
+
+    uint64_t started[LOADGEN_MAX_PIPELINE];     /* Send (or intended) time per request */
+    size_t head;
+    size_t inflight;
+    uint64_t issued;            /* Requests sent on this socket */
+    uint64_t next_send_ns;      /* --rate: when the next request is due */
+    uint64_t retry_ns;          /* Earliest reconnect after a failed connect */
+} loadgen_conn_t;
+
+/* One load thread with its own epoll set */
+typedef struct worker {
+    const loadgen_config_t *config;
+    int id;
+    int epoll_fd;
+    const struct addrinfo *address;
+
+    loadgen_conn_t *conns;
+    int conn_count;
+
+    uint64_t rng;
+    char keys[LOADGEN_KEY_RING][LOADGEN_KEY_LENGTH];
+    size_t key_count;
+    uint64_t key_serial;
+
+    uint64_t measure_start_ns;
+    uint64_t deadline_ns;
+    uint64_t interval_ns;       /* --rate: per-connection request spacing */
+
+    histogram_t *histogram;
+    loadgen_stats_t stats;
+    pthread_t thread;
+} worker_t;
+
+/* Requests issued by all workers (for --requests) */
+static uint64_t g_issued = 0;
+
+/* Distinguishes this run's idempotency keys from earlier runs */
+static unsigned int g_run_nonce = 0;
+
+/*
+ * Helper function: Current monotonic time in nanoseconds
+ */
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Helper function: xorshift64* step, uniform in [0, 1)
+ */
+static double random_unit(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return (double)((*state * 2685821657736338717ULL) >> 11) / (double)(1ULL << 53);
+}
+
+/*
+ * Helper function: Counts slot for a value
+ */
+static size_t hist_index(uint64_t value) {
+    if (value > HIST_MAX_VALUE) {
+        value = HIST_MAX_VALUE;
+    }
+    int bucket = 63 - __builtin_clzll(value | (HIST_SUB_BUCKET_COUNT - 1)) -
+                 (HIST_SUB_BUCKET_BITS - 1);
+    return ((size_t)bucket << (HIST_SUB_BUCKET_BITS - 1)) + (size_t)(value >> bucket);
+}
+
+/*
+ * Helper function: Highest value that lands in a counts slot
+ */
+static uint64_t hist_highest_value(size_t index) {
+    size_t bucket = 0;
+    size_t sub = index;
+    if (index >= HIST_SUB_BUCKET_COUNT) {
+        bucket = (index >> (HIST_SUB_BUCKET_BITS - 1)) - 1;
+        sub = index - (bucket << (HIST_SUB_BUCKET_BITS - 1));
+    }
+    return ((uint64_t)sub << bucket) + ((1ULL << bucket) - 1);
+}
+
+/*
+ * Helper function: Record one value
+ */
+static void hist_record(histogram_t *histogram, uint64_t value) {
+    histogram->counts[hist_index(value)]++;
+    if (histogram->total == 0 || value < histogram->min) {
+        histogram->min = value;
+    }
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+    histogram->total++;
+    histogram->sum += (double)value;
+}
+
+/*
+ * Helper function: Add one histogram into another
+ */
+static void hist_merge(histogram_t *into, const histogram_t *from) {
+    if (from->total == 0) {
+        return;
+    }
+    for (size_t i = 0; i < HIST_COUNTS; i++) {
+        into->counts[i] += from->counts[i];
+    }
+    if (into->total == 0 || from->min < into->min) {
+        into->min = from->min;
+    }
+    if (from->max > into->max) {
+        into->max = from->max;
+    }
+    into->total += from->total;
+    into->sum += from->sum;
+}
+
+/*
+ * Helper function: Value at a percentile (0-100)
+ */
+static uint64_t hist_percentile(const histogram_t *histogram, double percentile) {
+    if (histogram->total == 0) {
+        return 0;
+    }
+
+    uint64_t target = (uint64_t)((percentile / 100.0) * (double)histogram->total + 0.5);
+    if (target < 1) {
+        target = 1;
+    }
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HIST_COUNTS; i++) {
+        seen += histogram->counts[i];
+        if (seen >= target) {
+            uint64_t value = hist_highest_value(i);
+            return value < histogram->max ? value : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+/*
+ * Helper function: Next idempotency key, sometimes a recent one repeated
+ */
+static const char *next_key(worker_t *worker, bool *duplicate) {
+    const loadgen_config_t *config = worker->config;
+
+    *duplicate = worker->key_count > 0 && random_unit(&worker->rng) < config->dup_ratio;
+    if (*duplicate) {
+        size_t available = worker->key_count < LOADGEN_KEY_RING ? worker->key_count
+                                                                : LOADGEN_KEY_RING;
+        return worker->keys[(size_t)(random_unit(&worker->rng) * (double)available)];
+    }
+
+    char *key = worker->keys[worker->key_count % LOADGEN_KEY_RING];
+    snprintf(key, LOADGEN_KEY_LENGTH, "lg-%08x-%d-%llu", g_run_nonce, worker->id,
+             (unsigned long long)worker->key_serial++);
+    worker->key_count++;
+    return key;
+}
+
+/*
+ * Helper function: Append one request to the connection's output
+ */
+static void append_request(loadgen_conn_t *conn) {
+    worker_t *worker = conn->worker;
+    const loadgen_config_t *config = worker->config;
+    const char *connection = config->keepalive ? "" : "Connection: close\r\n";
+    char *out = conn->out + conn->out_length;
+    size_t room = conn->out_capacity - conn->out_length;
+    int length;
+
+    if (random_unit(&worker->rng) < config->post_ratio) {
+        bool duplicate;
+        const char *key = next_key(worker, &duplicate);
+        length = snprintf(out, room,
+                          "POST %s HTTP/1.1\r\nHost: %s\r\nContent-Type: application/json\r\n"
+                          "X-Idempotency-Key: %s\r\nContent-Length: %zu\r\n%s\r\n",
+                          config->post_path, config->host, key, config->body_size, connection);
+
+        /* Same body every time, so a repeated key is a true replay */
+        size_t at = (size_t)length;
+        static const char prefix[] = "{\"amount\":1000,\"currency\":\"USD\",\"pad\":\"";
+        for (size_t i = 0; i < config->body_size; i++) {
+            char c;
+            if (i < sizeof(prefix) - 1) {
+                c = prefix[i];
+            } else if (i + 2 == config->body_size) {
+                c = '"';
+            } else if (i + 1 == config->body_size) {
+                c = '}';
+            } else {
+                c = 'x';
+            }
+            out[at++] = c;
+        }
+        length = (int)at;
+        worker->stats.posts++;
+        worker->stats.duplicates += duplicate;
+    } else {
+        length = snprintf(out, room, "GET %s HTTP/1.1\r\nHost: %s\r\n%s\r\n", config->get_path,
+                          config->host, connection);
+        worker->stats.gets++;
+    }
+
+    conn->out_length += (size_t)length;
+}
+
+/*
+ * Helper function: Update the epoll interest of a connection
+ */
+static void conn_watch(loadgen_conn_t *conn, int op) {
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    if (conn->connecting || conn->out_sent < conn->out_length) {
+        event.events |= EPOLLOUT;
+    }
+    event.data.ptr = conn;
+    epoll_ctl(conn->worker->epoll_fd, op, conn->fd, &event);
+}
+
+/*
+ * Helper function: Open (or reopen) a connection
+ * Returns 0 on success, -1 on error
+ */
+static int conn_open(loadgen_conn_t *conn) {
+    const struct addrinfo *address = conn->worker->address;
+
+    conn->fd = socket(address->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (conn->fd < 0) {
+        return -1;
+    }
+    int one = 1;
+    setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (connect(conn->fd, address->ai_addr, address->ai_addrlen) < 0 && errno != EINPROGRESS) {
+        close(conn->fd);
+        conn->fd = -1;
+        return -1;
+    }
+
+    conn->connecting = true;
+    conn->out_length = 0;
+    conn->out_sent = 0;
+    conn->in_length = 0;
+    conn->head = 0;
+    conn->inflight = 0;
+    conn->issued = 0;
+    conn->worker->stats.connects++;
+    conn_watch(conn, EPOLL_CTL_ADD);
+    return 0;
+}
+
+/*
+ * Helper function: Close a connection; requests still in flight fail
+ */
+static void conn_close(loadgen_conn_t *conn, bool failed) {
+    if (conn->fd < 0) {
+        return;
+    }
+    if (failed) {
+        conn->worker->stats.errors += conn->inflight;
+    }
+    epoll_ctl(conn->worker->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    conn->fd = -1;
+    conn->inflight = 0;
+}
+
+/*
+ * Helper function: Check whether the worker may issue another request
+ */
+static bool may_issue(const worker_t *worker, uint64_t now) {
+    const loadgen_config_t *config = worker->config;
+    if (now >= worker->deadline_ns) {
+        return false;
+    }
+    return config->max_requests == 0 ||
+           __atomic_load_n(&g_issued, __ATOMIC_RELAXED) < config->max_requests;
+}
+
+/*
+ * Helper function: Queue as many requests as the connection may have in flight
+ */
+static void conn_fill(loadgen_conn_t *conn, uint64_t now) {
+    worker_t *worker = conn->worker;
+    const loadgen_config_t *config = worker->config;
+
+    if (conn->fd < 0 || conn->connecting) {
+        return;
+    }
+
+    /* Written requests are dropped from the buffer before adding more */
+    if (conn->out_sent == conn->out_length) {
+        conn->out_length = 0;
+        conn->out_sent = 0;
+    }
+
+    while (conn->inflight < (size_t)config->pipeline && may_issue(worker, now)) {
+        if (!config->keepalive && conn->issued > 0) {
+            break;
+        }
+        if (conn->out_capacity - conn->out_length < LOADGEN_REQUEST_HEAD + config->body_size) {
+            break;
+        }
+        if (config->rate > 0 && now < conn->next_send_ns) {
+            break;
+        }
+        if (config->max_requests > 0 &&
+            __atomic_fetch_add(&g_issued, 1, __ATOMIC_RELAXED) >= config->max_requests) {
+            break;
+        }
+
+        uint64_t started = now;
+        if (config->rate > 0) {
+            started = conn->next_send_ns;
+            conn->next_send_ns += worker->interval_ns;
+        }
+
+        append_request(conn);
+        conn->started[(conn->head + conn->inflight) % LOADGEN_MAX_PIPELINE] = started;
+        conn->inflight++;
+        conn->issued++;
+    }
+}
+
+/*
+ * Helper function: Write pending request bytes
+ * Returns 0 on success, -1 if the connection failed
+ */
+static int conn_send(loadgen_conn_t *conn) {
+    while (conn->out_sent < conn->out_length) {
+        ssize_t n = send(conn->fd, conn->out + conn->out_sent, conn->out_length - conn->out_sent,
+                         MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        conn->out_sent += (size_t)n;
+    }
+    conn_watch(conn, EPOLL_CTL_MOD);
+    return 0;
+}
+
+/*
+ * Helper function: Find a header in a response head (case-insensitive)
+ * Returns the start of its value, NULL if absent
+ */
+static const char *find_header(const char *head, size_t length, const char *name) {
+    size_t name_length = strlen(name);
+    const char *end = head + length;
+
+    for (const char *line = memchr(head, '\n', length); line != NULL && line + 1 < end;
+         line = memchr(line + 1, '\n', (size_t)(end - line - 1))) {
+        const char *p = line + 1;
+        if ((size_t)(end - p) > name_length && strncasecmp(p, name, name_length) == 0 &&
+            p[name_length] == ':') {
+            p += name_length + 1;
+            while (p < end && (*p == ' ' || *p == '\t')) {
+                p++;
+            }
+            return p;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Helper function: Consume complete responses from the input buffer
+ * Returns 1 if the server asked to close, 0 to continue, -1 on a bad response
+ */
+static int conn_parse(loadgen_conn_t *conn, uint64_t now) {
+    worker_t *worker = conn->worker;
+    size_t offset = 0;
+    int result = 0;
+
+    while (conn->in_length - offset >= 12) {
+        const char *start = conn->in + offset;
+        size_t available = conn->in_length - offset;
+        const char *head_end = memmem(start, available, "\r\n\r\n", 4);
+        if (head_end == NULL) {
+            if (available == sizeof(conn->in)) {
+                return -1;
+            }
+            break;
+        }
+
+        size_t head_length = (size_t)(head_end - start) + 4;
+        if (strncmp(start, "HTTP/1.", 7) != 0 || conn->inflight == 0) {
+            return -1;
+        }
+        int status = atoi(start + 9);
+
+        size_t body_length = 0;
+        const char *value = find_header(start, head_length, "Content-Length");
+        if (value != NULL) {
+            body_length = strtoul(value, NULL, 10);
+        }
+        if (head_length + body_length > available) {
+            if (head_length + body_length > sizeof(conn->in)) {
+                return -1;
+            }
+            break;
+        }
+
+        /* One request answered */
+        uint64_t started = conn->started[conn->head];
+        conn->head = (conn->head + 1) % LOADGEN_MAX_PIPELINE;
+        conn->inflight--;
+
+        if (started >= worker->measure_start_ns) {
+            hist_record(worker->histogram, now > started ? now - started : 0);
+            worker->stats.completed++;
+            worker->stats.bytes_in += head_length + body_length;
+            if (status >= 100 && status < 600) {
+                worker->stats.status[status / 100]++;
+            }
+            worker->stats.conflicts += status == 409;
+            worker->stats.replayed +=
+                find_header(start, head_length, "X-Idempotent-Replayed") != NULL;
+        } else {
+            worker->stats.warmup++;
+        }
+
+        const char *connection = find_header(start, head_length, "Connection");
+        if (connection != NULL && strncasecmp(connection, "close", 5) == 0) {
+            result = 1;
+        }
+        offset += head_length + body_length;
+        if (result == 1) {
+            break;
+        }
+    }
+
+    memmove(conn->in, conn->in + offset, conn->in_length - offset);
+    conn->in_length -= offset;
+    return result;
+}
+
+/*
+ * Helper function: Handle readiness on a connection
+ */
+static void conn_event(loadgen_conn_t *conn, uint32_t events, uint64_t now) {
+    if (conn->connecting) {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if ((events & (EPOLLERR | EPOLLHUP)) ||
+            getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error != 0) {
+            conn->worker->stats.errors++;
+            conn->retry_ns = now + LOADGEN_RETRY_NS;
+            conn_close(conn, true);
+            return;
+        }
+        conn->connecting = false;
+        conn_fill(conn, now);
+        if (conn_send(conn) < 0) {
+            conn_close(conn, true);
+        }
+        return;
+    }
+
+    if (events & EPOLLIN) {
+        for (;;) {
+            ssize_t n = recv(conn->fd, conn->in + conn->in_length,
+                             sizeof(conn->in) - conn->in_length, 0);
+            if (n > 0) {
+                conn->in_length += (size_t)n;
+                int parsed = conn_parse(conn, now);
+                if (parsed != 0) {
+                    conn_close(conn, parsed < 0 || conn->inflight > 0);
+                    if (parsed < 0) {
+                        conn->worker->stats.errors++;
+                    }
+                    return;
+                }
+                if (conn->in_length == sizeof(conn->in)) {
+                    break;
+                }
+                continue;
+            }
+            if (n == 0) {
+                /* Closed by the server; fine after a last response without keep-alive */
+                conn_close(conn, conn->inflight > 0);
+                return;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                conn_close(conn, true);
+                return;
+            }
+            break;
+        }
+    } else if (events & (EPOLLERR | EPOLLHUP)) {
+        conn_close(conn, true);
+        return;
+    }
+
+    conn_fill(conn, now);
+    if (conn_send(conn) < 0) {
+        conn_close(conn, true);
+    }
+}
+
+/*
+ * Helper function: Worker thread body
+ */
+static void *worker_main(void *arg) {
+    worker_t *worker = arg;
+    const loadgen_config_t *config = worker->config;
+    struct epoll_event events[256];
+
+    for (int i = 0; i < worker->conn_count; i++) {
+        loadgen_conn_t *conn = &worker->conns[i];
+        conn->next_send_ns = worker->measure_start_ns -
+                             (uint64_t)(config->warmup_s * 1e9) +
+                             (uint64_t)(random_unit(&worker->rng) * (double)worker->interval_ns);
+        if (conn_open(conn) < 0) {
+            worker->stats.errors++;
+        }
+    }
+
+    for (;;) {
+        uint64_t now = now_ns();
+        bool active = false;
+
+        /* Reopen closed connections and issue any requests now due */
+        for (int i = 0; i < worker->conn_count; i++) {
+            loadgen_conn_t *conn = &worker->conns[i];
+            if (conn->fd < 0 && now >= conn->retry_ns && may_issue(worker, now)) {
+                if (conn_open(conn) < 0) {
+                    worker->stats.errors++;
+                    conn->retry_ns = now + LOADGEN_RETRY_NS;
+                    continue;
+                }
+            }
+            if (config->rate > 0 && conn->fd >= 0 && !conn->connecting) {
+                conn_fill(conn, now);
+                if (conn_send(conn) < 0) {
+                    conn_close(conn, true);
+                }
+            }
+            if ((conn->fd >= 0 && conn->inflight > 0) || may_issue(worker, now)) {
+                active = true;
+            }
+        }
+        if (!active) {
+            break;
+        }
+
+        /* Wake for the deadline, or the next scheduled send under --rate */
+        int timeout_ms = 100;
+        if (config->rate > 0) {
+            timeout_ms = 1;
+        }
+        int count = epoll_wait(worker->epoll_fd, events, 256, timeout_ms);
+        if (count < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            break;
+        }
+
+        now = now_ns();
+        for (int i = 0; i < count; i++) {
+            conn_event((loadgen_conn_t *)events[i].data.ptr, events[i].events, now);
+        }
+
+        /* Requests still unanswered after the deadline are abandoned */
+        if (now >= worker->deadline_ns + 1000000000ULL) {
+            break;
+        }
+    }
+
+    for (int i = 0; i < worker->conn_count; i++) {
+        conn_close(&worker->conns[i], false);
+    }
+    return NULL;
+}
+
+/*
+ * Helper function: Append the results as one JSON line
+ * Returns 0 on success, -1 on error
+ */
+static int write_results(const loadgen_config_t *config, const loadgen_stats_t *stats,
+                         const histogram_t *histogram, double elapsed_s) {
+    FILE *file = fopen(config->out_path, "a");
+    if (file == NULL) {
+        perror(config->out_path);
+        return -1;
+    }
+
+    static const double points[] = { 50, 75, 90, 95, 99, 99.9, 99.99, 100 };
+
+    fprintf(file, "{\"label\":\"%s\",\"timestamp\":%lld,",
+            config->label != NULL ? config->label : "", (long long)time(NULL));
+    fprintf(file,
+            "\"config\":{\"connections\":%d,\"threads\":%d,\"duration_s\":%.3f,"
+            "\"pipeline\":%d,\"keepalive\":%s,\"post_ratio\":%.3f,\"dup_ratio\":%.3f,"
+            "\"body_size\":%zu,\"rate\":%.1f},",
+            config->connections, config->threads, config->duration_s, config->pipeline,
+            config->keepalive ? "true" : "false", config->post_ratio, config->dup_ratio,
+            config->body_size, config->rate);
+    fprintf(file,
+            "\"requests\":%llu,\"errors\":%llu,\"elapsed_s\":%.3f,\"rps\":%.1f,"
+            "\"mb_per_s\":%.3f,",
+            (unsigned long long)stats->completed, (unsigned long long)stats->errors, elapsed_s,
+            (double)stats->completed / elapsed_s,
+            (double)stats->bytes_in / elapsed_s / (1024.0 * 1024.0));
+    fprintf(file,
+            "\"status\":{\"2xx\":%llu,\"3xx\":%llu,\"4xx\":%llu,\"5xx\":%llu,\"409\":%llu,"
+            "\"replayed\":%llu},",
+            (unsigned long long)stats->status[2], (unsigned long long)stats->status[3],
+            (unsigned long long)stats->status[4], (unsigned long long)stats->status[5],
+            (unsigned long long)stats->conflicts, (unsigned long long)stats->replayed);
+    fprintf(file, "\"latency_us\":{\"mean\":%.1f,\"min\":%.1f",
+            histogram->total > 0 ? histogram->sum / (double)histogram->total / 1e3 : 0.0,
+            (double)histogram->min / 1e3);
+    for (size_t i = 0; i < sizeof(points) / sizeof(points[0]); i++) {
+        fprintf(file, ",\"p%g\":%.1f", points[i],
+                (double)hist_percentile(histogram, points[i]) / 1e3);
+    }
+    fprintf(file, "}}\n");
+
+    if (fclose(file) != 0) {
+        perror(config->out_path);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Helper function: Print usage
+ */
+static void print_usage(const char *program) {
+    printf("Usage: %s [options]\n"
+           "  -H, --host HOST        Server address (default: 127.0.0.1)\n"
+           "  -p, --port PORT        Server port (default: 8080)\n"
+           "  -c, --connections N    Concurrent connections (default: 64)\n"
+           "  -t, --threads N        Load threads (default: 1)\n"
+           "  -d, --duration SEC     Measured time (default: 10)\n"
+           "  -w, --warmup SEC       Unmeasured time first (default: 1)\n"
+           "  -n, --requests N       Stop after N requests (default: 0 = duration)\n"
+           "      --pipeline N       Requests in flight per connection (default: 1, max %d)\n"
+           "      --no-keepalive     One request per connection\n"
+           "      --post-ratio F     Fraction of requests that are POSTs (default: 0)\n"
+           "      --dup-ratio F      Fraction of POSTs repeating a recent\n"
+           "                         X-Idempotency-Key (default: 0)\n"
+           "      --get-path PATH    GET target (default: /health)\n"
+           "      --post-path PATH   POST target (default: /payments)\n"
+           "      --body-size BYTES  POST body size (default: 64)\n"
+           "      --rate R           Open loop at R requests/s in total; latency\n"
+           "                         counts from the scheduled send time\n"
+           "      --out FILE         Append results as a JSON line to FILE\n"
+           "      --label TEXT       Label stored with the results (e.g. a commit)\n"
+           "  -h, --help             Show this help message\n",
+           program, LOADGEN_MAX_PIPELINE);
+}
+
+/*
+ * Helper function: Parse a fraction option
+ * Returns 0 on success, -1 on error
+ */
+static int parse_fraction(const char *name, const char *text, double *out) {
+    char *end = NULL;
+    double value = strtod(text, &end);
+    if (end == text || *end != '\0' || value < 0 || value > 1) {
+        fprintf(stderr, "Invalid value for --%s: %s (expected 0..1)\n", name, text);
+        return -1;
+    }
+    *out = value;
+    return 0;
+}
+
+/*
+ * Helper function: Parse a positive number option
+ * Returns 0 on success, -1 on error
+ */
+static int parse_number(const char *name, const char *text, double min, double max, double *out) {
+    char *end = NULL;
+    double value = strtod(text, &end);
+    if (end == text || *end != '\0' || value < min || value > max) {
+        fprintf(stderr, "Invalid value for --%s: %s\n", name, text);
+        return -1;
+    }
+    *out = value;
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    enum {
+        OPT_PIPELINE = 256, OPT_NO_KEEPALIVE, OPT_POST_RATIO, OPT_DUP_RATIO, OPT_GET_PATH,
+        OPT_POST_PATH, OPT_BODY_SIZE, OPT_RATE, OPT_OUT, OPT_LABEL
+    };
+
+    static const struct option long_options[] = {
+        { "host",         required_argument, NULL, 'H' },
+        { "port",         required_argument, NULL, 'p' },
+        { "connections",  required_argument, NULL, 'c' },
+        { "threads",      required_argument, NULL, 't' },
+        { "duration",     required_argument, NULL, 'd' },
+        { "warmup",       required_argument, NULL, 'w' },
+        { "requests",     required_argument, NULL, 'n' },
+        { "pipeline",     required_argument, NULL, OPT_PIPELINE },
+        { "no-keepalive", no_argument,       NULL, OPT_NO_KEEPALIVE },
+        { "post-ratio",   required_argument, NULL, OPT_POST_RATIO },
+        { "dup-ratio",    required_argument, NULL, OPT_DUP_RATIO },
+        { "get-path",     required_argument, NULL, OPT_GET_PATH },
+        { "post-path",    required_argument, NULL, OPT_POST_PATH },
+        { "body-size",    required_argument, NULL, OPT_BODY_SIZE },
+        { "rate",         required_argument, NULL, OPT_RATE },
+        { "out",          required_argument, NULL, OPT_OUT },
+        { "label",        required_argument, NULL, OPT_LABEL },
+        { "help",         no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    loadgen_config_t config = {
+        .host = "127.0.0.1",
+        .port = "8080",
+        .connections = 64,
+        .threads = 1,
+        .duration_s = 10,
+        .warmup_s = 1,
+        .pipeline = 1,
+        .keepalive = true,
+        .get_path = "/health",
+        .post_path = "/payments",
+        .body_size = 64,
+    };
+
+    int opt;
+    double value;
+    while ((opt = getopt_long(argc, argv, "H:p:c:t:d:w:n:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'H': config.host = optarg; break;
+            case 'p': config.port = optarg; break;
+            case 'c':
+                if (parse_number("connections", optarg, 1, 100000, &value) < 0) return EXIT_FAILURE;
+                config.connections = (int)value;
+                break;
+            case 't':
+                if (parse_number("threads", optarg, 1, 256, &value) < 0) return EXIT_FAILURE;
+                config.threads = (int)value;
+                break;
+            case 'd':
+                if (parse_number("duration", optarg, 0.1, 86400, &config.duration_s) < 0) {
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'w':
+                if (parse_number("warmup", optarg, 0, 3600, &config.warmup_s) < 0) {
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'n':
+                if (parse_number("requests", optarg, 0, 1e15, &value) < 0) return EXIT_FAILURE;
+                config.max_requests = (uint64_t)value;
+                break;
+            case OPT_PIPELINE:
+                if (parse_number("pipeline", optarg, 1, LOADGEN_MAX_PIPELINE, &value) < 0) {
+                    return EXIT_FAILURE;
+                }
+                config.pipeline = (int)value;
+                break;
+            case OPT_NO_KEEPALIVE: config.keepalive = false; break;
+            case OPT_POST_RATIO:
+                if (parse_fraction("post-ratio", optarg, &config.post_ratio) < 0) {
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_DUP_RATIO:
+                if (parse_fraction("dup-ratio", optarg, &config.dup_ratio) < 0) return EXIT_FAILURE;
+                break;
+            case OPT_GET_PATH: config.get_path = optarg; break;
+            case OPT_POST_PATH: config.post_path = optarg; break;
+            case OPT_BODY_SIZE:
+                if (parse_number("body-size", optarg, 48, 1024 * 1024, &value) < 0) {
+                    return EXIT_FAILURE;
+                }
+                config.body_size = (size_t)value;
+                break;
+            case OPT_RATE:
+                if (parse_number("rate", optarg, 0, 1e9, &config.rate) < 0) return EXIT_FAILURE;
+                break;
+            case OPT_OUT: config.out_path = optarg; break;
+            case OPT_LABEL: config.label = optarg; break;
+            case 'h':
+                print_usage(argv[0]);
+                return EXIT_SUCCESS;
+            default:
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (!config.keepalive) {
+        config.pipeline = 1;
+    }
+    if (config.threads > config.connections) {
+        config.threads = config.connections;
+    }
+
+    struct addrinfo hints;
+    struct addrinfo *address = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int gai = getaddrinfo(config.host, config.port, &hints, &address);
+    if (gai != 0) {
+        fprintf(stderr, "Cannot resolve %s:%s: %s\n", config.host, config.port, gai_strerror(gai));
+        return EXIT_FAILURE;
+    }
+
+    g_run_nonce = (unsigned int)time(NULL) ^ ((unsigned int)getpid() << 16);
+
+    uint64_t start = now_ns();
+    uint64_t measure_start = start + (uint64_t)(config.warmup_s * 1e9);
+    uint64_t deadline = measure_start + (uint64_t)(config.duration_s * 1e9);
+    worker_t *workers = calloc((size_t)config.threads, sizeof(*workers));
+    if (workers == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    for (int t = 0; t < config.threads; t++) {
+        worker_t *worker = &workers[t];
+        worker->config = &config;
+        worker->id = t;
+        worker->address = address;
+        worker->rng = 0x9E3779B97F4A7C15ULL * (uint64_t)(t + 1) ^ g_run_nonce;
+        worker->measure_start_ns = measure_start;
+        worker->deadline_ns = deadline;
+        worker->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        worker->conn_count = config.connections / config.threads +
+                             (t < config.connections % config.threads ? 1 : 0);
+        worker->conns = calloc((size_t)worker->conn_count, sizeof(*worker->conns));
+        worker->histogram = calloc(1, sizeof(*worker->histogram));
+        if (config.rate > 0) {
+            worker->interval_ns = (uint64_t)((double)config.connections / config.rate * 1e9);
+        }
+        if (worker->epoll_fd < 0 || worker->conns == NULL || worker->histogram == NULL) {
+            fprintf(stderr, "Failed to set up load thread %d\n", t);
+            return EXIT_FAILURE;
+        }
+
+        for (int i = 0; i < worker->conn_count; i++) {
+            loadgen_conn_t *conn = &worker->conns[i];
+            conn->worker = worker;
+            conn->fd = -1;
+            conn->out_capacity =
+                (size_t)config.pipeline * (LOADGEN_REQUEST_HEAD + config.body_size);
+            conn->out = malloc(conn->out_capacity);
+            if (conn->out == NULL) {
+                fprintf(stderr, "Out of memory\n");
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    for (int t = 0; t < config.threads; t++) {
+        if (pthread_create(&workers[t].thread, NULL, worker_main, &workers[t]) != 0) {
+            fprintf(stderr, "Failed to start load thread %d\n", t);
+            return EXIT_FAILURE;
+        }
+    }
+
+    histogram_t *histogram = calloc(1, sizeof(*histogram));
+    loadgen_stats_t stats;
+    memset(&stats, 0, sizeof(stats));
+    for (int t = 0; t < config.threads; t++) {
+        worker_t *worker = &workers[t];
+        pthread_join(worker->thread, NULL);
+
+        if (histogram != NULL) {
+            hist_merge(histogram, worker->histogram);
+        }
+        stats.completed += worker->stats.completed;
+        stats.warmup += worker->stats.warmup;
+        stats.errors += worker->stats.errors;
+        for (int i = 0; i < 6; i++) {
+            stats.status[i] += worker->stats.status[i];
+        }
+        stats.conflicts += worker->stats.conflicts;
+        stats.replayed += worker->stats.replayed;
+        stats.gets += worker->stats.gets;
+        stats.posts += worker->stats.posts;
+        stats.duplicates += worker->stats.duplicates;
+        stats.connects += worker->stats.connects;
+        stats.bytes_in += worker->stats.bytes_in;
+    }
+
+    uint64_t end = now_ns();
+    if (end > deadline) {
+        end = deadline;
+    }
+    double elapsed_s = end > measure_start ? (double)(end - measure_start) / 1e9 : 1e-9;
+    if (histogram == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("loadgen: %s:%s, %d connections on %d threads, %.1fs (+%.1fs warmup), %s",
+           config.host, config.port, config.connections, config.threads, config.duration_s,
+           config.warmup_s, config.keepalive ? "keep-alive" : "connection per request");
+    if (config.pipeline > 1) {
+        printf(", pipeline %d", config.pipeline);
+    }
+    if (config.rate > 0) {
+        printf(", %.0f req/s open loop", config.rate);
+    }
+    printf("\n");
+    if (config.post_ratio > 0) {
+        printf("  mix        %.0f%% POST (%.0f%% repeated keys); "
+               "sent %llu GET, %llu POST, %llu repeats\n",
+               config.post_ratio * 100, config.dup_ratio * 100, (unsigned long long)stats.gets,
+               (unsigned long long)stats.posts, (unsigned long long)stats.duplicates);
+    }
+    printf("  requests   %llu in %.2fs = %.1f req/s, %.2f MB/s, %llu errors, %llu connects\n",
+           (unsigned long long)stats.completed, elapsed_s, (double)stats.completed / elapsed_s,
+           (double)stats.bytes_in / elapsed_s / (1024.0 * 1024.0),
+           (unsigned long long)stats.errors, (unsigned long long)stats.connects);
+    printf("  status     2xx %llu, 3xx %llu, 4xx %llu (409 %llu), 5xx %llu, replayed %llu\n",
+           (unsigned long long)stats.status[2], (unsigned long long)stats.status[3],
+           (unsigned long long)stats.status[4], (unsigned long long)stats.conflicts,
+           (unsigned long long)stats.status[5], (unsigned long long)stats.replayed);
+    printf("  latency    mean %.1fus, p50 %.1fus, p90 %.1fus, p99 %.1fus, p99.9 %.1fus, "
+           "p99.99 %.1fus, max %.1fus\n",
+           histogram->total > 0 ? histogram->sum / (double)histogram->total / 1e3 : 0.0,
+           (double)hist_percentile(histogram, 50) / 1e3,
+           (double)hist_percentile(histogram, 90) / 1e3,
+           (double)hist_percentile(histogram, 99) / 1e3,
+           (double)hist_percentile(histogram, 99.9) / 1e3,
+           (double)hist_percentile(histogram, 99.99) / 1e3, (double)histogram->max / 1e3);
+
+    int status = EXIT_SUCCESS;
+    if (config.out_path != NULL && write_results(&config, &stats, histogram, elapsed_s) < 0) {
+        status = EXIT_FAILURE;
+    }
+
+    for (int t = 0; t < config.threads; t++) {
+        for (int i = 0; i < workers[t].conn_count; i++) {
+            free(workers[t].conns[i].out);
+        }
+        free(workers[t].conns);
+        free(workers[t].histogram);
+        close(workers[t].epoll_fd);
+    }
+    free(workers);
+    free(histogram);
+    freeaddrinfo(address);
+    return stats.completed > 0 ? status : EXIT_FAILURE;
+}
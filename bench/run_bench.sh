@@ -0,0 +1,58 @@
+#!/bin/bash
+
+# C-HTTP Payment Server Benchmark Suite
+# Starts the optimized server, runs a fixed set of load scenarios with
+# bin/loadgen and appends one JSON result line per scenario, labelled
+# with the current commit, so runs can be compared across commits.
+#
+# Usage: bench/run_bench.sh [results-file]
+# Environment: BENCH_PORT, BENCH_DURATION (s), BENCH_CONNECTIONS,
+#              BENCH_THREADS (load threads), SERVER_ARGS (extra server flags)
+
+set -u
+
+BIN_DIR="$(dirname "$0")/../bin"
+SERVER="$BIN_DIR/bench-server"
+LOADGEN="$BIN_DIR/loadgen"
+
+PORT="${BENCH_PORT:-18080}"
+DURATION="${BENCH_DURATION:-5}"
+CONNECTIONS="${BENCH_CONNECTIONS:-64}"
+THREADS="${BENCH_THREADS:-2}"
+LABEL="$(git rev-parse --short HEAD 2>/dev/null || echo unknown)"
+if ! git diff --quiet HEAD 2>/dev/null; then
+    LABEL="$LABEL-dirty"
+fi
+RESULTS="${1:-$BIN_DIR/bench/results.jsonl}"
+
+mkdir -p "$(dirname "$RESULTS")"
+
+# Start the server; request logging off so it measures the request path
+"$SERVER" -p "$PORT" --log-level warn --max-requests 1000000 ${SERVER_ARGS:-} &
+SERVER_PID=$!
+trap 'kill -INT $SERVER_PID 2>/dev/null; wait $SERVER_PID 2>/dev/null' EXIT
+
+for _ in $(seq 50); do
+    if "$LOADGEN" -p "$PORT" -c 1 -n 1 -d 1 -w 0 > /dev/null 2>&1; then
+        break
+    fi
+    sleep 0.1
+done
+
+# Run one scenario: name, then loadgen arguments
+run() {
+    local name="$1"
+    shift
+    echo "== $name"
+    "$LOADGEN" -p "$PORT" -t "$THREADS" -d "$DURATION" -w 1 \
+        --out "$RESULTS" --label "$LABEL/$name" "$@" || echo "   (scenario failed)"
+}
+
+run get-keepalive     -c "$CONNECTIONS"
+run get-pipelined     -c "$CONNECTIONS" --pipeline 16
+run get-close         -c 16 --no-keepalive
+run post-unique       -c "$CONNECTIONS" --post-ratio 1
+run mixed-duplicates  -c "$CONNECTIONS" --post-ratio 0.3 --dup-ratio 0.2
+run open-loop         -c "$CONNECTIONS" --post-ratio 0.3 --rate 20000
+
+echo "Results appended to $RESULTS (label $LABEL)"
@@ -0,0 +1,77 @@
+/*
+ * C-HTTP Payment Server - Arena Allocator
+ * Per-worker bump allocator for request/response lifetimes
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/* Size of the first chunk of a new arena */
+#define ARENA_DEFAULT_CHUNK_SIZE (16 * 1024)
+
+/* Largest chunk kept across resets; bigger peaks (large bodies) are released */
+#define ARENA_MAX_RETAINED_SIZE (256 * 1024)
+
+/* Allocation alignment (fits any scalar type) */
+#define ARENA_ALIGNMENT 16
+
+/* Block of arena memory */
+typedef struct arena_chunk {
+    struct arena_chunk *next;   /* Older chunk (NULL for the first) */
+    size_t size;                /* Usable bytes in data */
+    size_t used;                /* Bytes handed out */
+    char data[];
+} arena_chunk_t;
+
+/*
+ * Arena
+ * Allocations are carved from the newest chunk and never freed individually;
+ * arena_reset() reclaims everything at once
+ */
+typedef struct {
+    arena_chunk_t *head;        /* Newest chunk (allocations come from here) */
+    size_t chunk_size;          /* Size of the retained chunk */
+    size_t allocated;           /* Bytes handed out since the last reset */
+} arena_t;
+
+/*
+ * Initialize arena with one chunk of chunk_size bytes (0 = default)
+ * Returns 0 on success, -1 on error
+ */
+int arena_init(arena_t *arena, size_t chunk_size);
+
+/*
+ * Allocate size bytes, aligned to ARENA_ALIGNMENT
+ * Memory stays valid until the next arena_reset()
+ * Returns pointer on success, NULL on error
+ */
+void *arena_alloc(arena_t *arena, size_t size);
+
+/*
+ * Copy length bytes into the arena and null-terminate
+ * Returns the copy on success, NULL on error
+ */
+char *arena_strndup(arena_t *arena, const char *str, size_t length);
+
+/*
+ * Release every allocation at once
+ * If the arena overflowed its chunk, the next chunk is sized to the peak
+ * (up to ARENA_MAX_RETAINED_SIZE) so steady-state requests fit in one chunk
+ */
+void arena_reset(arena_t *arena);
+
+/*
+ * Free all chunks
+ */
+void arena_destroy(arena_t *arena);
+
+/*
+ * Get the calling thread's arena, creating it on first use
+ * Freed automatically when the thread exits
+ * Returns arena on success, NULL on error
+ */
+arena_t *arena_thread(void);
+
+#endif /* ARENA_H */
@@ -0,0 +1,124 @@
+/*
+ * C-HTTP Payment Server - Binary Audit Log
+ * Per-request payment events recorded as an event ID plus raw arguments,
+ * formatted offline by tools/log_decode instead of on the request path
+ */
+
+#ifndef AUDIT_H
+#define AUDIT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* File header: magic, format version and a byte-order marker */
+#define AUDIT_MAGIC "CHTAUDIT"
+#define AUDIT_VERSION 1
+#define AUDIT_BYTE_ORDER 0x01020304u
+#define AUDIT_HEADER_SIZE 16
+
+/* Largest encoded record (strings are truncated to fit) */
+#define AUDIT_RECORD_MAX 512
+
+/* Most arguments one event may carry */
+#define AUDIT_MAX_ARGS 8
+
+/*
+ * Event formats
+ * Supported conversions: integers (d i u x X o c with hh h l ll z),
+ * doubles (f e g a), %s and %.*s. Width/precision other than %.*s are kept
+ * for decoding but must be literal. Formats may gain arguments only by
+ * adding a new event; IDs are never reused
+ */
+#define AUDIT_PAYMENT_PROCESSED_FORMAT "payment processed key=%.*s status=%d body_bytes=%zu fd=%d"
+#define AUDIT_PAYMENT_REPLAYED_FORMAT  "payment replayed key=%.*s status=%d fd=%d"
+#define AUDIT_PAYMENT_IN_FLIGHT_FORMAT "payment rejected key=%.*s reason=in-flight fd=%d"
+#define AUDIT_PAYMENT_MISMATCH_FORMAT  "payment rejected key=%.*s reason=mismatch fd=%d"
+#define AUDIT_PAYMENT_NO_KEY_FORMAT    "payment rejected uri=%.*s reason=missing-key fd=%d"
+
+/* Event catalogue: X(name, stable_id) */
+#define AUDIT_EVENTS(X) \
+    X(AUDIT_PAYMENT_PROCESSED, 1) \
+    X(AUDIT_PAYMENT_REPLAYED,  2) \
+    X(AUDIT_PAYMENT_IN_FLIGHT, 3) \
+    X(AUDIT_PAYMENT_MISMATCH,  4) \
+    X(AUDIT_PAYMENT_NO_KEY,    5)
+
+/* Event IDs (as written to the file) */
+typedef enum {
+#define AUDIT_EVENT_ENUM(name, id) name = id,
+    AUDIT_EVENTS(AUDIT_EVENT_ENUM)
+#undef AUDIT_EVENT_ENUM
+    AUDIT_EVENT_MAX
+} audit_event_t;
+
+/* Set while an audit log is open (read by the AUDIT() check) */
+extern bool g_audit_enabled;
+
+/*
+ * Check whether audit records are being written
+ */
+static inline bool audit_enabled(void) {
+    return __atomic_load_n(&g_audit_enabled, __ATOMIC_RELAXED);
+}
+
+/*
+ * Never called: lets the compiler check AUDIT() arguments against the format
+ */
+static inline void audit_format_check(const char *format, ...)
+    __attribute__((format(printf, 1, 2)));
+static inline void audit_format_check(const char *format, ...) {
+    (void)format;
+}
+
+/*
+ * Record an audit event
+ * Arguments are type-checked against <event>_FORMAT at compile time and
+ * not evaluated when no audit log is open
+ */
+#define AUDIT(event, ...) \
+    do { \
+        if (audit_enabled()) { \
+            if (0) { \
+                audit_format_check(event##_FORMAT, __VA_ARGS__); \
+            } \
+            audit_write(event, __VA_ARGS__); \
+        } \
+    } while (0)
+
+/*
+ * Open (or append to) the audit log at path and route the logger's binary
+ * sink to it; a header is written if the file is empty
+ * Returns 0 on success, -1 on error
+ */
+int audit_open(const char *path);
+
+/*
+ * Flush queued records and close the audit log
+ */
+void audit_close(void);
+
+/*
+ * Encode one event and queue it on the binary sink (use AUDIT() instead)
+ */
+void audit_write(audit_event_t event, ...);
+
+/*
+ * Check an audit file header
+ * Returns 0 if valid, -1 otherwise
+ */
+int audit_check_header(const uint8_t *header, size_t length);
+
+/*
+ * Decode one record at data into text ("[time] EVENT: message")
+ * Returns the record's length in bytes, 0 if more data is needed, -1 if
+ * the record is malformed
+ */
+int audit_decode(const uint8_t *data, size_t length, char *out, size_t out_size);
+
+/*
+ * Get an event's name (without the AUDIT_ prefix), NULL if unknown
+ */
+const char *audit_event_name(unsigned int id);
+
+#endif /* AUDIT_H */
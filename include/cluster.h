@@ -0,0 +1,179 @@
+/*
+ * C-HTTP Payment Server - Cluster Key Ownership
+ * Spreads the idempotency store over several nodes: each key is owned by
+ * one node, picked by rendezvous hashing over the peer list, and the other
+ * nodes run their key operations on the owner over pipelined connections
+ */
+
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "idempotency.h"
+
+/* Most nodes in one cluster */
+#define CLUSTER_MAX_PEERS 64
+
+/* How long a key operation waits for its owner before failing with 503 */
+#define CLUSTER_DEFAULT_TIMEOUT_MS 1000
+
+/* After a failed connection, calls to the peer fail at once for this long */
+#define CLUSTER_RETRY_MS 250
+
+/* Threads running key operations for other nodes */
+#define CLUSTER_WORKERS 8
+
+/* Frame header on the wire (big-endian fields, see cluster.c) */
+#define CLUSTER_HEADER_SIZE 32
+
+/* Largest frame payload (key + content type + body) */
+#define CLUSTER_MAX_PAYLOAD ((size_t)2 * 1024 * 1024)
+
+/* Longest shared secret (see --cluster-secret-file) */
+#define CLUSTER_MAX_SECRET 256
+
+/* Cluster settings */
+typedef struct {
+    const char *peers;      /* Comma-separated host:port of every node (NULL = off) */
+    const char *self;       /* This node's entry in peers; its port is bound for peer traffic */
+    int timeout_ms;         /* Longest a key operation waits for its owner */
+    const char *secret_file;    /* First line is the secret peers present (required) */
+} cluster_config_t;
+
+/* Key operation in flight to a peer (lives on the caller's stack) */
+typedef struct cluster_call {
+    uint32_t id;                        /* Echoed by the reply */
+    bool done;                          /* Reply arrived, or the connection failed */
+    bool failed;                        /* No reply: the connection failed or timed out */
+    int result;                         /* Reply outcome */
+    int status_code;
+    idempotency_response_t *response;   /* Response carried by the reply (caller releases) */
+    struct cluster_call *next;
+} cluster_call_t;
+
+/*
+ * Outgoing connection to one peer
+ * Callers append frames to one buffer and wait; a single I/O thread writes
+ * whatever has accumulated in one go and matches replies to calls, so
+ * concurrent operations share a connection and each write carries a batch
+ */
+typedef struct {
+    struct cluster *cluster;    /* Node the connection belongs to */
+    char *name;                 /* host:port as configured */
+    uint64_t seed;              /* Rendezvous hash of name */
+    char *host;
+    char *port;
+
+    pthread_mutex_t lock;
+    pthread_cond_t replied;     /* Some call completed */
+    int wake_pipe[2];           /* Wakes the I/O thread: frames queued, reset or shutdown */
+
+    char *out;                  /* Frames not yet handed to the I/O thread */
+    size_t out_length;
+    size_t out_capacity;
+    cluster_call_t *calls;      /* Waiting for a reply */
+    uint32_t next_id;
+    bool reset;                 /* A caller timed out: drop the connection */
+    uint64_t retry_ns;          /* Calls fail at once until then (after a connect failure) */
+
+    int fd;                     /* Connection (-1 until connected; I/O thread only) */
+    pthread_t thread;
+    bool started;
+} cluster_peer_t;
+
+/* Incoming connection from a peer (see cluster.c) */
+struct cluster_link;
+
+/* Queued key operation from a peer (see cluster.c) */
+struct cluster_job;
+
+/* Cluster node */
+typedef struct cluster {
+    cluster_peer_t peers[CLUSTER_MAX_PEERS];
+    int num_peers;
+    int self;                   /* Index of this node in peers */
+    int timeout_ms;
+    idempotency_store_t *store; /* Keys this node owns */
+    char secret[CLUSTER_MAX_SECRET];    /* Sent first on every outgoing connection */
+    size_t secret_length;
+
+    int listen_fd;              /* Peer traffic */
+    int stop_pipe[2];
+    pthread_t acceptor;
+
+    pthread_mutex_t lock;       /* Guards links and the job queue */
+    pthread_cond_t work;
+    struct cluster_link *links;
+    struct cluster_job *jobs_head;
+    struct cluster_job *jobs_tail;
+    pthread_t workers[CLUSTER_WORKERS];
+
+    bool started;
+    bool shutdown;
+} cluster_t;
+
+/*
+ * Fill cluster settings with built-in defaults (clustering stays off)
+ */
+void cluster_config_init_defaults(cluster_config_t *config);
+
+/*
+ * Parse the peer list, read the shared secret and bind the peer port on
+ * this node's own address
+ * Returns 0 on success, -1 on error
+ */
+int cluster_init(cluster_t *cluster, const cluster_config_t *config, idempotency_store_t *store);
+
+/*
+ * Start serving key operations for peers and the connections to them;
+ * from here on the store routes every key through cluster_begin() and friends
+ * Returns 0 on success, -1 on error
+ */
+int cluster_start(cluster_t *cluster);
+
+/*
+ * Stop the threads, close every connection and drop reservations held for peers
+ */
+void cluster_destroy(cluster_t *cluster);
+
+/*
+ * Index of the node owning key (highest rendezvous score)
+ */
+int cluster_owner(const cluster_t *cluster, const char *key, size_t key_length);
+
+/*
+ * idempotency_begin() on the key's owner: the local store if this node
+ * owns it or clustering is off, else over the owner's connection
+ * Returns IDEMPOTENCY_UNAVAILABLE if the owner cannot be reached in time
+ */
+idempotency_result_t cluster_begin(idempotency_store_t *store, const char *key,
+                                   size_t key_length, uint64_t digest,
+                                   idempotency_response_t **cached);
+
+/*
+ * idempotency_peek() on the key's owner
+ * Returns 1 if cached, 0 if in flight, -1 if unknown or the owner is unreachable
+ */
+int cluster_peek(idempotency_store_t *store, const char *key, size_t key_length,
+                 idempotency_response_t **cached);
+
+/*
+ * idempotency_complete() on the key's owner (durable there before it returns)
+ * Returns 0 on success, -1 if the local store could not cache the response,
+ * IDEMPOTENCY_NOT_DURABLE if the log failed or a remote owner did not
+ * confirm that it cached the response (unreachable, timed out, refused or
+ * too large to send): the client must be told to retry
+ */
+int cluster_complete(idempotency_store_t *store, const char *key, size_t key_length,
+                     int status_code, const char *content_type,
+                     const char *body, size_t body_length);
+
+/*
+ * idempotency_abort() on the key's owner
+ */
+void cluster_abort(idempotency_store_t *store, const char *key, size_t key_length);
+
+#endif /* CLUSTER_H */
@@ -0,0 +1,84 @@
+/*
+ * C-HTTP Payment Server - Runtime Configuration
+ * Server-wide settings populated from command-line options
+ */
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdint.h>
+#include "idempotency.h"
+#include "overload.h"
+#include "wal.h"
+#include "handoff.h"
+#include "cluster.h"
+#include "scheduler.h"
+#include "listener.h"
+#include "event_loop.h"
+#include "logger.h"
+
+/* Default listener settings */
+#define DEFAULT_PORT 8080
+#define DEFAULT_BACKLOG 128
+
+/* Connection I/O model */
+typedef enum {
+    IO_MODE_THREADED = 0,   /* Blocking thread-per-connection (fallback) */
+    IO_MODE_EPOLL,          /* Edge-triggered epoll reactor */
+    IO_MODE_REUSEPORT       /* Per-core epoll loops on SO_REUSEPORT sockets */
+} io_mode_t;
+
+/* Worker scheduling model */
+typedef enum {
+    SCHEDULER_MODE_SHARED = 0,  /* Thread pool pulling from one shared queue */
+    SCHEDULER_MODE_STEALING     /* Per-core workers with local deques and stealing */
+} scheduler_mode_t;
+
+/* Server configuration */
+typedef struct {
+    uint16_t port;          /* Port to bind to */
+    int backlog;            /* Listen backlog */
+    int num_threads;        /* Number of worker threads (0 = per-mode default) */
+    scheduler_mode_t scheduler;     /* Worker scheduling model */
+    sched_pin_t pin;        /* CPU pinning policy (stealing workers, reuseport loops) */
+    listener_steer_t steer; /* Connection steering across reuseport sockets */
+    io_mode_t io_mode;      /* Connection I/O model */
+    event_engine_t io_engine;   /* Reactor engine (and accept path of threaded mode) */
+    int idle_timeout_ms;    /* Keep-alive idle timeout */
+    int max_requests;       /* Requests per connection before closing */
+    size_t zerocopy_min_bytes;  /* MSG_ZEROCOPY threshold for response bodies (0 = off) */
+    log_level_t log_level;  /* Minimum level logged */
+    log_overflow_t log_overflow;    /* Async log ring overflow policy */
+    const char *audit_log_path;     /* Binary audit log (NULL = off) */
+    const char *static_root;        /* Document root served under /static/ (NULL = off) */
+    const char *trace_path;         /* Request phase trace output (NULL = off) */
+    long trace_threshold_us;        /* Only trace requests taking at least this long */
+    idempotency_config_t idempotency;   /* Idempotency store settings */
+    overload_config_t overload;         /* Load shedding settings */
+    wal_config_t wal;                   /* Idempotency log settings */
+    handoff_config_t handoff;           /* Warm restart settings */
+    cluster_config_t cluster;           /* Cluster key ownership settings */
+} server_config_t;
+
+/*
+ * Fill configuration with built-in defaults
+ */
+void config_init_defaults(server_config_t *config);
+
+/*
+ * Parse command-line options into configuration
+ * Returns 0 on success, 1 if the program should exit (e.g. --help), -1 on error
+ */
+int config_parse_args(server_config_t *config, int argc, char *argv[]);
+
+/*
+ * Convert I/O mode enum to string
+ */
+const char *config_io_mode_to_string(io_mode_t mode);
+
+/*
+ * Convert scheduler mode enum to string
+ */
+const char *config_scheduler_mode_to_string(scheduler_mode_t mode);
+
+#endif /* CONFIG_H */
@@ -7,11 +7,79 @@
 #define CONNECTION_H
 
 #include <stddef.h>
+#include <stdbool.h>
 #include <sys/types.h>
+#include <stdint.h>
+#include "idempotency.h"
+#include "http_parser.h"
+#include "http_body.h"
+#include "http_response.h"
+#include "dispatcher.h"
 
 /* Maximum buffer size for reading requests */
 #define CONN_BUFFER_SIZE 8192
 
+/* Keep-alive defaults */
+#define CONN_DEFAULT_IDLE_TIMEOUT_MS 5000
+#define CONN_DEFAULT_MAX_REQUESTS 100
+
+/* MSG_ZEROCOPY is off by default; page pinning only pays off for large bodies */
+#define CONN_DEFAULT_ZEROCOPY_MIN 0
+
+/* Interim response for Expect: 100-continue */
+#define CONN_CONTINUE_RESPONSE "HTTP/1.1 100 Continue\r\n\r\n"
+
+/* Persistent connection settings shared by all I/O models */
+typedef struct {
+    int idle_timeout_ms;    /* Close connections idle for this long */
+    int max_requests;       /* Requests served before forcing Connection: close */
+    idempotency_store_t *idempotency;   /* Response cache for POST replays (NULL = disabled) */
+    const dispatcher_t *dispatcher;     /* Compiled route table (NULL = every request is a 404) */
+    size_t zerocopy_min_bytes;  /* Send bodies at least this large with MSG_ZEROCOPY (0 = never) */
+    bool send_zc;           /* Send those bodies with io_uring SENDMSG_ZC instead */
+} connection_config_t;
+
+/*
+ * Drain phases while handing over to a successor process
+ */
+typedef enum {
+    CONN_DRAIN_NONE = 0,    /* Serving normally */
+    CONN_DRAIN_CLOSE,       /* Every response closes its connection */
+    CONN_DRAIN_REFUSE       /* ...and new payments get 503: the store is being handed over */
+} conn_drain_t;
+
+/*
+ * Per-socket MSG_ZEROCOPY state
+ * The kernel numbers zerocopy sends on a socket from 0 and reports their
+ * completion on the error queue; pages may only be reused after that
+ */
+typedef struct {
+    bool enabled;           /* SO_ZEROCOPY set on the socket */
+    bool unsupported;       /* Kernel refused SO_ZEROCOPY; do not retry */
+    uint32_t issued;        /* Zerocopy sends issued */
+    uint32_t completed;     /* Zerocopy sends the kernel has released */
+} conn_zerocopy_t;
+
+/*
+ * Request body as the payment handler consumes it
+ * Decoded chunks feed a running idempotency digest and are then dropped,
+ * so an upload only ever occupies the connection's read buffer
+ */
+typedef struct {
+    http_body_t decoder;    /* Framing state (Content-Length or chunked) */
+    uint64_t digest;        /* Idempotency digest of the URI and decoded body */
+} conn_body_t;
+
+/*
+ * Apply connection settings (call before serving traffic)
+ */
+void connection_configure(const connection_config_t *config);
+
+/*
+ * Get current connection settings
+ */
+const connection_config_t *connection_get_config(void);
+
 /*
  * Read data from a client socket
  * Returns number of bytes read, 0 on connection close, -1 on error
@@ -24,11 +92,106 @@ ssize_t connection_read(int client_fd, char *buffer, size_t buffer_size);
  */
 ssize_t connection_write(int client_fd, const char *data, size_t data_len);
 
+/*
+ * Send a rendered response with sendmsg(), resuming after partial writes
+ * A borrowed file region follows the segments via sendfile()
+ * zerocopy: socket state, or NULL to always copy. Bodies of at least
+ * zerocopy_min_bytes are sent with MSG_ZEROCOPY; call
+ * connection_zerocopy_wait() before their memory is reused. With send_zc
+ * they go out through io_uring instead and are released on return.
+ * Returns 1 when everything is sent, 0 if the socket would block, -1 on error
+ */
+int connection_send_output(int client_fd, http_output_t *output, conn_zerocopy_t *zerocopy);
+
+/*
+ * Wait until the kernel has released every zerocopy send on the socket
+ * Returns 0 on success, -1 on error or timeout
+ */
+int connection_zerocopy_wait(int client_fd, conn_zerocopy_t *zerocopy, int timeout_ms);
+
+/*
+ * Check a parsed request's headers before reading its body
+ * Catches unsupported framing, bodies over the limit and POSTs without an
+ * idempotency key. before_body (may be NULL) is set when the request
+ * should be answered without reading the body: the framing cannot be
+ * followed, the body is too large, or the client waits for 100 Continue.
+ * Returns the canned error response, NULL if the request may proceed
+ */
+const http_canned_t *connection_check_headers(const http_request_t *request, bool *before_body);
+
+/*
+ * Start streaming the body of a parsed request into body
+ * Returns 0 on success, -1 on error
+ */
+int connection_body_begin(conn_body_t *body, const http_request_t *request);
+
+/*
+ * Decode the body bytes buffered at buffer[offset, *length)
+ * Consumed bytes are removed: what follows moves down to offset and
+ * *length shrinks, so the buffer only ever holds one read window
+ * Returns the http_body_feed() result
+ */
+http_body_result_t connection_body_consume(conn_body_t *body, char *buffer, size_t offset,
+                                           size_t *length);
+
+/*
+ * Send "100 Continue" to a client waiting to upload its body
+ * Returns 0 on success, -1 on error
+ */
+int connection_send_continue(int client_fd);
+
+/*
+ * Enter a drain phase (phases only advance)
+ * Once CONN_DRAIN_REFUSE is set, the store is quiescent as soon as
+ * connection_payments_in_flight() drops to 0
+ */
+void connection_set_drain(conn_drain_t drain);
+
+/*
+ * Check whether responses must close their connections
+ */
+bool connection_draining(void);
+
+/*
+ * Count POST requests between their idempotency lookup and completion
+ */
+int connection_payments_in_flight(void);
+
+/*
+ * Answer a client the server has no capacity for
+ * Sends the canned 503 (Retry-After, Connection: close) without blocking
+ * and half-closes the socket; the caller closes client_fd
+ */
+void connection_send_overloaded(int client_fd);
+
+/*
+ * Build the response for one request
+ * request was fed by http_parse_request(); if parsing failed or never
+ * completed (headers too large) an error response is built instead.
+ * body: the streamed body, NULL if it was never read (refused up front).
+ * Unless the body was decoded completely the connection cannot be reused.
+ * keep_alive: in - connection may persist; out - connection should persist
+ * Request resources are released before returning.
+ * The rendered output references the calling thread's arena; reset it with
+ * arena_reset(arena_thread()) once sent.
+ * Returns 0 on success (output filled), -1 on error
+ */
+int connection_process_request(int client_fd, http_request_t *request, const conn_body_t *body,
+                               bool *keep_alive, http_output_t *output);
+
 /*
  * Handle a complete client connection
- * Reads HTTP request and sends back a simple HTTP response
+ * Serves requests until the client closes, asks for Connection: close,
+ * goes idle, or reaches the per-connection request cap
  * Returns 0 on success, -1 on error
  */
 int connection_handle(int client_fd);
 
+/*
+ * Serve a queued client connection, then close it (default task handler)
+ * queue_wait_ns: time it waited for a worker; connections the overload
+ * policy sheds get a 503 instead
+ */
+void connection_run(int client_fd, uint64_t queue_wait_ns);
+
 #endif /* CONNECTION_H */
@@ -1,40 +1,186 @@
 /*
- * NanoServe - Connection Dispatcher
- * Accepts connections and distributes them to worker threads via queue
+ * C-HTTP Payment Server - Request Dispatcher
+ * Routes (method, path) to handlers through a trie compiled at startup
+ *
+ * Patterns are made of '/'-separated segments: literal text, ":name"
+ * (captures one segment) or a final "*name" (captures the rest of the
+ * path, possibly empty). Routes are added while the server starts, then
+ * dispatcher_compile() freezes the table; lookups only read it, so any
+ * thread may match concurrently without locks.
  */
 
 #ifndef DISPATCHER_H
 #define DISPATCHER_H
 
-#include "listener.h"
-#include "queue.h"
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "http_parser.h"
+#include "http_response.h"
 
-/* Dispatcher configuration */
+/* Route that accepts any method without a more specific route */
+#define DISPATCH_ANY_METHOD HTTP_METHOD_UNKNOWN
+
+/* Slots in a node's per-method route table ([DISPATCH_ANY_METHOD] first) */
+#define DISPATCH_METHOD_COUNT (HTTP_METHOD_PATCH + 1)
+
+/* Most parameters one pattern may capture */
+#define DISPATCH_MAX_PARAMS 4
+
+/* Most segments in a pattern (deeper request paths simply do not match) */
+#define DISPATCH_MAX_DEPTH 16
+
+/*
+ * Lookup Result
+ */
+typedef enum {
+    DISPATCH_FOUND = 0,             /* Route selected (see context) */
+    DISPATCH_NOT_FOUND,             /* No pattern matches the path */
+    DISPATCH_METHOD_NOT_ALLOWED     /* Path matches, the method does not (see allowed) */
+} dispatch_result_t;
+
+/*
+ * Captured Path Parameter
+ * Both parts are slices: name into the route pattern, value into the request
+ */
+typedef struct {
+    http_str_t name;
+    http_str_t value;
+} dispatch_param_t;
+
+struct dispatch_context;
+
+/*
+ * Route Handler
+ * Fills in response (initialized by the handler) for the matched request
+ * Returns 0 on success, -1 on error (the caller answers 500)
+ */
+typedef int (*dispatch_handler_t)(struct dispatch_context *context, http_response_t *response);
+
+/*
+ * Per-Request Dispatch Context
+ * Filled by dispatcher_match(); lives on the stack of the request
+ */
+typedef struct dispatch_context {
+    int client_fd;                  /* Client socket (logging only) */
+    const http_request_t *request;  /* Parsed request (body already consumed) */
+    http_str_t path;                /* URI without the query string */
+    http_str_t query;               /* Text after '?', empty if none */
+
+    dispatch_param_t params[DISPATCH_MAX_PARAMS];
+    size_t param_count;
+
+    dispatch_handler_t handler;     /* Selected route's handler */
+    void *arg;                      /* Argument given when the route was added */
+    const char *pattern;            /* Selected route's pattern (logging) */
+    uint32_t allowed;               /* Methods the path accepts (bit per http_method_t) */
+
+    const http_canned_t *canned;    /* Pre-serialized error set by dispatch_error() */
+} dispatch_context_t;
+
+/*
+ * Route
+ */
 typedef struct {
-    listener_t *listener;   /* TCP listener */
-    queue_t *task_queue;    /* Task queue for worker threads */
-    int running;            /* Dispatcher running flag */
+    http_method_t method;           /* Method, or DISPATCH_ANY_METHOD */
+    char *pattern;                  /* Owned copy; node labels and param names point into it */
+    dispatch_handler_t handler;
+    void *arg;
+} dispatch_route_t;
+
+/*
+ * Segment Kind
+ */
+typedef enum {
+    DISPATCH_SEGMENT_STATIC = 0,    /* Literal text */
+    DISPATCH_SEGMENT_PARAM,         /* ":name" */
+    DISPATCH_SEGMENT_WILDCARD       /* "*name" */
+} dispatch_segment_t;
+
+/*
+ * Trie Node
+ * After compiling, each node's static children are contiguous and sorted
+ * by label, so a segment is found with a binary search
+ */
+typedef struct {
+    dispatch_segment_t kind;
+    http_str_t label;               /* Segment text, or the parameter name */
+    int32_t parent;                 /* Parent node (building only; -1 for the root) */
+    uint32_t first_child;           /* Static children [first_child, first_child + child_count) */
+    uint32_t child_count;
+    int32_t param_child;            /* ":name" child, -1 if none */
+    int32_t wildcard_child;         /* "*name" child, -1 if none */
+    int32_t routes[DISPATCH_METHOD_COUNT];  /* Route index per method, -1 if none */
+} dispatch_node_t;
+
+/*
+ * Dispatcher
+ * Route table plus its compiled trie (node 0 is the root, "/")
+ */
+typedef struct {
+    dispatch_route_t *routes;
+    size_t route_count;
+    size_t route_capacity;
+
+    dispatch_node_t *nodes;
+    size_t node_count;
+    size_t node_capacity;
+
+    bool compiled;                  /* Read-only from here on */
 } dispatcher_t;
 
 /*
- * Initialize dispatcher with listener and queue
+ * Initialize an empty dispatcher
  * Returns 0 on success, -1 on error
  */
-int dispatcher_init(dispatcher_t *dispatcher, listener_t *listener, queue_t *queue);
+int dispatcher_init(dispatcher_t *dispatcher);
 
 /*
- * Run dispatcher loop (accepts connections and enqueues them)
- * This is a blocking call that runs until shutdown
+ * Add a route (before dispatcher_compile() only)
+ * Adding the same (method, pattern) twice is an error
+ * Returns 0 on success, -1 on error
+ */
+int dispatcher_add(dispatcher_t *dispatcher, http_method_t method, const char *pattern,
+                   dispatch_handler_t handler, void *arg);
+
+/*
+ * Freeze the route table: lays the trie out for lookups
+ * Returns 0 on success, -1 on error
+ */
+int dispatcher_compile(dispatcher_t *dispatcher);
+
+/*
+ * Select the route for a request
+ * Literal segments win over ":name", which wins over "*name"; a method
+ * without its own route falls back to a DISPATCH_ANY_METHOD route (HEAD
+ * first tries the GET route)
+ * Returns DISPATCH_FOUND, DISPATCH_NOT_FOUND or DISPATCH_METHOD_NOT_ALLOWED
+ */
+dispatch_result_t dispatcher_match(const dispatcher_t *dispatcher, const http_request_t *request,
+                                   int client_fd, dispatch_context_t *context);
+
+/*
+ * Get a captured parameter by name
+ * Returns the value, or an empty slice (ptr NULL) if the route has none
+ */
+http_str_t dispatch_param(const dispatch_context_t *context, const char *name);
+
+/*
+ * Answer with an error: the canned response when one exists, otherwise
+ * a JSON error built into response
+ * Returns 0 on success, -1 on error
  */
-void dispatcher_run(dispatcher_t *dispatcher);
+int dispatch_error(dispatch_context_t *context, http_response_t *response, int status_code,
+                   const char *message);
 
 /*
- * Stop dispatcher loop
+ * Render the methods in an allowed mask as an Allow header value
+ * Returns 0 on success, -1 if buffer is too small
  */
-void dispatcher_stop(dispatcher_t *dispatcher);
+int dispatch_allow_header(uint32_t allowed, char *buffer, size_t size);
 
 /*
- * Cleanup dispatcher resources
+ * Free routes and trie
  */
 void dispatcher_destroy(dispatcher_t *dispatcher);
 
@@ -0,0 +1,231 @@
+/*
+ * C-HTTP Payment Server - Event Loop
+ * Reactor with non-blocking connections over epoll or io_uring
+ */
+
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "connection.h"
+#include "http_parser.h"
+#include "listener.h"
+#include "thread_pool.h"
+#include "scheduler.h"
+#include "trace.h"
+#include "uring.h"
+
+/* Maximum events returned by one epoll_wait() call */
+#define EVENT_LOOP_MAX_EVENTS 256
+
+/* io_uring engine: submission slots, completion slots, provided receive buffers */
+#define EVENT_LOOP_URING_ENTRIES 256
+#define EVENT_LOOP_URING_CQ_ENTRIES 4096
+#define EVENT_LOOP_URING_BUFFERS 256
+#define EVENT_LOOP_URING_BUFFER_SIZE 4096
+
+/*
+ * Reactor engine
+ * How connections wait for their next event; the state machine is shared
+ */
+typedef enum {
+    EVENT_ENGINE_EPOLL = 0,     /* Edge-triggered one-shot epoll, recv()/send() on readiness */
+    EVENT_ENGINE_URING          /* io_uring: multishot accept, receives into provided buffers */
+} event_engine_t;
+
+/*
+ * Connection State Enumeration
+ * Per-connection state machine driven by the reactor
+ */
+typedef enum {
+    CONN_STATE_READING_HEADERS = 0, /* Waiting for the blank line after headers */
+    CONN_STATE_READING_BODY,        /* Headers complete, streaming the body through its decoder */
+    CONN_STATE_PROCESSING,          /* Request complete, owned by a worker thread */
+    CONN_STATE_WRITING              /* Response partially sent, waiting for the socket to drain */
+} conn_state_t;
+
+/* Connection slots are allocated in slabs of this many fds */
+#define EVENT_LOOP_SLAB_CONNS 1024
+
+/* Most idle exchanges a loop keeps for reuse; the rest go back to the heap */
+#define EVENT_LOOP_POOL_KEEP 1024
+
+/*
+ * Request exchange
+ * Parse state, read buffer and pending output of one connection, taken
+ * from the loop's pool only while a request is buffered or being answered
+ */
+typedef struct event_exchange {
+    http_request_t request; /* Incremental parse state (slices into buffer) */
+    size_t request_length;  /* Bytes to drop once answered (decoded body bytes are gone) */
+    conn_body_t body;       /* Body decoder and digest (started once headers pass checks) */
+    trace_request_t trace;  /* Phase timestamps of the pending request (--trace only) */
+
+    /* Pending response output (worker arena, or heap copy once handed back) */
+    http_output_t output;
+    char *output_copy;      /* Heap copy of unsent bytes, freed by the connection */
+
+    struct event_exchange *next_free;   /* Pool free list / worker return stack / parked list */
+    uint32_t generation;                /* io_uring: connection it came from, while parked */
+    char buffer[CONN_BUFFER_SIZE];      /* Read buffer (must stay last, see exchange_get) */
+} event_exchange_t;
+
+/*
+ * Event Connection Structure
+ * Slot for one non-blocking client connection; an idle one holds no
+ * request state
+ */
+typedef struct event_conn {
+    int fd;                 /* Client socket file descriptor */
+    conn_state_t state;     /* Current state */
+    bool open;              /* The slot holds a connection */
+
+    /* Read buffer (exchange->buffer, NULL while idle; null-terminated at buffer[length]) */
+    char *buffer;
+    size_t length;
+    event_exchange_t *exchange; /* Request state (NULL while idle) */
+    conn_zerocopy_t zerocopy;   /* MSG_ZEROCOPY state for this socket */
+
+    /* Worker hand-off */
+    uint64_t dispatched_ns; /* When the pending request was submitted (overload deadline) */
+
+    /* Keep-alive */
+    int requests_served;    /* Responses sent on this connection */
+    bool keep_alive;        /* Connection persists after the pending response */
+
+    /* Reactor-only: idle timeout list, ordered by deadline */
+    uint64_t deadline_ms;
+    bool waiting;
+    struct event_conn *wait_prev;
+    struct event_conn *wait_next;
+
+    /* Reactor-only, io_uring: tag of the request in flight (stale completions differ) */
+    uint32_t generation;
+    bool pending;
+    struct event_exchange *parked;  /* Closed on this fd, cancelled request not yet complete */
+
+    /* Worker -> reactor hand-back list */
+    struct event_conn *next_returned;
+} event_conn_t;
+
+struct event_loop_group;
+struct event_engine_ops;
+
+/* Event loop (reactor) */
+typedef struct {
+    event_engine_t engine;  /* Engine in use (epoll if io_uring was unavailable) */
+    const struct event_engine_ops *ops; /* Its operations (see event_loop.c) */
+    int epoll_fd;           /* epoll instance (epoll engine) */
+    uring_t ring;           /* Submission and completion rings (io_uring engine) */
+    uring_bufs_t bufs;      /* Receive buffers shared by waiting connections (io_uring engine) */
+    uint32_t next_generation;   /* Tag source for connections (io_uring engine) */
+    listener_t *listener;   /* Listener providing listen socket and shutdown pipe */
+    int listen_fd;          /* Listen socket accepted on by this loop */
+    struct event_loop_group *group; /* Owning group (NULL for a standalone loop) */
+    task_submit_t submit;   /* Hands ready connections to workers (NULL = inline) */
+    void *submit_arg;       /* Worker pool passed to submit */
+    event_conn_t **slabs;   /* Connection slots by fd / EVENT_LOOP_SLAB_CONNS (NULL = unused) */
+    int num_slabs;
+    int max_fds;            /* Size of connection table */
+    bool running;           /* Loop running flag */
+    int open_conns;         /* Connections in the table (closed by reactor or workers) */
+
+    /* Listener drain: no more accepts, stop once open_conns reaches 0 or the deadline */
+    bool draining;
+    uint64_t drain_deadline_ms;
+    bool accept_pending;    /* io_uring: the cancelled accept may still deliver sockets */
+
+    /* Connections waiting on the socket, oldest deadline first */
+    event_conn_t *wait_head;
+    event_conn_t *wait_tail;
+
+    /* Connections handed back by workers once a response is sent */
+    int wake_fd;            /* eventfd used to wake the reactor */
+    pthread_mutex_t return_lock;
+    event_conn_t *returned;
+
+    /* Exchange pool: reactor-owned free list, plus a lock-free stack pushed by workers */
+    event_exchange_t *free_exchanges;
+    int num_free_exchanges;
+    event_exchange_t *returned_exchanges;
+} event_loop_t;
+
+/*
+ * SO_REUSEPORT loop group
+ * One inline event loop per listen socket, each on its own (pinned) thread
+ */
+typedef struct event_loop_group {
+    event_loop_t *loops;    /* One loop per listen socket */
+    pthread_t *threads;     /* Loop threads (0 if not running) */
+    int *cpus;              /* CPU each loop is pinned to (-1 = unpinned) */
+    int num_loops;          /* Initialized loops */
+    listener_t *listener;   /* Listener owning the reuseport sockets */
+} event_loop_group_t;
+
+/*
+ * Initialize event loop for listen socket listen_index of a started listener
+ * Switches the listen socket to non-blocking mode
+ * engine: EVENT_ENGINE_URING falls back to epoll if the kernel lacks io_uring
+ * submit/submit_arg: worker pool that serves complete requests
+ * (thread_pool_submit or scheduler_submit); NULL serves them on the loop thread
+ * Returns 0 on success, -1 on error (e.g. epoll unavailable)
+ */
+int event_loop_init(event_loop_t *loop, listener_t *listener, int listen_index,
+                    event_engine_t engine, task_submit_t submit, void *submit_arg);
+
+/*
+ * Run the reactor until the listener's shutdown pipe is signaled
+ * Accepts connections and reads requests; complete requests are
+ * submitted to the worker pool. Connections that sit idle
+ * longer than the keep-alive timeout are closed.
+ * If the listener is draining, the loop stops accepting, closes idle
+ * connections and keeps serving the rest until they close or the drain
+ * timeout passes.
+ * Returns 0 on clean shutdown, -1 on error
+ */
+int event_loop_run(event_loop_t *loop);
+
+/*
+ * Worker-side task handler (see thread_pool_set_handler, scheduler_set_handler)
+ * Builds and sends the response for a connection whose request is complete,
+ * then serves any pipelined requests already buffered before handing the
+ * connection back to the reactor
+ */
+void event_loop_process(int client_fd, void *arg);
+
+/*
+ * Close all remaining connections and free resources
+ * Should be called after worker threads have stopped
+ */
+void event_loop_destroy(event_loop_t *loop);
+
+/*
+ * Initialize one inline event loop per listen socket of a started listener
+ * pin: pin loop i to the i-th allowed CPU (SCHED_PIN_CORES) or not
+ * engine: reactor engine of every loop
+ * Returns 0 on success, -1 on error
+ */
+int event_loop_group_init(event_loop_group_t *group, listener_t *listener, sched_pin_t pin,
+                          event_engine_t engine);
+
+/*
+ * Run every loop on its own thread until the shutdown pipe is signaled
+ * Blocks until all loops have stopped
+ * Returns 0 on clean shutdown, -1 on error
+ */
+int event_loop_group_run(event_loop_group_t *group);
+
+/*
+ * Close all connections of every loop and free the group
+ */
+void event_loop_group_destroy(event_loop_group_t *group);
+
+/*
+ * Convert engine to its option name
+ */
+const char *event_engine_to_string(event_engine_t engine);
+
+#endif /* EVENT_LOOP_H */
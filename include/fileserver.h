@@ -1,38 +1,167 @@
 /*
- * NanoServe - Static File Server
- * Handles file serving and MIME type detection
+ * C-HTTP Payment Server - Static File Server
+ * Serves files under a document root from a cache of open files and
+ * their metadata, answering repeat requests without touching the disk
  */
 
 #ifndef FILESERVER_H
 #define FILESERVER_H
 
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
 #include "http_parser.h"
 #include "http_response.h"
 
-/* File server configuration */
+/* Files up to this size are cached in memory; larger ones go out with sendfile() */
+#define FILESERVER_SMALL_FILE (16 * 1024)
+
+/* Cache limits: open files/metadata entries, and bytes of in-memory contents */
+#define FILESERVER_MAX_ENTRIES 256
+#define FILESERVER_MEMORY_LIMIT (8 * 1024 * 1024)
+
+/* Hash buckets (power of two) */
+#define FILESERVER_BUCKETS 512
+
+/* Longest path (relative to the root) that is served */
+#define FILESERVER_MAX_PATH 1024
+
+/* Without inotify, cached entries are re-checked with stat() this often */
+#define FILESERVER_REVALIDATE_MS 1000
+
+/* File served for a directory */
+#define FILESERVER_INDEX "index.html"
+
+/* Largest file compressed on first request (bigger ones need offline variants) */
+#define FILESERVER_COMPRESS_MAX (4 * 1024 * 1024)
+
+/* Smallest file worth compressing */
+#define FILESERVER_COMPRESS_MIN 256
+
+/*
+ * Content Coding
+ * Variants other than identity come from "<file>.gz" / "<file>.br" next to
+ * the file when present, otherwise from compressing it once on demand
+ */
+typedef enum {
+    FILESERVER_ENCODING_IDENTITY = 0,
+    FILESERVER_ENCODING_GZIP,
+    FILESERVER_ENCODING_BR,
+    FILESERVER_ENCODING_COUNT
+} fileserver_encoding_t;
+
+/*
+ * Representation
+ * The bytes sent for one content coding of a file, with its headers
+ */
+typedef struct {
+    int fd;                     /* Open file for sendfile(), -1 if held in memory */
+    char *data;                 /* Contents (small or compressed on demand), NULL otherwise */
+    size_t size;
+    char etag[48];              /* Quoted entity tag (differs per coding) */
+    char *headers;              /* Content-Type, Content-Encoding, Vary, ETag, Last-Modified */
+    http_header_block_t block;  /* headers as a block for the renderer */
+} fileserver_variant_t;
+
+/*
+ * Cached File
+ * Immutable once published apart from variants, which are attached once
+ * (under the lock) and never replaced; shared by the cache and in-flight
+ * responses, and freed when the last of them lets go
+ */
+typedef struct fileserver_entry {
+    int refcount;               /* Owners (cache + responses), updated atomically */
+    bool cached;                /* Still reachable from the table (under the lock) */
+
+    char *key;                  /* Request path relative to the root (cache key) */
+    size_t key_length;
+    uint64_t hash;
+    char *file;                 /* File actually served, relative to the root */
+
+    fileserver_variant_t identity;  /* The file itself */
+    size_t size;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    char last_modified[32];     /* IMF-fixdate of mtime */
+    const char *content_type;
+
+    /* Compressed variants, built on first request for their coding */
+    fileserver_variant_t *variants[FILESERVER_ENCODING_COUNT];
+    uint8_t offline;            /* Codings with a "<file>.gz"/".br" on disk (bit per coding) */
+    uint8_t tried;              /* Codings already looked up (bit per coding) */
+    bool negotiable;            /* Some coding other than identity may exist (sends Vary) */
+    size_t memory;              /* In-memory bytes, counted against the cache limit */
+
+    uint64_t checked_ms;        /* Last stat() revalidation (no inotify) */
+
+    struct fileserver_entry *hash_next;
+    struct fileserver_entry *lru_prev;  /* Most recently served at the head */
+    struct fileserver_entry *lru_next;
+} fileserver_entry_t;
+
+/* Watched directory (inotify watch descriptor and its path) */
 typedef struct {
-    char *document_root;        /* Document root directory */
-} fileserver_config_t;
+    int wd;
+    char *dir;                  /* Relative to the root, "" for the root itself */
+} fileserver_watch_t;
+
+/*
+ * File Server
+ */
+typedef struct {
+    char *document_root;        /* Canonical root directory */
+    size_t root_length;
+
+    pthread_mutex_t lock;       /* Guards the table, LRU list and watches */
+    fileserver_entry_t *buckets[FILESERVER_BUCKETS];
+    fileserver_entry_t *lru_head;
+    fileserver_entry_t *lru_tail;
+    size_t entry_count;
+    size_t memory_used;         /* Bytes of in-memory file contents (all variants) */
+
+    /* Invalidation (inotify on Linux; stat() revalidation otherwise) */
+    int inotify_fd;             /* -1 when not watching */
+    int wake_fd;                /* Wakes the watcher for shutdown */
+    pthread_t watcher;
+    bool watcher_started;
+    fileserver_watch_t *watches;
+    size_t watch_count;
+    size_t watch_capacity;
+} fileserver_t;
 
 /*
  * Initialize file server with document root
  * Returns 0 on success, -1 on error
  */
-int fileserver_init(fileserver_config_t *config, const char *document_root);
+int fileserver_init(fileserver_t *server, const char *document_root);
+
+/*
+ * Start the thread that drops cache entries when their files change
+ * Without it (or off Linux) entries are re-checked with stat()
+ * Returns 0 on success, -1 on error
+ */
+int fileserver_start(fileserver_t *server);
 
 /*
- * Resolve URI to file path
- * Returns resolved path (caller must free), NULL on error or security violation
+ * Resolve a URI path (below the mount point) to a path relative to the root
+ * Percent-decodes it and rejects traversal, NUL bytes and overlong paths
+ * Returns the length written to out, -1 if the path must not be served
  */
-char *resolve_file_path(const fileserver_config_t *config, const char *uri);
+int resolve_file_path(const char *uri_path, size_t length, char *out, size_t out_size);
 
 /*
  * Serve file for given request
- * Populates response with file content or error
- * Returns 0 on success, -1 on error
+ * path is the URI path below the mount point; GET and HEAD only.
+ * Populates response with file content, or 304 Not Modified when the
+ * client's If-None-Match / If-Modified-Since still holds. The coding comes
+ * from Accept-Encoding (br, gzip or identity)
+ * Returns 0 if the response was built, otherwise the HTTP error status
+ * to answer with
  */
-int serve_file(const fileserver_config_t *config,
-               const http_request_t *request,
+int serve_file(fileserver_t *server, const http_request_t *request, http_str_t path,
                http_response_t *response);
 
 /*
@@ -43,7 +172,8 @@ const char *get_mime_type(const char *filename);
 
 /*
  * Cleanup file server resources
+ * Entries still referenced by responses are freed when those finish
  */
-void fileserver_destroy(fileserver_config_t *config);
+void fileserver_destroy(fileserver_t *server);
 
 #endif /* FILESERVER_H */
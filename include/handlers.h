@@ -0,0 +1,28 @@
+/*
+ * C-HTTP Payment Server - Route Handlers
+ * The server's endpoints, mounted on the request dispatcher
+ */
+
+#ifndef HANDLERS_H
+#define HANDLERS_H
+
+#include "dispatcher.h"
+#include "fileserver.h"
+#include "idempotency.h"
+
+/*
+ * Register the server's routes
+ *   GET  /health              liveness check
+ *   GET  /metrics             counters and latency histograms (Prometheus text)
+ *   POST /payments            create a payment (idempotent by key)
+ *   GET  /payments/:key       state of the payment created with key
+ *   GET/HEAD /static/...      files under the document root (files only)
+ * HEAD is answered for every GET route; other paths get 404, other
+ * methods on a known path 405 with Allow
+ * store answers payment status lookups (NULL: every lookup is a 404);
+ * files serves static files (NULL: no /static routes)
+ * Returns 0 on success, -1 on error
+ */
+int handlers_register(dispatcher_t *dispatcher, idempotency_store_t *store, fileserver_t *files);
+
+#endif /* HANDLERS_H */
@@ -0,0 +1,110 @@
+/*
+ * C-HTTP Payment Server - Warm Restart Handoff
+ * Passes the listening sockets and an image of the idempotency store from a
+ * running server to its replacement over a Unix socket, so a restart
+ * neither refuses connections nor replays the whole log
+ */
+
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "idempotency.h"
+#include "listener.h"
+#include "wal.h"
+
+/* Request and reply magic (the reply carries the descriptors) */
+#define HANDOFF_REQUEST_MAGIC "CHTHNDF1"
+#define HANDOFF_REPLY_MAGIC "CHTHNDR1"
+
+/* Most listen sockets one handoff carries (the kernel allows 253 per message) */
+#define HANDOFF_MAX_FDS 128
+
+/* How long the old server lets open requests finish before handing over */
+#define HANDOFF_DEFAULT_DRAIN_MS 1000
+
+/* How long the new server waits for its predecessor's reply */
+#define HANDOFF_RECEIVE_TIMEOUT_SEC 30
+
+/* Reply flag: the last descriptor is a store image */
+#define HANDOFF_FLAG_IMAGE 0x1
+
+/* Handoff settings */
+typedef struct {
+    const char *path;       /* Unix socket path shared by old and new server (NULL = off) */
+    int drain_ms;           /* Longest the old server waits for open requests */
+} handoff_config_t;
+
+/*
+ * Old server's side of a handoff
+ * A thread waits on the Unix socket; the first successor to connect puts
+ * the server into drain and is answered once requests have finished
+ */
+typedef struct {
+    char *path;             /* Socket path (unlinked at stop unless a successor took it) */
+    int server_fd;          /* Listening Unix socket */
+    int peer_fd;            /* Connected successor (-1 until one arrives) */
+    int stop_pipe[2];       /* Wakes the thread at stop */
+    int drain_ms;
+    listener_t *listener;   /* Listener to drain when a successor arrives */
+    bool pending;           /* A successor is waiting for the descriptors */
+    pthread_t thread;
+    bool started;
+} handoff_t;
+
+/* What the new server inherited */
+typedef struct {
+    int fds[HANDOFF_MAX_FDS];   /* Listen sockets, in reuseport group order */
+    int num_fds;
+    int image_fd;               /* Store image (-1 = none; replay the log instead) */
+    uint16_t port;              /* Port the sockets are bound to */
+    uint64_t started_ns;        /* When the handoff began (for the restart time) */
+} handoff_inherit_t;
+
+/*
+ * Fill handoff settings with built-in defaults (handoff stays off)
+ */
+void handoff_config_init_defaults(handoff_config_t *config);
+
+/*
+ * Ask a running predecessor at path for its sockets and store image
+ * Blocks until the predecessor has drained and replied
+ * Returns 1 with *inherit filled, 0 if there is no predecessor (cold start),
+ * -1 on error
+ */
+int handoff_receive(const char *path, handoff_inherit_t *inherit);
+
+/*
+ * Close whatever handoff_receive() passed on and was not used
+ */
+void handoff_inherit_close(handoff_inherit_t *inherit);
+
+/*
+ * Accept successors on the configured path from now on
+ * Returns 0 on success, -1 on error
+ */
+int handoff_listen(handoff_t *handoff, const handoff_config_t *config, listener_t *listener);
+
+/*
+ * Stop accepting successors; a successor that already arrived stays pending
+ */
+void handoff_stop(handoff_t *handoff);
+
+/*
+ * Returns true if a successor is waiting for handoff_send()
+ */
+bool handoff_pending(handoff_t *handoff);
+
+/*
+ * Answer the pending successor: stop taking payments, close the log, write
+ * the store image and pass it with the listen sockets
+ * Call once the workers are joined: nothing may use the store, its cluster
+ * or its log; payments still in flight after a short wait abort the handoff
+ * Returns 0 on success, -1 on error (the successor then starts cold)
+ */
+int handoff_send(handoff_t *handoff, listener_t *listener, idempotency_store_t *store,
+                 wal_t *wal);
+
+#endif /* HANDOFF_H */
@@ -0,0 +1,93 @@
+/*
+ * C-HTTP Payment Server - Streaming Request Body Decoder
+ * Decodes Content-Length and chunked bodies incrementally, handing decoded
+ * bytes to a sink as they arrive so no body is ever buffered whole
+ */
+
+#ifndef HTTP_BODY_H
+#define HTTP_BODY_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "http_parser.h"
+
+/* Longest chunk-size line accepted (size, extensions and CRLF) */
+#define HTTP_BODY_MAX_CHUNK_LINE 256
+
+/*
+ * Body Sink
+ * Receives decoded body bytes in order; data is only valid during the call
+ * Returns 0 to continue, -1 to abort decoding
+ */
+typedef int (*http_body_sink_t)(void *arg, const char *data, size_t length);
+
+/*
+ * Body Feed Result
+ */
+typedef enum {
+    HTTP_BODY_ERROR = -1,       /* Malformed framing or sink abort (see error) */
+    HTTP_BODY_DONE = 0,         /* Whole body decoded */
+    HTTP_BODY_NEED_MORE = 1,    /* Feed more bytes */
+    HTTP_BODY_TOO_LARGE = 2     /* Decoded size exceeds max_size */
+} http_body_result_t;
+
+/*
+ * Decoder state
+ */
+typedef enum {
+    HTTP_BODY_STATE_IDLE = 0,       /* Not started (http_body_init not called) */
+    HTTP_BODY_STATE_DATA,           /* Content-Length bytes or chunk data */
+    HTTP_BODY_STATE_CHUNK_SIZE,     /* Hex digits of a chunk-size line */
+    HTTP_BODY_STATE_CHUNK_EXT,      /* Extensions up to the line's LF */
+    HTTP_BODY_STATE_CHUNK_DATA_END, /* CRLF after chunk data */
+    HTTP_BODY_STATE_TRAILER,        /* Trailer lines until an empty one */
+    HTTP_BODY_STATE_DONE,
+    HTTP_BODY_STATE_FAILED
+} http_body_state_t;
+
+/*
+ * Streaming Body Decoder
+ * Holds only framing state: memory use is independent of body size
+ */
+typedef struct {
+    http_body_state_t state;    /* Where decoding resumes */
+    bool chunked;               /* Transfer-Encoding: chunked (else Content-Length) */
+    size_t remaining;           /* Bytes left in the body or current chunk */
+    size_t received;            /* Decoded bytes delivered to the sink */
+    size_t max_size;            /* Decoded size limit */
+    size_t line_length;         /* Bytes of the current chunk-size/trailer line */
+    bool size_digits;           /* Chunk-size line has at least one digit */
+    http_body_sink_t sink;      /* Decoded byte consumer (NULL = discard) */
+    void *sink_arg;             /* Opaque argument passed to sink */
+    const char *error;          /* Reason for HTTP_BODY_STATE_FAILED */
+    bool too_large;             /* Failed because max_size was exceeded */
+} http_body_t;
+
+/*
+ * Start decoding the body of a parsed request
+ * Framing comes from request (chunked or content_length)
+ * Returns 0 on success, -1 on error
+ */
+int http_body_init(http_body_t *body, const http_request_t *request, size_t max_size,
+                   http_body_sink_t sink, void *sink_arg);
+
+/*
+ * Decode framed bytes
+ * Consumes bytes up to the end of the body (*consumed is set to the count);
+ * anything after it belongs to the next request
+ * Returns HTTP_BODY_DONE, HTTP_BODY_NEED_MORE, HTTP_BODY_TOO_LARGE or HTTP_BODY_ERROR
+ */
+http_body_result_t http_body_feed(http_body_t *body, const char *data, size_t length,
+                                  size_t *consumed);
+
+/*
+ * Check whether http_body_init() was called
+ */
+bool http_body_started(const http_body_t *body);
+
+/*
+ * Check whether the whole body was decoded
+ */
+bool http_body_done(const http_body_t *body);
+
+#endif /* HTTP_BODY_H */
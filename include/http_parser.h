@@ -8,6 +8,7 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 /* Maximum limits for request components */
 #define MAX_HEADERS 32
@@ -42,41 +43,107 @@ typedef enum {
     HTTP_VERSION_1_1
 } http_version_t;
 
+/*
+ * Known Header Enumeration
+ * Headers the server acts on, recognized once while parsing
+ */
+typedef enum {
+    HTTP_HEADER_OTHER = 0,          /* Not a known header */
+    HTTP_HEADER_HOST,
+    HTTP_HEADER_CONNECTION,
+    HTTP_HEADER_CONTENT_LENGTH,
+    HTTP_HEADER_CONTENT_TYPE,
+    HTTP_HEADER_TRANSFER_ENCODING,
+    HTTP_HEADER_EXPECT,
+    HTTP_HEADER_ACCEPT_ENCODING,
+    HTTP_HEADER_IF_NONE_MATCH,
+    HTTP_HEADER_IF_MODIFIED_SINCE,
+    HTTP_HEADER_X_IDEMPOTENCY_KEY,
+    HTTP_HEADER_KNOWN_COUNT         /* Number of slots in the known header table */
+} http_header_id_t;
+
+/*
+ * Incremental Parse Result
+ * Returned by http_parse_request() after each batch of bytes
+ */
+typedef enum {
+    HTTP_PARSE_ERROR = -1,      /* Malformed request (see parse_error) */
+    HTTP_PARSE_DONE = 0,        /* Request line and headers complete */
+    HTTP_PARSE_NEED_MORE = 1    /* Feed more bytes and call again */
+} http_parse_result_t;
+
+/*
+ * Incremental Parse State
+ * Where the parser resumes on the next call
+ */
+typedef enum {
+    HTTP_PARSE_STATE_REQUEST_LINE = 0,
+    HTTP_PARSE_STATE_HEADERS,
+    HTTP_PARSE_STATE_COMPLETE,
+    HTTP_PARSE_STATE_FAILED
+} http_parse_state_t;
+
+/*
+ * String Slice
+ * Non-owning (pointer, length) view into the connection's read buffer
+ * Not null-terminated; valid only while the buffer is unchanged
+ */
+typedef struct {
+    const char *ptr;
+    size_t len;
+} http_str_t;
+
 /*
  * HTTP Header Structure
  * Represents a single HTTP header name-value pair
- * Uses fixed-size arrays for stack allocation
+ * Both parts are trimmed slices into the request buffer
  */
 typedef struct {
-    char name[MAX_HEADER_NAME_LENGTH];
-    char value[MAX_HEADER_VALUE_LENGTH];
+    http_str_t name;
+    http_str_t value;
+    http_header_id_t id;    /* Known header ID, HTTP_HEADER_OTHER if none */
 } http_header_t;
 
 /*
  * HTTP Request Structure
  * Contains all parsed information from an HTTP request
  * Supports POST bodies and idempotency keys for distributed systems
+ * Strings are slices into the buffer that was parsed, so the struct stays
+ * small (about 1KB) and parsing performs no copies or heap allocation
  */
 typedef struct {
     /* Request Line */
     http_method_t method;
-    char uri[MAX_URI_LENGTH];
+    http_str_t uri;
     http_version_t version;
 
-    /* Headers (fixed array for stack allocation) */
+    /* Headers (fixed array of slices) */
     http_header_t headers[MAX_HEADERS];
     int header_count;
 
-    /* Request Body (heap-allocated for POST/PUT) */
-    char *body;
+    /* First occurrence of each known header: index into headers + 1, 0 if absent */
+    uint8_t known_headers[HTTP_HEADER_KNOWN_COUNT];
+
+    /* Decoded body bytes (the body itself is streamed, see http_body.h) */
     size_t body_length;
 
-    /* Content-Length (extracted from header) */
+    /* Body framing (extracted from headers) */
     size_t content_length;
+    bool has_content_length;
+    bool chunked;                       /* Transfer-Encoding: chunked */
+    bool transfer_encoding_unsupported; /* Any other Transfer-Encoding */
+    bool expect_continue;               /* Expect: 100-continue */
 
     /* Idempotency Key (extracted from X-Idempotency-Key header) */
-    char idempotency_key[MAX_IDEMPOTENCY_KEY_LENGTH];
+    http_str_t idempotency_key;
     bool has_idempotency_key;
+
+    /* Incremental parser position (see http_parse_request) */
+    http_parse_state_t parse_state;
+    size_t parse_offset;        /* Start of the first line not yet parsed */
+    size_t header_length;       /* Bytes up to and including the blank line */
+    const char *parse_error;    /* Reason for HTTP_PARSE_STATE_FAILED */
+    uint64_t parse_ns;          /* Time spent in the parser so far (metrics) */
 } http_request_t;
 
 /*
@@ -88,41 +155,72 @@ int http_request_init(http_request_t *request);
 
 /*
  * Free an HTTP request structure
- * Deallocates dynamically allocated memory (body, etc.)
+ * Resets body and header bookkeeping
  */
 void http_request_free(http_request_t *request);
 
 /*
- * Parse complete HTTP request from raw data
- * Returns 0 on success, -1 on error
+ * Parse HTTP request line and headers incrementally
+ * Call again with the same buffer (grown by newly received bytes) until
+ * the result is not HTTP_PARSE_NEED_MORE. Each call resumes at the first
+ * unparsed line, so bytes are never rescanned. Once done, header_length
+ * marks where the body starts.
+ * Request must be initialized with http_request_init() first.
+ * Returns HTTP_PARSE_DONE, HTTP_PARSE_NEED_MORE or HTTP_PARSE_ERROR
+ */
+http_parse_result_t http_parse_request(http_request_t *request, const char *raw_request,
+                                       size_t length);
+
+/*
+ * Re-point slices after the parsed bytes were copied to a new buffer
+ * Call before freeing old_base
  */
-int http_parse_request(http_request_t *request, const char *raw_request, size_t length);
+void http_request_rebase(http_request_t *request, const char *old_base, const char *new_base);
 
 /*
  * Parse request line (method, URI, version)
  * Example: "POST /api/payment HTTP/1.1"
+ * line need not be null-terminated; the URI slice points into it
  * Returns 0 on success, -1 on error
  */
-int parse_request_line(http_request_t *request, const char *line);
+int parse_request_line(http_request_t *request, const char *line, size_t length);
 
 /*
- * Parse HTTP headers section
+ * Parse HTTP headers section (the lines between request line and blank line)
+ * header_section need not be null-terminated; header slices point into it
  * Returns 0 on success, -1 on error
  */
-int parse_headers(http_request_t *request, const char *header_section);
+int parse_headers(http_request_t *request, const char *header_section, size_t length);
 
 /*
- * Parse HTTP request body (POST/PUT support)
- * Reads Content-Length bytes from socket file descriptor
- * Returns 0 on success, -1 on error
+ * Get header value by name (case-insensitive)
+ * Returns pointer to the value slice, or NULL if not found
  */
-int parse_request_body(http_request_t *request, int socket_fd);
+const http_str_t *http_get_header(const http_request_t *request, const char *name);
 
 /*
- * Get header value by name (case-insensitive)
- * Returns pointer to value string, or NULL if not found
+ * Get a known header's value in O(1)
+ * Returns pointer to the value slice, or NULL if not present
+ */
+const http_str_t *http_get_known_header(const http_request_t *request, http_header_id_t id);
+
+/*
+ * Map a header name to its known header ID (case-insensitive)
+ * Returns HTTP_HEADER_OTHER if the name is not a known header
+ */
+http_header_id_t http_header_lookup(const char *name, size_t length);
+
+/*
+ * Compare a slice with a null-terminated string (case-insensitive)
+ */
+bool http_str_case_equals(const http_str_t *str, const char *literal);
+
+/*
+ * Check whether the client wants the connection kept open
+ * HTTP/1.1 defaults to keep-alive unless "Connection: close" is sent;
+ * HTTP/1.0 requires an explicit "Connection: keep-alive"
  */
-const char *http_get_header(const http_request_t *request, const char *name);
+bool http_request_keep_alive(const http_request_t *request);
 
 /*
  * Convert HTTP method enum to string
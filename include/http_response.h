@@ -7,31 +7,123 @@
 #define HTTP_RESPONSE_H
 
 #include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "arena.h"
 
 /* HTTP status codes */
 #define HTTP_OK                  200
+#define HTTP_NOT_MODIFIED        304
 #define HTTP_BAD_REQUEST         400
 #define HTTP_NOT_FOUND           404
+#define HTTP_METHOD_NOT_ALLOWED  405
 #define HTTP_CONFLICT            409
 #define HTTP_PAYLOAD_TOO_LARGE   413
 #define HTTP_UNPROCESSABLE       422
 #define HTTP_INTERNAL_ERROR      500
 #define HTTP_NOT_IMPLEMENTED     501
+#define HTTP_SERVICE_UNAVAILABLE 503
 
-/* HTTP response structure */
+/* Initial response header array capacity */
+#define HTTP_RESPONSE_INITIAL_HEADERS 8
+
+/* Most pre-rendered header blocks per response */
+#define HTTP_RESPONSE_MAX_BLOCKS 4
+
+/* Length of the rendered "Date: <IMF-fixdate>\r\n" line */
+#define HTTP_DATE_LINE_LENGTH (sizeof("Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n") - 1)
+
+/*
+ * Pre-rendered header line(s), "Name: value\r\n", copied verbatim by the
+ * renderer; build constant ones with HTTP_HEADER_BLOCK()
+ */
+typedef struct {
+    const char *data;           /* Rendered bytes (CRLF-terminated) */
+    size_t length;              /* Bytes in data */
+} http_header_block_t;
+
+#define HTTP_HEADER_BLOCK(name, value) \
+    { name ": " value "\r\n", sizeof(name ": " value "\r\n") - 1 }
+
+/* Content-Type: application/json */
+extern const http_header_block_t HTTP_BLOCK_JSON;
+
+/*
+ * Borrowed Body
+ * Bytes or a file region owned elsewhere (e.g. a file cache entry) that
+ * the response references in place instead of copying into the arena.
+ * release(arg) runs exactly once, when the output no longer needs them
+ */
+typedef struct {
+    int fd;                     /* File sent with sendfile() after the iovec (-1 = none) */
+    off_t offset;               /* Next file byte to send */
+    size_t length;              /* File bytes left to send */
+    void (*release)(void *arg); /* NULL when nothing is borrowed */
+    void *arg;
+} http_borrow_t;
+
+/*
+ * HTTP response structure
+ * Headers, body and rendered output live in the calling thread's arena
+ * and stay valid until that arena is reset
+ */
 typedef struct {
     int status_code;            /* HTTP status code */
-    char *status_message;       /* Status message */
-    char **header_names;        /* Header names */
-    char **header_values;       /* Header values */
+    const char *status_message; /* Status message (static string) */
+    const char **header_names;  /* Header names */
+    const char **header_values; /* Header values */
     size_t header_count;        /* Number of headers */
     size_t header_capacity;     /* Header array capacity */
+    const http_header_block_t *blocks[HTTP_RESPONSE_MAX_BLOCKS];   /* Pre-rendered headers */
+    size_t block_count;         /* Number of blocks */
     char *body;                 /* Response body */
     size_t body_length;         /* Body length */
+    http_borrow_t borrow;       /* Borrowed body bytes or file (moves to the output) */
+    bool omit_body;             /* HEAD: headers describe the body, none is sent */
+    bool keep_alive;            /* Connection stays open after this response */
+    arena_t *arena;             /* Backing memory */
 } http_response_t;
 
+/* Segments of a rendered response: status line, header block, body */
+#define HTTP_OUTPUT_MAX_IOV 3
+
+/*
+ * Rendered response
+ * Points at the status line, the header block and the body in place;
+ * nothing is copied into a contiguous buffer. A file body follows the
+ * segments and is sent with sendfile()
+ */
+typedef struct {
+    struct iovec iov[HTTP_OUTPUT_MAX_IOV];
+    int iov_count;              /* Segments in use */
+    int iov_index;              /* First segment with unsent bytes */
+    size_t length;              /* Total bytes across all segments */
+    size_t body_length;         /* Bytes of the body segment */
+    size_t sent;                /* Bytes already accepted by the kernel */
+    http_borrow_t borrow;       /* File region sent after the iovec; released when done */
+    char date[HTTP_DATE_LINE_LENGTH];   /* Date line copy (canned responses) */
+} http_output_t;
+
+/*
+ * Canned error response, serialized once at startup
+ * Everything but the Date line is pre-rendered: a prefix (status line,
+ * Server) and a suffix per Connection value (remaining headers and body)
+ */
+typedef struct {
+    int status_code;            /* HTTP status code */
+    const char *message;        /* Error message in the JSON body */
+    const char *headers;        /* Extra header lines (NULL for none) */
+    char *prefix;               /* Status line and Server header */
+    size_t prefix_length;
+    char *suffix[2];            /* [keep_alive]: headers after Date, blank line, body */
+    size_t suffix_length[2];
+    size_t body_length;         /* Bytes of body at the end of each suffix */
+} http_canned_t;
+
 /*
  * Initialize HTTP response with status code
+ * Allocations use the calling thread's arena (see arena_thread())
  * Returns 0 on success, -1 on error
  */
 int http_response_init(http_response_t *response, int status_code);
@@ -42,6 +134,23 @@ int http_response_init(http_response_t *response, int status_code);
  */
 int http_response_add_header(http_response_t *response, const char *name, const char *value);
 
+/*
+ * Add a pre-rendered header block (must outlive the rendered output)
+ * Returns 0 on success, -1 on error
+ */
+int http_response_add_block(http_response_t *response, const http_header_block_t *block);
+
+/*
+ * Render "name: value\r\n" once into a heap block for reuse by every response
+ * Returns 0 on success, -1 on error
+ */
+int http_header_block_init(http_header_block_t *block, const char *name, const char *value);
+
+/*
+ * Free a block from http_header_block_init()
+ */
+void http_header_block_destroy(http_header_block_t *block);
+
 /*
  * Set response body
  * Returns 0 on success, -1 on error
@@ -49,10 +158,68 @@ int http_response_add_header(http_response_t *response, const char *name, const
 int http_response_set_body(http_response_t *response, const char *body, size_t length);
 
 /*
- * Serialize response to string (ready to send)
- * Returns serialized response string (caller must free), NULL on error
+ * Reference body bytes in place (no copy)
+ * borrow.release (see http_response_set_borrow) must keep them alive
+ * Returns 0 on success, -1 on error
+ */
+int http_response_set_body_ref(http_response_t *response, const char *body, size_t length);
+
+/*
+ * Hand the response something it borrows: a file region to send with
+ * sendfile() (fd >= 0) and/or the owner of bytes set with
+ * http_response_set_body_ref(). Released with the output, or by
+ * http_response_free() if the response is never rendered
+ */
+void http_response_set_borrow(http_response_t *response, const http_borrow_t *borrow);
+
+/*
+ * Send headers only (HEAD); Content-Length still reports the body size
+ */
+void http_response_omit_body(http_response_t *response);
+
+/*
+ * Set whether the connection persists after this response
+ * Controls the Connection header emitted by the renderer (default: close)
+ */
+void http_response_set_keep_alive(http_response_t *response, bool keep_alive);
+
+/*
+ * Render response as an iovec (ready for writev/sendmsg)
+ * Segments reference the static status line, a header block in the
+ * response arena and the body; they stay valid until the arena is reset
+ * The header block is assembled with memcpy from pre-rendered pieces
+ * Returns 0 on success, -1 on error
+ */
+int http_response_render(http_response_t *response, http_output_t *output);
+
+/*
+ * Start the thread that re-renders the shared Date line once a second
+ * Without it the renderer refreshes the line itself when the second changes
+ * Returns 0 on success, -1 on error
+ */
+int http_date_start(void);
+
+/*
+ * Stop the Date refresh thread
  */
-char *http_response_serialize(http_response_t *response, size_t *out_length);
+void http_date_stop(void);
+
+/*
+ * Get the current "Date: ...\r\n" line (HTTP_DATE_LINE_LENGTH bytes)
+ * The pointer stays valid for several seconds; copy it rather than keep it
+ */
+const char *http_date_line(void);
+
+/*
+ * Advance output past bytes the kernel accepted (partial writes)
+ */
+void http_output_advance(http_output_t *output, size_t bytes);
+
+/*
+ * Release what the output borrows (call once it is sent or abandoned)
+ * Safe to call more than once
+ */
+void http_output_release(http_output_t *output);
 
 /*
  * Get status message for status code
@@ -65,8 +232,30 @@ const char *status_code_to_message(int status_code);
  */
 int http_response_create_error(http_response_t *response, int status_code, const char *error_message);
 
+/*
+ * Build the canned error table (also done on first lookup)
+ * Returns 0 on success, -1 on error
+ */
+int http_canned_init(void);
+
+/*
+ * Find the canned response for (status_code, error_message)
+ * Returns NULL if the pair is not in the table
+ */
+const http_canned_t *http_canned_find(int status_code, const char *error_message);
+
+/*
+ * Point output at a canned response, copying in the current Date line
+ * omit_body: answer to HEAD, headers only (Content-Length still describes the body)
+ * Allocates nothing; output stays valid as long as output itself
+ */
+void http_canned_render(const http_canned_t *canned, bool keep_alive, bool omit_body,
+                        http_output_t *output);
+
 /*
  * Free HTTP response resources
+ * Detaches the response; its memory is reclaimed when the arena is reset
+ * Anything still borrowed (not handed to an output) is released
  */
 void http_response_free(http_response_t *response);
 
@@ -0,0 +1,51 @@
+/*
+ * C-HTTP Payment Server - Delimiter Scanning
+ * Vectorized search for CR/LF/colon/space in request bytes
+ */
+
+#ifndef HTTP_SCAN_H
+#define HTTP_SCAN_H
+
+#include <stddef.h>
+
+/*
+ * Scan Kernel Enumeration
+ * Implementations of the delimiter search, fastest last
+ */
+typedef enum {
+    HTTP_SCAN_SCALAR = 0,   /* One byte at a time (portable fallback) */
+    HTTP_SCAN_SSE2,         /* 16 bytes per step (x86-64 baseline) */
+    HTTP_SCAN_AVX2,         /* 32 bytes per step (runtime-detected) */
+    HTTP_SCAN_NEON          /* 16 bytes per step (AArch64 baseline) */
+} http_scan_kernel_t;
+
+/*
+ * Select the fastest kernel the CPU supports
+ * Call once at startup before worker threads run
+ */
+void http_scan_init(void);
+
+/*
+ * Force a specific kernel (benchmarks)
+ * Returns 0 on success, -1 if the kernel is unavailable on this CPU or build
+ */
+int http_scan_select(http_scan_kernel_t kernel);
+
+/*
+ * Get the kernel currently in use
+ */
+http_scan_kernel_t http_scan_active(void);
+
+/*
+ * Convert kernel enum to string
+ */
+const char *http_scan_kernel_name(http_scan_kernel_t kernel);
+
+/*
+ * Find the first byte equal to a or b
+ * Pass the same byte twice to search for one delimiter
+ * Returns its offset, or length if neither occurs
+ */
+size_t http_scan_find2(const char *data, size_t length, char a, char b);
+
+#endif /* HTTP_SCAN_H */
@@ -0,0 +1,264 @@
+/*
+ * C-HTTP Payment Server - Idempotency Store
+ * Sharded in-memory cache of responses keyed by X-Idempotency-Key
+ */
+
+#ifndef IDEMPOTENCY_H
+#define IDEMPOTENCY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+/* Store defaults */
+#define IDEMPOTENCY_DEFAULT_SHARDS 64
+#define IDEMPOTENCY_DEFAULT_TTL_SEC (24 * 60 * 60)
+#define IDEMPOTENCY_DEFAULT_MAX_BYTES ((size_t)64 * 1024 * 1024)
+#define IDEMPOTENCY_DEFAULT_WAIT_MS 0
+
+/* Timer wheel: one slot per second, entries further out wrap around */
+#define IDEMPOTENCY_WHEEL_SLOTS 512
+
+/* Initial hash buckets per shard (grows by doubling) */
+#define IDEMPOTENCY_INITIAL_BUCKETS 64
+
+/* Maximum stored Content-Type length */
+#define IDEMPOTENCY_MAX_CONTENT_TYPE 64
+
+/* Store settings */
+typedef struct {
+    int num_shards;         /* Number of lock stripes (rounded up to a power of two) */
+    int ttl_sec;            /* Seconds a completed response stays replayable */
+    size_t max_bytes;       /* Memory budget across all shards */
+    int wait_ms;            /* How long a duplicate waits for an in-flight original (0 = 409) */
+} idempotency_config_t;
+
+/*
+ * Cached Response
+ * Immutable once stored; shared by the store and replaying workers
+ */
+typedef struct {
+    int refcount;           /* Owners (store + readers), updated atomically */
+    int status_code;        /* HTTP status of the original response */
+    char content_type[IDEMPOTENCY_MAX_CONTENT_TYPE];
+    size_t body_length;
+    char body[];            /* Response body (null-terminated) */
+} idempotency_response_t;
+
+/* Entry lifecycle */
+typedef enum {
+    IDEMPOTENCY_ENTRY_IN_FLIGHT = 0,    /* Original request still being processed */
+    IDEMPOTENCY_ENTRY_COMPLETE          /* Response cached, replayable until expiry */
+} idempotency_entry_state_t;
+
+/* Single cached key (owned by its shard) */
+typedef struct idempotency_entry {
+    uint64_t hash;          /* Full key hash */
+    char *key;              /* Idempotency key (null-terminated) */
+    size_t key_length;
+    uint64_t digest;        /* Digest of the original request */
+    idempotency_entry_state_t state;
+    idempotency_response_t *response;   /* Set once complete */
+    size_t charge;          /* Bytes charged to the shard budget */
+    uint64_t expire_tick;   /* Store tick (seconds) when the entry expires */
+
+    struct idempotency_entry *hash_next;    /* Bucket chain */
+    struct idempotency_entry *lru_prev;     /* LRU list (complete entries only) */
+    struct idempotency_entry *lru_next;
+    struct idempotency_entry *wheel_prev;   /* Timer wheel slot (complete entries only) */
+    struct idempotency_entry *wheel_next;
+} idempotency_entry_t;
+
+/*
+ * Store Shard
+ * Each shard has its own lock, hash table, LRU list, timer wheel and budget
+ * so requests for different keys rarely contend
+ */
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t completed;       /* Signaled when an in-flight entry resolves */
+
+    idempotency_entry_t **buckets;
+    size_t bucket_count;            /* Power of two */
+    size_t entry_count;
+
+    idempotency_entry_t *lru_head;  /* Most recently used */
+    idempotency_entry_t *lru_tail;  /* Eviction candidate */
+
+    idempotency_entry_t *wheel[IDEMPOTENCY_WHEEL_SLOTS];
+    uint64_t reaped_tick;           /* Last tick the reaper processed */
+
+    size_t bytes_used;
+    size_t bytes_limit;
+} idempotency_shard_t;
+
+struct wal;
+struct cluster;
+
+/* Idempotency store */
+typedef struct {
+    idempotency_shard_t *shards;
+    int num_shards;
+    int shard_shift;        /* Hash bits used to pick a shard */
+    int ttl_sec;
+    int wait_ms;
+    uint64_t epoch_sec;     /* Monotonic time at init; ticks count from here */
+    struct wal *wal;        /* Write-ahead log (NULL = responses are not durable) */
+    struct cluster *cluster;    /* Key owners across nodes (NULL = every key is local) */
+
+    /* Expiry thread */
+    pthread_t reaper;
+    bool reaper_started;
+    bool shutdown;
+    pthread_mutex_t reaper_lock;
+    pthread_cond_t reaper_cond;
+} idempotency_store_t;
+
+/* Outcome of idempotency_begin() */
+typedef enum {
+    IDEMPOTENCY_PROCEED = 0,    /* New key reserved: process, then complete or abort */
+    IDEMPOTENCY_REPLAY,         /* Cached response returned (release when done) */
+    IDEMPOTENCY_IN_FLIGHT,      /* Original still running (respond 409) */
+    IDEMPOTENCY_MISMATCH,       /* Key reused with a different request (respond 422) */
+    IDEMPOTENCY_ERROR,          /* Out of memory */
+    IDEMPOTENCY_UNAVAILABLE     /* Key owned by another node that did not answer (respond 503) */
+} idempotency_result_t;
+
+/* idempotency_complete(): the write-ahead log failed, so the response was not kept */
+#define IDEMPOTENCY_NOT_DURABLE (-2)
+
+/*
+ * Fill settings with built-in defaults
+ */
+void idempotency_config_init_defaults(idempotency_config_t *config);
+
+/*
+ * Initialize store
+ * Returns 0 on success, -1 on error
+ */
+int idempotency_store_init(idempotency_store_t *store, const idempotency_config_t *config);
+
+/*
+ * Start the background thread that expires entries
+ * Returns 0 on success, -1 on error
+ */
+int idempotency_store_start(idempotency_store_t *store);
+
+/*
+ * Stop the expiry thread and free all entries
+ */
+void idempotency_store_destroy(idempotency_store_t *store);
+
+/*
+ * Log every completed response to wal before it becomes replayable
+ * Call before serving traffic (NULL turns logging off)
+ */
+void idempotency_store_set_wal(idempotency_store_t *store, struct wal *wal);
+
+/*
+ * Route keys owned by other nodes through cluster (see cluster_begin())
+ * Call before serving traffic (NULL keeps every key local)
+ */
+void idempotency_store_set_cluster(idempotency_store_t *store, struct cluster *cluster);
+
+/*
+ * Visitor for idempotency_store_visit()
+ * ttl_sec is the time the response has left; non-zero stops the visit
+ */
+typedef int (*idempotency_visit_fn)(void *arg, const idempotency_entry_t *entry, int ttl_sec);
+
+/*
+ * Visit every replayable response, one shard locked at a time
+ * Returns 0 once every entry was visited, otherwise what fn returned
+ */
+int idempotency_store_visit(idempotency_store_t *store, idempotency_visit_fn fn, void *arg);
+
+/*
+ * Write every replayable response to fd as a store image: one file of
+ * position-independent records (lengths, no pointers), grouped by shard,
+ * that a successor process maps and loads with idempotency_store_import()
+ * Returns the number of responses written, -1 on error
+ */
+long idempotency_store_export(idempotency_store_t *store, int fd);
+
+/*
+ * Load a store image from fd; the image is mapped rather than read, hash
+ * tables are sized once, and each shard is locked once per run of records
+ * Returns the number of responses restored, -1 if fd holds no valid image
+ */
+long idempotency_store_import(idempotency_store_t *store, int fd);
+
+/*
+ * Install a completed response recovered from the log
+ * Replaces any entry for the key; not logged again
+ * Returns 0 on success, -1 if it could not be cached
+ */
+int idempotency_restore(idempotency_store_t *store, const char *key, size_t key_length,
+                        uint64_t digest, int status_code, const char *content_type,
+                        const char *body, size_t body_length, int ttl_sec);
+
+/*
+ * Look up a key and reserve it if unseen
+ * digest identifies the request payload (see idempotency_digest)
+ * On IDEMPOTENCY_REPLAY *cached holds a reference the caller must release
+ */
+idempotency_result_t idempotency_begin(idempotency_store_t *store, const char *key,
+                                       size_t key_length, uint64_t digest,
+                                       idempotency_response_t **cached);
+
+/*
+ * idempotency_begin() that never waits for an in-flight original: a
+ * duplicate gets IDEMPOTENCY_IN_FLIGHT at once, whatever wait_ms says
+ */
+idempotency_result_t idempotency_try_begin(idempotency_store_t *store, const char *key,
+                                           size_t key_length, uint64_t digest,
+                                           idempotency_response_t **cached);
+
+/*
+ * Look up a key without reserving it
+ * Returns 1 if its response is cached (*cached holds a reference the
+ * caller must release), 0 if the original request is still running,
+ * -1 if the key is unknown or expired
+ */
+int idempotency_peek(idempotency_store_t *store, const char *key, size_t key_length,
+                     idempotency_response_t **cached);
+
+/*
+ * Store the response for a key reserved by idempotency_begin()
+ * With a write-ahead log, returns only once the response is durable
+ * (duplicates keep waiting until then); wakes duplicates waiting on the key
+ * Returns 0 on success, -1 if the response could not be cached,
+ * IDEMPOTENCY_NOT_DURABLE if the log failed before it was on disk (nothing
+ * is cached, so the client must be told to retry rather than succeed)
+ * (the reservation is dropped whenever it is not cached)
+ */
+int idempotency_complete(idempotency_store_t *store, const char *key, size_t key_length,
+                         int status_code, const char *content_type,
+                         const char *body, size_t body_length);
+
+/*
+ * Drop the reservation for a key whose request failed
+ * The next request with the key is processed again
+ */
+void idempotency_abort(idempotency_store_t *store, const char *key, size_t key_length);
+
+/*
+ * Build a cached response outside the store (refcount 1)
+ * Returns the response, NULL if out of memory
+ */
+idempotency_response_t *idempotency_response_create(int status_code, const char *content_type,
+                                                    const char *body, size_t body_length);
+
+/*
+ * Release a reference returned by idempotency_begin()
+ */
+void idempotency_response_release(idempotency_response_t *response);
+
+/*
+ * Compute a request digest (FNV-1a), chained through seed
+ * Start with seed 0
+ */
+uint64_t idempotency_digest(uint64_t seed, const void *data, size_t length);
+
+#endif /* IDEMPOTENCY_H */
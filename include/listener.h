@@ -7,13 +7,40 @@
 #define LISTENER_H
 
 #include <stdint.h>
+#include <stdbool.h>
+
+struct uring;
+
+/*
+ * Connection steering across SO_REUSEPORT sockets
+ * Without steering the kernel hashes each connection's 4-tuple
+ */
+typedef enum {
+    LISTENER_STEER_NONE = 0,    /* Kernel 4-tuple hash */
+    LISTENER_STEER_CPU,         /* SO_INCOMING_CPU: prefer the socket bound to the RX CPU */
+    LISTENER_STEER_BPF          /* Reuseport CBPF: socket index = RX CPU % sockets */
+} listener_steer_t;
 
 /* Listener configuration */
 typedef struct {
     uint16_t port;          /* Port to bind to (default: 8080) */
     int backlog;            /* Connection backlog (default: 128) */
-    int socket_fd;          /* Listener socket file descriptor */
+    int socket_fd;          /* Listener socket file descriptor (socket_fds[0]) */
     int shutdown_pipe[2];   /* Pipe for shutdown signaling (self-pipe trick) */
+
+    /* SO_REUSEPORT group (num_sockets == 1 without reuseport) */
+    bool reuseport;         /* Open num_sockets sockets with SO_REUSEPORT */
+    int num_sockets;        /* Sockets bound to the port */
+    int *socket_fds;        /* All listen sockets */
+    listener_steer_t steer; /* Connection steering across the group */
+
+    /* Graceful drain (set by listener_drain before the shutdown signal) */
+    bool draining;          /* Stop accepting but finish open connections */
+    int drain_timeout_ms;   /* Longest open connections are waited for */
+
+    struct uring *ring;     /* io_uring accepting for listener_accept() (NULL = select()) */
+    bool ring_stopping;     /* Shutdown signaled: the accept is being cancelled */
+    bool ring_accepting;    /* The multishot accept may still deliver sockets */
 } listener_t;
 
 /*
@@ -28,9 +55,44 @@ int listener_init(listener_t *listener, uint16_t port, int backlog);
  */
 int listener_start(listener_t *listener);
 
+/*
+ * Take over already listening sockets (inherited from a predecessor)
+ * instead of binding new ones in listener_start(); the listener owns and
+ * eventually closes them
+ * Returns 0 on success, -1 on error
+ */
+int listener_adopt(listener_t *listener, const int *fds, int num_fds);
+
+/*
+ * Bind num_sockets SO_REUSEPORT sockets instead of one
+ * Must be called before listener_start(); each socket is meant to be owned
+ * by one event loop so the kernel spreads connections across them
+ * Returns 0 on success, -1 on error
+ */
+int listener_set_reuseport(listener_t *listener, int num_sockets, listener_steer_t steer);
+
+/*
+ * Tie reuseport socket index to cpu for SO_INCOMING_CPU steering
+ * Call from the thread pinned to cpu; no-op for other steering modes
+ * Returns 0 on success, -1 on error
+ */
+int listener_steer_socket(listener_t *listener, int index, int cpu);
+
+/*
+ * Convert steering enum to string
+ */
+const char *listener_steer_to_string(listener_steer_t steer);
+
+/*
+ * Accept through an io_uring multishot accept instead of select() + accept()
+ * Call after listener_start() or listener_adopt(); only listener_accept() uses it
+ * Returns 0 on success, -1 if io_uring is unavailable (select() stays in use)
+ */
+int listener_use_uring(listener_t *listener);
+
 /*
  * Accept incoming connection
- * Returns client socket FD on success, -1 on error
+ * Returns client socket FD on success, -1 on error, -2 on shutdown
  */
 int listener_accept(listener_t *listener);
 
@@ -40,6 +102,14 @@ int listener_accept(listener_t *listener);
  */
 int listener_shutdown(listener_t *listener);
 
+/*
+ * Signal listener to stop accepting while open connections finish
+ * The accept loop returns as on shutdown; event loops keep serving their
+ * connections (without keep-alive) for up to timeout_ms, then stop
+ * Returns 0 on success, -1 on error
+ */
+int listener_drain(listener_t *listener, int timeout_ms);
+
 /*
  * Close listener socket and cleanup
  */
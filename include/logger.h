@@ -7,6 +7,18 @@
 #define LOGGER_H
 
 #include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Longest formatted line (timestamp, level and message); longer lines are truncated */
+#define LOGGER_LINE_MAX 1024
+
+/* Per-thread ring size for the async backend (power of two) */
+#define LOGGER_RING_SIZE (64 * 1024)
+
+/* How often the flusher drains rings when nobody wakes it */
+#define LOGGER_FLUSH_INTERVAL_MS 10
 
 /* Log levels */
 typedef enum {
@@ -16,12 +28,28 @@ typedef enum {
     LOG_ERROR
 } log_level_t;
 
+/* What a thread does when its async ring is full */
+typedef enum {
+    LOG_OVERFLOW_DROP = 0,      /* Discard the line and count it */
+    LOG_OVERFLOW_BLOCK          /* Wait for the flusher to make room */
+} log_overflow_t;
+
+/* Output streams; each has its own fd and per-thread rings */
+typedef enum {
+    LOG_SINK_TEXT = 0,          /* Formatted lines (stderr) */
+    LOG_SINK_BINARY,            /* Pre-encoded records (e.g. the audit log) */
+    LOG_SINK_COUNT
+} log_sink_t;
+
 /* Logger configuration */
 typedef struct {
     log_level_t min_level;      /* Minimum log level to display */
     pthread_mutex_t mutex;      /* Mutex for thread-safe logging */
 } logger_t;
 
+/* Global logger instance (read by the inline level check) */
+extern logger_t g_logger;
+
 /*
  * Initialize logger with minimum log level
  * Returns 0 on success, -1 on error
@@ -30,23 +58,66 @@ int logger_init(logger_t *logger, log_level_t min_level);
 
 /*
  * Log a message with specified level
- * Thread-safe
+ * Thread-safe; never blocks on I/O once the async backend is running
  */
-void log_message(logger_t *logger, log_level_t level, const char *format, ...);
+void log_message(logger_t *logger, log_level_t level, const char *format, ...)
+    __attribute__((format(printf, 3, 4)));
+
+/*
+ * Lowest level compiled in; calls below it are removed at build time
+ * (release builds use -DLOG_COMPILE_LEVEL=LOG_WARN)
+ */
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_DEBUG
+#endif
+
+/*
+ * Check whether a message at level would be logged
+ */
+static inline bool log_enabled(const logger_t *logger, log_level_t level) {
+    return level >= (logger != NULL ? logger : &g_logger)->min_level;
+}
 
 /*
  * Convenience macros for logging
+ * Levels below LOG_COMPILE_LEVEL fold to nothing; filtered-out levels skip
+ * the call and argument evaluation entirely
  */
-#define LOG_DEBUG(logger, ...) log_message(logger, LOG_DEBUG, __VA_ARGS__)
-#define LOG_INFO(logger, ...)  log_message(logger, LOG_INFO, __VA_ARGS__)
-#define LOG_WARN(logger, ...)  log_message(logger, LOG_WARN, __VA_ARGS__)
-#define LOG_ERROR(logger, ...) log_message(logger, LOG_ERROR, __VA_ARGS__)
+#define LOG_AT(logger, level, ...) \
+    do { \
+        if ((level) >= LOG_COMPILE_LEVEL && log_enabled(logger, level)) { \
+            log_message(logger, level, __VA_ARGS__); \
+        } \
+    } while (0)
+
+#define LOG_DEBUG(logger, ...) LOG_AT(logger, LOG_DEBUG, __VA_ARGS__)
+#define LOG_INFO(logger, ...)  LOG_AT(logger, LOG_INFO, __VA_ARGS__)
+#define LOG_WARN(logger, ...)  LOG_AT(logger, LOG_WARN, __VA_ARGS__)
+#define LOG_ERROR(logger, ...) LOG_AT(logger, LOG_ERROR, __VA_ARGS__)
+
+/*
+ * Queue pre-encoded bytes (one whole record, at most LOGGER_LINE_MAX) for a sink
+ * Dropped if the sink has no fd
+ */
+void log_write(log_sink_t sink, const void *data, size_t length);
+
+/*
+ * Set the fd a sink writes to (-1 discards its output)
+ * Text defaults to stderr, binary to -1; the caller keeps ownership of fd
+ */
+void logger_set_sink_fd(log_sink_t sink, int fd);
 
 /*
  * Get log level name as string
  */
 const char *log_level_to_string(log_level_t level);
 
+/*
+ * Parse a log level name (debug, info, warn, error)
+ * Returns 0 on success, -1 if the name is unknown
+ */
+int log_level_from_string(const char *name, log_level_t *level);
+
 /*
  * Get global logger instance
  */
@@ -57,6 +128,24 @@ logger_t *logger_get_global(void);
  */
 void logger_set_level(log_level_t level);
 
+/*
+ * Start the async backend: log calls copy formatted lines into a per-thread
+ * ring and a background thread batches them to stderr
+ * Returns 0 on success, -1 on error (logging stays synchronous)
+ */
+int logger_start_async(log_overflow_t overflow);
+
+/*
+ * Stop the async backend after writing out everything queued
+ * Later log calls are written synchronously again
+ */
+void logger_stop_async(void);
+
+/*
+ * Number of lines dropped because a ring was full
+ */
+uint64_t logger_dropped(void);
+
 /*
  * Cleanup logger resources
  */
@@ -0,0 +1,222 @@
+/*
+ * C-HTTP Payment Server - Metrics Registry
+ * Per-thread counters and latency histograms, merged only when scraped
+ * and exposed in the Prometheus text format
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/* Cache line size; each thread's shard starts on its own line */
+#define METRICS_CACHE_LINE 64
+
+/* Prefix of every exported metric name */
+#define METRICS_PREFIX "nanoserve_"
+
+/* Histogram buckets: bucket i holds samples up to 1.024us * 2^i (about 8.6s at the top) */
+#define METRICS_HISTOGRAM_BUCKETS 24
+
+/* Smallest bucket bound, in nanoseconds (a power of two) */
+#define METRICS_HISTOGRAM_BASE_NS 1024
+
+/* Response status codes tracked (100-599) */
+#define METRICS_STATUS_MIN 100
+#define METRICS_STATUS_COUNT 500
+
+/* Most gauges sampled at scrape time */
+#define METRICS_MAX_GAUGES 8
+
+/* Largest rendered exposition */
+#define METRICS_RENDER_MAX (32 * 1024)
+
+/*
+ * Counters: X(id, family, label, help)
+ * Consecutive entries of one family share its HELP/TYPE lines;
+ * label is the "{...}" set, or "" for none
+ */
+#define METRICS_COUNTERS(X) \
+    X(METRIC_CONNECTIONS_ACCEPTED, "connections_accepted_total", "", \
+      "Client connections accepted") \
+    X(METRIC_BYTES_RECEIVED, "received_bytes_total", "", \
+      "Bytes read from client sockets") \
+    X(METRIC_BYTES_SENT, "sent_bytes_total", "", \
+      "Bytes written to client sockets (headers, bodies and files)") \
+    X(METRIC_IDEMPOTENCY_HIT, "idempotency_lookups_total", "{result=\"hit\"}", \
+      "Idempotency key lookups by outcome") \
+    X(METRIC_IDEMPOTENCY_MISS, "idempotency_lookups_total", "{result=\"miss\"}", \
+      "Idempotency key lookups by outcome") \
+    X(METRIC_IDEMPOTENCY_CONFLICT, "idempotency_lookups_total", "{result=\"conflict\"}", \
+      "Idempotency key lookups by outcome") \
+    X(METRIC_SHED_QUEUE_FULL, "shed_total", "{reason=\"queue_full\"}", \
+      "Work answered 503 instead of served, by reason") \
+    X(METRIC_SHED_DEADLINE, "shed_total", "{reason=\"deadline\"}", \
+      "Work answered 503 instead of served, by reason") \
+    X(METRIC_SHED_CODEL, "shed_total", "{reason=\"codel\"}", \
+      "Work answered 503 instead of served, by reason") \
+    X(METRIC_WAL_SYNCS, "wal_syncs_total", "", \
+      "Idempotency log group commits (one fdatasync each)") \
+    X(METRIC_CLUSTER_CALLS_OK, "cluster_calls_total", "{result=\"ok\"}", \
+      "Key operations sent to the owning node, by outcome") \
+    X(METRIC_CLUSTER_CALLS_FAILED, "cluster_calls_total", "{result=\"failed\"}", \
+      "Key operations sent to the owning node, by outcome") \
+    X(METRIC_CLUSTER_BATCHES, "cluster_batches_total", "", \
+      "Writes to cluster peer connections (each carries every frame queued so far)") \
+    X(METRIC_CLUSTER_SERVED, "cluster_served_total", "", \
+      "Key operations run for other nodes")
+
+/* Latency histograms: X(id, family, help) */
+#define METRICS_HISTOGRAMS(X) \
+    X(METRIC_QUEUE_WAIT, "queue_wait_seconds", \
+      "Time connections spent in a task queue before a worker took them") \
+    X(METRIC_PARSE_TIME, "request_parse_seconds", \
+      "Time spent parsing each request line and header block") \
+    X(METRIC_HANDLER_TIME, "handler_seconds", \
+      "Time spent in route handlers") \
+    X(METRIC_WAL_COMMIT, "wal_commit_seconds", \
+      "Time a cached response waited to become durable in the idempotency log") \
+    X(METRIC_CLUSTER_CALL, "cluster_call_seconds", \
+      "Round trip of key operations sent to the owning node")
+
+typedef enum {
+#define METRICS_COUNTER_ENUM(id, family, label, help) id,
+    METRICS_COUNTERS(METRICS_COUNTER_ENUM)
+#undef METRICS_COUNTER_ENUM
+    METRIC_COUNTER_COUNT
+} metric_counter_t;
+
+typedef enum {
+#define METRICS_HISTOGRAM_ENUM(id, family, help) id,
+    METRICS_HISTOGRAMS(METRICS_HISTOGRAM_ENUM)
+#undef METRICS_HISTOGRAM_ENUM
+    METRIC_HISTOGRAM_COUNT
+} metric_histogram_t;
+
+/*
+ * Latency histogram (one thread's samples)
+ * buckets are not cumulative; the last one counts samples above every bound,
+ * and their total is the sample count
+ */
+typedef struct {
+    uint64_t buckets[METRICS_HISTOGRAM_BUCKETS + 1];
+    uint64_t sum_ns;
+} metrics_histogram_t;
+
+/*
+ * Per-thread shard
+ * Only its thread writes it, with plain (relaxed) loads and stores, so
+ * recording costs no locked instruction; scrapers read it with relaxed
+ * loads at the same width and see each value whole
+ */
+typedef struct metrics_shard {
+    _Alignas(METRICS_CACHE_LINE) uint64_t counters[METRIC_COUNTER_COUNT];
+    uint64_t status[METRICS_STATUS_COUNT];      /* Responses by status code */
+    metrics_histogram_t histograms[METRIC_HISTOGRAM_COUNT];
+    struct metrics_shard *next;                 /* Registry list (set once) */
+} metrics_shard_t;
+
+/*
+ * Gauge sampled at scrape time
+ * Returns the current value
+ */
+typedef double (*metrics_gauge_fn)(void *arg);
+
+/* Calling thread's shard, NULL until its first sample */
+extern _Thread_local metrics_shard_t *t_metrics_shard;
+
+/*
+ * Create and register the calling thread's shard (first sample only)
+ * Returns the shard, NULL on error (the sample is dropped)
+ */
+metrics_shard_t *metrics_shard_create(void);
+
+/*
+ * Helper function: Calling thread's shard
+ */
+static inline metrics_shard_t *metrics_shard(void) {
+    metrics_shard_t *shard = t_metrics_shard;
+    return shard != NULL ? shard : metrics_shard_create();
+}
+
+/*
+ * Helper function: Add to a value only this thread writes
+ */
+static inline void metrics_bump(uint64_t *value, uint64_t amount) {
+    __atomic_store_n(value, __atomic_load_n(value, __ATOMIC_RELAXED) + amount,
+                     __ATOMIC_RELAXED);
+}
+
+/*
+ * Current monotonic time in nanoseconds (for latency samples)
+ */
+static inline uint64_t metrics_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Add amount to a counter
+ */
+static inline void metrics_add(metric_counter_t counter, uint64_t amount) {
+    metrics_shard_t *shard = metrics_shard();
+    if (shard != NULL) {
+        metrics_bump(&shard->counters[counter], amount);
+    }
+}
+
+/*
+ * Count one response with the given status code
+ */
+static inline void metrics_status(int status_code) {
+    metrics_shard_t *shard = metrics_shard();
+    unsigned slot = (unsigned)(status_code - METRICS_STATUS_MIN);
+    if (shard != NULL && slot < METRICS_STATUS_COUNT) {
+        metrics_bump(&shard->status[slot], 1);
+    }
+}
+
+/*
+ * Record a latency sample in nanoseconds
+ */
+static inline void metrics_observe(metric_histogram_t histogram, uint64_t ns) {
+    metrics_shard_t *shard = metrics_shard();
+    if (shard == NULL) {
+        return;
+    }
+
+    /* Bucket i holds (BASE << (i - 1), BASE << i]; bucket 0 everything up to BASE */
+    uint64_t scaled = ns > METRICS_HISTOGRAM_BASE_NS ? (ns - 1) / METRICS_HISTOGRAM_BASE_NS : 0;
+    unsigned bucket = scaled == 0 ? 0 : 64u - (unsigned)__builtin_clzll(scaled);
+    if (bucket > METRICS_HISTOGRAM_BUCKETS) {
+        bucket = METRICS_HISTOGRAM_BUCKETS;
+    }
+
+    metrics_histogram_t *h = &shard->histograms[histogram];
+    metrics_bump(&h->buckets[bucket], 1);
+    metrics_bump(&h->sum_ns, ns);
+}
+
+/*
+ * Register a gauge read on every scrape (before serving traffic)
+ * name is appended to METRICS_PREFIX; both strings must stay valid
+ * Returns 0 on success, -1 on error
+ */
+int metrics_register_gauge(const char *name, const char *help, metrics_gauge_fn fn, void *arg);
+
+/*
+ * Merge every shard and render the Prometheus text exposition
+ * Returns the length written to buffer, -1 if it does not fit
+ */
+int metrics_render(char *buffer, size_t size);
+
+/*
+ * Free every shard and forget the gauges
+ * Call once no other thread records samples
+ */
+void metrics_destroy(void);
+
+#endif /* METRICS_H */
@@ -0,0 +1,48 @@
+/*
+ * C-HTTP Payment Server - Overload Protection
+ * Queue-time deadlines and CoDel load shedding for work that waited too
+ * long for a worker; shed work is answered with a canned 503
+ */
+
+#ifndef OVERLOAD_H
+#define OVERLOAD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Shedding is off unless configured */
+#define OVERLOAD_DEFAULT_QUEUE_LIMIT 0
+#define OVERLOAD_DEFAULT_DEADLINE_MS 0
+#define OVERLOAD_DEFAULT_CODEL_TARGET_MS 0
+
+/* CoDel interval: queue wait must stay above target this long before shedding starts */
+#define OVERLOAD_DEFAULT_CODEL_INTERVAL_MS 100
+
+/* Overload settings */
+typedef struct {
+    int queue_limit;        /* Tasks queued per worker queue before new ones get 503 (0 = block) */
+    int deadline_ms;        /* Tasks that waited longer get 503 (0 = off) */
+    int codel_target_ms;    /* CoDel target queue wait (0 = off) */
+    int codel_interval_ms;  /* CoDel interval */
+} overload_config_t;
+
+/*
+ * Fill overload settings with built-in defaults
+ */
+void overload_config_init_defaults(overload_config_t *config);
+
+/*
+ * Apply overload settings (call before serving traffic)
+ */
+void overload_configure(const overload_config_t *config);
+
+/*
+ * Decide whether a task that waited wait_ns for a worker should be shed
+ * Applies the deadline, then CoDel: once waits have stayed above target for
+ * a whole interval, tasks above target are shed at an increasing rate
+ * (interval / sqrt(n)) until a wait drops below target again
+ * Returns true if the caller should answer 503 instead of serving the task
+ */
+bool overload_shed(uint64_t wait_ns);
+
+#endif /* OVERLOAD_H */
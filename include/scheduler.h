@@ -0,0 +1,143 @@
+/*
+ * C-HTTP Payment Server - Work-Stealing Scheduler
+ * One pinned worker per core with local deques and work stealing
+ */
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "task_queue.h"
+#include "thread_pool.h"
+
+/* Local deque capacity per worker (power of two) */
+#define SCHEDULER_DEQUE_CAPACITY 1024
+
+/* Inbox ring capacity per worker (tasks submitted from other threads) */
+#define SCHEDULER_INBOX_CAPACITY 8192
+
+/* Most CPUs considered for pinning */
+#define SCHEDULER_MAX_CPUS 1024
+
+/* Worker CPU pinning policy */
+typedef enum {
+    SCHED_PIN_NONE = 0,     /* Let the kernel place workers */
+    SCHED_PIN_CORES         /* Pin worker i to the i-th allowed CPU */
+} sched_pin_t;
+
+/*
+ * Bounded Chase-Lev deque
+ * The owner pushes and pops at bottom (LIFO, cache-hot); thieves take
+ * from top (FIFO, oldest first)
+ */
+typedef struct {
+    _Alignas(TASK_QUEUE_CACHE_LINE) long top;       /* Next slot to steal */
+    _Alignas(TASK_QUEUE_CACHE_LINE) long bottom;    /* Next slot to push */
+    int slots[SCHEDULER_DEQUE_CAPACITY];            /* Queued client fds */
+} sched_deque_t;
+
+/* Per-core worker */
+typedef struct scheduler_worker {
+    struct scheduler *sched;    /* Owning scheduler */
+    int index;                  /* Worker index (home of affinity % n) */
+    int cpu;                    /* CPU the worker is pinned to (-1 = unpinned) */
+    pthread_t thread;           /* Worker thread (0 if not started) */
+
+    sched_deque_t deque;        /* Tasks pushed by this worker */
+    task_queue_t inbox;         /* Tasks submitted from other threads */
+
+    _Alignas(TASK_QUEUE_CACHE_LINE) uint32_t park_sequence;   /* Futex word */
+    int parked;                 /* Set while the worker is (about to be) asleep */
+
+#ifndef __linux__
+    pthread_mutex_t park_mutex; /* Parking fallback without futexes */
+    pthread_cond_t park_cond;
+#endif
+} scheduler_worker_t;
+
+/* Work-stealing scheduler (drop-in for thread_pool_t) */
+typedef struct scheduler {
+    scheduler_worker_t *workers;    /* Array of num_workers workers */
+    int num_workers;                /* Number of workers */
+    sched_pin_t pin;                /* Pinning policy */
+    bool shutdown;                  /* Shutdown flag */
+    task_handler_t handler;         /* Task handler (NULL = connection_handle + close) */
+    void *handler_arg;              /* Opaque argument passed to handler */
+} scheduler_t;
+
+/*
+ * Initialize scheduler
+ * num_workers: Number of workers (0 = one per online CPU)
+ * pin: CPU pinning policy
+ * Returns 0 on success, -1 on error
+ */
+int scheduler_init(scheduler_t *sched, int num_workers, sched_pin_t pin);
+
+/*
+ * Set the handler workers run for each task
+ * Must be called before scheduler_start()
+ */
+void scheduler_set_handler(scheduler_t *sched, task_handler_t handler, void *arg);
+
+/*
+ * Refuse submissions once limit tasks wait in a worker's inbox
+ * (0 = block while it is full); must be called before scheduler_start()
+ */
+void scheduler_set_queue_limit(scheduler_t *sched, int limit);
+
+/*
+ * Start all workers (pinned according to the policy)
+ * Returns 0 on success, -1 on error
+ */
+int scheduler_start(scheduler_t *sched);
+
+/*
+ * Submit a client_fd (task_submit_t)
+ * The task goes to worker affinity % num_workers: onto its local deque when
+ * called from that worker, otherwise into its inbox. Idle workers may
+ * steal it if the home worker is busy
+ * Returns 0 on success, -1 on error
+ */
+int scheduler_submit(void *sched, int client_fd, int affinity);
+
+/*
+ * Count tasks waiting in every worker's deque and inbox
+ * Approximate while workers run
+ * Returns number of queued tasks
+ */
+int scheduler_pending(scheduler_t *sched);
+
+/*
+ * Shutdown scheduler gracefully
+ * Waits for all workers to finish
+ * Returns 0 on success, -1 on error
+ */
+int scheduler_shutdown(scheduler_t *sched);
+
+/*
+ * Destroy scheduler and free resources
+ * Should be called after shutdown completes; without a custom handler,
+ * connections still queued are closed
+ */
+void scheduler_destroy(scheduler_t *sched);
+
+/*
+ * List the CPUs this process may run on (its affinity mask), ascending
+ * Returns number of CPUs written to cpus, 0 if unknown
+ */
+int scheduler_allowed_cpus(int *cpus, int max_cpus);
+
+/*
+ * Pin the calling thread to one CPU
+ * Returns 0 on success, -1 on error (or unsupported platform)
+ */
+int scheduler_pin_self(int cpu);
+
+/*
+ * Convert pinning policy enum to string
+ */
+const char *scheduler_pin_to_string(sched_pin_t pin);
+
+#endif /* SCHEDULER_H */
@@ -1,6 +1,6 @@
 /*
- * C-HTTP Payment Server - Thread-Safe Task Queue
- * FIFO queue for distributing client connections to worker threads
+ * C-HTTP Payment Server - Lock-Free Task Queue
+ * Bounded MPMC ring for distributing client connections to worker threads
  */
 
 #ifndef TASK_QUEUE_H
@@ -8,48 +8,103 @@
 
 #include <pthread.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
-/* Task representing a client connection to be processed */
-typedef struct task {
-    int client_fd;          /* Client socket file descriptor */
-    struct task *next;      /* Pointer to next task in queue */
-} task_t;
+/* Cache line size used to keep producer and consumer state apart */
+#define TASK_QUEUE_CACHE_LINE 64
 
-/* Thread-safe FIFO task queue */
+/* Ring capacity when task_queue_init() is given max_size 0 */
+#define TASK_QUEUE_DEFAULT_CAPACITY 65536
+
+/* Empty polls before an idle worker parks (multi-core hosts only) */
+#define TASK_QUEUE_SPIN_LIMIT 128
+
+/*
+ * Ring slot
+ * sequence tells producers and consumers whose turn the slot is
+ * (Vyukov bounded MPMC queue)
+ */
+typedef struct {
+    size_t sequence;        /* Slot turn counter, updated atomically */
+    int client_fd;          /* Queued client socket */
+    uint64_t enqueued_ns;   /* When it was queued (queue wait metric) */
+} task_slot_t;
+
+/*
+ * Parking word for threads waiting on one condition
+ * Waiters sleep while the word is unchanged; wakers bump it first
+ */
+typedef struct {
+    uint32_t sequence;      /* Futex word (bumped on every wakeup) */
+    int waiters;            /* Threads parked or about to park */
+} task_park_t;
+
+/*
+ * Lock-free task queue
+ * Producers and consumers claim slots with CAS on their own index, each on
+ * its own cache line. Idle threads spin briefly, then park on a futex
+ * (mutex/condvar elsewhere); the fast path takes no locks
+ */
 typedef struct {
-    task_t *head;           /* Head of queue (dequeue from here) */
-    task_t *tail;           /* Tail of queue (enqueue here) */
-    int count;              /* Number of tasks in queue */
-    int max_size;           /* Maximum queue size (0 = unlimited) */
-    bool shutdown;          /* Shutdown flag */
-
-    pthread_mutex_t mutex;  /* Mutex for thread safety */
-    pthread_cond_t cond;    /* Condition variable for signaling workers */
+    task_slot_t *slots;     /* Ring storage (capacity entries) */
+    size_t mask;            /* capacity - 1 (capacity is a power of two) */
+    int max_size;           /* Capacity */
+    int limit;              /* Queued tasks before enqueue fails instead of blocking (0 = none) */
+    int spin_limit;         /* Empty polls before parking (0 on one CPU) */
+
+    _Alignas(TASK_QUEUE_CACHE_LINE) size_t enqueue_pos;    /* Next slot to fill */
+    _Alignas(TASK_QUEUE_CACHE_LINE) size_t dequeue_pos;    /* Next slot to drain */
+
+    _Alignas(TASK_QUEUE_CACHE_LINE) task_park_t not_empty; /* Idle workers */
+    _Alignas(TASK_QUEUE_CACHE_LINE) task_park_t not_full;  /* Producers blocked on a full ring */
+
+    _Alignas(TASK_QUEUE_CACHE_LINE) bool shutdown;         /* Shutdown flag */
+
+#ifndef __linux__
+    pthread_mutex_t park_mutex;     /* Parking fallback without futexes */
+    pthread_cond_t park_cond;
+#endif
 } task_queue_t;
 
 /*
  * Initialize task queue
- * max_size: Maximum number of tasks (0 = unlimited)
+ * max_size: Capacity, rounded up to a power of two (0 = default capacity)
  * Returns 0 on success, -1 on error
  */
 int task_queue_init(task_queue_t *queue, int max_size);
 
+/*
+ * Refuse new tasks once limit are queued instead of blocking producers
+ * limit: 1 to capacity (0 = block while the ring is full)
+ * Must be called before the queue is shared
+ */
+void task_queue_set_limit(task_queue_t *queue, int limit);
+
 /*
  * Enqueue a new task (client connection)
- * Blocks if queue is full (when max_size > 0)
- * Returns 0 on success, -1 on error
+ * Blocks while the ring is full, unless a limit is set
+ * Returns 0 on success, -1 on error, shutdown or when the limit is reached
  */
 int task_queue_enqueue(task_queue_t *queue, int client_fd);
 
 /*
  * Dequeue a task (blocking)
  * Blocks until a task is available or shutdown is signaled
+ * wait_ns (may be NULL) receives how long the task was queued
  * Returns client_fd on success, -1 on shutdown/error
  */
-int task_queue_dequeue(task_queue_t *queue);
+int task_queue_dequeue(task_queue_t *queue, uint64_t *wait_ns);
+
+/*
+ * Dequeue a task without blocking
+ * wait_ns (may be NULL) receives how long the task was queued
+ * Returns client_fd on success, -1 if the queue is empty
+ */
+int task_queue_try_dequeue(task_queue_t *queue, uint64_t *wait_ns);
 
 /*
- * Get current queue size (thread-safe)
+ * Get current queue size (approximate while producers/consumers run)
  * Returns number of tasks in queue
  */
 int task_queue_size(task_queue_t *queue);
@@ -62,7 +117,8 @@ int task_queue_shutdown(task_queue_t *queue);
 
 /*
  * Destroy task queue and free resources
- * Should be called after all threads have stopped
+ * Should be called after all threads have stopped; queued fds are not
+ * closed, so owners drain them with task_queue_try_dequeue() first
  */
 void task_queue_destroy(task_queue_t *queue);
 
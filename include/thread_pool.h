@@ -13,12 +13,28 @@
 /* Default number of worker threads */
 #define DEFAULT_THREAD_POOL_SIZE 10
 
+/*
+ * Task handler invoked by a worker for each dequeued client_fd
+ * The handler owns the fd and is responsible for closing it
+ */
+typedef void (*task_handler_t)(int client_fd, void *arg);
+
+/*
+ * Hands a ready client_fd to a pool of workers (thread pool or scheduler)
+ * affinity: stable per-connection value; pools that keep connections on
+ * one worker map the same value to the same worker every time
+ * Returns 0 on success, -1 on error
+ */
+typedef int (*task_submit_t)(void *pool, int client_fd, int affinity);
+
 /* Thread pool managing worker threads */
 typedef struct {
     pthread_t *threads;     /* Array of worker thread IDs */
     int num_threads;        /* Number of threads in pool */
     task_queue_t *queue;    /* Shared task queue */
     bool shutdown;          /* Shutdown flag */
+    task_handler_t handler; /* Task handler (NULL = connection_handle + close) */
+    void *handler_arg;      /* Opaque argument passed to handler */
 } thread_pool_t;
 
 /*
@@ -29,12 +45,25 @@ typedef struct {
  */
 int thread_pool_init(thread_pool_t *pool, int num_threads, task_queue_t *queue);
 
+/*
+ * Set the handler workers run for each task
+ * Must be called before thread_pool_start()
+ */
+void thread_pool_set_handler(thread_pool_t *pool, task_handler_t handler, void *arg);
+
 /*
  * Start all worker threads in the pool
  * Returns 0 on success, -1 on error
  */
 int thread_pool_start(thread_pool_t *pool);
 
+/*
+ * Enqueue a client_fd on the pool's shared queue (task_submit_t)
+ * affinity is ignored: any worker may take the task
+ * Returns 0 on success, -1 on error
+ */
+int thread_pool_submit(void *pool, int client_fd, int affinity);
+
 /*
  * Shutdown thread pool gracefully
  * Waits for all worker threads to finish
@@ -44,7 +73,8 @@ int thread_pool_shutdown(thread_pool_t *pool);
 
 /*
  * Destroy thread pool and free resources
- * Should be called after shutdown completes
+ * Should be called after shutdown completes; without a custom handler,
+ * connections still queued are closed
  */
 void thread_pool_destroy(thread_pool_t *pool);
 
@@ -0,0 +1,151 @@
+/*
+ * C-HTTP Payment Server - Request Phase Tracing
+ * Optional per-request timestamps for each phase of serving a request,
+ * kept in per-thread rings and written out as Chrome trace-event JSON
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/* Completed requests kept per thread (the oldest are overwritten) */
+#define TRACE_RING_CAPACITY 4096
+
+/* Request URI bytes kept in a record */
+#define TRACE_URI_MAX 64
+
+/*
+ * Phase boundaries: X(id, span)
+ * A mark is stamped when its phase ends; span names the time since the
+ * previous mark that was reached (threaded I/O never queues per request,
+ * so it has no "dequeued" mark)
+ */
+#define TRACE_MARKS(X) \
+    X(TRACE_RECEIVED, "recv") \
+    X(TRACE_PARSED,   "parse") \
+    X(TRACE_BODY,     "body") \
+    X(TRACE_DEQUEUED, "queue") \
+    X(TRACE_HANDLER,  "route") \
+    X(TRACE_HANDLED,  "handler") \
+    X(TRACE_RENDERED, "serialize") \
+    X(TRACE_SENT,     "send")
+
+typedef enum {
+#define TRACE_MARK_ENUM(id, span) id,
+    TRACE_MARKS(TRACE_MARK_ENUM)
+#undef TRACE_MARK_ENUM
+    TRACE_MARK_COUNT
+} trace_mark_t;
+
+/*
+ * Per-request record
+ * Lives with the request (connection state or the serving stack frame);
+ * copied into the finishing thread's ring if it was slow enough
+ */
+typedef struct {
+    uint64_t marks[TRACE_MARK_COUNT];   /* Ticks per mark, 0 if not reached */
+    int status_code;                    /* Response status, 0 if none was built */
+    const char *method;                 /* Static method name, NULL if unknown */
+    char uri[TRACE_URI_MAX];            /* Request URI (truncated, NUL-terminated) */
+} trace_request_t;
+
+/* Set while tracing (read by every mark) */
+extern bool g_trace_enabled;
+
+/* Record of the request the calling thread is building a response for */
+extern _Thread_local trace_request_t *t_trace_current;
+
+/*
+ * Check whether tracing is on
+ */
+static inline bool trace_enabled(void) {
+    return __atomic_load_n(&g_trace_enabled, __ATOMIC_RELAXED);
+}
+
+/*
+ * Current timestamp in ticks: the TSC on x86 (converted when written out),
+ * otherwise CLOCK_MONOTONIC nanoseconds
+ */
+static inline uint64_t trace_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/*
+ * Clear a record for the next request
+ */
+static inline void trace_reset(trace_request_t *record) {
+    if (trace_enabled()) {
+        *record = (trace_request_t){ .status_code = 0 };
+    }
+}
+
+/*
+ * Stamp the end of a phase
+ */
+static inline void trace_mark(trace_request_t *record, trace_mark_t mark) {
+    if (trace_enabled() && record != NULL) {
+        record->marks[mark] = trace_ticks();
+    }
+}
+
+/*
+ * Stamp a mark unless it was already reached (first byte of a request)
+ */
+static inline void trace_mark_once(trace_request_t *record, trace_mark_t mark) {
+    if (trace_enabled() && record != NULL && record->marks[mark] == 0) {
+        record->marks[mark] = trace_ticks();
+    }
+}
+
+/*
+ * Make record the calling thread's current request (NULL to clear)
+ */
+static inline void trace_set_current(trace_request_t *record) {
+    if (trace_enabled()) {
+        t_trace_current = record;
+    }
+}
+
+/*
+ * Get the calling thread's current request record (NULL if none)
+ */
+static inline trace_request_t *trace_current(void) {
+    return trace_enabled() ? t_trace_current : NULL;
+}
+
+/*
+ * Start tracing; rings are written to path by trace_stop()
+ * Requests faster than threshold_us (end to end) are not kept
+ * Returns 0 on success, -1 on error
+ */
+int trace_start(const char *path, long threshold_us);
+
+/*
+ * Describe the request a record belongs to (method, URI and status)
+ */
+void trace_describe(trace_request_t *record, const char *method, const char *uri,
+                    size_t uri_length, int status_code);
+
+/*
+ * Finish a record once its response is sent
+ * Kept in the calling thread's ring if it took at least the threshold
+ */
+void trace_finish(trace_request_t *record);
+
+/*
+ * Stop tracing and write every ring as Chrome trace-event JSON
+ * Call once no other thread serves requests
+ */
+void trace_stop(void);
+
+#endif /* TRACE_H */
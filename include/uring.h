@@ -0,0 +1,173 @@
+/*
+ * C-HTTP Payment Server - io_uring
+ * Minimal io_uring bindings over the raw system calls: ring setup,
+ * submission and completion, provided buffer rings, and a per-thread
+ * zerocopy send. Without kernel support every call fails with ENOSYS,
+ * so callers fall back to epoll and plain sends.
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/* Completion flags (same values as IORING_CQE_F_*) */
+#define URING_CQE_BUFFER (1U << 0)      /* A provided buffer was used; its id is in flags >> 16 */
+#define URING_CQE_MORE (1U << 1)        /* A multishot request stays armed */
+#define URING_CQE_BUFFER_SHIFT 16
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+
+/* One completion, copied off the ring */
+typedef struct {
+    uint64_t user_data;     /* Tag of the submission */
+    int32_t res;            /* Result, or -errno */
+    uint32_t flags;         /* URING_CQE_* */
+} uring_cqe_t;
+
+/* Submission and completion rings shared with the kernel */
+typedef struct uring {
+    int fd;                         /* Ring file descriptor (-1 = not set up) */
+    void *map;                      /* SQ and CQ rings (one mapping) */
+    size_t map_size;
+    struct io_uring_sqe *sqes;      /* Submission entries */
+    size_t sqes_size;
+
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sq_pending;            /* SQEs filled in but not yet published (local tail) */
+
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+} uring_t;
+
+/*
+ * Provided buffer ring
+ * The kernel picks a buffer when data arrives, so waiting receives pin no
+ * memory of their own; buffers go back with uring_bufs_put()
+ */
+typedef struct {
+    struct io_uring_buf_ring *ring; /* Shared with the kernel */
+    size_t ring_size;
+    char *base;                     /* entries * size bytes of buffer memory */
+    size_t size;                    /* Bytes per buffer */
+    unsigned entries;
+    uint16_t tail;                  /* Next free slot (published to the kernel) */
+    uint16_t group;                 /* Buffer group id used by submissions */
+    bool registered;
+} uring_bufs_t;
+
+/*
+ * Set up a ring with entries submission slots and cq_entries completion slots
+ * Needs extended wait arguments and lossless completions (Linux 5.11+)
+ * Returns 0 on success, -1 on error (errno set; ENOSYS if unsupported)
+ */
+int uring_init(uring_t *ring, unsigned entries, unsigned cq_entries);
+
+/*
+ * Unmap and close a ring (cancels everything still in flight)
+ */
+void uring_destroy(uring_t *ring);
+
+/*
+ * Check whether the kernel implements an IORING_OP_* opcode
+ */
+bool uring_supports(uring_t *ring, unsigned opcode);
+
+/*
+ * Check whether the kernel accepts multishot (Linux 5.19+)
+ */
+bool uring_accept_multishot_supported(uring_t *ring);
+
+/*
+ * Queue a multishot accept: one submission yields a completion (the new
+ * socket) per connection until it is cancelled or fails
+ * Returns 0 on success, -1 if the submission queue is full
+ */
+int uring_accept(uring_t *ring, int fd, int flags, uint64_t user_data);
+
+/*
+ * Queue a receive into buffer, or into a buffer of group when buffer is NULL
+ * Returns 0 on success, -1 if the submission queue is full
+ */
+int uring_recv(uring_t *ring, int fd, void *buffer, size_t length, uint16_t group,
+               uint64_t user_data);
+
+/*
+ * Queue a one-shot poll for events (POLLIN, POLLOUT...)
+ * Returns 0 on success, -1 if the submission queue is full
+ */
+int uring_poll(uring_t *ring, int fd, unsigned events, uint64_t user_data);
+
+/*
+ * Queue cancellation of the request tagged target
+ * Returns 0 on success, -1 if the submission queue is full
+ */
+int uring_cancel(uring_t *ring, uint64_t target, uint64_t user_data);
+
+/*
+ * Submit queued requests without waiting
+ * Returns 0 on success, -1 on error
+ */
+int uring_submit(uring_t *ring);
+
+/*
+ * Submit queued requests and wait up to timeout_ms (-1 = forever) for a completion
+ * Returns 0 on success or timeout, -1 on error
+ */
+int uring_wait(uring_t *ring, int timeout_ms);
+
+/*
+ * Take the next completion off the ring
+ * Returns true if cqe was filled, false if the ring is empty
+ */
+bool uring_next(uring_t *ring, uring_cqe_t *cqe);
+
+/*
+ * Register entries buffers of size bytes as buffer group (Linux 5.19+)
+ * entries must be a power of two
+ * Returns 0 on success, -1 on error
+ */
+int uring_bufs_init(uring_t *ring, uring_bufs_t *bufs, uint16_t group, unsigned entries,
+                    size_t size);
+
+/*
+ * Memory of buffer id (from a URING_CQE_BUFFER completion)
+ */
+char *uring_bufs_data(uring_bufs_t *bufs, uint16_t id);
+
+/*
+ * Hand buffer id back to the kernel
+ */
+void uring_bufs_put(uring_bufs_t *bufs, uint16_t id);
+
+/*
+ * Unregister and free a buffer group (before its ring is destroyed)
+ */
+void uring_bufs_destroy(uring_t *ring, uring_bufs_t *bufs);
+
+/*
+ * Check once whether this kernel can send with IORING_OP_SENDMSG_ZC
+ */
+bool uring_send_zc_supported(void);
+
+/*
+ * Send iov with IORING_OP_SENDMSG_ZC on the calling thread's own small ring
+ * Blocks until the kernel has released the pages (the memory may be reused
+ * on return) or timeout_ms passes; the send itself is cancelled by a linked
+ * timeout if the socket does not drain in time
+ * Returns bytes sent, -1 on error (errno set; ENOSYS if unsupported)
+ */
+ssize_t uring_send_zc(int fd, const struct iovec *iov, int iov_count, int flags, int timeout_ms);
+
+#endif /* URING_H */
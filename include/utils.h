@@ -7,6 +7,7 @@
 #define UTILS_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 /*
  * String utilities
@@ -0,0 +1,138 @@
+/*
+ * C-HTTP Payment Server - Idempotency Write-Ahead Log
+ * Durable record of cached responses with group commit, replayed into the
+ * idempotency store at startup and compacted by periodic snapshots
+ */
+
+#ifndef WAL_H
+#define WAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "idempotency.h"
+
+/* File header (segments and snapshots): magic, format version, byte-order marker */
+#define WAL_MAGIC "CHTIDWAL"
+#define WAL_VERSION 1
+#define WAL_BYTE_ORDER 0x01020304u
+#define WAL_HEADER_SIZE 16
+
+/* Group commit defaults: sync at most this long after the first pending record... */
+#define WAL_DEFAULT_COMMIT_US 1000
+
+/* ...or as soon as this many records are pending */
+#define WAL_DEFAULT_COMMIT_BATCH 64
+
+/* Snapshot (and drop older segments) this often while the log grows */
+#define WAL_DEFAULT_SNAPSHOT_SEC 300
+
+/* Snapshot early once the current segment reaches this size */
+#define WAL_SNAPSHOT_BYTES ((uint64_t)64 * 1024 * 1024)
+
+/* Log settings */
+typedef struct {
+    const char *dir;            /* Directory holding segments and snapshots (NULL = off) */
+    int commit_us;              /* Longest a record waits for its sync */
+    int commit_batch;           /* Pending records that trigger a sync right away */
+    int snapshot_sec;           /* Snapshot interval */
+} wal_config_t;
+
+/*
+ * Append ticket
+ * Identifies a record until it is durable and installed in the store
+ */
+typedef struct {
+    uint64_t lsn;               /* Record sequence number (durable once synced past it) */
+    uint64_t generation;        /* Segment generation it was appended under */
+} wal_ticket_t;
+
+/*
+ * Write-ahead log
+ * Appenders copy records into a pending buffer; one flusher thread writes
+ * and syncs the whole batch, then wakes every appender it covered
+ */
+typedef struct wal {
+    char *dir;                  /* Log directory */
+    int commit_us;
+    int commit_batch;
+    int snapshot_sec;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;        /* Flusher: records pending, rotation or shutdown */
+    pthread_cond_t synced;      /* Appenders: durable_lsn advanced, or rotation done */
+    pthread_cond_t applied;     /* Snapshotter: a record was installed in the store */
+
+    char *pending;              /* Records not yet written (flusher swaps it out) */
+    size_t pending_length;
+    size_t pending_capacity;
+    int pending_records;
+    uint64_t first_pending_ns;  /* When the oldest pending record was appended */
+
+    uint64_t appended_lsn;      /* Last record appended */
+    uint64_t durable_lsn;       /* Last record synced to disk */
+    bool failed;                /* A write or sync failed; nothing is durable any more */
+
+    int fd;                     /* Current segment */
+    uint64_t generation;        /* Current segment generation */
+    uint64_t segment_bytes;     /* Bytes written to the current segment */
+    uint64_t snapshot_generation;   /* Generation of the newest snapshot (0 = none) */
+    bool rotate;                /* Snapshotter asked for a new segment */
+    int unapplied[2];           /* Appended but not installed, by generation parity */
+
+    idempotency_store_t *store; /* Store snapshots are taken from */
+    pthread_t flusher;
+    pthread_t snapshotter;
+    bool started;
+    bool shutdown;
+} wal_t;
+
+/*
+ * Fill log settings with built-in defaults (logging stays off)
+ */
+void wal_config_init_defaults(wal_config_t *config);
+
+/*
+ * Open the log directory and replay the newest snapshot and every later
+ * segment into store (expired records are skipped)
+ * replay: false when store was already loaded from a predecessor's image, so
+ * only the generation numbers are read; the log carries on from there
+ * Returns 0 on success, -1 on error
+ */
+int wal_open(wal_t *wal, const wal_config_t *config, idempotency_store_t *store, bool replay);
+
+/*
+ * Start a new segment and the flusher and snapshot threads; from here on
+ * the store logs every completed response before replaying it
+ * Returns 0 on success, -1 on error
+ */
+int wal_start(wal_t *wal);
+
+/*
+ * Sync pending records, stop the threads and close the log
+ */
+void wal_close(wal_t *wal);
+
+/*
+ * Append one completed response (copied into the pending batch)
+ * expire_unix: wall-clock second the response stops being replayable
+ * Returns 0 and fills *ticket on success, -1 if the log has failed
+ */
+int wal_append(wal_t *wal, const char *key, size_t key_length, uint64_t digest,
+               int status_code, const char *content_type, const char *body,
+               size_t body_length, int64_t expire_unix, wal_ticket_t *ticket);
+
+/*
+ * Wait until the record behind ticket is on disk
+ * Returns 0 once durable, -1 if the log failed first
+ */
+int wal_wait(wal_t *wal, const wal_ticket_t *ticket);
+
+/*
+ * Report that the record behind ticket is installed in the store
+ * (or was dropped); snapshots wait for this before reading the store
+ */
+void wal_applied(wal_t *wal, const wal_ticket_t *ticket);
+
+#endif /* WAL_H */
@@ -0,0 +1,233 @@
+/*
+ * C-HTTP Payment Server - Arena Allocator
+ * Per-worker bump allocator for request/response lifetimes
+ *
+ * Everything a worker allocates while answering one request (a body read
+ * from the socket, response headers, the rendered header block) comes from
+ * its arena and is released by a single reset once the response is sent.
+ * After the first few requests the arena settles on one chunk large enough
+ * for the workload, so the steady-state path never calls malloc or free.
+ */
+
+#include "arena.h"
+#include "logger.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/* Thread-local arena and the key that frees it on thread exit */
+static _Thread_local arena_t *t_arena = NULL;
+static pthread_key_t g_arena_key;
+static pthread_once_t g_arena_key_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Helper function: Round size up to the allocation alignment
+ */
+static size_t align_up(size_t size) {
+    return (size + (ARENA_ALIGNMENT - 1)) & ~((size_t)ARENA_ALIGNMENT - 1);
+}
+
+/*
+ * Helper function: Allocate an empty chunk
+ * Returns chunk on success, NULL on error
+ */
+static arena_chunk_t *chunk_create(size_t size) {
+    arena_chunk_t *chunk = (arena_chunk_t *)malloc(sizeof(arena_chunk_t) + size);
+    if (chunk == NULL) {
+        LOG_ERROR(NULL, "Failed to allocate %zu byte arena chunk", size);
+        return NULL;
+    }
+
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+    return chunk;
+}
+
+/*
+ * Initialize arena with one chunk of chunk_size bytes (0 = default)
+ * Returns 0 on success, -1 on error
+ */
+int arena_init(arena_t *arena, size_t chunk_size) {
+    if (arena == NULL) {
+        LOG_ERROR(NULL, "arena_init: NULL arena pointer");
+        return -1;
+    }
+
+    arena->chunk_size = align_up(chunk_size == 0 ? ARENA_DEFAULT_CHUNK_SIZE : chunk_size);
+    arena->allocated = 0;
+    arena->head = chunk_create(arena->chunk_size);
+    if (arena->head == NULL) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Allocate size bytes, aligned to ARENA_ALIGNMENT
+ * Returns pointer on success, NULL on error
+ */
+void *arena_alloc(arena_t *arena, size_t size) {
+    if (arena == NULL) {
+        return NULL;
+    }
+
+    size = align_up(size == 0 ? 1 : size);
+
+    arena_chunk_t *chunk = arena->head;
+    if (chunk == NULL || chunk->size - chunk->used < size) {
+        /* Overflow chunk: used until the next reset, which resizes the arena */
+        size_t chunk_size = size > arena->chunk_size ? size : arena->chunk_size;
+        chunk = chunk_create(chunk_size);
+        if (chunk == NULL) {
+            return NULL;
+        }
+        chunk->next = arena->head;
+        arena->head = chunk;
+    }
+
+    void *ptr = chunk->data + chunk->used;
+    chunk->used += size;
+    arena->allocated += size;
+    return ptr;
+}
+
+/*
+ * Copy length bytes into the arena and null-terminate
+ * Returns the copy on success, NULL on error
+ */
+char *arena_strndup(arena_t *arena, const char *str, size_t length) {
+    if (str == NULL) {
+        return NULL;
+    }
+
+    char *copy = (char *)arena_alloc(arena, length + 1);
+    if (copy == NULL) {
+        return NULL;
+    }
+
+    memcpy(copy, str, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+/*
+ * Release every allocation at once
+ */
+void arena_reset(arena_t *arena) {
+    if (arena == NULL || arena->head == NULL) {
+        return;
+    }
+
+    /* Common case: everything fit in the one chunk */
+    if (arena->head->next == NULL) {
+        arena->head->used = 0;
+        arena->allocated = 0;
+        return;
+    }
+
+    /* Replace the chunk list with one chunk sized for the observed peak */
+    size_t target = arena->allocated;
+    if (target > ARENA_MAX_RETAINED_SIZE) {
+        target = ARENA_MAX_RETAINED_SIZE;
+    }
+    if (target < arena->chunk_size) {
+        target = arena->chunk_size;
+    }
+    target = align_up(target);
+
+    arena_chunk_t *keep = NULL;
+    arena_chunk_t *chunk = arena->head;
+    while (chunk != NULL) {
+        arena_chunk_t *next = chunk->next;
+        if (keep == NULL && chunk->size == target) {
+            keep = chunk;
+        } else {
+            free(chunk);
+        }
+        chunk = next;
+    }
+
+    if (keep == NULL) {
+        keep = chunk_create(target);
+        if (keep == NULL) {
+            /* Retry allocation lazily on the next arena_alloc() */
+            arena->head = NULL;
+            arena->allocated = 0;
+            return;
+        }
+    }
+
+    keep->next = NULL;
+    keep->used = 0;
+    arena->head = keep;
+    arena->chunk_size = target;
+    arena->allocated = 0;
+
+    LOG_DEBUG(NULL, "Arena resized to %zu bytes", target);
+}
+
+/*
+ * Free all chunks
+ */
+void arena_destroy(arena_t *arena) {
+    if (arena == NULL) {
+        return;
+    }
+
+    arena_chunk_t *chunk = arena->head;
+    while (chunk != NULL) {
+        arena_chunk_t *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    arena->head = NULL;
+    arena->allocated = 0;
+}
+
+/*
+ * Helper function: Thread exit destructor for the thread-local arena
+ */
+static void arena_thread_release(void *ptr) {
+    arena_t *arena = (arena_t *)ptr;
+    arena_destroy(arena);
+    free(arena);
+}
+
+/*
+ * Helper function: Create the thread-exit key (runs once)
+ */
+static void arena_key_create(void) {
+    if (pthread_key_create(&g_arena_key, arena_thread_release) != 0) {
+        LOG_ERROR(NULL, "Failed to create arena thread key");
+    }
+}
+
+/*
+ * Get the calling thread's arena, creating it on first use
+ * Returns arena on success, NULL on error
+ */
+arena_t *arena_thread(void) {
+    if (t_arena != NULL) {
+        return t_arena;
+    }
+
+    pthread_once(&g_arena_key_once, arena_key_create);
+
+    arena_t *arena = (arena_t *)malloc(sizeof(arena_t));
+    if (arena == NULL) {
+        LOG_ERROR(NULL, "Failed to allocate thread arena");
+        return NULL;
+    }
+
+    if (arena_init(arena, 0) != 0) {
+        free(arena);
+        return NULL;
+    }
+
+    pthread_setspecific(g_arena_key, arena);
+    t_arena = arena;
+    return arena;
+}
@@ -0,0 +1,492 @@
+/*
+ * C-HTTP Payment Server - Binary Audit Log Implementation
+ *
+ * A record is the event ID, a wall-clock timestamp and the raw arguments,
+ * packed in the order the event's format string consumes them:
+ *
+ *   u16 length    whole record, header included
+ *   u16 event     stable event ID (audit.h)
+ *   u64 time_ns   CLOCK_REALTIME
+ *   args          ints as 4 bytes, long/long long/size_t/double as 8,
+ *                 strings as u16 length + bytes
+ *
+ * Fields use host byte order; the file header carries a marker so the
+ * decoder can refuse a file from a machine of the other endianness.
+ * Records go through the logger's binary sink, so an audit call costs an
+ * encode and a ring copy rather than a printf.
+ */
+
+#include "audit.h"
+#include "logger.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Record header: length, event, timestamp */
+#define AUDIT_RECORD_HEADER 12
+
+/* Catalogue entry */
+typedef struct {
+    const char *name;                   /* Event name without the AUDIT_ prefix */
+    const char *format;                 /* printf format the arguments follow */
+    char signature[AUDIT_MAX_ARGS + 1]; /* One type code per argument */
+    bool valid;                         /* Format parsed successfully */
+} audit_catalogue_t;
+
+#define AUDIT_EVENT_ENTRY(event, id) \
+    [event] = { .name = #event + sizeof("AUDIT_") - 1, .format = event##_FORMAT },
+static audit_catalogue_t g_catalogue[AUDIT_EVENT_MAX] = {
+    AUDIT_EVENTS(AUDIT_EVENT_ENTRY)
+};
+#undef AUDIT_EVENT_ENTRY
+
+static pthread_once_t g_catalogue_once = PTHREAD_ONCE_INIT;
+
+bool g_audit_enabled = false;
+static int g_audit_fd = -1;
+
+/*
+ * Helper function: Parse one conversion spec (p points just past '%')
+ * Type codes: i int, l long, L long long, z size_t, f double, s string,
+ * S string with a %.* precision argument
+ * Returns the type code, 0 if unsupported; *end is set past the spec
+ */
+static char parse_spec(const char *p, const char **end) {
+    bool star_precision = false;
+
+    while (*p != '\0' && strchr("-+ #0", *p) != NULL) {
+        p++;
+    }
+    while (*p >= '0' && *p <= '9') {
+        p++;
+    }
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            star_precision = true;
+            p++;
+        } else {
+            while (*p >= '0' && *p <= '9') {
+                p++;
+            }
+        }
+    }
+
+    char length = 0;
+    if (p[0] == 'h') {
+        p += p[1] == 'h' ? 2 : 1;
+    } else if (p[0] == 'l' && p[1] == 'l') {
+        length = 'L';
+        p += 2;
+    } else if (p[0] == 'l' || p[0] == 'z') {
+        length = *p++;
+    }
+
+    char conversion = *p;
+    *end = conversion != '\0' ? p + 1 : p;
+
+    if (conversion != '\0' && strchr("diuxXoc", conversion) != NULL) {
+        return star_precision ? 0 : (length != 0 ? length : 'i');
+    }
+    if (conversion != '\0' && strchr("feEgGaA", conversion) != NULL) {
+        return star_precision || length != 0 ? 0 : 'f';
+    }
+    if (conversion == 's' && length == 0) {
+        return star_precision ? 'S' : 's';
+    }
+    return 0;
+}
+
+/*
+ * Helper function: Derive every event's argument signature (runs once)
+ */
+static void catalogue_init(void) {
+    for (int id = 0; id < AUDIT_EVENT_MAX; id++) {
+        audit_catalogue_t *entry = &g_catalogue[id];
+        if (entry->format == NULL) {
+            continue;
+        }
+
+        size_t count = 0;
+        bool valid = true;
+        for (const char *p = entry->format; *p != '\0' && valid;) {
+            if (*p++ != '%') {
+                continue;
+            }
+            if (*p == '%') {
+                p++;
+                continue;
+            }
+            char code = parse_spec(p, &p);
+            if (code == 0 || count == AUDIT_MAX_ARGS) {
+                valid = false;
+            } else {
+                entry->signature[count++] = code;
+            }
+        }
+
+        entry->signature[count] = '\0';
+        entry->valid = valid;
+    }
+}
+
+/*
+ * Helper function: Look up a parsed catalogue entry
+ * Returns NULL for unknown IDs and unsupported formats
+ */
+static const audit_catalogue_t *catalogue_get(unsigned int id) {
+    pthread_once(&g_catalogue_once, catalogue_init);
+
+    if (id >= AUDIT_EVENT_MAX || g_catalogue[id].format == NULL || !g_catalogue[id].valid) {
+        return NULL;
+    }
+    return &g_catalogue[id];
+}
+
+/*
+ * Get an event's name (without the AUDIT_ prefix), NULL if unknown
+ */
+const char *audit_event_name(unsigned int id) {
+    const audit_catalogue_t *entry = catalogue_get(id);
+    return entry != NULL ? entry->name : NULL;
+}
+
+/*
+ * Open (or append to) the audit log at path
+ */
+int audit_open(const char *path) {
+    if (path == NULL) {
+        return -1;
+    }
+
+    for (unsigned int id = 1; id < AUDIT_EVENT_MAX; id++) {
+        if (catalogue_get(id) == NULL) {
+            LOG_ERROR(NULL, "Audit event %u has an unsupported format", id);
+            return -1;
+        }
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0640);
+    if (fd < 0) {
+        LOG_ERROR(NULL, "Failed to open audit log %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        LOG_ERROR(NULL, "Failed to stat audit log %s: %s", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    uint8_t header[AUDIT_HEADER_SIZE];
+    if (st.st_size == 0) {
+        uint32_t version = AUDIT_VERSION;
+        uint32_t byte_order = AUDIT_BYTE_ORDER;
+        memcpy(header, AUDIT_MAGIC, 8);
+        memcpy(header + 8, &version, sizeof(version));
+        memcpy(header + 12, &byte_order, sizeof(byte_order));
+        if (write(fd, header, sizeof(header)) != (ssize_t)sizeof(header)) {
+            LOG_ERROR(NULL, "Failed to write audit log header %s", path);
+            close(fd);
+            return -1;
+        }
+    } else if (pread(fd, header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+               audit_check_header(header, sizeof(header)) < 0) {
+        LOG_ERROR(NULL, "%s exists and is not an audit log of this version", path);
+        close(fd);
+        return -1;
+    }
+
+    g_audit_fd = fd;
+    logger_set_sink_fd(LOG_SINK_BINARY, fd);
+    __atomic_store_n(&g_audit_enabled, true, __ATOMIC_RELEASE);
+
+    LOG_INFO(NULL, "Audit log: %s", path);
+    return 0;
+}
+
+/*
+ * Flush queued records and close the audit log
+ */
+void audit_close(void) {
+    if (g_audit_fd < 0) {
+        return;
+    }
+
+    __atomic_store_n(&g_audit_enabled, false, __ATOMIC_RELEASE);
+    logger_set_sink_fd(LOG_SINK_BINARY, -1);
+    close(g_audit_fd);
+    g_audit_fd = -1;
+}
+
+/*
+ * Helper function: Append a length-prefixed string, truncated to fit
+ */
+static size_t put_string(uint8_t *record, size_t pos, const char *str, size_t length) {
+    size_t room = AUDIT_RECORD_MAX - pos - sizeof(uint16_t);
+    if (length > room) {
+        length = room;
+    }
+
+    uint16_t encoded = (uint16_t)length;
+    memcpy(record + pos, &encoded, sizeof(encoded));
+    memcpy(record + pos + sizeof(encoded), str, length);
+    return pos + sizeof(encoded) + length;
+}
+
+/*
+ * Encode one event and queue it on the binary sink
+ */
+void audit_write(audit_event_t event, ...) {
+    const audit_catalogue_t *entry = catalogue_get((unsigned int)event);
+    if (entry == NULL) {
+        return;
+    }
+
+    uint8_t record[AUDIT_RECORD_MAX];
+    size_t pos = AUDIT_RECORD_HEADER;
+
+    va_list args;
+    va_start(args, event);
+    for (const char *code = entry->signature; *code != '\0'; code++) {
+        /* Room for the largest fixed field or an empty string */
+        if (pos + sizeof(uint64_t) > AUDIT_RECORD_MAX) {
+            va_end(args);
+            return;
+        }
+
+        int32_t i32;
+        int64_t i64;
+        double f64;
+        const char *str;
+        int precision;
+
+        switch (*code) {
+            case 'i':
+                i32 = va_arg(args, int);
+                memcpy(record + pos, &i32, sizeof(i32));
+                pos += sizeof(i32);
+                break;
+            case 'l':
+                i64 = va_arg(args, long);
+                memcpy(record + pos, &i64, sizeof(i64));
+                pos += sizeof(i64);
+                break;
+            case 'L':
+                i64 = va_arg(args, long long);
+                memcpy(record + pos, &i64, sizeof(i64));
+                pos += sizeof(i64);
+                break;
+            case 'z':
+                i64 = (int64_t)va_arg(args, size_t);
+                memcpy(record + pos, &i64, sizeof(i64));
+                pos += sizeof(i64);
+                break;
+            case 'f':
+                f64 = va_arg(args, double);
+                memcpy(record + pos, &f64, sizeof(f64));
+                pos += sizeof(f64);
+                break;
+            case 'S':
+                precision = va_arg(args, int);
+                str = va_arg(args, const char *);
+                if (str == NULL) {
+                    str = "(null)";
+                    precision = -1;
+                }
+                pos = put_string(record, pos, str,
+                                 precision >= 0 ? strnlen(str, (size_t)precision) : strlen(str));
+                break;
+            default:
+                str = va_arg(args, const char *);
+                if (str == NULL) {
+                    str = "(null)";
+                }
+                pos = put_string(record, pos, str, strlen(str));
+                break;
+        }
+    }
+    va_end(args);
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    uint16_t length = (uint16_t)pos;
+    uint16_t id = (uint16_t)event;
+    uint64_t time_ns = (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+    memcpy(record, &length, sizeof(length));
+    memcpy(record + 2, &id, sizeof(id));
+    memcpy(record + 4, &time_ns, sizeof(time_ns));
+
+    log_write(LOG_SINK_BINARY, record, pos);
+}
+
+/*
+ * Check an audit file header
+ */
+int audit_check_header(const uint8_t *header, size_t length) {
+    if (header == NULL || length < AUDIT_HEADER_SIZE || memcmp(header, AUDIT_MAGIC, 8) != 0) {
+        return -1;
+    }
+
+    uint32_t version, byte_order;
+    memcpy(&version, header + 8, sizeof(version));
+    memcpy(&byte_order, header + 12, sizeof(byte_order));
+    return version == AUDIT_VERSION && byte_order == AUDIT_BYTE_ORDER ? 0 : -1;
+}
+
+/*
+ * Helper function: snprintf at *pos, clamping *pos to the buffer
+ */
+__attribute__((format(printf, 4, 5)))
+static void append(char *out, size_t out_size, size_t *pos, const char *format, ...) {
+    if (*pos >= out_size) {
+        return;
+    }
+
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(out + *pos, out_size - *pos, format, args);
+    va_end(args);
+
+    if (written > 0) {
+        *pos += (size_t)written;
+        if (*pos >= out_size) {
+            *pos = out_size - 1;
+        }
+    }
+}
+
+/*
+ * Decode one record into text
+ */
+int audit_decode(const uint8_t *data, size_t length, char *out, size_t out_size) {
+    if (data == NULL || out == NULL || out_size == 0) {
+        return -1;
+    }
+    if (length < AUDIT_RECORD_HEADER) {
+        return 0;
+    }
+
+    uint16_t record_length, id;
+    uint64_t time_ns;
+    memcpy(&record_length, data, sizeof(record_length));
+    memcpy(&id, data + 2, sizeof(id));
+    memcpy(&time_ns, data + 4, sizeof(time_ns));
+
+    if (record_length < AUDIT_RECORD_HEADER || record_length > AUDIT_RECORD_MAX) {
+        return -1;
+    }
+    if (length < record_length) {
+        return 0;
+    }
+
+    size_t pos = 0;
+    out[0] = '\0';
+
+    /* Timestamp in local time, nanosecond resolution */
+    time_t seconds = (time_t)(time_ns / 1000000000ull);
+    struct tm tm;
+    char stamp[32];
+    localtime_r(&seconds, &tm);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+    append(out, out_size, &pos, "[%s.%09llu] ", stamp,
+           (unsigned long long)(time_ns % 1000000000ull));
+
+    const audit_catalogue_t *entry = catalogue_get(id);
+    if (entry == NULL) {
+        /* Newer event than this decoder knows: skip it, but say so */
+        append(out, out_size, &pos, "EVENT_%u: (unknown, %u bytes)", id, record_length);
+        return record_length;
+    }
+    append(out, out_size, &pos, "%s: ", entry->name);
+
+    const uint8_t *field = data + AUDIT_RECORD_HEADER;
+    const uint8_t *end = data + record_length;
+    const char *code = entry->signature;
+
+    for (const char *p = entry->format; *p != '\0';) {
+        if (*p != '%') {
+            const char *next = strchr(p, '%');
+            size_t literal = next != NULL ? (size_t)(next - p) : strlen(p);
+            append(out, out_size, &pos, "%.*s", (int)literal, p);
+            p += literal;
+            continue;
+        }
+        if (p[1] == '%') {
+            append(out, out_size, &pos, "%%");
+            p += 2;
+            continue;
+        }
+
+        /* Re-run this one conversion with the stored argument */
+        const char *spec_end;
+        parse_spec(p + 1, &spec_end);
+        char spec[32];
+        size_t spec_length = (size_t)(spec_end - p);
+        if (spec_length >= sizeof(spec) || *code == '\0') {
+            return -1;
+        }
+        memcpy(spec, p, spec_length);
+        spec[spec_length] = '\0';
+        p = spec_end;
+
+        int32_t i32;
+        int64_t i64;
+        double f64;
+        uint16_t str_length;
+        char str[AUDIT_RECORD_MAX];
+
+        switch (*code++) {
+            case 'i':
+                if (end - field < (ptrdiff_t)sizeof(i32)) return -1;
+                memcpy(&i32, field, sizeof(i32));
+                field += sizeof(i32);
+                append(out, out_size, &pos, spec, (int)i32);
+                break;
+            case 'l':
+            case 'L':
+            case 'z':
+                if (end - field < (ptrdiff_t)sizeof(i64)) return -1;
+                memcpy(&i64, field, sizeof(i64));
+                field += sizeof(i64);
+                if (code[-1] == 'l') {
+                    append(out, out_size, &pos, spec, (long)i64);
+                } else if (code[-1] == 'L') {
+                    append(out, out_size, &pos, spec, (long long)i64);
+                } else {
+                    append(out, out_size, &pos, spec, (size_t)i64);
+                }
+                break;
+            case 'f':
+                if (end - field < (ptrdiff_t)sizeof(f64)) return -1;
+                memcpy(&f64, field, sizeof(f64));
+                field += sizeof(f64);
+                append(out, out_size, &pos, spec, f64);
+                break;
+            default:
+                if (end - field < (ptrdiff_t)sizeof(str_length)) return -1;
+                memcpy(&str_length, field, sizeof(str_length));
+                field += sizeof(str_length);
+                if (end - field < (ptrdiff_t)str_length) return -1;
+                memcpy(str, field, str_length);
+                str[str_length] = '\0';
+                field += str_length;
+                if (code[-1] == 'S') {
+                    append(out, out_size, &pos, spec, (int)str_length, str);
+                } else {
+                    append(out, out_size, &pos, spec, str);
+                }
+                break;
+        }
+    }
+
+    return record_length;
+}
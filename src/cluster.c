@@ -0,0 +1,1528 @@
+/*
+ * C-HTTP Payment Server - Cluster Key Ownership
+ *
+ * Every node is configured with the same peer list. A key belongs to the
+ * peer with the highest rendezvous score mix(hash(key) ^ hash(peer)), so
+ * all nodes agree on the owner without coordinating, and adding or
+ * removing a node only moves the keys that node wins or held.
+ *
+ * Requests are still served where they land: the node that received a
+ * payment runs its handler, but the key's begin/complete/abort run on the
+ * owner's store, so a retry that lands on any node sees the same
+ * reservation and cached response. The body never leaves the receiving
+ * node; only the request digest and the cached response travel. The owner
+ * answers a duplicate of an in-flight key at once; the node that received
+ * the duplicate does the waiting, asking again until the original resolves.
+ *
+ * Each node keeps one connection to every other node. Callers append a
+ * frame to the peer's buffer and sleep; the peer's I/O thread writes
+ * whatever has accumulated in one write (a batch) without waiting for
+ * replies (pipelining), and wakes each caller as the reply with its id
+ * arrives. The owner's side reads frames, runs them on a small worker
+ * pool, and its workers coalesce replies the same way: whichever finds
+ * no write in progress writes out every reply queued so far.
+ *
+ * A call that is not answered within the timeout drops the connection
+ * and fails every call on it (503 with Retry-After to the client); a
+ * node that cannot be reached fails calls at once for CLUSTER_RETRY_MS.
+ * Reservations a peer still holds when its connection drops are aborted,
+ * so a node that dies mid-request does not leave keys stuck in flight.
+ *
+ * The peer port is bound to this node's own address from the peer list,
+ * never to every interface. Each connection starts with a HELLO frame
+ * carrying the shared secret; one that does not is closed before any of
+ * its key operations run. The secret travels in the clear, so peer
+ * traffic belongs on a private network.
+ */
+
+#include "cluster.h"
+#include "logger.h"
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+/* Read buffer per connection (grows to a whole frame when needed) */
+#define CLUSTER_READ_SIZE (64 * 1024)
+
+/* How often a duplicate asks the owner again while its original is in flight */
+#define CLUSTER_WAIT_POLL_MS 10
+
+/* Key operations */
+typedef enum {
+    CLUSTER_OP_BEGIN = 1,   /* digest -> idempotency_result_t (+ response on replay), no wait */
+    CLUSTER_OP_PEEK,        /* -> idempotency_peek() + 1 (+ response if cached) */
+    CLUSTER_OP_COMPLETE,    /* status, content type, body -> 0, 1 if not cached, 2 if not durable */
+    CLUSTER_OP_ABORT,       /* -> 0 */
+    CLUSTER_OP_HELLO        /* Shared secret as the key; first frame of a connection, no reply */
+} cluster_op_t;
+
+/*
+ * Frame header (requests and replies)
+ * Followed by key, content type and body bytes; replies carry no key
+ */
+typedef struct {
+    uint32_t length;                /* Payload bytes after the header */
+    uint32_t id;                    /* Call id, echoed by the reply */
+    uint8_t op;                     /* cluster_op_t */
+    uint8_t result;                 /* Reply outcome */
+    uint16_t status_code;           /* Response status (0 = no response attached) */
+    uint16_t key_length;
+    uint16_t content_type_length;
+    uint32_t body_length;
+    uint64_t digest;                /* BEGIN: request digest */
+} frame_t;
+
+/* A key reserved on behalf of a peer */
+typedef struct {
+    char *key;
+    size_t length;
+} reserved_key_t;
+
+/* Incoming connection from a peer */
+typedef struct cluster_link {
+    int fd;
+    cluster_t *cluster;
+    pthread_mutex_t lock;
+    char *out;                  /* Replies not yet written */
+    size_t out_length;
+    size_t out_capacity;
+    bool writing;               /* A worker is writing; the others only append */
+    int refs;                   /* Reader + queued jobs; the last one cleans up */
+    bool finished;              /* Reader and jobs done: ready to be joined and freed */
+    reserved_key_t *reserved;   /* Keys reserved for the peer and not yet resolved */
+    int num_reserved;
+    int reserved_capacity;
+    pthread_t reader;
+    struct cluster_link *next;
+} cluster_link_t;
+
+/* Key operation received from a peer */
+typedef struct cluster_job {
+    cluster_link_t *link;
+    frame_t frame;
+    struct cluster_job *next;
+    char payload[];
+} cluster_job_t;
+
+/* I/O thread state of an outgoing connection */
+typedef struct {
+    int fd;
+    char *send;                 /* Batch being written */
+    size_t send_length;
+    size_t send_offset;
+    size_t send_capacity;
+    char *in;                   /* Replies read so far */
+    size_t in_length;
+    size_t in_capacity;
+} peer_io_t;
+
+/*
+ * Fill cluster settings with built-in defaults
+ */
+void cluster_config_init_defaults(cluster_config_t *config) {
+    if (config == NULL) {
+        return;
+    }
+
+    config->peers = NULL;
+    config->self = NULL;
+    config->timeout_ms = CLUSTER_DEFAULT_TIMEOUT_MS;
+    config->secret_file = NULL;
+}
+
+/*
+ * Helper function: Big-endian field encoding
+ */
+static void put16(unsigned char *p, uint16_t v) {
+    p[0] = (unsigned char)(v >> 8);
+    p[1] = (unsigned char)v;
+}
+
+static void put32(unsigned char *p, uint32_t v) {
+    put16(p, (uint16_t)(v >> 16));
+    put16(p + 2, (uint16_t)v);
+}
+
+static void put64(unsigned char *p, uint64_t v) {
+    put32(p, (uint32_t)(v >> 32));
+    put32(p + 4, (uint32_t)v);
+}
+
+static uint16_t get16(const unsigned char *p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t get32(const unsigned char *p) {
+    return ((uint32_t)get16(p) << 16) | get16(p + 2);
+}
+
+static uint64_t get64(const unsigned char *p) {
+    return ((uint64_t)get32(p) << 32) | get32(p + 4);
+}
+
+/*
+ * Helper function: Encode a frame header into CLUSTER_HEADER_SIZE bytes
+ */
+static void frame_encode(char *dst, const frame_t *frame) {
+    unsigned char *p = (unsigned char *)dst;
+    memset(p, 0, CLUSTER_HEADER_SIZE);
+    put32(p, frame->length);
+    put32(p + 4, frame->id);
+    p[8] = frame->op;
+    p[9] = frame->result;
+    put16(p + 10, frame->status_code);
+    put16(p + 12, frame->key_length);
+    put16(p + 14, frame->content_type_length);
+    put32(p + 16, frame->body_length);
+    put64(p + 20, frame->digest);
+}
+
+/*
+ * Helper function: Decode a frame header
+ * Returns 0 on success, -1 if the lengths are inconsistent or too large
+ */
+static int frame_decode(const char *src, frame_t *frame) {
+    const unsigned char *p = (const unsigned char *)src;
+    frame->length = get32(p);
+    frame->id = get32(p + 4);
+    frame->op = p[8];
+    frame->result = p[9];
+    frame->status_code = get16(p + 10);
+    frame->key_length = get16(p + 12);
+    frame->content_type_length = get16(p + 14);
+    frame->body_length = get32(p + 16);
+    frame->digest = get64(p + 20);
+
+    uint64_t payload = (uint64_t)frame->key_length + frame->content_type_length +
+                       frame->body_length;
+    return payload == frame->length && payload <= CLUSTER_MAX_PAYLOAD ? 0 : -1;
+}
+
+/*
+ * Helper function: Make room for length more bytes in a growable buffer
+ * Returns 0 on success, -1 if out of memory
+ */
+static int buffer_reserve(char **buffer, size_t used, size_t *capacity, size_t length) {
+    if (used + length <= *capacity) {
+        return 0;
+    }
+
+    size_t new_capacity = *capacity > 0 ? *capacity : 4096;
+    while (new_capacity < used + length) {
+        new_capacity *= 2;
+    }
+    char *grown = (char *)realloc(*buffer, new_capacity);
+    if (grown == NULL) {
+        return -1;
+    }
+    *buffer = grown;
+    *capacity = new_capacity;
+    return 0;
+}
+
+/*
+ * Helper function: Append a frame (header and payload parts) to a buffer
+ * Returns 0 on success, -1 if out of memory
+ */
+static int frame_append(char **buffer, size_t *length, size_t *capacity, const frame_t *frame,
+                        const char *key, const char *content_type, const char *body) {
+    if (buffer_reserve(buffer, *length, capacity, CLUSTER_HEADER_SIZE + frame->length) != 0) {
+        return -1;
+    }
+
+    char *p = *buffer + *length;
+    frame_encode(p, frame);
+    p += CLUSTER_HEADER_SIZE;
+    if (frame->key_length > 0) {
+        memcpy(p, key, frame->key_length);
+        p += frame->key_length;
+    }
+    if (frame->content_type_length > 0) {
+        memcpy(p, content_type, frame->content_type_length);
+        p += frame->content_type_length;
+    }
+    if (frame->body_length > 0) {
+        memcpy(p, body, frame->body_length);
+    }
+    *length += CLUSTER_HEADER_SIZE + frame->length;
+    return 0;
+}
+
+/*
+ * Helper function: Finalizer spreading a 64-bit hash over all bits
+ */
+static uint64_t mix64(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    return x;
+}
+
+/*
+ * Helper function: Absolute CLOCK_REALTIME deadline delay_ms from now
+ */
+static struct timespec deadline_after(int delay_ms) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += delay_ms / 1000;
+    deadline.tv_nsec += (long)(delay_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    return deadline;
+}
+
+/*
+ * Helper function: Write a whole buffer to a blocking socket
+ * Returns 0 on success, -1 on error
+ */
+static int write_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t written = send(fd, data, length, MSG_NOSIGNAL);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += written;
+        length -= (size_t)written;
+    }
+    return 0;
+}
+
+/*
+ * Helper function: Wake a peer's I/O thread
+ */
+static void peer_wake(cluster_peer_t *peer) {
+    char signal = 1;
+    if (write(peer->wake_pipe[1], &signal, 1) < 0 && errno != EAGAIN) {
+        LOG_WARN(NULL, "Failed to wake cluster peer %s: %s", peer->name, strerror(errno));
+    }
+}
+
+/*
+ * Index of the node owning key (highest rendezvous score)
+ */
+int cluster_owner(const cluster_t *cluster, const char *key, size_t key_length) {
+    uint64_t hash = idempotency_digest(0, key, key_length);
+    int owner = 0;
+    uint64_t best = 0;
+
+    for (int i = 0; i < cluster->num_peers; i++) {
+        uint64_t score = mix64(hash ^ cluster->peers[i].seed);
+        if (i == 0 || score > best) {
+            best = score;
+            owner = i;
+        }
+    }
+    return owner;
+}
+
+/*
+ * Helper function: Parse "host:port" (or "[v6]:port") into a peer
+ * Returns 0 on success, -1 on error
+ */
+static int peer_parse(cluster_peer_t *peer, const char *name) {
+    const char *colon = strrchr(name, ':');
+    if (colon == NULL || colon == name || colon[1] == '\0') {
+        LOG_ERROR(NULL, "Invalid cluster peer '%s' (expected host:port)", name);
+        return -1;
+    }
+
+    const char *host = name;
+    size_t host_length = (size_t)(colon - name);
+    if (host[0] == '[' && host_length >= 2 && host[host_length - 1] == ']') {
+        host++;
+        host_length -= 2;
+    }
+
+    peer->name = strdup(name);
+    peer->host = strndup(host, host_length);
+    peer->port = strdup(colon + 1);
+    if (peer->name == NULL || peer->host == NULL || peer->port == NULL) {
+        return -1;
+    }
+    peer->seed = mix64(idempotency_digest(0, name, strlen(name)));
+    return 0;
+}
+
+/*
+ * Helper function: Bind the port peers connect to, on this node's address only
+ * Returns the socket, -1 on error
+ */
+static int listen_socket(const char *host, const char *port) {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo *info = NULL;
+    if (getaddrinfo(host, port, &hints, &info) != 0 || info == NULL) {
+        LOG_ERROR(NULL, "Invalid cluster address %s port %s", host, port);
+        return -1;
+    }
+
+    int fd = socket(info->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int opt = 1;
+    if (fd < 0 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0 ||
+        bind(fd, info->ai_addr, info->ai_addrlen) < 0 || listen(fd, CLUSTER_MAX_PEERS) < 0) {
+        LOG_ERROR(NULL, "Failed to listen for cluster peers on %s port %s: %s", host, port,
+                  strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        freeaddrinfo(info);
+        return -1;
+    }
+
+    freeaddrinfo(info);
+    return fd;
+}
+
+/*
+ * Helper function: Read the shared secret (first line of path, trailing whitespace dropped)
+ * Returns 0 on success, -1 on error
+ */
+static int read_secret(cluster_t *cluster, const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        LOG_ERROR(NULL, "Failed to open cluster secret file %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    char line[CLUSTER_MAX_SECRET + 2];
+    bool got = fgets(line, sizeof(line), fp) != NULL;
+    fclose(fp);
+
+    size_t length = got ? strlen(line) : 0;
+    while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r' ||
+                          line[length - 1] == ' ' || line[length - 1] == '\t')) {
+        length--;
+    }
+    if (length == 0 || length >= CLUSTER_MAX_SECRET) {
+        LOG_ERROR(NULL, "Cluster secret in %s must be 1-%d bytes", path, CLUSTER_MAX_SECRET - 1);
+        return -1;
+    }
+
+    memcpy(cluster->secret, line, length);
+    cluster->secret_length = length;
+    return 0;
+}
+
+/*
+ * Helper function: Compare a presented secret without leaking where it differs
+ */
+static bool secret_matches(const cluster_t *cluster, const char *secret, size_t length) {
+    if (length != cluster->secret_length) {
+        return false;
+    }
+
+    unsigned char diff = 0;
+    for (size_t i = 0; i < length; i++) {
+        diff |= (unsigned char)(secret[i] ^ cluster->secret[i]);
+    }
+    return diff == 0;
+}
+
+/*
+ * Parse the peer list, read the shared secret and bind the peer port
+ * Returns 0 on success, -1 on error
+ */
+int cluster_init(cluster_t *cluster, const cluster_config_t *config, idempotency_store_t *store) {
+    if (cluster == NULL || config == NULL || config->peers == NULL || store == NULL) {
+        LOG_ERROR(NULL, "cluster_init: invalid parameters");
+        return -1;
+    }
+    if (config->self == NULL) {
+        LOG_ERROR(NULL, "Cluster mode needs --cluster-self (this node's entry in the peer list)");
+        return -1;
+    }
+    if (config->secret_file == NULL) {
+        LOG_ERROR(NULL, "Cluster mode needs --cluster-secret-file (the secret peers present)");
+        return -1;
+    }
+
+    memset(cluster, 0, sizeof(*cluster));
+    cluster->self = -1;
+    cluster->listen_fd = -1;
+    cluster->stop_pipe[0] = -1;
+    cluster->stop_pipe[1] = -1;
+    cluster->timeout_ms = config->timeout_ms > 0 ? config->timeout_ms
+                                                 : CLUSTER_DEFAULT_TIMEOUT_MS;
+    cluster->store = store;
+    pthread_mutex_init(&cluster->lock, NULL);
+    pthread_cond_init(&cluster->work, NULL);
+
+    char *list = strdup(config->peers);
+    if (list == NULL) {
+        cluster_destroy(cluster);
+        return -1;
+    }
+
+    char *saveptr = NULL;
+    for (char *name = strtok_r(list, ", ", &saveptr); name != NULL;
+         name = strtok_r(NULL, ", ", &saveptr)) {
+        if (cluster->num_peers == CLUSTER_MAX_PEERS) {
+            LOG_ERROR(NULL, "Too many cluster peers (at most %d)", CLUSTER_MAX_PEERS);
+            free(list);
+            cluster_destroy(cluster);
+            return -1;
+        }
+        for (int i = 0; i < cluster->num_peers; i++) {
+            if (strcmp(cluster->peers[i].name, name) == 0) {
+                LOG_ERROR(NULL, "Cluster peer %s listed twice", name);
+                free(list);
+                cluster_destroy(cluster);
+                return -1;
+            }
+        }
+
+        cluster_peer_t *peer = &cluster->peers[cluster->num_peers++];
+        peer->cluster = cluster;
+        peer->fd = -1;
+        peer->wake_pipe[0] = -1;
+        peer->wake_pipe[1] = -1;
+        pthread_mutex_init(&peer->lock, NULL);
+        pthread_cond_init(&peer->replied, NULL);
+        if (peer_parse(peer, name) < 0 || pipe(peer->wake_pipe) < 0) {
+            free(list);
+            cluster_destroy(cluster);
+            return -1;
+        }
+        for (int i = 0; i < 2; i++) {
+            fcntl(peer->wake_pipe[i], F_SETFL, fcntl(peer->wake_pipe[i], F_GETFL, 0) | O_NONBLOCK);
+        }
+        if (strcmp(name, config->self) == 0) {
+            cluster->self = cluster->num_peers - 1;
+        }
+    }
+    free(list);
+
+    if (cluster->self < 0) {
+        LOG_ERROR(NULL, "--cluster-self %s is not in the peer list", config->self);
+        cluster_destroy(cluster);
+        return -1;
+    }
+
+    if (read_secret(cluster, config->secret_file) < 0) {
+        cluster_destroy(cluster);
+        return -1;
+    }
+
+    cluster->listen_fd = listen_socket(cluster->peers[cluster->self].host,
+                                       cluster->peers[cluster->self].port);
+    if (cluster->listen_fd < 0 || pipe(cluster->stop_pipe) < 0) {
+        cluster_destroy(cluster);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Helper function: Fail every call waiting on a peer and drop its connection
+ * retry: also fail new calls for CLUSTER_RETRY_MS (the peer is unreachable)
+ */
+static void peer_disconnect(cluster_peer_t *peer, peer_io_t *io, bool retry, const char *why) {
+    if (io->fd >= 0) {
+        close(io->fd);
+        io->fd = -1;
+    }
+    io->send_length = 0;
+    io->send_offset = 0;
+    io->in_length = 0;
+
+    pthread_mutex_lock(&peer->lock);
+    int failed = 0;
+    for (cluster_call_t *call = peer->calls; call != NULL; call = call->next) {
+        call->done = true;
+        call->failed = true;
+        failed++;
+    }
+    peer->calls = NULL;
+    peer->out_length = 0;
+    peer->reset = false;
+    if (retry) {
+        peer->retry_ns = metrics_now_ns() + (uint64_t)CLUSTER_RETRY_MS * 1000000;
+    }
+    pthread_cond_broadcast(&peer->replied);
+    pthread_mutex_unlock(&peer->lock);
+
+    if (why != NULL) {
+        LOG_WARN(NULL, "Cluster peer %s: %s (%d calls failed)", peer->name, why, failed);
+    }
+}
+
+/*
+ * Helper function: Connect to a peer within the call timeout
+ * Returns 0 on success, -1 on error
+ */
+static int peer_connect(cluster_peer_t *peer, peer_io_t *io) {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo *info = NULL;
+    if (getaddrinfo(peer->host, peer->port, &hints, &info) != 0 || info == NULL) {
+        return -1;
+    }
+
+    int fd = socket(info->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        freeaddrinfo(info);
+        return -1;
+    }
+
+    int result = connect(fd, info->ai_addr, info->ai_addrlen);
+    freeaddrinfo(info);
+    if (result < 0 && errno == EINPROGRESS) {
+        struct pollfd pfd = { .fd = fd, .events = POLLOUT, .revents = 0 };
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if (poll(&pfd, 1, peer->cluster->timeout_ms) == 1 &&
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) == 0 && error == 0) {
+            result = 0;
+        }
+    }
+    if (result < 0) {
+        close(fd);
+        return -1;
+    }
+
+    /* Present the secret before any key operation (a fresh socket has room for it) */
+    const cluster_t *cluster = peer->cluster;
+    frame_t frame = { .op = CLUSTER_OP_HELLO, .key_length = (uint16_t)cluster->secret_length,
+                      .length = (uint32_t)cluster->secret_length };
+    char hello[CLUSTER_HEADER_SIZE + CLUSTER_MAX_SECRET];
+    size_t hello_length = CLUSTER_HEADER_SIZE + cluster->secret_length;
+    frame_encode(hello, &frame);
+    memcpy(hello + CLUSTER_HEADER_SIZE, cluster->secret, cluster->secret_length);
+    if (send(fd, hello, hello_length, MSG_NOSIGNAL) != (ssize_t)hello_length) {
+        close(fd);
+        return -1;
+    }
+
+    int opt = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    io->fd = fd;
+    LOG_INFO(NULL, "Connected to cluster peer %s", peer->name);
+    return 0;
+}
+
+/*
+ * Helper function: Match the replies read so far to their calls
+ * Returns 0 on success, -1 on a malformed reply
+ */
+static int peer_replies(cluster_peer_t *peer, peer_io_t *io) {
+    size_t offset = 0;
+    while (io->in_length - offset >= CLUSTER_HEADER_SIZE) {
+        frame_t reply;
+        if (frame_decode(io->in + offset, &reply) != 0) {
+            return -1;
+        }
+        if (io->in_length - offset < CLUSTER_HEADER_SIZE + reply.length) {
+            break;
+        }
+
+        /* Built outside the lock; dropped if the call has gone */
+        const char *payload = io->in + offset + CLUSTER_HEADER_SIZE + reply.key_length;
+        idempotency_response_t *response = NULL;
+        if (reply.status_code != 0) {
+            char content_type[IDEMPOTENCY_MAX_CONTENT_TYPE];
+            size_t ct_length = reply.content_type_length < sizeof(content_type) - 1
+                ? reply.content_type_length : sizeof(content_type) - 1;
+            memcpy(content_type, payload, ct_length);
+            content_type[ct_length] = '\0';
+            response = idempotency_response_create(reply.status_code, content_type,
+                                                   payload + reply.content_type_length,
+                                                   reply.body_length);
+        }
+        offset += CLUSTER_HEADER_SIZE + reply.length;
+
+        pthread_mutex_lock(&peer->lock);
+        cluster_call_t **link = &peer->calls;
+        while (*link != NULL && (*link)->id != reply.id) {
+            link = &(*link)->next;
+        }
+        cluster_call_t *call = *link;
+        if (call != NULL) {
+            *link = call->next;
+            call->result = reply.result;
+            call->status_code = reply.status_code;
+            call->response = response;
+            call->done = true;
+            response = NULL;
+            pthread_cond_broadcast(&peer->replied);
+        }
+        pthread_mutex_unlock(&peer->lock);
+
+        if (response != NULL) {
+            idempotency_response_release(response);
+        }
+    }
+
+    io->in_length -= offset;
+    memmove(io->in, io->in + offset, io->in_length);
+    return 0;
+}
+
+/*
+ * Helper function: Outgoing connection I/O thread
+ * Connects on demand, writes each accumulated batch and reads replies
+ */
+static void *peer_thread(void *arg) {
+    cluster_peer_t *peer = (cluster_peer_t *)arg;
+    cluster_t *cluster = peer->cluster;
+    peer_io_t io;
+    memset(&io, 0, sizeof(io));
+    io.fd = -1;
+
+    while (!__atomic_load_n(&cluster->shutdown, __ATOMIC_ACQUIRE)) {
+        /* Take the next batch once the previous one is out */
+        pthread_mutex_lock(&peer->lock);
+        bool reset = peer->reset;
+        bool queued = peer->out_length > 0;
+        if (!reset && io.fd >= 0 && queued && io.send_offset == io.send_length) {
+            char *spare = io.send;
+            size_t spare_capacity = io.send_capacity;
+            io.send = peer->out;
+            io.send_capacity = peer->out_capacity;
+            io.send_length = peer->out_length;
+            io.send_offset = 0;
+            peer->out = spare;
+            peer->out_capacity = spare_capacity;
+            peer->out_length = 0;
+        }
+        pthread_mutex_unlock(&peer->lock);
+
+        if (reset) {
+            peer_disconnect(peer, &io, false, "no reply in time, reconnecting");
+            continue;
+        }
+        if (io.fd < 0 && queued) {
+            if (peer_connect(peer, &io) < 0) {
+                peer_disconnect(peer, &io, true, "unreachable");
+            }
+            continue;
+        }
+
+        bool sending = io.send_offset < io.send_length;
+        struct pollfd pfds[2] = {
+            { .fd = peer->wake_pipe[0], .events = POLLIN, .revents = 0 },
+            { .fd = io.fd, .events = (short)(POLLIN | (sending ? POLLOUT : 0)), .revents = 0 }
+        };
+        if (poll(pfds, io.fd >= 0 ? 2 : 1, -1) < 0) {
+            if (errno != EINTR) {
+                LOG_ERROR(NULL, "Cluster peer poll failed: %s", strerror(errno));
+                break;
+            }
+            continue;
+        }
+
+        if (pfds[0].revents != 0) {
+            char drain[64];
+            while (read(peer->wake_pipe[0], drain, sizeof(drain)) > 0) {
+            }
+        }
+        if (io.fd < 0) {
+            continue;
+        }
+
+        if ((pfds[1].revents & POLLOUT) != 0) {
+            ssize_t written = send(io.fd, io.send + io.send_offset,
+                                   io.send_length - io.send_offset, MSG_NOSIGNAL);
+            if (written < 0 && errno != EAGAIN && errno != EINTR) {
+                peer_disconnect(peer, &io, false, "write failed");
+                continue;
+            }
+            if (written > 0) {
+                io.send_offset += (size_t)written;
+                if (io.send_offset == io.send_length) {
+                    metrics_add(METRIC_CLUSTER_BATCHES, 1);
+                }
+            }
+        }
+
+        if ((pfds[1].revents & (POLLIN | POLLHUP | POLLERR)) != 0) {
+            if (buffer_reserve(&io.in, io.in_length, &io.in_capacity, CLUSTER_READ_SIZE) != 0) {
+                peer_disconnect(peer, &io, false, "out of memory");
+                continue;
+            }
+            ssize_t got = recv(io.fd, io.in + io.in_length, io.in_capacity - io.in_length, 0);
+            if (got == 0 || (got < 0 && errno != EAGAIN && errno != EINTR)) {
+                peer_disconnect(peer, &io, false, "connection closed");
+                continue;
+            }
+            if (got > 0) {
+                io.in_length += (size_t)got;
+                if (peer_replies(peer, &io) != 0) {
+                    peer_disconnect(peer, &io, false, "malformed reply");
+                }
+            }
+        }
+    }
+
+    peer_disconnect(peer, &io, false, NULL);
+    free(io.send);
+    free(io.in);
+    return NULL;
+}
+
+/*
+ * Helper function: Run one key operation on a peer and wait for its reply
+ * Returns 0 with call filled on success, -1 if the peer did not answer
+ */
+static int peer_call(cluster_peer_t *peer, frame_t *frame, const char *key,
+                     const char *content_type, const char *body, cluster_call_t *call) {
+    memset(call, 0, sizeof(*call));
+    frame->length = (uint32_t)frame->key_length + frame->content_type_length +
+                    frame->body_length;
+    uint64_t start = metrics_now_ns();
+
+    pthread_mutex_lock(&peer->lock);
+    if (!peer->started || start < peer->retry_ns) {
+        pthread_mutex_unlock(&peer->lock);
+        metrics_add(METRIC_CLUSTER_CALLS_FAILED, 1);
+        return -1;
+    }
+
+    call->id = ++peer->next_id;
+    frame->id = call->id;
+    bool wake = peer->out_length == 0;
+    if (frame_append(&peer->out, &peer->out_length, &peer->out_capacity, frame, key,
+                     content_type, body) != 0) {
+        pthread_mutex_unlock(&peer->lock);
+        metrics_add(METRIC_CLUSTER_CALLS_FAILED, 1);
+        return -1;
+    }
+    call->next = peer->calls;
+    peer->calls = call;
+    if (wake) {
+        peer_wake(peer);
+    }
+
+    /* Past the deadline the connection is dropped, which fails this call too */
+    struct timespec deadline = deadline_after(peer->cluster->timeout_ms);
+    bool timed_out = false;
+    while (!call->done) {
+        if (timed_out) {
+            pthread_cond_wait(&peer->replied, &peer->lock);
+        } else if (pthread_cond_timedwait(&peer->replied, &peer->lock, &deadline) == ETIMEDOUT &&
+                   !call->done) {
+            timed_out = true;
+            peer->reset = true;
+            peer_wake(peer);
+        }
+    }
+    pthread_mutex_unlock(&peer->lock);
+
+    metrics_observe(METRIC_CLUSTER_CALL, metrics_now_ns() - start);
+    metrics_add(call->failed ? METRIC_CLUSTER_CALLS_FAILED : METRIC_CLUSTER_CALLS_OK, 1);
+    return call->failed ? -1 : 0;
+}
+
+/*
+ * Helper function: Connection to the node owning key
+ * Returns the peer, NULL if the key is local (or clustering is off)
+ */
+static cluster_peer_t *remote_owner(idempotency_store_t *store, const char *key,
+                                    size_t key_length) {
+    cluster_t *cluster = store != NULL ? store->cluster : NULL;
+    if (cluster == NULL) {
+        return NULL;
+    }
+
+    int owner = cluster_owner(cluster, key, key_length);
+    return owner == cluster->self ? NULL : &cluster->peers[owner];
+}
+
+/*
+ * Helper function: One BEGIN on a remote owner (which never waits for an original)
+ */
+static idempotency_result_t remote_begin(cluster_peer_t *peer, const char *key,
+                                         size_t key_length, uint64_t digest,
+                                         idempotency_response_t **cached) {
+    frame_t frame = { .op = CLUSTER_OP_BEGIN, .key_length = (uint16_t)key_length,
+                      .digest = digest };
+    cluster_call_t call;
+    if (peer_call(peer, &frame, key, NULL, NULL, &call) != 0) {
+        return IDEMPOTENCY_UNAVAILABLE;
+    }
+
+    if (call.result == IDEMPOTENCY_REPLAY && call.response != NULL) {
+        *cached = call.response;
+        return IDEMPOTENCY_REPLAY;
+    }
+    if (call.response != NULL) {
+        idempotency_response_release(call.response);
+    }
+    switch (call.result) {
+        case IDEMPOTENCY_PROCEED:
+        case IDEMPOTENCY_IN_FLIGHT:
+        case IDEMPOTENCY_MISMATCH:
+            return (idempotency_result_t)call.result;
+        default:
+            return IDEMPOTENCY_ERROR;
+    }
+}
+
+/*
+ * idempotency_begin() on the key's owner
+ */
+idempotency_result_t cluster_begin(idempotency_store_t *store, const char *key,
+                                   size_t key_length, uint64_t digest,
+                                   idempotency_response_t **cached) {
+    cluster_peer_t *peer = remote_owner(store, key, key_length);
+    if (peer == NULL) {
+        return idempotency_begin(store, key, key_length, digest, cached);
+    }
+    if (cached == NULL || key_length > UINT16_MAX) {
+        return IDEMPOTENCY_ERROR;
+    }
+
+    /* The wait for an in-flight original happens here, not on one of the owner's workers */
+    *cached = NULL;
+    uint64_t deadline = metrics_now_ns() + (uint64_t)store->wait_ms * 1000000;
+    for (;;) {
+        idempotency_result_t result = remote_begin(peer, key, key_length, digest, cached);
+        if (result != IDEMPOTENCY_IN_FLIGHT || store->wait_ms <= 0 ||
+            metrics_now_ns() >= deadline) {
+            return result;
+        }
+        struct timespec pause = { .tv_sec = 0, .tv_nsec = CLUSTER_WAIT_POLL_MS * 1000000L };
+        nanosleep(&pause, NULL);
+    }
+}
+
+/*
+ * idempotency_peek() on the key's owner
+ */
+int cluster_peek(idempotency_store_t *store, const char *key, size_t key_length,
+                 idempotency_response_t **cached) {
+    cluster_peer_t *peer = remote_owner(store, key, key_length);
+    if (peer == NULL) {
+        return idempotency_peek(store, key, key_length, cached);
+    }
+    if (cached == NULL || key_length > UINT16_MAX) {
+        return -1;
+    }
+
+    *cached = NULL;
+    frame_t frame = { .op = CLUSTER_OP_PEEK, .key_length = (uint16_t)key_length };
+    cluster_call_t call;
+    if (peer_call(peer, &frame, key, NULL, NULL, &call) != 0) {
+        return -1;
+    }
+
+    int found = call.result - 1;
+    if (found == 1 && call.response != NULL) {
+        *cached = call.response;
+        return 1;
+    }
+    if (call.response != NULL) {
+        idempotency_response_release(call.response);
+    }
+    return found == 0 ? 0 : -1;
+}
+
+/*
+ * idempotency_complete() on the key's owner
+ */
+int cluster_complete(idempotency_store_t *store, const char *key, size_t key_length,
+                     int status_code, const char *content_type,
+                     const char *body, size_t body_length) {
+    cluster_peer_t *peer = remote_owner(store, key, key_length);
+    if (peer == NULL) {
+        return idempotency_complete(store, key, key_length, status_code, content_type,
+                                    body, body_length);
+    }
+
+    size_t ct_length = content_type != NULL ? strlen(content_type) : 0;
+    if (ct_length >= IDEMPOTENCY_MAX_CONTENT_TYPE) {
+        ct_length = IDEMPOTENCY_MAX_CONTENT_TYPE - 1;
+    }
+    /* Unless the owner confirms it cached the response, a retry would run the payment again */
+    if (key_length > UINT16_MAX || status_code <= 0 || status_code > UINT16_MAX ||
+        key_length + ct_length + body_length > CLUSTER_MAX_PAYLOAD) {
+        cluster_abort(store, key, key_length);
+        return IDEMPOTENCY_NOT_DURABLE;
+    }
+
+    frame_t frame = {
+        .op = CLUSTER_OP_COMPLETE,
+        .status_code = (uint16_t)status_code,
+        .key_length = (uint16_t)key_length,
+        .content_type_length = (uint16_t)ct_length,
+        .body_length = (uint32_t)body_length
+    };
+    cluster_call_t call;
+    if (peer_call(peer, &frame, key, content_type, body, &call) != 0) {
+        return IDEMPOTENCY_NOT_DURABLE;
+    }
+    if (call.response != NULL) {
+        idempotency_response_release(call.response);
+    }
+    return call.result == 0 ? 0 : IDEMPOTENCY_NOT_DURABLE;
+}
+
+/*
+ * idempotency_abort() on the key's owner
+ */
+void cluster_abort(idempotency_store_t *store, const char *key, size_t key_length) {
+    cluster_peer_t *peer = remote_owner(store, key, key_length);
+    if (peer == NULL) {
+        idempotency_abort(store, key, key_length);
+        return;
+    }
+    if (key_length > UINT16_MAX) {
+        return;
+    }
+
+    /* If this fails too, the owner aborts the key when the connection drops */
+    frame_t frame = { .op = CLUSTER_OP_ABORT, .key_length = (uint16_t)key_length };
+    cluster_call_t call;
+    if (peer_call(peer, &frame, key, NULL, NULL, &call) == 0 && call.response != NULL) {
+        idempotency_response_release(call.response);
+    }
+}
+
+/*
+ * Helper function: Remember a key reserved for a link's peer
+ */
+static void link_reserve(cluster_link_t *link, const char *key, size_t key_length) {
+    pthread_mutex_lock(&link->lock);
+    if (link->num_reserved == link->reserved_capacity) {
+        int capacity = link->reserved_capacity > 0 ? link->reserved_capacity * 2 : 16;
+        reserved_key_t *grown = (reserved_key_t *)realloc(link->reserved,
+                                                          sizeof(reserved_key_t) *
+                                                          (size_t)capacity);
+        if (grown == NULL) {
+            pthread_mutex_unlock(&link->lock);
+            return;
+        }
+        link->reserved = grown;
+        link->reserved_capacity = capacity;
+    }
+
+    char *copy = strndup(key, key_length);
+    if (copy != NULL) {
+        link->reserved[link->num_reserved].key = copy;
+        link->reserved[link->num_reserved].length = key_length;
+        link->num_reserved++;
+    }
+    pthread_mutex_unlock(&link->lock);
+}
+
+/*
+ * Helper function: Forget a reserved key once the peer resolves it
+ */
+static void link_unreserve(cluster_link_t *link, const char *key, size_t key_length) {
+    pthread_mutex_lock(&link->lock);
+    for (int i = 0; i < link->num_reserved; i++) {
+        if (link->reserved[i].length == key_length &&
+            memcmp(link->reserved[i].key, key, key_length) == 0) {
+            free(link->reserved[i].key);
+            link->reserved[i] = link->reserved[--link->num_reserved];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&link->lock);
+}
+
+/*
+ * Helper function: Drop a reference to a link
+ * The last one aborts the keys its peer still held and closes the socket
+ */
+static void link_release(cluster_link_t *link) {
+    pthread_mutex_lock(&link->lock);
+    bool last = --link->refs == 0;
+    pthread_mutex_unlock(&link->lock);
+    if (!last) {
+        return;
+    }
+
+    if (link->num_reserved > 0) {
+        LOG_WARN(NULL, "Cluster peer left with %d keys in flight; aborting them",
+                 link->num_reserved);
+    }
+    for (int i = 0; i < link->num_reserved; i++) {
+        idempotency_abort(link->cluster->store, link->reserved[i].key, link->reserved[i].length);
+        free(link->reserved[i].key);
+    }
+    link->num_reserved = 0;
+
+    close(link->fd);
+    link->fd = -1;
+    __atomic_store_n(&link->finished, true, __ATOMIC_RELEASE);
+}
+
+/*
+ * Helper function: Queue a reply on a link and write out every queued reply
+ * unless another worker is already doing so
+ */
+static void link_send(cluster_link_t *link, const frame_t *reply, const char *content_type,
+                      const char *body) {
+    pthread_mutex_lock(&link->lock);
+    if (frame_append(&link->out, &link->out_length, &link->out_capacity, reply, NULL,
+                     content_type, body) != 0) {
+        pthread_mutex_unlock(&link->lock);
+        shutdown(link->fd, SHUT_RDWR);
+        return;
+    }
+    if (link->writing) {
+        pthread_mutex_unlock(&link->lock);
+        return;
+    }
+
+    link->writing = true;
+    char *batch = NULL;
+    size_t batch_capacity = 0;
+    while (link->out_length > 0) {
+        char *pending = link->out;
+        size_t pending_length = link->out_length;
+        link->out = batch;
+        link->out_capacity = batch_capacity;
+        link->out_length = 0;
+        pthread_mutex_unlock(&link->lock);
+
+        if (write_all(link->fd, pending, pending_length) != 0) {
+            shutdown(link->fd, SHUT_RDWR);
+        }
+        metrics_add(METRIC_CLUSTER_BATCHES, 1);
+
+        batch = pending;
+        pthread_mutex_lock(&link->lock);
+        batch_capacity = link->out_capacity;
+        if (link->out_length == 0) {
+            /* Keep the larger buffer for the next batch */
+            free(link->out);
+            link->out = batch;
+            link->out_capacity = batch_capacity;
+            batch = NULL;
+        }
+    }
+    link->writing = false;
+    pthread_mutex_unlock(&link->lock);
+    free(batch);
+}
+
+/*
+ * Helper function: Run a key operation received from a peer and reply
+ */
+static void job_run(cluster_job_t *job) {
+    cluster_link_t *link = job->link;
+    idempotency_store_t *store = link->cluster->store;
+    const frame_t *frame = &job->frame;
+    const char *key = job->payload;
+    const char *content_type = key + frame->key_length;
+    const char *body = content_type + frame->content_type_length;
+
+    frame_t reply = { .id = frame->id, .op = frame->op };
+    idempotency_response_t *response = NULL;
+
+    switch (frame->op) {
+        case CLUSTER_OP_BEGIN:
+            /* Answered at once: a duplicate waiting here would hold a shared worker */
+            reply.result = (uint8_t)idempotency_try_begin(store, key, frame->key_length,
+                                                          frame->digest, &response);
+            if (reply.result == IDEMPOTENCY_PROCEED) {
+                link_reserve(link, key, frame->key_length);
+            }
+            break;
+        case CLUSTER_OP_PEEK:
+            reply.result = (uint8_t)(idempotency_peek(store, key, frame->key_length,
+                                                      &response) + 1);
+            break;
+        case CLUSTER_OP_COMPLETE: {
+            char type[IDEMPOTENCY_MAX_CONTENT_TYPE];
+            size_t ct_length = frame->content_type_length < sizeof(type) - 1
+                ? frame->content_type_length : sizeof(type) - 1;
+            memcpy(type, content_type, ct_length);
+            type[ct_length] = '\0';
+
+            /* Resolved from here on: a dropped connection must not abort it */
+            link_unreserve(link, key, frame->key_length);
+            int completed = idempotency_complete(store, key, frame->key_length,
+                                                 frame->status_code, type, body,
+                                                 frame->body_length);
+            reply.result = completed == 0 ? 0 : completed == IDEMPOTENCY_NOT_DURABLE ? 2 : 1;
+            break;
+        }
+        case CLUSTER_OP_ABORT:
+            link_unreserve(link, key, frame->key_length);
+            idempotency_abort(store, key, frame->key_length);
+            break;
+        default:
+            reply.result = UINT8_MAX;
+            break;
+    }
+    metrics_add(METRIC_CLUSTER_SERVED, 1);
+
+    const char *reply_type = NULL;
+    const char *reply_body = NULL;
+    if (response != NULL) {
+        reply.status_code = (uint16_t)response->status_code;
+        reply.content_type_length = (uint16_t)strlen(response->content_type);
+        reply.body_length = (uint32_t)response->body_length;
+        reply_type = response->content_type;
+        reply_body = response->body;
+    }
+    reply.length = (uint32_t)reply.content_type_length + reply.body_length;
+
+    link_send(link, &reply, reply_type, reply_body);
+    if (response != NULL) {
+        idempotency_response_release(response);
+    }
+}
+
+/*
+ * Helper function: Worker thread running key operations for peers
+ */
+static void *worker_thread(void *arg) {
+    cluster_t *cluster = (cluster_t *)arg;
+
+    for (;;) {
+        pthread_mutex_lock(&cluster->lock);
+        while (cluster->jobs_head == NULL && !cluster->shutdown) {
+            pthread_cond_wait(&cluster->work, &cluster->lock);
+        }
+        cluster_job_t *job = cluster->jobs_head;
+        if (job == NULL) {
+            pthread_mutex_unlock(&cluster->lock);
+            return NULL;
+        }
+        cluster->jobs_head = job->next;
+        if (cluster->jobs_head == NULL) {
+            cluster->jobs_tail = NULL;
+        }
+        pthread_mutex_unlock(&cluster->lock);
+
+        job_run(job);
+        link_release(job->link);
+        free(job);
+    }
+}
+
+/*
+ * Helper function: Reader thread of an incoming connection
+ * Checks the peer's HELLO, then splits the stream into frames and queues
+ * each for the workers
+ */
+static void *link_reader(void *arg) {
+    cluster_link_t *link = (cluster_link_t *)arg;
+    cluster_t *cluster = link->cluster;
+    char *buffer = NULL;
+    size_t length = 0;
+    size_t capacity = 0;
+    bool authenticated = false;
+
+    for (;;) {
+        if (buffer_reserve(&buffer, length, &capacity, CLUSTER_READ_SIZE) != 0) {
+            break;
+        }
+        ssize_t got = recv(link->fd, buffer + length, capacity - length, 0);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            break;
+        }
+        length += (size_t)got;
+
+        size_t offset = 0;
+        bool malformed = false;
+        bool rejected = false;
+        while (length - offset >= CLUSTER_HEADER_SIZE) {
+            frame_t frame;
+            if (frame_decode(buffer + offset, &frame) != 0) {
+                malformed = true;
+                break;
+            }
+            if (!authenticated && (frame.op != CLUSTER_OP_HELLO ||
+                                   frame.length >= CLUSTER_MAX_SECRET)) {
+                rejected = true;
+                break;
+            }
+            if (length - offset < CLUSTER_HEADER_SIZE + frame.length) {
+                break;
+            }
+
+            const char *payload = buffer + offset + CLUSTER_HEADER_SIZE;
+            if (!authenticated) {
+                if (frame.key_length != frame.length ||
+                    !secret_matches(cluster, payload, frame.key_length)) {
+                    rejected = true;
+                    break;
+                }
+                authenticated = true;
+                offset += CLUSTER_HEADER_SIZE + frame.length;
+                continue;
+            }
+            if (frame.op == CLUSTER_OP_HELLO) {
+                malformed = true;
+                break;
+            }
+
+            cluster_job_t *job = (cluster_job_t *)malloc(sizeof(*job) + frame.length);
+            if (job == NULL) {
+                malformed = true;
+                break;
+            }
+            job->link = link;
+            job->frame = frame;
+            job->next = NULL;
+            memcpy(job->payload, payload, frame.length);
+            offset += CLUSTER_HEADER_SIZE + frame.length;
+
+            pthread_mutex_lock(&link->lock);
+            link->refs++;
+            pthread_mutex_unlock(&link->lock);
+
+            pthread_mutex_lock(&cluster->lock);
+            if (cluster->jobs_tail != NULL) {
+                cluster->jobs_tail->next = job;
+            } else {
+                cluster->jobs_head = job;
+            }
+            cluster->jobs_tail = job;
+            pthread_cond_signal(&cluster->work);
+            pthread_mutex_unlock(&cluster->lock);
+        }
+        if (rejected) {
+            LOG_WARN(NULL, "Cluster peer failed authentication, closing its connection");
+            break;
+        }
+        if (malformed) {
+            LOG_WARN(NULL, "Malformed frame from a cluster peer, closing its connection");
+            break;
+        }
+
+        length -= offset;
+        memmove(buffer, buffer + offset, length);
+    }
+
+    free(buffer);
+    shutdown(link->fd, SHUT_RDWR);
+    link_release(link);
+    return NULL;
+}
+
+/*
+ * Helper function: Join and free links whose peer has gone
+ * all: every link (at shutdown, once the workers have stopped)
+ */
+static void links_reap(cluster_t *cluster, bool all) {
+    pthread_mutex_lock(&cluster->lock);
+    cluster_link_t **next = &cluster->links;
+    while (*next != NULL) {
+        cluster_link_t *link = *next;
+        if (!all && !__atomic_load_n(&link->finished, __ATOMIC_ACQUIRE)) {
+            next = &link->next;
+            continue;
+        }
+        *next = link->next;
+        pthread_mutex_unlock(&cluster->lock);
+
+        pthread_join(link->reader, NULL);
+        pthread_mutex_destroy(&link->lock);
+        free(link->out);
+        free(link->reserved);
+        free(link);
+
+        pthread_mutex_lock(&cluster->lock);
+    }
+    pthread_mutex_unlock(&cluster->lock);
+}
+
+/*
+ * Helper function: Accept connections from peers
+ */
+static void *acceptor_thread(void *arg) {
+    cluster_t *cluster = (cluster_t *)arg;
+
+    for (;;) {
+        struct pollfd pfds[2] = {
+            { .fd = cluster->listen_fd, .events = POLLIN, .revents = 0 },
+            { .fd = cluster->stop_pipe[0], .events = POLLIN, .revents = 0 }
+        };
+        if (poll(pfds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_ERROR(NULL, "Cluster accept poll failed: %s", strerror(errno));
+            return NULL;
+        }
+        if (pfds[1].revents != 0) {
+            return NULL;
+        }
+
+        int fd = accept4(cluster->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            continue;
+        }
+        int opt = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
+        links_reap(cluster, false);
+
+        cluster_link_t *link = (cluster_link_t *)calloc(1, sizeof(cluster_link_t));
+        if (link == NULL) {
+            close(fd);
+            continue;
+        }
+        link->fd = fd;
+        link->cluster = cluster;
+        link->refs = 1;
+        pthread_mutex_init(&link->lock, NULL);
+
+        if (pthread_create(&link->reader, NULL, link_reader, link) != 0) {
+            LOG_ERROR(NULL, "Failed to start cluster connection thread");
+            pthread_mutex_destroy(&link->lock);
+            close(fd);
+            free(link);
+            continue;
+        }
+
+        pthread_mutex_lock(&cluster->lock);
+        link->next = cluster->links;
+        cluster->links = link;
+        pthread_mutex_unlock(&cluster->lock);
+        LOG_DEBUG(NULL, "Cluster peer connected (fd=%d)", fd);
+    }
+}
+
+/*
+ * Start serving key operations for peers and the connections to them
+ * Returns 0 on success, -1 on error
+ */
+int cluster_start(cluster_t *cluster) {
+    if (cluster == NULL || cluster->listen_fd < 0) {
+        LOG_ERROR(NULL, "cluster_start: cluster not initialized");
+        return -1;
+    }
+
+    cluster->started = true;
+    int workers = 0;
+    while (workers < CLUSTER_WORKERS &&
+           pthread_create(&cluster->workers[workers], NULL, worker_thread, cluster) == 0) {
+        workers++;
+    }
+    bool acceptor = workers == CLUSTER_WORKERS &&
+                    pthread_create(&cluster->acceptor, NULL, acceptor_thread, cluster) == 0;
+    if (!acceptor) {
+        LOG_ERROR(NULL, "Failed to start cluster threads");
+        pthread_mutex_lock(&cluster->lock);
+        cluster->shutdown = true;
+        pthread_cond_broadcast(&cluster->work);
+        pthread_mutex_unlock(&cluster->lock);
+        for (int i = 0; i < workers; i++) {
+            pthread_join(cluster->workers[i], NULL);
+        }
+        cluster->started = false;
+        return -1;
+    }
+
+    for (int i = 0; i < cluster->num_peers; i++) {
+        cluster_peer_t *peer = &cluster->peers[i];
+        if (i == cluster->self) {
+            continue;
+        }
+        if (pthread_create(&peer->thread, NULL, peer_thread, peer) != 0) {
+            LOG_WARN(NULL, "Failed to start connection thread for cluster peer %s", peer->name);
+            continue;
+        }
+        pthread_mutex_lock(&peer->lock);
+        peer->started = true;
+        pthread_mutex_unlock(&peer->lock);
+    }
+
+    idempotency_store_set_cluster(cluster->store, cluster);
+    LOG_INFO(NULL, "Cluster node %s: %d nodes, peer traffic on port %s (timeout %dms)",
+             cluster->peers[cluster->self].name, cluster->num_peers,
+             cluster->peers[cluster->self].port, cluster->timeout_ms);
+    return 0;
+}
+
+/*
+ * Stop the threads, close every connection and drop reservations held for peers
+ */
+void cluster_destroy(cluster_t *cluster) {
+    if (cluster == NULL || cluster->store == NULL) {
+        return;
+    }
+
+    idempotency_store_set_cluster(cluster->store, NULL);
+
+    if (cluster->started) {
+        pthread_mutex_lock(&cluster->lock);
+        __atomic_store_n(&cluster->shutdown, true, __ATOMIC_RELEASE);
+        pthread_cond_broadcast(&cluster->work);
+        for (cluster_link_t *link = cluster->links; link != NULL; link = link->next) {
+            shutdown(link->fd, SHUT_RDWR);
+        }
+        pthread_mutex_unlock(&cluster->lock);
+
+        char signal = 1;
+        if (write(cluster->stop_pipe[1], &signal, 1) < 0) {
+            LOG_WARN(NULL, "Failed to stop cluster acceptor: %s", strerror(errno));
+        }
+        pthread_join(cluster->acceptor, NULL);
+
+        /* Workers finish the queued jobs first; replies to closed links just fail */
+        for (int i = 0; i < CLUSTER_WORKERS; i++) {
+            pthread_join(cluster->workers[i], NULL);
+        }
+        links_reap(cluster, true);
+
+        for (int i = 0; i < cluster->num_peers; i++) {
+            if (cluster->peers[i].started) {
+                peer_wake(&cluster->peers[i]);
+                pthread_join(cluster->peers[i].thread, NULL);
+            }
+        }
+        cluster->started = false;
+    }
+
+    for (int i = 0; i < cluster->num_peers; i++) {
+        cluster_peer_t *peer = &cluster->peers[i];
+        for (int j = 0; j < 2; j++) {
+            if (peer->wake_pipe[j] >= 0) {
+                close(peer->wake_pipe[j]);
+            }
+        }
+        pthread_cond_destroy(&peer->replied);
+        pthread_mutex_destroy(&peer->lock);
+        free(peer->out);
+        free(peer->name);
+        free(peer->host);
+        free(peer->port);
+    }
+    cluster->num_peers = 0;
+
+    if (cluster->listen_fd >= 0) {
+        close(cluster->listen_fd);
+    }
+    for (int i = 0; i < 2; i++) {
+        if (cluster->stop_pipe[i] >= 0) {
+            close(cluster->stop_pipe[i]);
+        }
+    }
+    pthread_cond_destroy(&cluster->work);
+    pthread_mutex_destroy(&cluster->lock);
+    cluster->store = NULL;
+}
@@ -0,0 +1,439 @@
+/*
+ * C-HTTP Payment Server - Runtime Configuration
+ * Parses command-line options into server settings
+ */
+
+#include "config.h"
+#include "connection.h"
+#include "thread_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+/*
+ * Fill configuration with built-in defaults
+ */
+void config_init_defaults(server_config_t *config) {
+    if (config == NULL) {
+        return;
+    }
+
+    memset(config, 0, sizeof(*config));
+    config->port = DEFAULT_PORT;
+    config->backlog = DEFAULT_BACKLOG;
+    config->num_threads = 0;
+    config->scheduler = SCHEDULER_MODE_SHARED;
+    config->io_engine = EVENT_ENGINE_EPOLL;
+    config->pin = SCHED_PIN_CORES;
+    config->steer = LISTENER_STEER_NONE;
+    config->idle_timeout_ms = CONN_DEFAULT_IDLE_TIMEOUT_MS;
+    config->max_requests = CONN_DEFAULT_MAX_REQUESTS;
+    config->zerocopy_min_bytes = CONN_DEFAULT_ZEROCOPY_MIN;
+    config->log_level = LOG_INFO;
+    config->log_overflow = LOG_OVERFLOW_DROP;
+    config->audit_log_path = NULL;
+    config->static_root = NULL;
+    config->trace_path = NULL;
+    config->trace_threshold_us = 0;
+    idempotency_config_init_defaults(&config->idempotency);
+    overload_config_init_defaults(&config->overload);
+    wal_config_init_defaults(&config->wal);
+    handoff_config_init_defaults(&config->handoff);
+    cluster_config_init_defaults(&config->cluster);
+#ifdef __linux__
+    config->io_mode = IO_MODE_EPOLL;
+#else
+    config->io_mode = IO_MODE_THREADED;
+#endif
+}
+
+/*
+ * Convert I/O mode enum to string
+ */
+const char *config_io_mode_to_string(io_mode_t mode) {
+    switch (mode) {
+        case IO_MODE_THREADED: return "threaded";
+        case IO_MODE_EPOLL:    return "epoll";
+        case IO_MODE_REUSEPORT: return "reuseport";
+        default:               return "unknown";
+    }
+}
+
+/*
+ * Convert scheduler mode enum to string
+ */
+const char *config_scheduler_mode_to_string(scheduler_mode_t mode) {
+    switch (mode) {
+        case SCHEDULER_MODE_SHARED:   return "shared";
+        case SCHEDULER_MODE_STEALING: return "stealing";
+        default:                      return "unknown";
+    }
+}
+
+/*
+ * Helper function: Parse a bounded integer option
+ * Returns 0 on success, -1 on error
+ */
+static int parse_int_option(const char *name, const char *value, long min, long max, long *out) {
+    char *endptr;
+    long parsed = strtol(value, &endptr, 10);
+
+    if (*value == '\0' || *endptr != '\0' || parsed < min || parsed > max) {
+        fprintf(stderr, "Invalid value for --%s: %s (expected %ld-%ld)\n", name, value, min, max);
+        return -1;
+    }
+
+    *out = parsed;
+    return 0;
+}
+
+/*
+ * Print command-line usage
+ */
+static void print_usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "\n"
+            "Options:\n"
+            "  -p, --port PORT       Port to listen on (default: %d)\n"
+            "  -b, --backlog N       Listen backlog (default: %d)\n"
+            "  -t, --threads N       Worker threads (default: %d for shared,\n"
+            "                        one per CPU for stealing and reuseport)\n"
+            "      --io MODE         Connection I/O model: epoll, reuseport\n"
+            "                        (one loop per thread, no worker pool), threaded\n"
+            "      --io-engine ENGINE\n"
+            "                        Socket I/O engine: epoll, uring (io_uring accept\n"
+            "                        and receives, SEND_ZC with --zerocopy; falls back to\n"
+            "                        epoll if unsupported) (default: epoll)\n"
+            "      --scheduler MODE  Worker scheduling: shared (one queue),\n"
+            "                        stealing (per-core deques) (default: shared)\n"
+            "      --pin POLICY      Pin stealing workers / reuseport loops to CPUs:\n"
+            "                        cores, none (default: cores)\n"
+            "      --steer MODE      Reuseport connection steering: none (kernel hash),\n"
+            "                        cpu (SO_INCOMING_CPU), bpf (RX CPU program)\n"
+            "      --keepalive-timeout MS\n"
+            "                        Close idle connections after MS (default: %d)\n"
+            "      --max-requests N  Requests per connection (default: %d)\n"
+            "      --zerocopy BYTES  Send response bodies of at least BYTES with\n"
+            "                        MSG_ZEROCOPY (default: 0 = off)\n"
+            "      --log-level LEVEL debug, info, warn, error (default: info)\n"
+            "      --log-overflow POLICY\n"
+            "                        When a thread's log ring is full: drop, block\n"
+            "                        (default: drop)\n"
+            "      --audit-log PATH  Append binary payment audit records to PATH\n"
+            "                        (decode with bin/log_decode; default: off)\n"
+            "      --static-root DIR Serve files below DIR under /static/ (default: off)\n"
+            "      --trace PATH      Record request phase timings and write them to PATH\n"
+            "                        as Chrome trace-event JSON on exit (default: off)\n"
+            "      --trace-threshold-us US\n"
+            "                        Only keep traced requests taking US or more (default: 0)\n"
+            "      --idempotency-ttl SEC\n"
+            "                        Keep cached POST responses for SEC (default: %d)\n"
+            "      --idempotency-max-mb MB\n"
+            "                        Idempotency cache memory budget (default: %zu)\n"
+            "      --idempotency-shards N\n"
+            "                        Idempotency cache lock stripes (default: %d)\n"
+            "      --idempotency-wait MS\n"
+            "                        Let duplicates wait MS for an in-flight original\n"
+            "                        instead of failing with 409 (default: %d)\n"
+            "      --idempotency-log DIR\n"
+            "                        Make cached responses durable in a write-ahead log\n"
+            "                        under DIR, replayed on startup (default: off)\n"
+            "      --wal-commit-us US\n"
+            "                        Sync the log at most US after a response (default: %d)\n"
+            "      --wal-commit-batch N\n"
+            "                        ...or once N responses are pending (default: %d)\n"
+            "      --wal-snapshot-sec SEC\n"
+            "                        Snapshot the store and drop old log segments every\n"
+            "                        SEC (default: %d)\n"
+            "      --handoff PATH    Take over the sockets and cached responses of a\n"
+            "                        server running with the same PATH, and hand them\n"
+            "                        to the next one (default: off)\n"
+            "      --handoff-drain-ms MS\n"
+            "                        Let open requests finish for MS before handing\n"
+            "                        over (default: %d)\n"
+            "      --cluster-peers LIST\n"
+            "                        Share idempotency keys with the comma-separated\n"
+            "                        host:port nodes in LIST, each key owned by one node\n"
+            "                        (same LIST on every node; default: off)\n"
+            "      --cluster-self HOST:PORT\n"
+            "                        This node's entry in LIST; PORT takes peer traffic\n"
+            "      --cluster-timeout-ms MS\n"
+            "                        Answer 503 if a key's owner has not replied in MS\n"
+            "                        (default: %d)\n"
+            "      --cluster-secret-file PATH\n"
+            "                        Shared secret every node presents on its peer\n"
+            "                        connections (first line of PATH; required with\n"
+            "                        --cluster-peers; sent in the clear, so keep peer\n"
+            "                        traffic on a private network)\n"
+            "      --queue-limit N   Answer 503 once N connections wait for a worker\n"
+            "                        (per worker with stealing; default: 0 = block)\n"
+            "      --queue-deadline MS\n"
+            "                        Answer 503 to work that waited MS for a worker\n"
+            "                        (default: 0 = off)\n"
+            "      --codel-target MS Shed work while queue waits stay above MS for a\n"
+            "                        whole interval (CoDel; default: 0 = off)\n"
+            "      --codel-interval MS\n"
+            "                        CoDel interval (default: %d)\n"
+            "  -h, --help            Show this help message\n",
+            program, DEFAULT_PORT, DEFAULT_BACKLOG, DEFAULT_THREAD_POOL_SIZE,
+            CONN_DEFAULT_IDLE_TIMEOUT_MS, CONN_DEFAULT_MAX_REQUESTS,
+            IDEMPOTENCY_DEFAULT_TTL_SEC, IDEMPOTENCY_DEFAULT_MAX_BYTES / (1024 * 1024),
+            IDEMPOTENCY_DEFAULT_SHARDS, IDEMPOTENCY_DEFAULT_WAIT_MS,
+            WAL_DEFAULT_COMMIT_US, WAL_DEFAULT_COMMIT_BATCH, WAL_DEFAULT_SNAPSHOT_SEC,
+            HANDOFF_DEFAULT_DRAIN_MS, CLUSTER_DEFAULT_TIMEOUT_MS,
+            OVERLOAD_DEFAULT_CODEL_INTERVAL_MS);
+}
+
+/*
+ * Parse command-line options into configuration
+ * Returns 0 on success, 1 if the program should exit (e.g. --help), -1 on error
+ */
+int config_parse_args(server_config_t *config, int argc, char *argv[]) {
+    enum {
+        OPT_IO = 256, OPT_IO_ENGINE, OPT_SCHEDULER, OPT_PIN, OPT_STEER, OPT_KEEPALIVE_TIMEOUT,
+        OPT_MAX_REQUESTS, OPT_ZEROCOPY, OPT_LOG_LEVEL, OPT_LOG_OVERFLOW,
+        OPT_AUDIT_LOG, OPT_STATIC_ROOT, OPT_TRACE, OPT_TRACE_THRESHOLD,
+        OPT_IDEMPOTENCY_TTL, OPT_IDEMPOTENCY_MAX_MB, OPT_IDEMPOTENCY_SHARDS, OPT_IDEMPOTENCY_WAIT,
+        OPT_IDEMPOTENCY_LOG, OPT_WAL_COMMIT_US, OPT_WAL_COMMIT_BATCH, OPT_WAL_SNAPSHOT_SEC,
+        OPT_HANDOFF, OPT_HANDOFF_DRAIN_MS, OPT_CLUSTER_PEERS, OPT_CLUSTER_SELF,
+        OPT_CLUSTER_TIMEOUT, OPT_CLUSTER_SECRET_FILE,
+        OPT_QUEUE_LIMIT, OPT_QUEUE_DEADLINE, OPT_CODEL_TARGET, OPT_CODEL_INTERVAL
+    };
+
+    static const struct option long_options[] = {
+        { "port",    required_argument, NULL, 'p' },
+        { "backlog", required_argument, NULL, 'b' },
+        { "threads", required_argument, NULL, 't' },
+        { "io",      required_argument, NULL, OPT_IO },
+        { "io-engine", required_argument, NULL, OPT_IO_ENGINE },
+        { "scheduler", required_argument, NULL, OPT_SCHEDULER },
+        { "pin",     required_argument, NULL, OPT_PIN },
+        { "steer",   required_argument, NULL, OPT_STEER },
+        { "keepalive-timeout", required_argument, NULL, OPT_KEEPALIVE_TIMEOUT },
+        { "max-requests",      required_argument, NULL, OPT_MAX_REQUESTS },
+        { "zerocopy",          required_argument, NULL, OPT_ZEROCOPY },
+        { "log-level",         required_argument, NULL, OPT_LOG_LEVEL },
+        { "log-overflow",      required_argument, NULL, OPT_LOG_OVERFLOW },
+        { "audit-log",         required_argument, NULL, OPT_AUDIT_LOG },
+        { "static-root",       required_argument, NULL, OPT_STATIC_ROOT },
+        { "trace",             required_argument, NULL, OPT_TRACE },
+        { "trace-threshold-us", required_argument, NULL, OPT_TRACE_THRESHOLD },
+        { "idempotency-ttl",    required_argument, NULL, OPT_IDEMPOTENCY_TTL },
+        { "idempotency-max-mb", required_argument, NULL, OPT_IDEMPOTENCY_MAX_MB },
+        { "idempotency-shards", required_argument, NULL, OPT_IDEMPOTENCY_SHARDS },
+        { "idempotency-wait",   required_argument, NULL, OPT_IDEMPOTENCY_WAIT },
+        { "idempotency-log",    required_argument, NULL, OPT_IDEMPOTENCY_LOG },
+        { "wal-commit-us",      required_argument, NULL, OPT_WAL_COMMIT_US },
+        { "wal-commit-batch",   required_argument, NULL, OPT_WAL_COMMIT_BATCH },
+        { "wal-snapshot-sec",   required_argument, NULL, OPT_WAL_SNAPSHOT_SEC },
+        { "handoff",            required_argument, NULL, OPT_HANDOFF },
+        { "handoff-drain-ms",   required_argument, NULL, OPT_HANDOFF_DRAIN_MS },
+        { "cluster-peers",      required_argument, NULL, OPT_CLUSTER_PEERS },
+        { "cluster-self",       required_argument, NULL, OPT_CLUSTER_SELF },
+        { "cluster-timeout-ms", required_argument, NULL, OPT_CLUSTER_TIMEOUT },
+        { "cluster-secret-file", required_argument, NULL, OPT_CLUSTER_SECRET_FILE },
+        { "queue-limit",        required_argument, NULL, OPT_QUEUE_LIMIT },
+        { "queue-deadline",     required_argument, NULL, OPT_QUEUE_DEADLINE },
+        { "codel-target",       required_argument, NULL, OPT_CODEL_TARGET },
+        { "codel-interval",     required_argument, NULL, OPT_CODEL_INTERVAL },
+        { "help",    no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    if (config == NULL) {
+        return -1;
+    }
+
+    int opt;
+    long value;
+
+    while ((opt = getopt_long(argc, argv, "p:b:t:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'p':
+                if (parse_int_option("port", optarg, 1, 65535, &value) < 0) return -1;
+                config->port = (uint16_t)value;
+                break;
+            case 'b':
+                if (parse_int_option("backlog", optarg, 1, 65535, &value) < 0) return -1;
+                config->backlog = (int)value;
+                break;
+            case 't':
+                if (parse_int_option("threads", optarg, 1, 1024, &value) < 0) return -1;
+                config->num_threads = (int)value;
+                break;
+            case OPT_IO:
+                if (strcmp(optarg, "epoll") == 0) {
+                    config->io_mode = IO_MODE_EPOLL;
+                } else if (strcmp(optarg, "reuseport") == 0) {
+                    config->io_mode = IO_MODE_REUSEPORT;
+                } else if (strcmp(optarg, "threaded") == 0) {
+                    config->io_mode = IO_MODE_THREADED;
+                } else {
+                    fprintf(stderr, "Invalid value for --io: %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case OPT_IO_ENGINE:
+                if (strcmp(optarg, "epoll") == 0) {
+                    config->io_engine = EVENT_ENGINE_EPOLL;
+                } else if (strcmp(optarg, "uring") == 0) {
+                    config->io_engine = EVENT_ENGINE_URING;
+                } else {
+                    fprintf(stderr, "Invalid value for --io-engine: %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case OPT_SCHEDULER:
+                if (strcmp(optarg, "shared") == 0) {
+                    config->scheduler = SCHEDULER_MODE_SHARED;
+                } else if (strcmp(optarg, "stealing") == 0) {
+                    config->scheduler = SCHEDULER_MODE_STEALING;
+                } else {
+                    fprintf(stderr, "Invalid value for --scheduler: %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case OPT_PIN:
+                if (strcmp(optarg, "cores") == 0) {
+                    config->pin = SCHED_PIN_CORES;
+    config->steer = LISTENER_STEER_NONE;
+                } else if (strcmp(optarg, "none") == 0) {
+                    config->pin = SCHED_PIN_NONE;
+                } else {
+                    fprintf(stderr, "Invalid value for --pin: %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case OPT_STEER:
+                if (strcmp(optarg, "none") == 0) {
+                    config->steer = LISTENER_STEER_NONE;
+                } else if (strcmp(optarg, "cpu") == 0) {
+                    config->steer = LISTENER_STEER_CPU;
+                } else if (strcmp(optarg, "bpf") == 0) {
+                    config->steer = LISTENER_STEER_BPF;
+                } else {
+                    fprintf(stderr, "Invalid value for --steer: %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case OPT_KEEPALIVE_TIMEOUT:
+                if (parse_int_option("keepalive-timeout", optarg, 1, 3600000, &value) < 0) return -1;
+                config->idle_timeout_ms = (int)value;
+                break;
+            case OPT_MAX_REQUESTS:
+                if (parse_int_option("max-requests", optarg, 1, 1000000, &value) < 0) return -1;
+                config->max_requests = (int)value;
+                break;
+            case OPT_ZEROCOPY:
+                if (parse_int_option("zerocopy", optarg, 0, 1L << 30, &value) < 0) return -1;
+                config->zerocopy_min_bytes = (size_t)value;
+                break;
+            case OPT_LOG_LEVEL:
+                if (log_level_from_string(optarg, &config->log_level) < 0) {
+                    fprintf(stderr, "Invalid value for --log-level: %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case OPT_LOG_OVERFLOW:
+                if (strcmp(optarg, "drop") == 0) {
+                    config->log_overflow = LOG_OVERFLOW_DROP;
+                } else if (strcmp(optarg, "block") == 0) {
+                    config->log_overflow = LOG_OVERFLOW_BLOCK;
+                } else {
+                    fprintf(stderr, "Invalid value for --log-overflow: %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case OPT_AUDIT_LOG:
+                config->audit_log_path = optarg;
+                break;
+            case OPT_STATIC_ROOT:
+                config->static_root = optarg;
+                break;
+            case OPT_TRACE:
+                config->trace_path = optarg;
+                break;
+            case OPT_TRACE_THRESHOLD:
+                if (parse_int_option("trace-threshold-us", optarg, 0, 60000000, &value) < 0) return -1;
+                config->trace_threshold_us = value;
+                break;
+            case OPT_IDEMPOTENCY_TTL:
+                if (parse_int_option("idempotency-ttl", optarg, 1, 30 * 86400, &value) < 0) return -1;
+                config->idempotency.ttl_sec = (int)value;
+                break;
+            case OPT_IDEMPOTENCY_MAX_MB:
+                if (parse_int_option("idempotency-max-mb", optarg, 1, 1024 * 1024, &value) < 0) return -1;
+                config->idempotency.max_bytes = (size_t)value * 1024 * 1024;
+                break;
+            case OPT_IDEMPOTENCY_SHARDS:
+                if (parse_int_option("idempotency-shards", optarg, 1, 4096, &value) < 0) return -1;
+                config->idempotency.num_shards = (int)value;
+                break;
+            case OPT_IDEMPOTENCY_WAIT:
+                if (parse_int_option("idempotency-wait", optarg, 0, 60000, &value) < 0) return -1;
+                config->idempotency.wait_ms = (int)value;
+                break;
+            case OPT_IDEMPOTENCY_LOG:
+                config->wal.dir = optarg;
+                break;
+            case OPT_WAL_COMMIT_US:
+                if (parse_int_option("wal-commit-us", optarg, 1, 1000000, &value) < 0) return -1;
+                config->wal.commit_us = (int)value;
+                break;
+            case OPT_WAL_COMMIT_BATCH:
+                if (parse_int_option("wal-commit-batch", optarg, 1, 65536, &value) < 0) return -1;
+                config->wal.commit_batch = (int)value;
+                break;
+            case OPT_WAL_SNAPSHOT_SEC:
+                if (parse_int_option("wal-snapshot-sec", optarg, 1, 86400, &value) < 0) return -1;
+                config->wal.snapshot_sec = (int)value;
+                break;
+            case OPT_HANDOFF:
+                config->handoff.path = optarg;
+                break;
+            case OPT_HANDOFF_DRAIN_MS:
+                if (parse_int_option("handoff-drain-ms", optarg, 0, 600000, &value) < 0) return -1;
+                config->handoff.drain_ms = (int)value;
+                break;
+            case OPT_CLUSTER_PEERS:
+                config->cluster.peers = optarg;
+                break;
+            case OPT_CLUSTER_SELF:
+                config->cluster.self = optarg;
+                break;
+            case OPT_CLUSTER_TIMEOUT:
+                if (parse_int_option("cluster-timeout-ms", optarg, 1, 600000, &value) < 0) return -1;
+                config->cluster.timeout_ms = (int)value;
+                break;
+            case OPT_CLUSTER_SECRET_FILE:
+                config->cluster.secret_file = optarg;
+                break;
+            case OPT_QUEUE_LIMIT:
+                if (parse_int_option("queue-limit", optarg, 0, 1 << 20, &value) < 0) return -1;
+                config->overload.queue_limit = (int)value;
+                break;
+            case OPT_QUEUE_DEADLINE:
+                if (parse_int_option("queue-deadline", optarg, 0, 3600000, &value) < 0) return -1;
+                config->overload.deadline_ms = (int)value;
+                break;
+            case OPT_CODEL_TARGET:
+                if (parse_int_option("codel-target", optarg, 0, 60000, &value) < 0) return -1;
+                config->overload.codel_target_ms = (int)value;
+                break;
+            case OPT_CODEL_INTERVAL:
+                if (parse_int_option("codel-interval", optarg, 1, 60000, &value) < 0) return -1;
+                config->overload.codel_interval_ms = (int)value;
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return 1;
+            default:
+                print_usage(argv[0]);
+                return -1;
+        }
+    }
+
+    return 0;
+}
@@ -4,16 +4,142 @@
  */
 
 #include "connection.h"
+#include "audit.h"
+#include "cluster.h"
 #include "http_parser.h"
 #include "http_response.h"
+#include "arena.h"
 #include "logger.h"
+#include "metrics.h"
+#include "uring.h"
+#include "overload.h"
+#include "trace.h"
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <poll.h>
 #include <sys/socket.h>
 
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+#if defined(__linux__) && defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+#define CONN_HAVE_ZEROCOPY 1
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#endif
+
+/* Connection settings (written once at startup, read by all workers) */
+static connection_config_t g_conn_config = {
+    .idle_timeout_ms = CONN_DEFAULT_IDLE_TIMEOUT_MS,
+    .max_requests = CONN_DEFAULT_MAX_REQUESTS,
+    .idempotency = NULL,
+    .zerocopy_min_bytes = CONN_DEFAULT_ZEROCOPY_MIN
+};
+
+/* Drain phase and payments inside the idempotency store (see connection_set_drain) */
+static conn_drain_t g_conn_drain = CONN_DRAIN_NONE;
+static int g_payments_in_flight = 0;
+
+/* Longest a blocking read waits before checking whether a handoff wants the worker back */
+#define CONN_DRAIN_POLL_MS 50
+
+/*
+ * Apply connection settings
+ */
+void connection_configure(const connection_config_t *config) {
+    if (config == NULL) {
+        return;
+    }
+
+    g_conn_config = *config;
+    LOG_INFO(NULL, "Keep-alive: idle_timeout=%dms, max_requests=%d",
+             g_conn_config.idle_timeout_ms, g_conn_config.max_requests);
+
+    if (g_conn_config.zerocopy_min_bytes > 0 && g_conn_config.send_zc) {
+        LOG_INFO(NULL, "io_uring SEND_ZC for bodies of %zu bytes or more",
+                 g_conn_config.zerocopy_min_bytes);
+        return;
+    }
+
+#ifdef CONN_HAVE_ZEROCOPY
+    if (g_conn_config.zerocopy_min_bytes > 0) {
+        LOG_INFO(NULL, "MSG_ZEROCOPY for bodies of %zu bytes or more",
+                 g_conn_config.zerocopy_min_bytes);
+    }
+#else
+    if (g_conn_config.zerocopy_min_bytes > 0) {
+        LOG_WARN(NULL, "MSG_ZEROCOPY is not available on this platform; sending copies");
+        g_conn_config.zerocopy_min_bytes = 0;
+    }
+#endif
+}
+
+/*
+ * Get current connection settings
+ */
+const connection_config_t *connection_get_config(void) {
+    return &g_conn_config;
+}
+
+/*
+ * Enter a drain phase
+ */
+void connection_set_drain(conn_drain_t drain) {
+    if (drain > __atomic_load_n(&g_conn_drain, __ATOMIC_SEQ_CST)) {
+        __atomic_store_n(&g_conn_drain, drain, __ATOMIC_SEQ_CST);
+    }
+}
+
+/*
+ * Check whether responses must close their connections
+ */
+bool connection_draining(void) {
+    return __atomic_load_n(&g_conn_drain, __ATOMIC_RELAXED) != CONN_DRAIN_NONE;
+}
+
+/*
+ * Count POST requests between their idempotency lookup and completion
+ */
+int connection_payments_in_flight(void) {
+    return __atomic_load_n(&g_payments_in_flight, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * Helper function: Wait until the socket is readable
+ * Gives up as if timed out once new payments are refused, so a handoff can
+ * join a worker blocked on an idle client
+ * Returns 1 if readable, 0 on timeout, -1 on error
+ */
+static int connection_wait_readable(int client_fd, int timeout_ms) {
+    struct pollfd pfd;
+    pfd.fd = client_fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    int waited = 0;
+    while (__atomic_load_n(&g_conn_drain, __ATOMIC_SEQ_CST) != CONN_DRAIN_REFUSE) {
+        int slice = timeout_ms - waited < CONN_DRAIN_POLL_MS ? timeout_ms - waited
+                                                               : CONN_DRAIN_POLL_MS;
+        int ready = poll(&pfd, 1, slice);
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ready != 0) {
+            return ready < 0 ? -1 : 1;
+        }
+        waited += slice;
+        if (waited >= timeout_ms) {
+            break;
+        }
+    }
+    return 0;
+}
+
 /*
  * Read data from a client socket
  * Returns number of bytes read, 0 on connection close, -1 on error
@@ -48,6 +174,7 @@ ssize_t connection_read(int client_fd, char *buffer, size_t buffer_size) {
 
     /* Null-terminate the buffer for string operations */
     buffer[bytes_read] = '\0';
+    metrics_add(METRIC_BYTES_RECEIVED, (uint64_t)bytes_read);
 
     LOG_DEBUG(NULL, "Read %zd bytes from client (fd=%d)", bytes_read, client_fd);
     return bytes_read;
@@ -86,213 +213,880 @@ ssize_t connection_write(int client_fd, const char *data, size_t data_len) {
     }
 
     LOG_DEBUG(NULL, "Wrote %zd bytes to client (fd=%d)", bytes_written, client_fd);
+    metrics_add(METRIC_BYTES_SENT, (uint64_t)bytes_written);
     return bytes_written;
 }
 
+#ifdef CONN_HAVE_ZEROCOPY
+
 /*
- * Handle a complete client connection
- * Reads HTTP request, parses it, and sends back appropriate HTTP response
- * Returns 0 on success, -1 on error
+ * Helper function: Enable SO_ZEROCOPY on first use
+ * Returns true if zerocopy sends may be used on the socket
  */
-int connection_handle(int client_fd) {
-    char buffer[CONN_BUFFER_SIZE];
-    http_request_t request;
-    http_response_t response;
-    int result = 0;
-    size_t serialized_length = 0;
-    char *serialized = NULL;
-    size_t total_sent = 0;
-    ssize_t bytes_sent;
-    int response_initialized = 0;
+static bool connection_enable_zerocopy(int client_fd, conn_zerocopy_t *zerocopy) {
+    if (zerocopy->enabled) {
+        return true;
+    }
+    if (zerocopy->unsupported) {
+        return false;
+    }
 
-    LOG_INFO(NULL, "Starting connection_handle (fd=%d)", client_fd);
-    LOG_DEBUG(NULL, "Handling connection (fd=%d)", client_fd);
+    int one = 1;
+    if (setsockopt(client_fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) < 0) {
+        LOG_DEBUG(NULL, "SO_ZEROCOPY unavailable (fd=%d): %s", client_fd, strerror(errno));
+        zerocopy->unsupported = true;
+        return false;
+    }
 
-    /* Initialize structures to safe state */
-    memset(&response, 0, sizeof(response));
+    zerocopy->enabled = true;
+    return true;
+}
+
+/*
+ * Helper function: Read zerocopy completions from the socket error queue
+ * Returns number of notifications read, -1 on error
+ */
+static int connection_zerocopy_reap(int client_fd, conn_zerocopy_t *zerocopy) {
+    int reaped = 0;
+
+    for (;;) {
+        char control[128];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg(client_fd, &msg, MSG_ERRQUEUE) < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return reaped;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_WARN(NULL, "recvmsg(MSG_ERRQUEUE) failed (fd=%d): %s", client_fd, strerror(errno));
+            return -1;
+        }
+
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+            bool is_recverr = (cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                              (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR);
+            if (!is_recverr) {
+                continue;
+            }
+
+            struct sock_extended_err serr;
+            memcpy(&serr, CMSG_DATA(cm), sizeof(serr));
+            if (serr.ee_errno != 0 || serr.ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+
+            /* One notification covers the inclusive id range [ee_info, ee_data] */
+            zerocopy->completed += serr.ee_data - serr.ee_info + 1;
+            reaped++;
+        }
+    }
+}
+
+#endif /* CONN_HAVE_ZEROCOPY */
 
-    /* Initialize request structure */
-    if (http_request_init(&request) != 0) {
-        LOG_ERROR(NULL, "Failed to initialize HTTP request (fd=%d)", client_fd);
+/*
+ * Helper function: Send part of a borrowed file region, advancing its offset
+ * Returns bytes sent, 0 at end of file, -1 on error (errno set)
+ */
+static ssize_t connection_sendfile(int client_fd, http_borrow_t *file) {
+#ifdef __linux__
+    return sendfile(client_fd, file->fd, &file->offset, file->length);
+#else
+    /* No sendfile(): bounce through a stack buffer */
+    char chunk[16384];
+    size_t want = file->length < sizeof(chunk) ? file->length : sizeof(chunk);
+    ssize_t got = pread(file->fd, chunk, want, file->offset);
+    if (got <= 0) {
+        return got;
+    }
+
+    ssize_t bytes_sent = send(client_fd, chunk, (size_t)got, MSG_NOSIGNAL);
+    if (bytes_sent > 0) {
+        file->offset += bytes_sent;
+    }
+    return bytes_sent;
+#endif
+}
+
+/*
+ * Helper function: Send the segments with io_uring SENDMSG_ZC
+ * Each call returns once the kernel has released the pages, so the arena may
+ * be reset right after; a socket that does not drain in time fails the send
+ * Returns 1 when the segments are sent, 0 to fall back to sendmsg(), -1 on error
+ */
+static int connection_send_zc(int client_fd, http_output_t *output) {
+    int flags = output->borrow.length > 0 ? MSG_MORE : 0;
+
+    while (output->iov_index < output->iov_count) {
+        ssize_t bytes_sent = uring_send_zc(client_fd, &output->iov[output->iov_index],
+                                           output->iov_count - output->iov_index, flags,
+                                           g_conn_config.idle_timeout_ms);
+        if (bytes_sent <= 0) {
+            if (bytes_sent < 0 && errno == EINTR) {
+                continue;
+            }
+            if (bytes_sent < 0 && (errno == ENOSYS || errno == EOPNOTSUPP || errno == EINVAL)) {
+                return 0;
+            }
+            if (bytes_sent < 0 && (errno == EPIPE || errno == ECONNRESET)) {
+                LOG_WARN(NULL, "Client closed connection during send (fd=%d)", client_fd);
+            } else {
+                LOG_ERROR(NULL, "SENDMSG_ZC failed (fd=%d): %s", client_fd,
+                          bytes_sent < 0 ? strerror(errno) : "nothing sent");
+            }
+            return -1;
+        }
+
+        http_output_advance(output, (size_t)bytes_sent);
+        metrics_add(METRIC_BYTES_SENT, (uint64_t)bytes_sent);
+    }
+    return 1;
+}
+
+/*
+ * Send a rendered response with sendmsg(), resuming after partial writes
+ * Returns 1 when everything is sent, 0 if the socket would block, -1 on error
+ */
+int connection_send_output(int client_fd, http_output_t *output, conn_zerocopy_t *zerocopy) {
+    if (output == NULL) {
+        LOG_ERROR(NULL, "connection_send_output: NULL output");
         return -1;
     }
 
-    /* Step 1: Read the HTTP request headers */
-    LOG_INFO(NULL, "About to read from socket (fd=%d)", client_fd);
-    ssize_t bytes_read = connection_read(client_fd, buffer, CONN_BUFFER_SIZE);
-    LOG_INFO(NULL, "Read %zd bytes from socket (fd=%d)", bytes_read, client_fd);
+    /* Segments left here go through sendmsg(), e.g. where SENDMSG_ZC is refused */
+    if (zerocopy != NULL && g_conn_config.send_zc && g_conn_config.zerocopy_min_bytes > 0 &&
+        output->body_length >= g_conn_config.zerocopy_min_bytes &&
+        output->iov_index < output->iov_count &&
+        connection_send_zc(client_fd, output) < 0) {
+        return -1;
+    }
 
-    if (bytes_read <= 0) {
-        if (bytes_read == 0) {
-            LOG_DEBUG(NULL, "Client closed connection before sending data (fd=%d)", client_fd);
-        } else {
-            LOG_ERROR(NULL, "Failed to read from client (fd=%d)", client_fd);
+    int flags = MSG_NOSIGNAL;
+#ifdef CONN_HAVE_ZEROCOPY
+    if (zerocopy != NULL && g_conn_config.zerocopy_min_bytes > 0 &&
+        output->body_length >= g_conn_config.zerocopy_min_bytes &&
+        connection_enable_zerocopy(client_fd, zerocopy)) {
+        flags |= MSG_ZEROCOPY;
+    }
+#else
+    (void)zerocopy;
+#endif
+
+    /* Headers are corked with a file body so they leave in its first segment */
+    if (output->borrow.length > 0) {
+        flags |= MSG_MORE;
+    }
+
+    while (output->iov_index < output->iov_count) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &output->iov[output->iov_index];
+        msg.msg_iovlen = (size_t)(output->iov_count - output->iov_index);
+
+        ssize_t bytes_sent = sendmsg(client_fd, &msg, flags);
+        if (bytes_sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                LOG_DEBUG(NULL, "sendmsg() would block (fd=%d)", client_fd);
+                return 0;
+            }
+#ifdef CONN_HAVE_ZEROCOPY
+            if (errno == ENOBUFS && (flags & MSG_ZEROCOPY)) {
+                /* Out of pinned-page budget (optmem): copy this one instead */
+                flags &= ~MSG_ZEROCOPY;
+                continue;
+            }
+#endif
+            if (errno == EPIPE || errno == ECONNRESET) {
+                LOG_WARN(NULL, "Client closed connection during send (fd=%d)", client_fd);
+            } else {
+                LOG_ERROR(NULL, "sendmsg() failed (fd=%d): %s", client_fd, strerror(errno));
+            }
+            return -1;
+        }
+
+#ifdef CONN_HAVE_ZEROCOPY
+        if (flags & MSG_ZEROCOPY) {
+            zerocopy->issued++;
+        }
+#endif
+        http_output_advance(output, (size_t)bytes_sent);
+        metrics_add(METRIC_BYTES_SENT, (uint64_t)bytes_sent);
+    }
+
+    while (output->borrow.length > 0) {
+        ssize_t bytes_sent = connection_sendfile(client_fd, &output->borrow);
+        if (bytes_sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                LOG_DEBUG(NULL, "sendfile() would block (fd=%d)", client_fd);
+                return 0;
+            }
+            if (errno == EPIPE || errno == ECONNRESET) {
+                LOG_WARN(NULL, "Client closed connection during send (fd=%d)", client_fd);
+            } else {
+                LOG_ERROR(NULL, "sendfile() failed (fd=%d): %s", client_fd, strerror(errno));
+            }
+            return -1;
+        }
+        if (bytes_sent == 0) {
+            /* File shrank under us: the promised Content-Length cannot be met */
+            LOG_ERROR(NULL, "File ended %zu bytes early (fd=%d)", output->borrow.length, client_fd);
+            return -1;
+        }
+
+        output->borrow.length -= (size_t)bytes_sent;
+        output->sent += (size_t)bytes_sent;
+        metrics_add(METRIC_BYTES_SENT, (uint64_t)bytes_sent);
+    }
+
+    LOG_DEBUG(NULL, "Wrote %zu bytes to client (fd=%d)", output->length, client_fd);
+    return 1;
+}
+
+/*
+ * Wait until the kernel has released every zerocopy send on the socket
+ * Returns 0 on success, -1 on error or timeout
+ */
+int connection_zerocopy_wait(int client_fd, conn_zerocopy_t *zerocopy, int timeout_ms) {
+    if (zerocopy == NULL || zerocopy->completed == zerocopy->issued) {
+        return 0;
+    }
+
+#ifdef CONN_HAVE_ZEROCOPY
+    while (zerocopy->completed != zerocopy->issued) {
+        if (connection_zerocopy_reap(client_fd, zerocopy) < 0) {
+            return -1;
+        }
+        if (zerocopy->completed == zerocopy->issued) {
+            break;
+        }
+
+        /* Completions arrive on the error queue, which polls as POLLERR */
+        struct pollfd pfd;
+        pfd.fd = client_fd;
+        pfd.events = 0;
+        pfd.revents = 0;
+
+        int ready = poll(&pfd, 1, timeout_ms);
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ready <= 0) {
+            LOG_WARN(NULL, "Timed out waiting for zerocopy completion (fd=%d, %u pending)",
+                     client_fd, zerocopy->issued - zerocopy->completed);
+            return -1;
+        }
+    }
+    return 0;
+#else
+    (void)client_fd;
+    (void)timeout_ms;
+    return -1;
+#endif
+}
+
+/*
+ * Helper function: Look up the canned response for an error
+ * Messages outside the canned table are built into response instead
+ * Returns the canned response, NULL if response was built
+ */
+static const http_canned_t *connection_error(http_response_t *response, int status_code,
+                                             const char *error_message) {
+    const http_canned_t *canned = http_canned_find(status_code, error_message);
+    if (canned == NULL) {
+        http_response_create_error(response, status_code, error_message);
+    }
+    return canned;
+}
+
+/*
+ * Helper function: Build a 405 listing the methods the path accepts
+ */
+static void connection_method_not_allowed(http_response_t *response, uint32_t allowed) {
+    char allow[128];
+
+    if (http_response_create_error(response, HTTP_METHOD_NOT_ALLOWED, "Method not allowed") == 0 &&
+        dispatch_allow_header(allowed, allow, sizeof(allow)) == 0) {
+        http_response_add_header(response, "Allow", allow);
+    }
+}
+
+/*
+ * Helper function: Content-Type of a built response, for the replay cache
+ * Returns the media type, "" if the response sets none
+ */
+static const char *connection_content_type(const http_response_t *response) {
+    for (size_t i = 0; i < response->block_count; i++) {
+        if (response->blocks[i] == &HTTP_BLOCK_JSON) {
+            return "application/json";
+        }
+    }
+    for (size_t i = 0; i < response->header_count; i++) {
+        if (strcasecmp(response->header_names[i], "Content-Type") == 0) {
+            return response->header_values[i];
         }
-        http_request_free(&request);
+    }
+    return "";
+}
+
+/*
+ * Check a request's headers before its body is read
+ * Returns the canned error to answer with, NULL if the request may proceed
+ */
+const http_canned_t *connection_check_headers(const http_request_t *request, bool *before_body) {
+    const http_canned_t *canned = NULL;
+    bool skip_body = false;
+
+    if (request->transfer_encoding_unsupported) {
+        canned = http_canned_find(HTTP_NOT_IMPLEMENTED, "Unsupported Transfer-Encoding");
+        skip_body = true;
+    } else if (request->content_length > MAX_REQUEST_BODY_SIZE) {
+        canned = http_canned_find(HTTP_PAYLOAD_TOO_LARGE, "Request body exceeds 1MB limit");
+        skip_body = true;
+    } else if (request->method == HTTP_METHOD_POST && !request->has_idempotency_key) {
+        /* A waiting client is refused before it uploads; others have sent it already */
+        canned = http_canned_find(HTTP_UNPROCESSABLE, "POST requests require X-Idempotency-Key header");
+        skip_body = request->expect_continue;
+    }
+
+    if (before_body != NULL) {
+        *before_body = skip_body;
+    }
+    return canned;
+}
+
+/*
+ * Helper function: Body sink of the payment handler
+ * Chains decoded bytes into the idempotency digest; nothing is stored
+ */
+static int connection_body_sink(void *arg, const char *data, size_t length) {
+    conn_body_t *body = (conn_body_t *)arg;
+    body->digest = idempotency_digest(body->digest, data, length);
+    return 0;
+}
+
+/*
+ * Start streaming a request's body
+ * Returns 0 on success, -1 on error
+ */
+int connection_body_begin(conn_body_t *body, const http_request_t *request) {
+    if (body == NULL || request == NULL) {
         return -1;
     }
 
-    LOG_DEBUG(NULL, "Read %zd bytes from client (fd=%d)", bytes_read, client_fd);
+    /* A reused idempotency key must carry the same URI and body */
+    body->digest = idempotency_digest(0, request->uri.ptr, request->uri.len);
+    return http_body_init(&body->decoder, request, MAX_REQUEST_BODY_SIZE,
+                          connection_body_sink, body);
+}
 
-    /* Step 2: Find the end of headers (blank line: \r\n\r\n) */
-    char *headers_end = strstr(buffer, "\r\n\r\n");
-    if (headers_end == NULL) {
-        LOG_WARN(NULL, "Malformed HTTP request - no blank line after headers (fd=%d)", client_fd);
-        http_response_create_error(&response, HTTP_BAD_REQUEST, "Malformed HTTP request");
-        response_initialized = 1;
-        goto send_response;
+/*
+ * Feed buffered body bytes to the decoder and drop them from the buffer
+ */
+http_body_result_t connection_body_consume(conn_body_t *body, char *buffer, size_t offset,
+                                           size_t *length) {
+    size_t consumed = 0;
+    http_body_result_t result = http_body_feed(&body->decoder, buffer + offset,
+                                               *length - offset, &consumed);
+
+    /* Whatever follows (the rest of a read, or a pipelined request) moves down */
+    memmove(buffer + offset, buffer + offset + consumed, *length - offset - consumed);
+    *length -= consumed;
+    buffer[*length] = '\0';
+    return result;
+}
+
+/*
+ * Send the interim 100 Continue response
+ * Returns 0 on success, -1 on error
+ */
+int connection_send_continue(int client_fd) {
+    static const char response[] = CONN_CONTINUE_RESPONSE;
+
+    /* A fresh socket always has room for 25 bytes; anything else is an error */
+    ssize_t sent = send(client_fd, response, sizeof(response) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (sent != (ssize_t)(sizeof(response) - 1)) {
+        LOG_WARN(NULL, "Failed to send 100 Continue (fd=%d)", client_fd);
+        return -1;
+    }
+
+    LOG_DEBUG(NULL, "Sent 100 Continue (fd=%d)", client_fd);
+    return 0;
+}
+
+/*
+ * Answer a client the server has no capacity for
+ * Best effort: the response fits an empty socket buffer, so one
+ * non-blocking send is enough
+ */
+void connection_send_overloaded(int client_fd) {
+    const http_canned_t *canned = http_canned_find(HTTP_SERVICE_UNAVAILABLE,
+                                                   "Server overloaded, retry later");
+    if (canned == NULL) {
+        return;
+    }
+
+    http_output_t output;
+    http_canned_render(canned, false, false, &output);
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = output.iov;
+    msg.msg_iovlen = (size_t)output.iov_count;
+
+    ssize_t bytes_sent = sendmsg(client_fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (bytes_sent > 0) {
+        metrics_add(METRIC_BYTES_SENT, (uint64_t)bytes_sent);
     }
+    metrics_status(HTTP_SERVICE_UNAVAILABLE);
 
-    /* Null-terminate the headers section */
-    *headers_end = '\0';
+    /* FIN after the response, so the client reads it before the close */
+    shutdown(client_fd, SHUT_WR);
+    LOG_DEBUG(NULL, "Shed connection with 503 (fd=%d)", client_fd);
+}
 
-    /* Step 3: Parse request line */
-    char *request_line = buffer;
-    char *line_end = strstr(buffer, "\r\n");
-    if (line_end == NULL) {
-        LOG_WARN(NULL, "Malformed request line (fd=%d)", client_fd);
-        http_response_create_error(&response, HTTP_BAD_REQUEST, "Malformed request line");
-        response_initialized = 1;
-        goto send_response;
+/*
+ * Build the response for one request
+ * Checks the parse result and the streamed body, then generates the response
+ * Returns 0 on success (output filled), -1 on error
+ */
+int connection_process_request(int client_fd, http_request_t *request, const conn_body_t *body,
+                               bool *keep_alive, http_output_t *output) {
+    http_response_t response;
+    const http_canned_t *canned = NULL;    /* Pre-serialized error, if any */
+    int result = 0;
+    bool framing_ok = false;    /* Request boundary known, connection reusable */
+    bool entered = false;       /* Counted in g_payments_in_flight */
+
+    if (request == NULL || keep_alive == NULL || output == NULL) {
+        LOG_ERROR(NULL, "connection_process_request: NULL parameter");
+        return -1;
     }
 
-    /* Temporarily null-terminate request line */
-    *line_end = '\0';
+    /* Initialize structures to safe state */
+    memset(&response, 0, sizeof(response));
 
-    if (parse_request_line(&request, request_line) != 0) {
-        LOG_WARN(NULL, "Failed to parse request line (fd=%d)", client_fd);
-        http_response_create_error(&response, HTTP_BAD_REQUEST, "Invalid request line");
-        response_initialized = 1;
-        goto send_response;
+    /* Steps 2-4: Request line and headers were parsed as bytes arrived */
+    if (request->parse_state == HTTP_PARSE_STATE_FAILED) {
+        LOG_WARN(NULL, "Failed to parse request: %s (fd=%d)", request->parse_error, client_fd);
+        canned = connection_error(&response, HTTP_BAD_REQUEST, request->parse_error);
+        goto render;
     }
 
-    /* Move to headers (skip \r\n) */
-    char *headers_start = line_end + 2;
+    if (request->parse_state != HTTP_PARSE_STATE_COMPLETE) {
+        LOG_WARN(NULL, "Malformed HTTP request - no blank line after headers (fd=%d)", client_fd);
+        canned = connection_error(&response, HTTP_BAD_REQUEST, "Malformed HTTP request");
+        goto render;
+    }
 
-    LOG_INFO(NULL, "Request: %s %s HTTP/%s (fd=%d)",
-             http_method_to_string(request.method),
-             request.uri,
-             http_version_to_string(request.version),
+    LOG_DEBUG(NULL, "Request: %s %.*s HTTP/%s (fd=%d)",
+             http_method_to_string(request->method),
+             (int)request->uri.len, request->uri.ptr,
+             http_version_to_string(request->version),
              client_fd);
 
-    /* Step 4: Parse headers */
-    if (parse_headers(&request, headers_start) != 0) {
-        LOG_WARN(NULL, "Failed to parse headers (fd=%d)", client_fd);
-        http_response_create_error(&response, HTTP_BAD_REQUEST, "Invalid headers");
-        response_initialized = 1;
-        goto send_response;
+    /* Step 5: The body was streamed as it arrived (unless refused up front) */
+    canned = connection_check_headers(request, NULL);
+
+    if (body == NULL || !http_body_done(&body->decoder)) {
+        if (canned == NULL && body != NULL && body->decoder.too_large) {
+            LOG_WARN(NULL, "Request body too large: over %zu bytes (fd=%d)",
+                     body->decoder.max_size, client_fd);
+            canned = connection_error(&response, HTTP_PAYLOAD_TOO_LARGE,
+                                      "Request body exceeds 1MB limit");
+        } else if (canned == NULL && body != NULL && body->decoder.error != NULL) {
+            LOG_WARN(NULL, "Invalid request body: %s (fd=%d)", body->decoder.error, client_fd);
+            canned = connection_error(&response, HTTP_BAD_REQUEST, "Invalid chunked body");
+        } else if (canned == NULL) {
+            LOG_ERROR(NULL, "Failed to read request body (fd=%d)", client_fd);
+            canned = connection_error(&response, HTTP_BAD_REQUEST, "Failed to read request body");
+        } else {
+            LOG_WARN(NULL, "Refused request before reading its body (fd=%d)", client_fd);
+            if (request->method == HTTP_METHOD_POST && !request->has_idempotency_key) {
+                AUDIT(AUDIT_PAYMENT_NO_KEY, (int)request->uri.len, request->uri.ptr, client_fd);
+            }
+        }
+        goto render;
     }
 
-    /* Step 5: Parse request body if Content-Length is present */
-    if (request.content_length > 0) {
-        if (request.method != HTTP_METHOD_POST && request.method != HTTP_METHOD_PUT) {
-            LOG_WARN(NULL, "Content-Length on non-POST/PUT request (fd=%d)", client_fd);
+    if (request->content_length > 0 || request->chunked) {
+        if (request->method != HTTP_METHOD_POST && request->method != HTTP_METHOD_PUT) {
+            LOG_WARN(NULL, "Request body on non-POST/PUT request (fd=%d)", client_fd);
         }
+        request->body_length = body->decoder.received;
+        LOG_DEBUG(NULL, "Streamed request body: %zu bytes (fd=%d)", request->body_length, client_fd);
+    }
+
+    /* Whole request consumed: the next one can follow on this connection */
+    framing_ok = true;
+
+    /* Step 6: Header checks that wait for the body (missing idempotency key) */
+    if (canned != NULL) {
+        LOG_WARN(NULL, "POST request missing X-Idempotency-Key header (fd=%d)", client_fd);
+        AUDIT(AUDIT_PAYMENT_NO_KEY, (int)request->uri.len, request->uri.ptr, client_fd);
+        goto render;
+    }
+
+    /* Step 7: Route the request */
+    dispatch_context_t context;
+    switch (dispatcher_match(g_conn_config.dispatcher, request, client_fd, &context)) {
+        case DISPATCH_FOUND:
+            LOG_DEBUG(NULL, "Routed %.*s to %s (fd=%d)",
+                      (int)request->uri.len, request->uri.ptr, context.pattern, client_fd);
+            break;
+        case DISPATCH_METHOD_NOT_ALLOWED:
+            LOG_DEBUG(NULL, "Method not allowed for %.*s (fd=%d)",
+                      (int)request->uri.len, request->uri.ptr, client_fd);
+            connection_method_not_allowed(&response, context.allowed);
+            goto render;
+        case DISPATCH_NOT_FOUND:
+        default:
+            canned = connection_error(&response, HTTP_NOT_FOUND, "Not found");
+            goto render;
+    }
 
-        /* Check if body exceeds size limit */
-        if (request.content_length > MAX_REQUEST_BODY_SIZE) {
-            LOG_WARN(NULL, "Request body too large: %zu bytes (fd=%d)",
-                     request.content_length, client_fd);
-            http_response_create_error(&response, HTTP_PAYLOAD_TOO_LARGE,
-                                     "Request body exceeds 1MB limit");
-            response_initialized = 1;
-            goto send_response;
+    /* Step 8: Replay or reserve the idempotency key */
+    idempotency_store_t *store = g_conn_config.idempotency;
+    bool reserved = false;
+
+    if (request->method == HTTP_METHOD_POST && store != NULL) {
+        /* Counted before the phase is checked, so a refusing drain never misses one */
+        __atomic_add_fetch(&g_payments_in_flight, 1, __ATOMIC_SEQ_CST);
+        entered = true;
+        if (__atomic_load_n(&g_conn_drain, __ATOMIC_SEQ_CST) == CONN_DRAIN_REFUSE) {
+            LOG_DEBUG(NULL, "Refusing payment during handoff (fd=%d)", client_fd);
+            canned = connection_error(&response, HTTP_SERVICE_UNAVAILABLE,
+                                      "Server restarting, retry later");
+            goto render;
         }
 
-        if (parse_request_body(&request, client_fd) != 0) {
-            LOG_ERROR(NULL, "Failed to read request body (fd=%d)", client_fd);
-            http_response_create_error(&response, HTTP_BAD_REQUEST, "Failed to read request body");
-            response_initialized = 1;
-            goto send_response;
+        /* A reused key must carry the same request to be replayed (URI + body) */
+        uint64_t digest = body->digest;
+
+        idempotency_response_t *cached = NULL;
+        switch (cluster_begin(store, request->idempotency_key.ptr,
+                              request->idempotency_key.len, digest, &cached)) {
+            case IDEMPOTENCY_PROCEED:
+                metrics_add(METRIC_IDEMPOTENCY_MISS, 1);
+                reserved = true;
+                break;
+            case IDEMPOTENCY_REPLAY:
+                metrics_add(METRIC_IDEMPOTENCY_HIT, 1);
+                LOG_DEBUG(NULL, "Replaying cached response for key %.*s (fd=%d)",
+                         (int)request->idempotency_key.len, request->idempotency_key.ptr, client_fd);
+                AUDIT(AUDIT_PAYMENT_REPLAYED, (int)request->idempotency_key.len,
+                      request->idempotency_key.ptr, cached->status_code, client_fd);
+                if (http_response_init(&response, cached->status_code) == 0) {
+                    if (strcmp(cached->content_type, "application/json") == 0) {
+                        http_response_add_block(&response, &HTTP_BLOCK_JSON);
+                    } else if (cached->content_type[0] != '\0') {
+                        http_response_add_header(&response, "Content-Type", cached->content_type);
+                    }
+                    http_response_add_header(&response, "X-Idempotent-Replayed", "true");
+                    http_response_set_body(&response, cached->body, cached->body_length);
+                } else {
+                    canned = connection_error(&response, HTTP_INTERNAL_ERROR, "Out of memory");
+                }
+                idempotency_response_release(cached);
+                goto render;
+            case IDEMPOTENCY_IN_FLIGHT:
+                metrics_add(METRIC_IDEMPOTENCY_CONFLICT, 1);
+                LOG_WARN(NULL, "Duplicate request for in-flight key %.*s (fd=%d)",
+                         (int)request->idempotency_key.len, request->idempotency_key.ptr, client_fd);
+                AUDIT(AUDIT_PAYMENT_IN_FLIGHT, (int)request->idempotency_key.len,
+                      request->idempotency_key.ptr, client_fd);
+                canned = connection_error(&response, HTTP_CONFLICT,
+                                        "A request with this X-Idempotency-Key is in progress");
+                goto render;
+            case IDEMPOTENCY_MISMATCH:
+                metrics_add(METRIC_IDEMPOTENCY_CONFLICT, 1);
+                LOG_WARN(NULL, "Idempotency key %.*s reused with a different request (fd=%d)",
+                         (int)request->idempotency_key.len, request->idempotency_key.ptr, client_fd);
+                AUDIT(AUDIT_PAYMENT_MISMATCH, (int)request->idempotency_key.len,
+                      request->idempotency_key.ptr, client_fd);
+                canned = connection_error(&response, HTTP_UNPROCESSABLE,
+                                        "X-Idempotency-Key was already used for a different request");
+                goto render;
+            case IDEMPOTENCY_UNAVAILABLE:
+                LOG_WARN(NULL, "Owner of idempotency key %.*s unreachable (fd=%d)",
+                         (int)request->idempotency_key.len, request->idempotency_key.ptr, client_fd);
+                canned = connection_error(&response, HTTP_SERVICE_UNAVAILABLE,
+                                          "Idempotency key owner unavailable, retry later");
+                goto render;
+            case IDEMPOTENCY_ERROR:
+            default:
+                canned = connection_error(&response, HTTP_INTERNAL_ERROR, "Out of memory");
+                goto render;
         }
+    }
 
-        LOG_INFO(NULL, "Read request body: %zu bytes (fd=%d)", request.body_length, client_fd);
+    /* Step 9: Run the handler */
+    trace_mark(trace_current(), TRACE_HANDLER);
+    uint64_t handler_start = metrics_now_ns();
+    int handled = context.handler(&context, &response);
+    metrics_observe(METRIC_HANDLER_TIME, metrics_now_ns() - handler_start);
+    trace_mark(trace_current(), TRACE_HANDLED);
+
+    if (handled != 0) {
+        LOG_ERROR(NULL, "Handler for %s failed (fd=%d)", context.pattern, client_fd);
+        http_response_free(&response);
+        canned = connection_error(&response, HTTP_INTERNAL_ERROR, "Request handler failed");
+    } else if (context.canned != NULL) {
+        canned = context.canned;
     }
 
-    /* Step 6: Validate POST requests have idempotency key */
-    if (request.method == HTTP_METHOD_POST && !request.has_idempotency_key) {
-        LOG_WARN(NULL, "POST request missing X-Idempotency-Key header (fd=%d)", client_fd);
-        http_response_create_error(&response, HTTP_UNPROCESSABLE,
-                                 "POST requests require X-Idempotency-Key header");
-        response_initialized = 1;
-        goto send_response;
+    if (request->method == HTTP_METHOD_POST) {
+        AUDIT(AUDIT_PAYMENT_PROCESSED, (int)request->idempotency_key.len,
+              request->idempotency_key.ptr, canned != NULL ? canned->status_code : response.status_code,
+              request->body_length, client_fd);
     }
 
-    /* Step 7: Generate success response (hardcoded test response for now) */
-    if (http_response_init(&response, HTTP_OK) != 0) {
-        LOG_ERROR(NULL, "Failed to initialize response (fd=%d)", client_fd);
-        result = -1;
-        goto cleanup;
+    /* Cache the response so retries with the same key replay it (errors are retried instead) */
+    if (reserved && canned == NULL && response.status_code < HTTP_INTERNAL_ERROR) {
+        if (cluster_complete(store, request->idempotency_key.ptr, request->idempotency_key.len,
+                             response.status_code, connection_content_type(&response),
+                             response.body, response.body_length) == IDEMPOTENCY_NOT_DURABLE) {
+            /* Not recorded: a success a crash could forget must not reach the client */
+            http_response_free(&response);
+            canned = connection_error(&response, HTTP_SERVICE_UNAVAILABLE,
+                                      "Payment could not be recorded, retry later");
+        }
+    } else if (reserved) {
+        cluster_abort(store, request->idempotency_key.ptr, request->idempotency_key.len);
     }
-    response_initialized = 1;
 
-    http_response_add_header(&response, "Content-Type", "application/json");
+render:
+    if (entered) {
+        __atomic_sub_fetch(&g_payments_in_flight, 1, __ATOMIC_SEQ_CST);
+    }
 
-    /* Build response body with request info */
-    char response_body[1024];
-    int body_len;
+    /* Step 10: Decide on keep-alive and render response */
+    *keep_alive = *keep_alive && framing_ok && http_request_keep_alive(request) &&
+                  !connection_draining();
 
-    if (request.method == HTTP_METHOD_POST && request.has_idempotency_key) {
-        body_len = snprintf(response_body, sizeof(response_body),
-                           "{\"status\":\"success\",\"message\":\"Payment processed\","
-                           "\"idempotency_key\":\"%s\",\"body_size\":%zu}",
-                           request.idempotency_key,
-                           request.body_length);
+    /* A body after HEAD headers would be read as the start of the next response */
+    bool omit_body = request->method == HTTP_METHOD_HEAD;
+    if (canned != NULL) {
+        /* Canned errors are sent as-is: no allocation, no formatting */
+        http_canned_render(canned, *keep_alive, omit_body, output);
+        metrics_status(canned->status_code);
+        LOG_DEBUG(NULL, "Sending canned HTTP %d response (%zu bytes) (fd=%d)",
+                  canned->status_code, output->length, client_fd);
     } else {
-        body_len = snprintf(response_body, sizeof(response_body),
-                           "{\"status\":\"success\",\"message\":\"Request received\","
-                           "\"method\":\"%s\",\"uri\":\"%s\"}",
-                           http_method_to_string(request.method),
-                           request.uri);
-    }
+        http_response_set_keep_alive(&response, *keep_alive);
+        if (omit_body) {
+            http_response_omit_body(&response);
+        }
 
-    if (body_len < 0 || (size_t)body_len >= sizeof(response_body)) {
-        LOG_ERROR(NULL, "Failed to format response body (fd=%d)", client_fd);
-        http_response_create_error(&response, HTTP_INTERNAL_ERROR, "Failed to format response");
-        response_initialized = 1;
-        goto send_response;
+        result = http_response_render(&response, output);
+        if (result != 0) {
+            LOG_ERROR(NULL, "Failed to render response (fd=%d)", client_fd);
+        } else {
+            metrics_status(response.status_code);
+            LOG_DEBUG(NULL, "Built HTTP %d response (%zu bytes) for client (fd=%d)",
+                      response.status_code, output->length, client_fd);
+        }
     }
 
-    http_response_set_body(&response, response_body, body_len);
+    trace_mark(trace_current(), TRACE_RENDERED);
+    trace_describe(trace_current(), http_method_to_string(request->method), request->uri.ptr,
+                   request->uri.len, canned != NULL ? canned->status_code : response.status_code);
 
-send_response:
-    /* Step 8: Serialize and send response */
-    serialized_length = 0;
-    serialized = http_response_serialize(&response, &serialized_length);
+    /* Step 11: Clean up resources (output still references the arena) */
+    http_request_free(request);
+    http_response_free(&response);
 
-    if (serialized == NULL) {
-        LOG_ERROR(NULL, "Failed to serialize response (fd=%d)", client_fd);
-        result = -1;
-        goto cleanup;
+    return result;
+}
+
+/*
+ * Helper function: Wait for and read more bytes into buffer
+ * Returns bytes read, 0 if the client closed or went idle, -1 on error
+ */
+static ssize_t connection_fill(int client_fd, char *buffer, size_t *length, size_t capacity) {
+    int ready = connection_wait_readable(client_fd, g_conn_config.idle_timeout_ms);
+    if (ready <= 0) {
+        if (ready == 0) {
+            LOG_DEBUG(NULL, "Idle timeout, closing connection (fd=%d)", client_fd);
+        }
+        return ready;
     }
 
-    /* Send response in loop to handle partial writes */
-    total_sent = 0;
-    while (total_sent < serialized_length) {
-        bytes_sent = connection_write(client_fd,
-                                      serialized + total_sent,
-                                      serialized_length - total_sent);
-        if (bytes_sent < 0) {
+    /* connection_read() keeps a byte for the terminator */
+    ssize_t bytes_read = connection_read(client_fd, buffer + *length, capacity - *length);
+    if (bytes_read > 0) {
+        *length += (size_t)bytes_read;
+    }
+    return bytes_read;
+}
+
+/*
+ * Helper function: Stream a request body through its decoder (blocking)
+ * Body bytes that arrived with the headers are decoded first; later reads
+ * reuse the buffer space after the headers, so the window stays fixed
+ * Returns 0 once decoding has finished (or failed), -1 if the client went away
+ */
+static int connection_read_body(int client_fd, conn_body_t *body, char *buffer, size_t offset,
+                                size_t *length, size_t capacity) {
+    while (connection_body_consume(body, buffer, offset, length) == HTTP_BODY_NEED_MORE) {
+        if (connection_fill(client_fd, buffer, length, capacity) <= 0) {
+            LOG_WARN(NULL, "Client stopped sending after %zu body bytes (fd=%d)",
+                     body->decoder.received, client_fd);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Handle a complete client connection
+ * Serves requests until close, idle timeout or the per-connection cap
+ * Returns 0 on success, -1 on error
+ */
+int connection_handle(int client_fd) {
+    char buffer[CONN_BUFFER_SIZE];
+    size_t length = 0;
+    int served = 0;
+    int result = 0;
+    http_request_t request;
+    conn_zerocopy_t zerocopy;
+    trace_request_t trace;
+
+    LOG_DEBUG(NULL, "Handling connection (fd=%d)", client_fd);
+
+    buffer[0] = '\0';
+    http_request_init(&request);
+    memset(&zerocopy, 0, sizeof(zerocopy));
+
+    for (;;) {
+        /* Step 1: Parse headers as they arrive */
+        http_parse_result_t parsed;
+        trace_reset(&trace);
+
+        for (;;) {
+            if (length > 0) {
+                trace_mark_once(&trace, TRACE_RECEIVED);
+            }
+            parsed = http_parse_request(&request, buffer, length);
+            if (parsed != HTTP_PARSE_NEED_MORE || length + 1 >= sizeof(buffer)) {
+                /* Done, malformed, or a header block that does not fit */
+                break;
+            }
+
+            ssize_t bytes_read = connection_fill(client_fd, buffer, &length, sizeof(buffer));
+            if (bytes_read <= 0) {
+                if (bytes_read == 0) {
+                    LOG_DEBUG(NULL, "Client closed connection (fd=%d, served=%d)",
+                              client_fd, served);
+                } else {
+                    LOG_ERROR(NULL, "Failed to read from client (fd=%d)", client_fd);
+                }
+                return served > 0 && bytes_read == 0 ? 0 : -1;
+            }
+        }
+
+        trace_mark(&trace, TRACE_PARSED);
+
+        /* Stream the body unless the headers alone settle the response */
+        bool keep_alive = served + 1 < g_conn_config.max_requests;
+        size_t request_length = length;
+        conn_body_t body;
+        const conn_body_t *streamed = NULL;
+
+        if (parsed == HTTP_PARSE_DONE) {
+            bool before_body = false;
+            connection_check_headers(&request, &before_body);
+
+            if (!before_body && connection_body_begin(&body, &request) == 0) {
+                /* Only a client that has not started uploading is still waiting */
+                if (request.expect_continue && length == request.header_length &&
+                    connection_send_continue(client_fd) != 0) {
+                    return -1;
+                }
+                if (connection_read_body(client_fd, &body, buffer, request.header_length,
+                                         &length, sizeof(buffer)) != 0) {
+                    return -1;
+                }
+                streamed = &body;
+                trace_mark(&trace, TRACE_BODY);
+            }
+        }
+
+        if (streamed != NULL && http_body_done(&streamed->decoder)) {
+            /* Body bytes are gone from the buffer; a pipelined request follows the headers */
+            request_length = request.header_length;
+        } else {
+            keep_alive = false;
+        }
+
+        /* Steps 2-11: Route the request and render the response */
+        http_output_t output;
+        trace_set_current(&trace);
+        int processed = connection_process_request(client_fd, &request, streamed, &keep_alive,
+                                                   &output);
+        trace_set_current(NULL);
+        if (processed != 0) {
+            arena_reset(arena_thread());
+            return -1;
+        }
+
+        /* Blocking socket: sendmsg() resumes after partial writes until done */
+        if (connection_send_output(client_fd, &output, &zerocopy) != 1) {
             LOG_ERROR(NULL, "Failed to send response (fd=%d)", client_fd);
             result = -1;
-            break;
         }
-        total_sent += bytes_sent;
-    }
+        trace_mark(&trace, TRACE_SENT);
+        trace_finish(&trace);
 
-    if (result == 0) {
-        LOG_INFO(NULL, "Sent HTTP %d response (%zu bytes) to client (fd=%d)",
-                 response.status_code, total_sent, client_fd);
-    }
+        /* Zerocopy pages must be released before the arena reuses them */
+        if (connection_zerocopy_wait(client_fd, &zerocopy, g_conn_config.idle_timeout_ms) != 0) {
+            result = -1;
+        }
 
-    free(serialized);
+        /* Response and any copied body are done with: recycle the arena */
+        http_output_release(&output);
+        arena_reset(arena_thread());
 
-cleanup:
-    /* Step 9: Clean up resources */
-    http_request_free(&request);
-    if (response_initialized) {
-        http_response_free(&response);
+        if (result != 0) {
+            return result;
+        }
+
+        served++;
+        LOG_DEBUG(NULL, "Sent response (%zu bytes) to client (fd=%d, request %d)",
+                 output.length, client_fd, served);
+
+        if (!keep_alive) {
+            return 0;
+        }
+
+        /* Keep pipelined bytes that followed this request */
+        length -= request_length;
+        memmove(buffer, buffer + request_length, length);
+        buffer[length] = '\0';
+        http_request_init(&request);
     }
+}
 
-    return result;
+/*
+ * Serve a queued client connection, then close it
+ */
+void connection_run(int client_fd, uint64_t queue_wait_ns) {
+    if (overload_shed(queue_wait_ns)) {
+        connection_send_overloaded(client_fd);
+    } else {
+        connection_handle(client_fd);
+    }
+
+    /* Close the client connection */
+    close(client_fd);
 }
@@ -0,0 +1,570 @@
+/*
+ * C-HTTP Payment Server - Request Dispatcher Implementation
+ *
+ * Routes are inserted into a trie with one node per pattern segment.
+ * dispatcher_compile() then lays the nodes out again breadth-first so
+ * that every node's literal children sit next to each other, sorted by
+ * label: matching a segment is a binary search over a few adjacent nodes,
+ * and the whole table is one array that never changes while serving.
+ */
+
+#include "dispatcher.h"
+#include "logger.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Initial node and route array capacity */
+#define DISPATCH_INITIAL_CAPACITY 16
+
+/*
+ * Helper function: Compare two labels (bytes, then length)
+ */
+static int label_compare(http_str_t a, http_str_t b) {
+    size_t shorter = a.len < b.len ? a.len : b.len;
+    int order = memcmp(a.ptr, b.ptr, shorter);
+    if (order != 0) {
+        return order;
+    }
+    return a.len < b.len ? -1 : (a.len > b.len ? 1 : 0);
+}
+
+/*
+ * Helper function: Append a node under parent
+ * Returns the new node's index, -1 on error
+ */
+static int32_t node_append(dispatcher_t *dispatcher, int32_t parent, dispatch_segment_t kind,
+                           http_str_t label) {
+    if (dispatcher->node_count == dispatcher->node_capacity) {
+        size_t capacity = dispatcher->node_capacity * 2;
+        dispatch_node_t *nodes = (dispatch_node_t *)realloc(dispatcher->nodes,
+                                                            capacity * sizeof(*nodes));
+        if (nodes == NULL) {
+            LOG_ERROR(NULL, "Failed to grow route trie to %zu nodes", capacity);
+            return -1;
+        }
+        dispatcher->nodes = nodes;
+        dispatcher->node_capacity = capacity;
+    }
+
+    dispatch_node_t *node = &dispatcher->nodes[dispatcher->node_count];
+    memset(node, 0, sizeof(*node));
+    node->kind = kind;
+    node->label = label;
+    node->parent = parent;
+    node->param_child = -1;
+    node->wildcard_child = -1;
+    for (size_t i = 0; i < DISPATCH_METHOD_COUNT; i++) {
+        node->routes[i] = -1;
+    }
+
+    return (int32_t)dispatcher->node_count++;
+}
+
+/*
+ * Helper function: Find or create the child of parent for one segment
+ * Returns the child's index, -1 on error
+ */
+static int32_t node_child(dispatcher_t *dispatcher, int32_t parent, dispatch_segment_t kind,
+                          http_str_t label) {
+    for (size_t i = 1; i < dispatcher->node_count; i++) {
+        dispatch_node_t *node = &dispatcher->nodes[i];
+        if (node->parent != parent || node->kind != kind) {
+            continue;
+        }
+        if (label_compare(node->label, label) == 0) {
+            return (int32_t)i;
+        }
+
+        /* One ":name" / "*name" per position: the captured value needs one name */
+        if (kind != DISPATCH_SEGMENT_STATIC) {
+            LOG_ERROR(NULL, "Route parameter '%.*s' conflicts with '%.*s'",
+                      (int)label.len, label.ptr, (int)node->label.len, node->label.ptr);
+            return -1;
+        }
+    }
+
+    return node_append(dispatcher, parent, kind, label);
+}
+
+/*
+ * Initialize an empty dispatcher
+ * Returns 0 on success, -1 on error
+ */
+int dispatcher_init(dispatcher_t *dispatcher) {
+    if (dispatcher == NULL) {
+        LOG_ERROR(NULL, "dispatcher_init: NULL parameter");
+        return -1;
+    }
+
+    memset(dispatcher, 0, sizeof(*dispatcher));
+    dispatcher->nodes = (dispatch_node_t *)malloc(DISPATCH_INITIAL_CAPACITY *
+                                                  sizeof(dispatch_node_t));
+    dispatcher->routes = (dispatch_route_t *)malloc(DISPATCH_INITIAL_CAPACITY *
+                                                    sizeof(dispatch_route_t));
+    if (dispatcher->nodes == NULL || dispatcher->routes == NULL) {
+        LOG_ERROR(NULL, "Failed to allocate route table");
+        dispatcher_destroy(dispatcher);
+        return -1;
+    }
+    dispatcher->node_capacity = DISPATCH_INITIAL_CAPACITY;
+    dispatcher->route_capacity = DISPATCH_INITIAL_CAPACITY;
+
+    /* Root node: the path "/" */
+    http_str_t empty = { "", 0 };
+    node_append(dispatcher, -1, DISPATCH_SEGMENT_STATIC, empty);
+
+    return 0;
+}
+
+/*
+ * Add a route (before dispatcher_compile() only)
+ * Returns 0 on success, -1 on error
+ */
+int dispatcher_add(dispatcher_t *dispatcher, http_method_t method, const char *pattern,
+                   dispatch_handler_t handler, void *arg) {
+    if (dispatcher == NULL || pattern == NULL || handler == NULL ||
+        (int)method < 0 || (int)method >= DISPATCH_METHOD_COUNT) {
+        LOG_ERROR(NULL, "dispatcher_add: invalid parameter");
+        return -1;
+    }
+    if (dispatcher->compiled) {
+        LOG_ERROR(NULL, "dispatcher_add: route table is already compiled");
+        return -1;
+    }
+    if (pattern[0] != '/') {
+        LOG_ERROR(NULL, "Route pattern must start with '/': %s", pattern);
+        return -1;
+    }
+
+    if (dispatcher->route_count == dispatcher->route_capacity) {
+        size_t capacity = dispatcher->route_capacity * 2;
+        dispatch_route_t *routes = (dispatch_route_t *)realloc(dispatcher->routes,
+                                                               capacity * sizeof(*routes));
+        if (routes == NULL) {
+            LOG_ERROR(NULL, "Failed to grow route table to %zu routes", capacity);
+            return -1;
+        }
+        dispatcher->routes = routes;
+        dispatcher->route_capacity = capacity;
+    }
+
+    /* Labels point into the route's own copy of the pattern */
+    char *copy = strdup(pattern);
+    if (copy == NULL) {
+        LOG_ERROR(NULL, "Failed to copy route pattern");
+        return -1;
+    }
+
+    size_t first_new = dispatcher->node_count;
+    int32_t node = 0;
+    int depth = 0;
+    int params = 0;
+    const char *cursor = copy + 1;
+    const char *end = copy + strlen(copy);
+
+    while (cursor < end) {
+        const char *slash = memchr(cursor, '/', (size_t)(end - cursor));
+        const char *segment_end = slash != NULL ? slash : end;
+        http_str_t label = { cursor, (size_t)(segment_end - cursor) };
+        dispatch_segment_t kind = DISPATCH_SEGMENT_STATIC;
+
+        if (label.len > 0 && (label.ptr[0] == ':' || label.ptr[0] == '*')) {
+            kind = label.ptr[0] == ':' ? DISPATCH_SEGMENT_PARAM : DISPATCH_SEGMENT_WILDCARD;
+            label.ptr++;
+            label.len--;
+            if (label.len == 0 || ++params > DISPATCH_MAX_PARAMS) {
+                LOG_ERROR(NULL, "Route parameter unnamed or over the limit of %d: %s",
+                          DISPATCH_MAX_PARAMS, pattern);
+                goto fail;
+            }
+        }
+
+        if (label.len == 0 || ++depth > DISPATCH_MAX_DEPTH ||
+            (kind == DISPATCH_SEGMENT_WILDCARD && slash != NULL)) {
+            LOG_ERROR(NULL, "Invalid route pattern (empty segment, too deep or wildcard "
+                      "not last): %s", pattern);
+            goto fail;
+        }
+
+        node = node_child(dispatcher, node, kind, label);
+        if (node < 0) {
+            goto fail;
+        }
+
+        cursor = slash != NULL ? slash + 1 : end;
+        if (slash != NULL && cursor == end) {
+            LOG_ERROR(NULL, "Route pattern has a trailing '/': %s", pattern);
+            goto fail;
+        }
+    }
+
+    if (dispatcher->nodes[node].routes[method] >= 0) {
+        LOG_ERROR(NULL, "Duplicate route: %s %s",
+                  method == DISPATCH_ANY_METHOD ? "*" : http_method_to_string(method), pattern);
+        goto fail;
+    }
+
+    dispatch_route_t *route = &dispatcher->routes[dispatcher->route_count];
+    route->method = method;
+    route->pattern = copy;
+    route->handler = handler;
+    route->arg = arg;
+    dispatcher->nodes[node].routes[method] = (int32_t)dispatcher->route_count++;
+
+    LOG_DEBUG(NULL, "Added route %s %s",
+              method == DISPATCH_ANY_METHOD ? "*" : http_method_to_string(method), pattern);
+    return 0;
+
+fail:
+    /* Drop the nodes this pattern created: their labels point into copy */
+    dispatcher->node_count = first_new;
+    free(copy);
+    return -1;
+}
+
+/*
+ * Freeze the route table: lays the trie out for lookups
+ * Returns 0 on success, -1 on error
+ */
+int dispatcher_compile(dispatcher_t *dispatcher) {
+    if (dispatcher == NULL || dispatcher->compiled) {
+        LOG_ERROR(NULL, "dispatcher_compile: invalid or already compiled dispatcher");
+        return -1;
+    }
+
+    size_t count = dispatcher->node_count;
+    dispatch_node_t *compiled = (dispatch_node_t *)malloc(count * sizeof(*compiled));
+    int32_t *order = (int32_t *)malloc(count * sizeof(*order));     /* new index -> old */
+    int32_t *placed = (int32_t *)malloc(count * sizeof(*placed));   /* old index -> new */
+    if (compiled == NULL || order == NULL || placed == NULL) {
+        LOG_ERROR(NULL, "Failed to allocate compiled route trie");
+        free(compiled);
+        free(order);
+        free(placed);
+        return -1;
+    }
+
+    /* Breadth-first: each node's children are appended as one sorted run */
+    size_t next = 1;
+    order[0] = 0;
+    placed[0] = 0;
+
+    for (size_t index = 0; index < count; index++) {
+        int32_t old = order[index];
+        dispatch_node_t *node = &compiled[index];
+        *node = dispatcher->nodes[old];
+        node->parent = index == 0 ? -1 : placed[node->parent];
+        node->first_child = (uint32_t)next;
+        node->child_count = 0;
+        node->param_child = -1;
+        node->wildcard_child = -1;
+
+        /* Literal children, insertion-sorted by label as they are placed */
+        for (size_t i = 1; i < count; i++) {
+            const dispatch_node_t *child = &dispatcher->nodes[i];
+            if (child->parent != old || child->kind != DISPATCH_SEGMENT_STATIC) {
+                continue;
+            }
+
+            size_t slot = next;
+            while (slot > node->first_child &&
+                   label_compare(dispatcher->nodes[order[slot - 1]].label, child->label) > 0) {
+                order[slot] = order[slot - 1];
+                placed[order[slot]] = (int32_t)slot;
+                slot--;
+            }
+            order[slot] = (int32_t)i;
+            placed[i] = (int32_t)slot;
+            node->child_count++;
+            next++;
+        }
+
+        /* Then the ":name" and "*name" children */
+        for (size_t i = 1; i < count; i++) {
+            const dispatch_node_t *child = &dispatcher->nodes[i];
+            if (child->parent != old || child->kind == DISPATCH_SEGMENT_STATIC) {
+                continue;
+            }
+
+            order[next] = (int32_t)i;
+            placed[i] = (int32_t)next;
+            if (child->kind == DISPATCH_SEGMENT_PARAM) {
+                node->param_child = (int32_t)next;
+            } else {
+                node->wildcard_child = (int32_t)next;
+            }
+            next++;
+        }
+    }
+
+    free(dispatcher->nodes);
+    free(order);
+    free(placed);
+
+    dispatcher->nodes = compiled;
+    dispatcher->node_capacity = count;
+    dispatcher->compiled = true;
+
+    LOG_INFO(NULL, "Route table compiled: %zu routes, %zu trie nodes",
+             dispatcher->route_count, count);
+    return 0;
+}
+
+/*
+ * Helper function: Select a node's route for the request method
+ * HEAD is served by the GET route (the body is dropped when rendering)
+ * Records the methods the node accepts when none applies
+ * Returns the route index, -1 if the node has no route for the method
+ */
+static int32_t route_at(const dispatch_node_t *node, http_method_t method,
+                        dispatch_context_t *context) {
+    int32_t route = node->routes[method];
+    if (route < 0 && method == HTTP_METHOD_HEAD) {
+        route = node->routes[HTTP_METHOD_GET];
+    }
+    if (route < 0) {
+        route = node->routes[DISPATCH_ANY_METHOD];
+    }
+    if (route >= 0) {
+        return route;
+    }
+
+    for (int m = DISPATCH_ANY_METHOD + 1; m < DISPATCH_METHOD_COUNT; m++) {
+        if (node->routes[m] >= 0) {
+            context->allowed |= 1u << m;
+        }
+    }
+    if (node->routes[HTTP_METHOD_GET] >= 0) {
+        context->allowed |= 1u << HTTP_METHOD_HEAD;
+    }
+    return -1;
+}
+
+/*
+ * Helper function: Record a captured parameter
+ * Returns false if the capture limit is reached
+ */
+static bool capture(dispatch_context_t *context, const dispatch_node_t *node, http_str_t value) {
+    if (context->param_count >= DISPATCH_MAX_PARAMS) {
+        return false;
+    }
+    context->params[context->param_count].name = node->label;
+    context->params[context->param_count].value = value;
+    context->param_count++;
+    return true;
+}
+
+/*
+ * Helper function: Match the rest of a path below node, backtracking from
+ * literals to ":name" to "*name"
+ * rest is the path after node's segment and its '/'; done means there is
+ * no further segment (the path ended at node)
+ * Returns the route index, -1 if nothing below node matches
+ */
+static int32_t match_node(const dispatcher_t *dispatcher, const dispatch_node_t *node,
+                          http_str_t rest, bool done, http_method_t method,
+                          dispatch_context_t *context) {
+    size_t saved = context->param_count;
+    int32_t route;
+
+    if (done) {
+        route = route_at(node, method, context);
+        if (route < 0 && node->wildcard_child >= 0) {
+            /* "*name" also matches nothing at all */
+            const dispatch_node_t *wildcard = &dispatcher->nodes[node->wildcard_child];
+            http_str_t empty = { rest.ptr, 0 };
+            route = route_at(wildcard, method, context);
+            if (route >= 0 && !capture(context, wildcard, empty)) {
+                route = -1;
+            }
+        }
+        return route;
+    }
+
+    const char *slash = memchr(rest.ptr, '/', rest.len);
+    http_str_t segment = { rest.ptr, slash != NULL ? (size_t)(slash - rest.ptr) : rest.len };
+    http_str_t after = { rest.ptr + rest.len, 0 };
+    bool last = slash == NULL;
+    if (!last) {
+        after.ptr = slash + 1;
+        after.len = rest.len - segment.len - 1;
+    }
+
+    /* Literal segment: binary search over the sorted run of children */
+    size_t low = node->first_child;
+    size_t high = node->first_child + node->child_count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        int order = label_compare(dispatcher->nodes[mid].label, segment);
+        if (order == 0) {
+            route = match_node(dispatcher, &dispatcher->nodes[mid], after, last, method, context);
+            if (route >= 0) {
+                return route;
+            }
+            break;
+        }
+        if (order < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    /* ":name" captures one non-empty segment */
+    if (node->param_child >= 0 && segment.len > 0) {
+        const dispatch_node_t *param = &dispatcher->nodes[node->param_child];
+        if (capture(context, param, segment)) {
+            route = match_node(dispatcher, param, after, last, method, context);
+            if (route >= 0) {
+                return route;
+            }
+            context->param_count = saved;
+        }
+    }
+
+    /* "*name" takes whatever is left */
+    if (node->wildcard_child >= 0) {
+        const dispatch_node_t *wildcard = &dispatcher->nodes[node->wildcard_child];
+        route = route_at(wildcard, method, context);
+        if (route >= 0 && capture(context, wildcard, rest)) {
+            return route;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Select the route for a request
+ * Returns DISPATCH_FOUND, DISPATCH_NOT_FOUND or DISPATCH_METHOD_NOT_ALLOWED
+ */
+dispatch_result_t dispatcher_match(const dispatcher_t *dispatcher, const http_request_t *request,
+                                   int client_fd, dispatch_context_t *context) {
+    if (context == NULL) {
+        return DISPATCH_NOT_FOUND;
+    }
+
+    memset(context, 0, sizeof(*context));
+    context->client_fd = client_fd;
+    context->request = request;
+
+    if (dispatcher == NULL || !dispatcher->compiled || request == NULL ||
+        (int)request->method < 0 || (int)request->method >= DISPATCH_METHOD_COUNT) {
+        return DISPATCH_NOT_FOUND;
+    }
+
+    /* Split off the query string */
+    const char *question = memchr(request->uri.ptr, '?', request->uri.len);
+    context->path.ptr = request->uri.ptr;
+    context->path.len = question != NULL ? (size_t)(question - request->uri.ptr)
+                                         : request->uri.len;
+    if (question != NULL) {
+        context->query.ptr = question + 1;
+        context->query.len = request->uri.len - context->path.len - 1;
+    }
+
+    /* Origin-form only ("/path"); "*" and absolute URIs match no route */
+    if (context->path.len == 0 || context->path.ptr[0] != '/') {
+        return DISPATCH_NOT_FOUND;
+    }
+
+    http_str_t rest = { context->path.ptr + 1, context->path.len - 1 };
+    int32_t route = match_node(dispatcher, &dispatcher->nodes[0], rest, rest.len == 0,
+                               request->method, context);
+    if (route < 0) {
+        context->param_count = 0;
+        return context->allowed != 0 ? DISPATCH_METHOD_NOT_ALLOWED : DISPATCH_NOT_FOUND;
+    }
+
+    const dispatch_route_t *selected = &dispatcher->routes[route];
+    context->handler = selected->handler;
+    context->arg = selected->arg;
+    context->pattern = selected->pattern;
+    return DISPATCH_FOUND;
+}
+
+/*
+ * Get a captured parameter by name
+ * Returns the value, or an empty slice (ptr NULL) if the route has none
+ */
+http_str_t dispatch_param(const dispatch_context_t *context, const char *name) {
+    http_str_t none = { NULL, 0 };
+    if (context == NULL || name == NULL) {
+        return none;
+    }
+
+    http_str_t wanted = { name, strlen(name) };
+    for (size_t i = 0; i < context->param_count; i++) {
+        if (label_compare(context->params[i].name, wanted) == 0) {
+            return context->params[i].value;
+        }
+    }
+    return none;
+}
+
+/*
+ * Answer with an error (canned when possible)
+ * Returns 0 on success, -1 on error
+ */
+int dispatch_error(dispatch_context_t *context, http_response_t *response, int status_code,
+                   const char *message) {
+    if (context == NULL || response == NULL || message == NULL) {
+        return -1;
+    }
+
+    context->canned = http_canned_find(status_code, message);
+    if (context->canned != NULL) {
+        return 0;
+    }
+    return http_response_create_error(response, status_code, message);
+}
+
+/*
+ * Render the methods in an allowed mask as an Allow header value
+ * Returns 0 on success, -1 if buffer is too small
+ */
+int dispatch_allow_header(uint32_t allowed, char *buffer, size_t size) {
+    if (buffer == NULL || size == 0) {
+        return -1;
+    }
+
+    size_t used = 0;
+    buffer[0] = '\0';
+
+    for (int m = DISPATCH_ANY_METHOD + 1; m < DISPATCH_METHOD_COUNT; m++) {
+        if ((allowed & (1u << m)) == 0) {
+            continue;
+        }
+
+        const char *name = http_method_to_string((http_method_t)m);
+        size_t length = strlen(name) + (used > 0 ? 2 : 0);
+        if (used + length + 1 > size) {
+            return -1;
+        }
+        if (used > 0) {
+            memcpy(buffer + used, ", ", 2);
+            used += 2;
+            length -= 2;
+        }
+        memcpy(buffer + used, name, length + 1);
+        used += length;
+    }
+
+    return 0;
+}
+
+/*
+ * Free routes and trie
+ */
+void dispatcher_destroy(dispatcher_t *dispatcher) {
+    if (dispatcher == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < dispatcher->route_count; i++) {
+        free(dispatcher->routes[i].pattern);
+    }
+    free(dispatcher->routes);
+    free(dispatcher->nodes);
+    memset(dispatcher, 0, sizeof(*dispatcher));
+}
@@ -0,0 +1,1648 @@
+/*
+ * C-HTTP Payment Server - Event Loop
+ * Reactor with non-blocking connections over epoll or io_uring
+ *
+ * The reactor thread owns accept() and all socket reads. Each connection
+ * is registered with EPOLLET | EPOLLONESHOT, so exactly one thread touches
+ * a connection at a time: the reactor while reading, a worker while
+ * processing. Workers therefore only run once a request's headers are
+ * buffered and its body has been streamed through the decoder, and hand
+ * the connection back to the reactor when they are done so it alone owns
+ * re-arming and idle timers.
+ *
+ * A loop created without a worker pool serves requests on its own thread
+ * instead. The SO_REUSEPORT loop group runs one such loop per core, each
+ * with its own listen socket, so a connection is accepted, read, answered
+ * and timed out on one pinned thread with no cross-thread handoff.
+ *
+ * How a connection waits is up to the engine. The epoll engine registers
+ * each connection with EPOLLET | EPOLLONESHOT and reads on readiness. The
+ * io_uring engine keeps one request in flight per waiting connection: a
+ * multishot accept feeds new sockets, and a connection with nothing
+ * buffered receives into the loop's shared provided buffers; one holding
+ * part of a request polls for readability and reads with recv(), so the
+ * kernel never writes into connection memory. Every re-arm of a loop pass
+ * goes to the kernel in the single io_uring_enter() that waits for the next.
+ *
+ * Connection slots live in slabs indexed by fd, so an idle keep-alive
+ * connection costs one slot. Its parser state and read buffer (an
+ * exchange) come from a per-loop free list when bytes arrive and go back
+ * once nothing is buffered; a worker returns them through a lock-free
+ * stack the reactor drains on its next allocation.
+ */
+
+#include "event_loop.h"
+#include "connection.h"
+#include "http_parser.h"
+#include "arena.h"
+#include "scheduler.h"
+#include "logger.h"
+#include "metrics.h"
+#include "overload.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#ifdef __linux__
+
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/* Upper bound on the fd-indexed connection table */
+#define EVENT_LOOP_MAX_FDS (1 << 20)
+
+/* While draining, how often to check for connections closed by workers */
+#define EVENT_LOOP_DRAIN_POLL_MS 10
+
+/* io_uring request tags: kind in the top byte, then a 24-bit generation and the fd */
+#define URING_TAG(kind, generation, fd) \
+    (((uint64_t)(kind) << 56) | ((uint64_t)((generation) & 0xffffffU) << 32) | (uint32_t)(fd))
+#define URING_TAG_ACCEPT 1
+#define URING_TAG_SHUTDOWN 2
+#define URING_TAG_WAKE 3
+#define URING_TAG_CONN 4
+#define URING_TAG_CANCEL 5
+
+/*
+ * Engine operations (reactor thread only)
+ * The connection state machine is shared; an engine decides how a
+ * connection waits for its next event and how events are collected
+ */
+typedef struct event_engine_ops {
+    const char *name;
+    int (*init)(event_loop_t *loop);        /* Watch listen socket, shutdown pipe and wakeups */
+    void (*destroy)(event_loop_t *loop);
+    int (*open)(event_loop_t *loop, event_conn_t *conn);    /* Wait for the first request */
+    int (*arm)(event_loop_t *loop, event_conn_t *conn);     /* Wait for what conn->state needs */
+    void (*forget)(event_loop_t *loop, event_conn_t *conn); /* Connection is being closed */
+    void (*stop_accepting)(event_loop_t *loop);             /* Listener is draining */
+    int (*wait)(event_loop_t *loop, int timeout_ms);        /* Handle events, up to timeout_ms */
+} event_engine_ops_t;
+
+/*
+ * Helper function: Current monotonic time in milliseconds
+ */
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/*
+ * Helper function: Remove connection from the idle timeout list
+ */
+static void wait_list_remove(event_loop_t *loop, event_conn_t *conn) {
+    if (!conn->waiting) {
+        return;
+    }
+
+    if (conn->wait_prev != NULL) {
+        conn->wait_prev->wait_next = conn->wait_next;
+    } else {
+        loop->wait_head = conn->wait_next;
+    }
+
+    if (conn->wait_next != NULL) {
+        conn->wait_next->wait_prev = conn->wait_prev;
+    } else {
+        loop->wait_tail = conn->wait_prev;
+    }
+
+    conn->wait_prev = NULL;
+    conn->wait_next = NULL;
+    conn->waiting = false;
+}
+
+/*
+ * Helper function: Append connection to the idle timeout list
+ * All deadlines use the same timeout, so appending keeps the list sorted
+ */
+static void wait_list_append(event_loop_t *loop, event_conn_t *conn) {
+    wait_list_remove(loop, conn);
+
+    conn->deadline_ms = now_ms() + (uint64_t)connection_get_config()->idle_timeout_ms;
+    conn->wait_prev = loop->wait_tail;
+    conn->wait_next = NULL;
+
+    if (loop->wait_tail != NULL) {
+        loop->wait_tail->wait_next = conn;
+    } else {
+        loop->wait_head = conn;
+    }
+    loop->wait_tail = conn;
+    conn->waiting = true;
+}
+
+/* Loop whose reactor runs on this thread (NULL on worker threads) */
+static __thread event_loop_t *t_reactor = NULL;
+
+/*
+ * Helper function: Take a reset exchange from the loop's pool (reactor only)
+ * Returns the exchange, NULL if out of memory
+ */
+static event_exchange_t *exchange_get(event_loop_t *loop) {
+    if (loop->free_exchanges == NULL) {
+        /* Take over everything workers have released since the list ran dry */
+        event_exchange_t *returned = __atomic_exchange_n(&loop->returned_exchanges, NULL,
+                                                         __ATOMIC_ACQUIRE);
+        loop->free_exchanges = returned;
+        for (; returned != NULL; returned = returned->next_free) {
+            loop->num_free_exchanges++;
+        }
+    }
+
+    event_exchange_t *exchange = loop->free_exchanges;
+    if (exchange != NULL) {
+        loop->free_exchanges = exchange->next_free;
+        loop->num_free_exchanges--;
+    } else {
+        exchange = (event_exchange_t *)malloc(sizeof(event_exchange_t));
+        if (exchange == NULL) {
+            return NULL;
+        }
+    }
+
+    memset(exchange, 0, offsetof(event_exchange_t, buffer));
+    http_request_init(&exchange->request);
+    exchange->buffer[0] = '\0';
+    return exchange;
+}
+
+/*
+ * Helper function: Give an exchange back to the loop's pool
+ * The reactor keeps it on its own free list; other threads push it onto a
+ * lock-free stack that only the reactor empties, all at once
+ */
+static void exchange_put(event_loop_t *loop, event_exchange_t *exchange) {
+    http_output_release(&exchange->output);
+    free(exchange->output_copy);
+    exchange->output_copy = NULL;
+
+    if (t_reactor != loop) {
+        event_exchange_t *head = __atomic_load_n(&loop->returned_exchanges, __ATOMIC_RELAXED);
+        do {
+            exchange->next_free = head;
+        } while (!__atomic_compare_exchange_n(&loop->returned_exchanges, &head, exchange, true,
+                                              __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+        return;
+    }
+
+    if (loop->num_free_exchanges >= EVENT_LOOP_POOL_KEEP) {
+        free(exchange);
+        return;
+    }
+    exchange->next_free = loop->free_exchanges;
+    loop->free_exchanges = exchange;
+    loop->num_free_exchanges++;
+}
+
+/*
+ * Helper function: Slot for fd, allocating its slab on first use (reactor only)
+ * Returns the slot, NULL if fd is out of range or out of memory
+ */
+static event_conn_t *conn_slot(event_loop_t *loop, int fd) {
+    if (fd < 0 || fd >= loop->max_fds) {
+        LOG_ERROR(NULL, "client_fd=%d exceeds connection table size %d, closing",
+                  fd, loop->max_fds);
+        return NULL;
+    }
+
+    event_conn_t **slab = &loop->slabs[fd / EVENT_LOOP_SLAB_CONNS];
+    if (*slab == NULL) {
+        event_conn_t *conns = (event_conn_t *)calloc(EVENT_LOOP_SLAB_CONNS,
+                                                     sizeof(event_conn_t));
+        if (conns == NULL) {
+            LOG_ERROR(NULL, "Failed to allocate connection slab (fd=%d)", fd);
+            return NULL;
+        }
+        __atomic_store_n(slab, conns, __ATOMIC_RELEASE);
+    }
+    return &(*slab)[fd % EVENT_LOOP_SLAB_CONNS];
+}
+
+/*
+ * Helper function: Open connection on fd
+ * Returns the connection, NULL if none
+ */
+static event_conn_t *conn_lookup(event_loop_t *loop, int fd) {
+    if (fd < 0 || fd >= loop->max_fds) {
+        return NULL;
+    }
+
+    event_conn_t *slab = __atomic_load_n(&loop->slabs[fd / EVENT_LOOP_SLAB_CONNS],
+                                         __ATOMIC_ACQUIRE);
+    if (slab == NULL) {
+        return NULL;
+    }
+    event_conn_t *conn = &slab[fd % EVENT_LOOP_SLAB_CONNS];
+    return __atomic_load_n(&conn->open, __ATOMIC_ACQUIRE) ? conn : NULL;
+}
+
+/*
+ * Helper function: Attach request state and a read buffer (reactor only)
+ * Returns 0 on success, -1 on error
+ */
+static int conn_exchange_attach(event_loop_t *loop, event_conn_t *conn) {
+    if (conn->exchange != NULL) {
+        return 0;
+    }
+
+    conn->exchange = exchange_get(loop);
+    if (conn->exchange == NULL) {
+        LOG_ERROR(NULL, "Failed to allocate request state (fd=%d)", conn->fd);
+        return -1;
+    }
+    conn->buffer = conn->exchange->buffer;
+    return 0;
+}
+
+/*
+ * Helper function: Give a connection's request state back to the pool
+ */
+static void conn_exchange_release(event_loop_t *loop, event_conn_t *conn) {
+    if (conn->exchange == NULL) {
+        return;
+    }
+
+    exchange_put(loop, conn->exchange);
+    conn->exchange = NULL;
+    conn->buffer = NULL;
+}
+
+/*
+ * Helper function: Release connection state and close its socket
+ * Frees the slot before close() so the fd number can be reused
+ */
+static void conn_close(event_loop_t *loop, event_conn_t *conn) {
+    LOG_DEBUG(NULL, "Closing connection (fd=%d, served=%d)", conn->fd, conn->requests_served);
+
+    loop->ops->forget(loop, conn);
+    conn_exchange_release(loop, conn);
+
+    int fd = conn->fd;
+    __atomic_store_n(&conn->open, false, __ATOMIC_RELEASE);
+    close(fd);
+    __atomic_sub_fetch(&loop->open_conns, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Helper function: Close a connection from the reactor thread
+ */
+static void conn_close_waiting(event_loop_t *loop, event_conn_t *conn) {
+    wait_list_remove(loop, conn);
+    conn_close(loop, conn);
+}
+
+/*
+ * Helper function: Re-arm a connection and start its idle timer (reactor only)
+ */
+static void conn_wait(event_loop_t *loop, event_conn_t *conn) {
+    /* Nothing buffered between requests: an idle connection holds no request state */
+    if (conn->state == CONN_STATE_READING_HEADERS && conn->length == 0) {
+        conn_exchange_release(loop, conn);
+    }
+
+    if (loop->ops->arm(loop, conn) < 0) {
+        conn_close_waiting(loop, conn);
+        return;
+    }
+    wait_list_append(loop, conn);
+}
+
+/*
+ * Helper function: Feed newly received bytes to the request parser
+ * Returns true when the buffered request is ready for a worker
+ */
+static bool conn_request_ready(event_conn_t *conn) {
+    event_exchange_t *exchange = conn->exchange;
+
+    if (conn->state == CONN_STATE_READING_HEADERS) {
+        if (conn->length > 0) {
+            trace_mark_once(&exchange->trace, TRACE_RECEIVED);
+        }
+        http_parse_result_t parsed = http_parse_request(&exchange->request, conn->buffer,
+                                                        conn->length);
+
+        if (parsed == HTTP_PARSE_NEED_MORE) {
+            return false;
+        }
+        trace_mark(&exchange->trace, TRACE_PARSED);
+
+        /* Malformed request, or headers that settle the response: dispatch now */
+        bool before_body = false;
+        if (parsed == HTTP_PARSE_DONE) {
+            connection_check_headers(&exchange->request, &before_body);
+        }
+        if (parsed == HTTP_PARSE_ERROR || before_body ||
+            connection_body_begin(&exchange->body, &exchange->request) != 0) {
+            exchange->request_length = conn->length;
+            return true;
+        }
+
+        /* Only a client that has not started uploading is still waiting */
+        if (exchange->request.expect_continue && conn->length == exchange->request.header_length &&
+            connection_send_continue(conn->fd) != 0) {
+            LOG_DEBUG(NULL, "Failed to send 100 Continue (fd=%d)", conn->fd);
+        }
+
+        conn->state = CONN_STATE_READING_BODY;
+    }
+
+    /* Decoded bytes are dropped from the buffer, so it never outgrows one window */
+    http_body_result_t result = connection_body_consume(&exchange->body, conn->buffer,
+                                                        exchange->request.header_length,
+                                                        &conn->length);
+    if (result == HTTP_BODY_NEED_MORE) {
+        return false;
+    }
+
+    /* A failed body has no known end: drop everything and close after answering */
+    exchange->request_length = result == HTTP_BODY_DONE ? exchange->request.header_length
+                                                        : conn->length;
+    trace_mark(&exchange->trace, TRACE_BODY);
+    return true;
+}
+
+/*
+ * Helper function: Drop the answered request, keeping pipelined bytes
+ */
+static void conn_consume_request(event_conn_t *conn) {
+    event_exchange_t *exchange = conn->exchange;
+
+    conn->length -= exchange->request_length;
+    memmove(conn->buffer, conn->buffer + exchange->request_length, conn->length);
+    conn->buffer[conn->length] = '\0';
+    exchange->request_length = 0;
+    memset(&exchange->body, 0, sizeof(exchange->body));
+    http_request_init(&exchange->request);
+    trace_reset(&exchange->trace);
+    conn->state = CONN_STATE_READING_HEADERS;
+}
+
+/*
+ * Helper function: Send as much pending output as the socket accepts
+ * zerocopy is NULL once the output has been copied off the worker arena
+ * Returns 1 when all output is sent, 0 if the socket would block, -1 on error
+ */
+static int conn_flush(event_conn_t *conn, conn_zerocopy_t *zerocopy) {
+    event_exchange_t *exchange = conn->exchange;
+
+    int result = connection_send_output(conn->fd, &exchange->output, zerocopy);
+    if (result != 1) {
+        return result;
+    }
+
+    trace_mark(&exchange->trace, TRACE_SENT);
+    trace_finish(&exchange->trace);
+    LOG_DEBUG(NULL, "Sent response (%zu bytes) to client (fd=%d, request %d)",
+             exchange->output.length, conn->fd, conn->requests_served);
+
+    http_output_release(&exchange->output);
+    free(exchange->output_copy);
+    exchange->output_copy = NULL;
+    memset(&exchange->output, 0, sizeof(exchange->output));
+    return 1;
+}
+
+/*
+ * Helper function: Move unsent output off the worker arena (worker only)
+ * The reactor finishes the write after the worker has recycled its arena
+ * Returns 0 on success, -1 on error
+ */
+static int conn_detach_output(event_conn_t *conn) {
+    http_output_t *output = &conn->exchange->output;
+    size_t remaining = 0;
+    for (int i = output->iov_index; i < output->iov_count; i++) {
+        remaining += output->iov[i].iov_len;
+    }
+
+    /* The borrowed file (if any) stays referenced: only arena bytes move */
+    if (remaining == 0) {
+        output->iov_count = 0;
+        output->iov_index = 0;
+        output->body_length = 0;
+        output->length = output->borrow.length;
+        output->sent = 0;
+        return 0;
+    }
+
+    char *copy = (char *)malloc(remaining);
+    if (copy == NULL) {
+        LOG_ERROR(NULL, "Failed to copy %zu bytes of pending output (fd=%d)",
+                  remaining, conn->fd);
+        return -1;
+    }
+
+    size_t offset = 0;
+    for (int i = output->iov_index; i < output->iov_count; i++) {
+        memcpy(copy + offset, output->iov[i].iov_base, output->iov[i].iov_len);
+        offset += output->iov[i].iov_len;
+    }
+
+    conn->exchange->output_copy = copy;
+    output->iov[0].iov_base = copy;
+    output->iov[0].iov_len = remaining;
+    output->iov_count = 1;
+    output->iov_index = 0;
+    output->body_length = 0;
+    output->length = remaining + output->borrow.length;
+    output->sent = 0;
+    return 0;
+}
+
+static void conn_serve(event_loop_t *loop, event_conn_t *conn);
+
+/*
+ * Helper function: Hand a complete request to the worker pool (reactor only)
+ * Loops without a pool serve it right here
+ */
+static void conn_dispatch(event_loop_t *loop, event_conn_t *conn) {
+    wait_list_remove(loop, conn);
+    conn->state = CONN_STATE_PROCESSING;
+
+    if (loop->submit == NULL) {
+        conn_serve(loop, conn);
+        return;
+    }
+
+    /* The fd doubles as affinity: a connection keeps the same home worker */
+    conn->dispatched_ns = metrics_now_ns();
+    if (loop->submit(loop->submit_arg, conn->fd, conn->fd) < 0) {
+        /* Queue limit reached (or shutting down): refuse fast */
+        LOG_WARN(NULL, "Workers unavailable, shedding client_fd=%d", conn->fd);
+        connection_send_overloaded(conn->fd);
+        conn_close(loop, conn);
+    }
+}
+
+/*
+ * Helper function: Return a connection to the reactor (worker only)
+ * The reactor re-arms it and restarts its idle timer
+ */
+static void conn_hand_back(event_loop_t *loop, event_conn_t *conn) {
+    if (loop->submit == NULL) {
+        /* Already on the reactor thread */
+        conn_wait(loop, conn);
+        return;
+    }
+
+    pthread_mutex_lock(&loop->return_lock);
+    bool was_empty = loop->returned == NULL;
+    conn->next_returned = loop->returned;
+    loop->returned = conn;
+    pthread_mutex_unlock(&loop->return_lock);
+
+    /* One wakeup per batch of returned connections */
+    if (was_empty) {
+        uint64_t one = 1;
+        if (write(loop->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            LOG_ERROR(NULL, "Failed to wake event loop: %s", strerror(errno));
+        }
+    }
+}
+
+/*
+ * Helper function: Re-arm every connection handed back by workers
+ */
+static void drain_returned(event_loop_t *loop) {
+    uint64_t count;
+    if (read(loop->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        LOG_ERROR(NULL, "Failed to read event loop wakeup: %s", strerror(errno));
+    }
+
+    pthread_mutex_lock(&loop->return_lock);
+    event_conn_t *conn = loop->returned;
+    loop->returned = NULL;
+    pthread_mutex_unlock(&loop->return_lock);
+
+    while (conn != NULL) {
+        event_conn_t *next = conn->next_returned;
+        conn->next_returned = NULL;
+        conn_wait(loop, conn);
+        conn = next;
+    }
+}
+
+/*
+ * Helper function: Account for bytes received at buffer[length]
+ * Returns true if the connection went to a worker (the caller must let go)
+ */
+static bool conn_received(event_loop_t *loop, event_conn_t *conn, size_t bytes) {
+    conn->length += bytes;
+    conn->buffer[conn->length] = '\0';
+    metrics_add(METRIC_BYTES_RECEIVED, (uint64_t)bytes);
+    LOG_DEBUG(NULL, "Read %zu bytes from client (fd=%d)", bytes, conn->fd);
+
+    if (conn_request_ready(conn)) {
+        conn_dispatch(loop, conn);
+        return true;
+    }
+    if (conn->length + 1 >= CONN_BUFFER_SIZE) {
+        /* Buffer full (oversized header block) */
+        conn->exchange->request_length = conn->length;
+        conn_dispatch(loop, conn);
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Helper function: Read everything available on a connection
+ * (epoll engine, or io_uring once a connection holding bytes is readable)
+ */
+static void conn_on_readable(event_loop_t *loop, event_conn_t *conn) {
+    wait_list_remove(loop, conn);
+
+    if (conn_exchange_attach(loop, conn) < 0) {
+        conn_close(loop, conn);
+        return;
+    }
+
+    for (;;) {
+        size_t space = CONN_BUFFER_SIZE - conn->length - 1;
+        ssize_t bytes_read = recv(conn->fd, conn->buffer + conn->length, space, 0);
+
+        if (bytes_read > 0) {
+            if (conn_received(loop, conn, (size_t)bytes_read)) {
+                return;
+            }
+            continue;
+        }
+
+        if (bytes_read == 0) {
+            LOG_DEBUG(NULL, "Connection closed by client (fd=%d)", conn->fd);
+            conn_close(loop, conn);
+            return;
+        }
+
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            /* Drained: wait for the next edge */
+            conn_wait(loop, conn);
+            return;
+        }
+
+        LOG_ERROR(NULL, "recv() failed (fd=%d): %s", conn->fd, strerror(errno));
+        conn_close(loop, conn);
+        return;
+    }
+}
+
+/*
+ * Helper function: Continue a partially sent response (reactor only)
+ */
+static void conn_on_writable(event_loop_t *loop, event_conn_t *conn) {
+    wait_list_remove(loop, conn);
+
+    int result = conn_flush(conn, NULL);
+    if (result < 0) {
+        conn_close(loop, conn);
+        return;
+    }
+    if (result == 0) {
+        conn_wait(loop, conn);
+        return;
+    }
+
+    if (!conn->keep_alive) {
+        conn_close(loop, conn);
+        return;
+    }
+
+    conn_consume_request(conn);
+    if (conn_request_ready(conn)) {
+        /* Pipelined request already buffered */
+        conn_dispatch(loop, conn);
+    } else {
+        conn_wait(loop, conn);
+    }
+}
+
+/*
+ * Helper function: Close connections whose idle deadline has passed
+ * Returns the engine wait timeout until the next deadline (-1 if none)
+ */
+static int expire_idle(event_loop_t *loop) {
+    uint64_t now = now_ms();
+
+    while (loop->wait_head != NULL && loop->wait_head->deadline_ms <= now) {
+        event_conn_t *conn = loop->wait_head;
+        LOG_DEBUG(NULL, "Idle timeout, closing connection (fd=%d)", conn->fd);
+        conn_close_waiting(loop, conn);
+    }
+
+    if (loop->wait_head == NULL) {
+        return -1;
+    }
+    return (int)(loop->wait_head->deadline_ms - now);
+}
+
+/*
+ * Helper function: Stop accepting and close keep-alive connections between
+ * requests; the rest finish without keep-alive (see connection_draining)
+ */
+static void drain_begin(event_loop_t *loop) {
+    loop->draining = true;
+    loop->drain_deadline_ms = now_ms() + (uint64_t)loop->listener->drain_timeout_ms;
+
+    /* The listen socket now belongs to our successor; the pipe stays signaled for others */
+    loop->ops->stop_accepting(loop);
+
+    int closed = 0;
+    event_conn_t *conn = loop->wait_head;
+    while (conn != NULL) {
+        event_conn_t *next = conn->wait_next;
+        /* A fresh connection's first request may still be in flight: let it in */
+        if (conn->state == CONN_STATE_READING_HEADERS && conn->length == 0 &&
+            conn->requests_served > 0) {
+            conn_close_waiting(loop, conn);
+            closed++;
+        }
+        conn = next;
+    }
+
+    LOG_INFO(NULL, "Event loop draining: closed %d idle connections, %d still open",
+             closed, __atomic_load_n(&loop->open_conns, __ATOMIC_RELAXED));
+}
+
+/*
+ * Helper function: Handle the shutdown pipe becoming readable
+ * Left undrained so every loop sharing the pipe sees it
+ */
+static void loop_on_shutdown(event_loop_t *loop) {
+    LOG_DEBUG(NULL, "Shutdown signal received via pipe");
+    if (__atomic_load_n(&loop->listener->draining, __ATOMIC_ACQUIRE)) {
+        drain_begin(loop);
+    } else {
+        loop->running = false;
+    }
+}
+
+/*
+ * Helper function: Take ownership of an accepted socket and wait for its first request
+ */
+static void conn_open(event_loop_t *loop, int client_fd) {
+    metrics_add(METRIC_CONNECTIONS_ACCEPTED, 1);
+
+    event_conn_t *conn = conn_slot(loop, client_fd);
+    if (conn == NULL) {
+        close(client_fd);
+        return;
+    }
+
+    /* Request state comes from the pool once the first bytes arrive */
+    event_exchange_t *parked = conn->parked;
+    memset(conn, 0, sizeof(*conn));
+    conn->parked = parked;
+    conn->fd = client_fd;
+    conn->state = CONN_STATE_READING_HEADERS;
+    conn->generation = loop->next_generation++;
+    __atomic_store_n(&conn->open, true, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&loop->open_conns, 1, __ATOMIC_RELAXED);
+
+    if (loop->ops->open(loop, conn) < 0) {
+        conn_close(loop, conn);
+        return;
+    }
+
+    /* Slow clients get the idle timeout for their first request too */
+    wait_list_append(loop, conn);
+}
+
+/*
+ * Helper function: Accept all pending connections on the listen socket (epoll engine)
+ */
+static void accept_connections(event_loop_t *loop) {
+    for (;;) {
+        struct sockaddr_in client_addr;
+        socklen_t client_addr_len = sizeof(client_addr);
+
+        int client_fd = accept4(loop->listen_fd,
+                                (struct sockaddr *)&client_addr,
+                                &client_addr_len,
+                                SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return;
+            }
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            LOG_ERROR(NULL, "accept4() failed: %s", strerror(errno));
+            return;
+        }
+
+        char client_ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
+        LOG_DEBUG(NULL, "Accepted connection from %s:%d (fd=%d)",
+                 client_ip, ntohs(client_addr.sin_port), client_fd);
+
+        conn_open(loop, client_fd);
+    }
+}
+
+/*
+ * Helper function: Register a level-triggered fd for EPOLLIN
+ * Returns 0 on success, -1 on error
+ */
+static int register_fd(event_loop_t *loop, int fd) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+
+    return epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/*
+ * Helper function: Create the epoll instance and watch the loop's own fds
+ * Returns 0 on success, -1 on error
+ */
+static int epoll_engine_init(event_loop_t *loop) {
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll_fd < 0) {
+        LOG_ERROR(NULL, "epoll_create1() failed: %s", strerror(errno));
+        return -1;
+    }
+
+    /* Listen socket, shutdown pipe and wakeup eventfd are level-triggered */
+    if (register_fd(loop, loop->listen_fd) < 0 ||
+        register_fd(loop, loop->listener->shutdown_pipe[0]) < 0 ||
+        register_fd(loop, loop->wake_fd) < 0) {
+        LOG_ERROR(NULL, "Failed to register event loop fds: %s", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Helper function: Close the epoll instance
+ */
+static void epoll_engine_destroy(event_loop_t *loop) {
+    if (loop->epoll_fd >= 0) {
+        close(loop->epoll_fd);
+        loop->epoll_fd = -1;
+    }
+}
+
+/*
+ * Helper function: Register a new connection, one-shot and edge-triggered
+ * Returns 0 on success, -1 on error
+ */
+static int epoll_engine_open(event_loop_t *loop, event_conn_t *conn) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET | EPOLLONESHOT;
+    ev.data.fd = conn->fd;
+
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, conn->fd, &ev) < 0) {
+        LOG_ERROR(NULL, "epoll_ctl(ADD) failed (fd=%d): %s", conn->fd, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Helper function: Re-arm a one-shot connection for reading or writing
+ * Returns 0 on success, -1 on error
+ */
+static int epoll_engine_arm(event_loop_t *loop, event_conn_t *conn) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = (conn->state == CONN_STATE_WRITING ? EPOLLOUT : EPOLLIN) |
+                EPOLLET | EPOLLONESHOT | EPOLLRDHUP;
+    ev.data.fd = conn->fd;
+
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev) < 0) {
+        LOG_ERROR(NULL, "epoll_ctl(MOD) failed (fd=%d): %s", conn->fd, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Helper function: Nothing to undo; close() removes the fd from epoll
+ */
+static void epoll_engine_forget(event_loop_t *loop, event_conn_t *conn) {
+    (void)loop;
+    (void)conn;
+}
+
+/*
+ * Helper function: Stop watching the listen socket and the shutdown pipe
+ */
+static void epoll_engine_stop_accepting(event_loop_t *loop) {
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, loop->listen_fd, NULL);
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, loop->listener->shutdown_pipe[0], NULL);
+}
+
+/*
+ * Helper function: Wait for readiness and handle every ready fd
+ * Returns 0 on success, -1 on error
+ */
+static int epoll_engine_wait(event_loop_t *loop, int timeout_ms) {
+    struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+    int ready = epoll_wait(loop->epoll_fd, events, EVENT_LOOP_MAX_EVENTS, timeout_ms);
+
+    if (ready < 0) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        LOG_ERROR(NULL, "epoll_wait() failed: %s", strerror(errno));
+        return -1;
+    }
+
+    for (int i = 0; i < ready; i++) {
+        int fd = events[i].data.fd;
+
+        if (fd == loop->listener->shutdown_pipe[0]) {
+            loop_on_shutdown(loop);
+            continue;
+        }
+
+        if (fd == loop->listen_fd) {
+            accept_connections(loop);
+            continue;
+        }
+
+        if (fd == loop->wake_fd) {
+            drain_returned(loop);
+            continue;
+        }
+
+        event_conn_t *conn = conn_lookup(loop, fd);
+        if (conn == NULL) {
+            continue;
+        }
+
+        if (conn->state == CONN_STATE_WRITING) {
+            conn_on_writable(loop, conn);
+        } else if (conn->state != CONN_STATE_PROCESSING) {
+            conn_on_readable(loop, conn);
+        }
+    }
+    return 0;
+}
+
+static const event_engine_ops_t epoll_engine = {
+    .name = "epoll",
+    .init = epoll_engine_init,
+    .destroy = epoll_engine_destroy,
+    .open = epoll_engine_open,
+    .arm = epoll_engine_arm,
+    .forget = epoll_engine_forget,
+    .stop_accepting = epoll_engine_stop_accepting,
+    .wait = epoll_engine_wait
+};
+
+/*
+ * Helper function: Queue the multishot accept of the listen socket
+ * Returns 0 on success, -1 on error
+ */
+static int uring_engine_accept(event_loop_t *loop) {
+    return uring_accept(&loop->ring, loop->listen_fd, SOCK_NONBLOCK | SOCK_CLOEXEC,
+                        URING_TAG(URING_TAG_ACCEPT, 0, loop->listen_fd));
+}
+
+/*
+ * Helper function: Set up the ring and buffer group, accept and watch the loop's fds
+ * Provided buffer rings need Linux 5.19, which also has multishot accept
+ * Returns 0 on success, -1 if io_uring is unavailable
+ */
+static int uring_engine_init(event_loop_t *loop) {
+    if (uring_init(&loop->ring, EVENT_LOOP_URING_ENTRIES, EVENT_LOOP_URING_CQ_ENTRIES) < 0) {
+        LOG_WARN(NULL, "io_uring unavailable (%s), using epoll", strerror(errno));
+        return -1;
+    }
+
+    if (uring_bufs_init(&loop->ring, &loop->bufs, 0, EVENT_LOOP_URING_BUFFERS,
+                        EVENT_LOOP_URING_BUFFER_SIZE) < 0) {
+        LOG_WARN(NULL, "io_uring buffer rings unavailable (%s), using epoll", strerror(errno));
+        uring_destroy(&loop->ring);
+        return -1;
+    }
+
+    int shutdown_fd = loop->listener->shutdown_pipe[0];
+    if (uring_engine_accept(loop) < 0 ||
+        uring_poll(&loop->ring, shutdown_fd, POLLIN,
+                   URING_TAG(URING_TAG_SHUTDOWN, 0, shutdown_fd)) < 0 ||
+        uring_poll(&loop->ring, loop->wake_fd, POLLIN,
+                   URING_TAG(URING_TAG_WAKE, 0, loop->wake_fd)) < 0 ||
+        uring_submit(&loop->ring) < 0) {
+        LOG_WARN(NULL, "io_uring setup failed (%s), using epoll", strerror(errno));
+        uring_bufs_destroy(&loop->ring, &loop->bufs);
+        uring_destroy(&loop->ring);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Helper function: Free the buffer group and the ring (cancels what is in flight)
+ */
+static void uring_engine_destroy(event_loop_t *loop) {
+    uring_bufs_destroy(&loop->ring, &loop->bufs);
+    uring_destroy(&loop->ring);
+}
+
+/*
+ * Helper function: Queue the request a connection waits on
+ * An idle connection has no read buffer: the kernel picks a shared one when
+ * data arrives, and the bytes move into request state from the pool. The
+ * kernel never writes into connection memory, which a close may recycle
+ * before the cancelled request completes; a connection holding part of a
+ * request polls for readability instead and reads with recv()
+ * Returns 0 on success, -1 on error
+ */
+static int uring_engine_arm(event_loop_t *loop, event_conn_t *conn) {
+    uint64_t tag = URING_TAG(URING_TAG_CONN, conn->generation, conn->fd);
+    int result;
+
+    if (conn->state == CONN_STATE_WRITING) {
+        result = uring_poll(&loop->ring, conn->fd, POLLOUT, tag);
+    } else if (conn->exchange == NULL) {
+        result = uring_recv(&loop->ring, conn->fd, NULL, loop->bufs.size, loop->bufs.group, tag);
+    } else {
+        result = uring_poll(&loop->ring, conn->fd, POLLIN, tag);
+    }
+
+    if (result < 0) {
+        LOG_ERROR(NULL, "Failed to queue io_uring request (fd=%d): %s",
+                  conn->fd, strerror(errno));
+        return -1;
+    }
+    conn->pending = true;
+    return 0;
+}
+
+/*
+ * Helper function: Cancel the request in flight on a connection being closed
+ * Its completion arrives later and is recognized as stale; until then the
+ * connection's exchange stays parked on the slot, out of the pool
+ */
+static void uring_engine_forget(event_loop_t *loop, event_conn_t *conn) {
+    if (!conn->pending) {
+        return;
+    }
+
+    conn->pending = false;
+    if (uring_cancel(&loop->ring, URING_TAG(URING_TAG_CONN, conn->generation, conn->fd),
+                     URING_TAG(URING_TAG_CANCEL, 0, 0)) < 0) {
+        LOG_WARN(NULL, "Failed to cancel io_uring request (fd=%d)", conn->fd);
+    }
+
+    if (conn->exchange != NULL) {
+        conn->exchange->generation = conn->generation;
+        conn->exchange->next_free = conn->parked;
+        conn->parked = conn->exchange;
+        conn->exchange = NULL;
+        conn->buffer = NULL;
+    }
+}
+
+/*
+ * Helper function: Return the exchange parked by a closed connection once
+ * its cancelled request has completed
+ */
+static void uring_engine_unpark(event_loop_t *loop, int fd, uint32_t generation) {
+    if (fd < 0 || fd >= loop->max_fds || loop->slabs[fd / EVENT_LOOP_SLAB_CONNS] == NULL) {
+        return;
+    }
+
+    event_conn_t *slot = &loop->slabs[fd / EVENT_LOOP_SLAB_CONNS][fd % EVENT_LOOP_SLAB_CONNS];
+    for (event_exchange_t **link = &slot->parked; *link != NULL; link = &(*link)->next_free) {
+        event_exchange_t *exchange = *link;
+        if ((exchange->generation & 0xffffffU) == generation) {
+            *link = exchange->next_free;
+            exchange_put(loop, exchange);
+            return;
+        }
+    }
+}
+
+/*
+ * Helper function: Cancel the multishot accept
+ */
+static void uring_engine_stop_accepting(event_loop_t *loop) {
+    if (uring_cancel(&loop->ring, URING_TAG(URING_TAG_ACCEPT, 0, loop->listen_fd),
+                     URING_TAG(URING_TAG_CANCEL, 0, 0)) < 0) {
+        LOG_WARN(NULL, "Failed to cancel io_uring accept");
+        return;
+    }
+    /* Sockets it took before the cancellation still get served */
+    loop->accept_pending = true;
+}
+
+/*
+ * Helper function: Handle an accept completion, re-arming once the kernel stops it
+ */
+static void uring_engine_on_accept(event_loop_t *loop, const uring_cqe_t *cqe) {
+    if (cqe->res >= 0) {
+        LOG_DEBUG(NULL, "Accepted connection (fd=%d)", cqe->res);
+        conn_open(loop, cqe->res);
+    } else if (cqe->res != -ECANCELED && cqe->res != -ECONNABORTED && cqe->res != -EINTR) {
+        LOG_ERROR(NULL, "accept failed: %s", strerror(-cqe->res));
+    }
+
+    if ((cqe->flags & URING_CQE_MORE) != 0) {
+        return;
+    }
+    if (loop->draining) {
+        loop->accept_pending = false;
+    } else if (loop->running && uring_engine_accept(loop) < 0) {
+        LOG_ERROR(NULL, "Failed to re-arm io_uring accept");
+    }
+}
+
+/*
+ * Helper function: Handle the completion of a connection's request
+ */
+static void uring_engine_on_conn(event_loop_t *loop, const uring_cqe_t *cqe) {
+    int fd = (int)(uint32_t)cqe->user_data;
+    uint32_t generation = (uint32_t)(cqe->user_data >> 32) & 0xffffffU;
+    bool buffered = (cqe->flags & URING_CQE_BUFFER) != 0;
+    uint16_t id = (uint16_t)(cqe->flags >> URING_CQE_BUFFER_SHIFT);
+
+    event_conn_t *conn = conn_lookup(loop, fd);
+    if (conn == NULL || !conn->pending || (conn->generation & 0xffffffU) != generation) {
+        /* Cancelled under a connection that has since closed */
+        if (buffered) {
+            uring_bufs_put(&loop->bufs, id);
+        }
+        uring_engine_unpark(loop, fd, generation);
+        return;
+    }
+
+    conn->pending = false;
+    wait_list_remove(loop, conn);
+
+    if (conn->state == CONN_STATE_WRITING) {
+        conn_on_writable(loop, conn);
+        return;
+    }
+
+    if (conn->exchange != NULL) {
+        /* Readiness poll: read into the connection's buffer from here */
+        if (cqe->res < 0) {
+            LOG_ERROR(NULL, "poll failed (fd=%d): %s", conn->fd, strerror(-cqe->res));
+            conn_close(loop, conn);
+            return;
+        }
+        conn_on_readable(loop, conn);
+        return;
+    }
+
+    if (cqe->res == -ENOBUFS) {
+        /* Every shared buffer is taken: wait for readability, then read into our own */
+        if (conn_exchange_attach(loop, conn) < 0 || uring_engine_arm(loop, conn) < 0) {
+            conn_close(loop, conn);
+            return;
+        }
+        wait_list_append(loop, conn);
+        return;
+    }
+
+    if (cqe->res == 0) {
+        LOG_DEBUG(NULL, "Connection closed by client (fd=%d)", conn->fd);
+        conn_close(loop, conn);
+        return;
+    }
+    if (cqe->res == -EINTR || cqe->res == -EAGAIN) {
+        conn_wait(loop, conn);
+        return;
+    }
+    if (cqe->res < 0) {
+        LOG_ERROR(NULL, "recv() failed (fd=%d): %s", conn->fd, strerror(-cqe->res));
+        conn_close(loop, conn);
+        return;
+    }
+
+    if (buffered) {
+        /* Shared buffers are smaller than a connection buffer, which is empty here */
+        int attached = conn_exchange_attach(loop, conn);
+        if (attached == 0) {
+            memcpy(conn->buffer, uring_bufs_data(&loop->bufs, id), (size_t)cqe->res);
+        }
+        uring_bufs_put(&loop->bufs, id);
+        if (attached < 0) {
+            conn_close(loop, conn);
+            return;
+        }
+    }
+
+    if (!conn_received(loop, conn, (size_t)cqe->res)) {
+        conn_wait(loop, conn);
+    }
+}
+
+/*
+ * Helper function: Submit queued requests, wait for completions and handle them
+ * Returns 0 on success, -1 on error
+ */
+static int uring_engine_wait(event_loop_t *loop, int timeout_ms) {
+    if (uring_wait(&loop->ring, timeout_ms) < 0) {
+        LOG_ERROR(NULL, "io_uring_enter() failed: %s", strerror(errno));
+        return -1;
+    }
+
+    uring_cqe_t cqe;
+    while (uring_next(&loop->ring, &cqe)) {
+        switch (cqe.user_data >> 56) {
+        case URING_TAG_ACCEPT:
+            uring_engine_on_accept(loop, &cqe);
+            break;
+        case URING_TAG_SHUTDOWN:
+            loop_on_shutdown(loop);
+            break;
+        case URING_TAG_WAKE:
+            drain_returned(loop);
+            if (uring_poll(&loop->ring, loop->wake_fd, POLLIN,
+                           URING_TAG(URING_TAG_WAKE, 0, loop->wake_fd)) < 0) {
+                LOG_ERROR(NULL, "Failed to re-arm event loop wakeup");
+                return -1;
+            }
+            break;
+        case URING_TAG_CONN:
+            uring_engine_on_conn(loop, &cqe);
+            break;
+        default:
+            /* Cancellation results */
+            break;
+        }
+    }
+    return 0;
+}
+
+static const event_engine_ops_t uring_engine = {
+    .name = "uring",
+    .init = uring_engine_init,
+    .destroy = uring_engine_destroy,
+    .open = uring_engine_arm,
+    .arm = uring_engine_arm,
+    .forget = uring_engine_forget,
+    .stop_accepting = uring_engine_stop_accepting,
+    .wait = uring_engine_wait
+};
+
+/*
+ * Initialize event loop for listen socket listen_index of a started listener
+ * Returns 0 on success, -1 on error
+ */
+int event_loop_init(event_loop_t *loop, listener_t *listener, int listen_index,
+                    event_engine_t engine, task_submit_t submit, void *submit_arg) {
+    if (loop == NULL || listener == NULL || listener->socket_fds == NULL ||
+        listen_index < 0 || listen_index >= listener->num_sockets) {
+        LOG_ERROR(NULL, "event_loop_init: invalid parameters");
+        return -1;
+    }
+
+    memset(loop, 0, sizeof(*loop));
+    loop->listener = listener;
+    loop->listen_fd = listener->socket_fds[listen_index];
+    loop->submit = submit;
+    loop->submit_arg = submit_arg;
+    loop->epoll_fd = -1;
+    loop->ring.fd = -1;
+    loop->wake_fd = -1;
+
+    if (pthread_mutex_init(&loop->return_lock, NULL) != 0) {
+        LOG_ERROR(NULL, "Failed to initialize event loop mutex: %s", strerror(errno));
+        return -1;
+    }
+
+    /* Size the connection table from the fd limit */
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) {
+        loop->max_fds = limit.rlim_cur < EVENT_LOOP_MAX_FDS ? (int)limit.rlim_cur
+                                                             : EVENT_LOOP_MAX_FDS;
+    } else {
+        loop->max_fds = EVENT_LOOP_MAX_FDS;
+    }
+
+    loop->num_slabs = (loop->max_fds + EVENT_LOOP_SLAB_CONNS - 1) / EVENT_LOOP_SLAB_CONNS;
+    loop->slabs = (event_conn_t **)calloc((size_t)loop->num_slabs, sizeof(event_conn_t *));
+    if (loop->slabs == NULL) {
+        LOG_ERROR(NULL, "Failed to allocate connection table: %s", strerror(errno));
+        event_loop_destroy(loop);
+        return -1;
+    }
+
+    loop->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (loop->wake_fd < 0) {
+        LOG_ERROR(NULL, "eventfd() failed: %s", strerror(errno));
+        event_loop_destroy(loop);
+        return -1;
+    }
+
+    /* Listen socket must not block so accept4() can drain the backlog */
+    int flags = fcntl(loop->listen_fd, F_GETFL, 0);
+    fcntl(loop->listen_fd, F_SETFL, flags | O_NONBLOCK);
+
+    /* Older kernels without io_uring get the epoll engine */
+    loop->engine = EVENT_ENGINE_EPOLL;
+    if (engine == EVENT_ENGINE_URING && uring_engine_init(loop) == 0) {
+        loop->engine = EVENT_ENGINE_URING;
+        loop->ops = &uring_engine;
+    } else if (epoll_engine_init(loop) == 0) {
+        loop->ops = &epoll_engine;
+    } else {
+        loop->ops = &epoll_engine;
+        event_loop_destroy(loop);
+        return -1;
+    }
+
+    LOG_INFO(NULL, "Event loop initialized (engine=%s, listen_fd=%d, max_fds=%d, %s)",
+             loop->ops->name, loop->listen_fd, loop->max_fds,
+             submit != NULL ? "worker pool" : "inline");
+    return 0;
+}
+
+/*
+ * Run the reactor until the listener's shutdown pipe is signaled
+ * Returns 0 on clean shutdown, -1 on error
+ */
+int event_loop_run(event_loop_t *loop) {
+    if (loop == NULL || loop->ops == NULL) {
+        LOG_ERROR(NULL, "event_loop_run: invalid loop");
+        return -1;
+    }
+
+    int timeout_ms = -1;
+
+    loop->running = true;
+    t_reactor = loop;
+    LOG_INFO(NULL, "Event loop running");
+
+    while (loop->running) {
+        if (loop->ops->wait(loop, timeout_ms) < 0) {
+            t_reactor = NULL;
+            return -1;
+        }
+
+        timeout_ms = expire_idle(loop);
+
+        if (loop->draining) {
+            uint64_t now = now_ms();
+            if ((__atomic_load_n(&loop->open_conns, __ATOMIC_RELAXED) == 0 &&
+                 !loop->accept_pending) || now >= loop->drain_deadline_ms) {
+                loop->running = false;
+            } else if (timeout_ms < 0 || timeout_ms > EVENT_LOOP_DRAIN_POLL_MS) {
+                timeout_ms = EVENT_LOOP_DRAIN_POLL_MS;
+            }
+        }
+    }
+
+    t_reactor = NULL;
+    LOG_INFO(NULL, "Event loop stopped");
+    return 0;
+}
+
+/*
+ * Helper function: Build and send responses until no complete request
+ * remains buffered (worker thread, or the loop thread when inline)
+ */
+static void conn_serve(event_loop_t *loop, event_conn_t *conn) {
+    int client_fd = conn->fd;
+    arena_t *arena = arena_thread();
+
+    for (;;) {
+        event_exchange_t *exchange = conn->exchange;
+        conn->keep_alive = conn->requests_served + 1 < connection_get_config()->max_requests;
+        const conn_body_t *body = NULL;
+        if (http_body_started(&exchange->body.decoder)) {
+            body = &exchange->body;
+        }
+        trace_set_current(&exchange->trace);
+        int processed = connection_process_request(client_fd, &exchange->request, body,
+                                                   &conn->keep_alive, &exchange->output);
+        trace_set_current(NULL);
+        if (processed != 0) {
+            arena_reset(arena);
+            conn_close(loop, conn);
+            return;
+        }
+
+        conn->requests_served++;
+        conn->state = CONN_STATE_WRITING;
+
+        int result = conn_flush(conn, &conn->zerocopy);
+        if (result == 0 && conn_detach_output(conn) < 0) {
+            result = -1;
+        }
+
+        /* Zerocopy pages must be released before the arena reuses them */
+        if (connection_zerocopy_wait(client_fd, &conn->zerocopy,
+                                     connection_get_config()->idle_timeout_ms) != 0) {
+            result = -1;
+        }
+
+        /* Response is sent or copied out: recycle the arena for the next request */
+        arena_reset(arena);
+
+        if (result < 0) {
+            conn_close(loop, conn);
+            return;
+        }
+        if (result == 0) {
+            /* Socket buffer full: the reactor finishes the write on EPOLLOUT */
+            conn_hand_back(loop, conn);
+            return;
+        }
+
+        if (!conn->keep_alive) {
+            conn_close(loop, conn);
+            return;
+        }
+
+        /* Serve pipelined requests that are already buffered */
+        conn_consume_request(conn);
+        if (!conn_request_ready(conn)) {
+            break;
+        }
+        conn->state = CONN_STATE_PROCESSING;
+    }
+
+    conn_hand_back(loop, conn);
+}
+
+/*
+ * Worker-side task handler
+ * Builds and sends responses until no complete request remains buffered
+ */
+void event_loop_process(int client_fd, void *arg) {
+    event_loop_t *loop = (event_loop_t *)arg;
+
+    if (loop == NULL || client_fd < 0 || client_fd >= loop->max_fds) {
+        LOG_ERROR(NULL, "event_loop_process: invalid parameters (fd=%d)", client_fd);
+        return;
+    }
+
+    event_conn_t *conn = conn_lookup(loop, client_fd);
+    if (conn == NULL || conn->state != CONN_STATE_PROCESSING) {
+        LOG_WARN(NULL, "event_loop_process: no pending request (fd=%d)", client_fd);
+        return;
+    }
+
+    trace_mark(&conn->exchange->trace, TRACE_DEQUEUED);
+
+    /* Waited too long for a worker: its client has likely given up */
+    if (overload_shed(metrics_now_ns() - conn->dispatched_ns)) {
+        connection_send_overloaded(client_fd);
+        conn_close(loop, conn);
+        return;
+    }
+
+    conn_serve(loop, conn);
+}
+
+/*
+ * Close all remaining connections and free resources
+ */
+void event_loop_destroy(event_loop_t *loop) {
+    if (loop == NULL) {
+        return;
+    }
+
+    if (loop->slabs != NULL) {
+        for (int fd = 0; fd < loop->max_fds; fd++) {
+            event_conn_t *conn = conn_lookup(loop, fd);
+            if (conn != NULL) {
+                conn_close(loop, conn);
+            }
+        }
+    }
+
+    /* Connections first: their cancellations die with the ring */
+    if (loop->ops != NULL) {
+        loop->ops->destroy(loop);
+        loop->ops = NULL;
+    }
+
+    /* Nothing in flight can reach parked exchanges any more: pool them for freeing below */
+    if (loop->slabs != NULL) {
+        for (int i = 0; i < loop->num_slabs; i++) {
+            for (int j = 0; loop->slabs[i] != NULL && j < EVENT_LOOP_SLAB_CONNS; j++) {
+                event_conn_t *slot = &loop->slabs[i][j];
+                while (slot->parked != NULL) {
+                    event_exchange_t *parked = slot->parked;
+                    slot->parked = parked->next_free;
+                    exchange_put(loop, parked);
+                }
+            }
+            free(loop->slabs[i]);
+        }
+        free(loop->slabs);
+        loop->slabs = NULL;
+    }
+
+    /* Pooled request state, kept by the reactor or released by other threads */
+    event_exchange_t *lists[2] = { loop->free_exchanges, loop->returned_exchanges };
+    for (int i = 0; i < 2; i++) {
+        while (lists[i] != NULL) {
+            event_exchange_t *next = lists[i]->next_free;
+            free(lists[i]);
+            lists[i] = next;
+        }
+    }
+    loop->free_exchanges = NULL;
+    loop->returned_exchanges = NULL;
+    loop->num_free_exchanges = 0;
+
+    if (loop->wake_fd >= 0) {
+        close(loop->wake_fd);
+        loop->wake_fd = -1;
+    }
+
+    loop->wait_head = NULL;
+    loop->wait_tail = NULL;
+    loop->returned = NULL;
+    pthread_mutex_destroy(&loop->return_lock);
+
+    LOG_INFO(NULL, "Event loop destroyed");
+}
+
+/*
+ * Helper function: Loop thread for one SO_REUSEPORT socket
+ */
+static void *group_loop_thread(void *arg) {
+    event_loop_t *loop = (event_loop_t *)arg;
+    event_loop_group_t *group = loop->group;
+    int index = (int)(loop - group->loops);
+    int cpu = group->cpus[index];
+
+    if (cpu >= 0 && scheduler_pin_self(cpu) < 0) {
+        cpu = -1;
+    }
+    listener_steer_socket(group->listener, index, cpu);
+
+    LOG_INFO(NULL, "Event loop %d started (cpu=%d, listen_fd=%d)", index, cpu, loop->listen_fd);
+    event_loop_run(loop);
+    return NULL;
+}
+
+/*
+ * Initialize one inline event loop per listen socket of a started listener
+ * Returns 0 on success, -1 on error
+ */
+int event_loop_group_init(event_loop_group_t *group, listener_t *listener, sched_pin_t pin,
+                          event_engine_t engine) {
+    if (group == NULL || listener == NULL || listener->socket_fds == NULL) {
+        LOG_ERROR(NULL, "event_loop_group_init: invalid parameters");
+        return -1;
+    }
+
+    memset(group, 0, sizeof(*group));
+    group->listener = listener;
+
+    int n = listener->num_sockets;
+    group->loops = (event_loop_t *)calloc((size_t)n, sizeof(event_loop_t));
+    group->threads = (pthread_t *)calloc((size_t)n, sizeof(pthread_t));
+    group->cpus = (int *)malloc(sizeof(int) * (size_t)n);
+    if (group->loops == NULL || group->threads == NULL || group->cpus == NULL) {
+        LOG_ERROR(NULL, "Failed to allocate event loop group: %s", strerror(errno));
+        event_loop_group_destroy(group);
+        return -1;
+    }
+
+    /* Loop i runs on the i-th allowed CPU, matching the BPF socket index = CPU % n */
+    int cpus[SCHEDULER_MAX_CPUS];
+    int num_cpus = pin == SCHED_PIN_CORES ? scheduler_allowed_cpus(cpus, SCHEDULER_MAX_CPUS) : 0;
+    for (int i = 0; i < n; i++) {
+        group->cpus[i] = num_cpus > 0 ? cpus[i % num_cpus] : -1;
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (event_loop_init(&group->loops[i], listener, i, engine, NULL, NULL) < 0) {
+            event_loop_group_destroy(group);
+            return -1;
+        }
+        group->loops[i].group = group;
+        group->num_loops++;
+    }
+
+    LOG_INFO(NULL, "Event loop group initialized (%d loops, pin=%s, engine=%s)",
+             n, scheduler_pin_to_string(pin), group->loops[0].ops->name);
+    return 0;
+}
+
+/*
+ * Run every loop on its own thread until the shutdown pipe is signaled
+ * Returns 0 on clean shutdown, -1 on error
+ */
+int event_loop_group_run(event_loop_group_t *group) {
+    if (group == NULL || group->num_loops == 0) {
+        LOG_ERROR(NULL, "event_loop_group_run: invalid group");
+        return -1;
+    }
+
+    int started = 0;
+    for (int i = 0; i < group->num_loops; i++) {
+        int rc = pthread_create(&group->threads[i], NULL, group_loop_thread, &group->loops[i]);
+        if (rc != 0) {
+            /* Its socket stays in the group; connections hashed to it wait in its backlog */
+            LOG_ERROR(NULL, "Failed to create event loop thread %d: %s", i, strerror(rc));
+            group->threads[i] = 0;
+        } else {
+            started++;
+        }
+    }
+
+    for (int i = 0; i < group->num_loops; i++) {
+        if (group->threads[i] != 0) {
+            pthread_join(group->threads[i], NULL);
+            group->threads[i] = 0;
+        }
+    }
+
+    LOG_INFO(NULL, "Event loop group stopped (%d/%d loops ran)", started, group->num_loops);
+    return started == group->num_loops ? 0 : -1;
+}
+
+/*
+ * Close all connections of every loop and free the group
+ */
+void event_loop_group_destroy(event_loop_group_t *group) {
+    if (group == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < group->num_loops; i++) {
+        event_loop_destroy(&group->loops[i]);
+    }
+
+    free(group->loops);
+    free(group->threads);
+    free(group->cpus);
+    group->loops = NULL;
+    group->threads = NULL;
+    group->cpus = NULL;
+    group->num_loops = 0;
+}
+
+#else /* !__linux__ */
+
+int event_loop_init(event_loop_t *loop, listener_t *listener, int listen_index,
+                    event_engine_t engine, task_submit_t submit, void *submit_arg) {
+    (void)loop;
+    (void)listener;
+    (void)listen_index;
+    (void)engine;
+    (void)submit;
+    (void)submit_arg;
+    LOG_ERROR(NULL, "epoll event loop is only available on Linux");
+    return -1;
+}
+
+int event_loop_run(event_loop_t *loop) {
+    (void)loop;
+    return -1;
+}
+
+void event_loop_process(int client_fd, void *arg) {
+    (void)arg;
+    close(client_fd);
+}
+
+void event_loop_destroy(event_loop_t *loop) {
+    (void)loop;
+}
+
+int event_loop_group_init(event_loop_group_t *group, listener_t *listener, sched_pin_t pin,
+                          event_engine_t engine) {
+    (void)group;
+    (void)listener;
+    (void)pin;
+    (void)engine;
+    LOG_ERROR(NULL, "epoll event loop is only available on Linux");
+    return -1;
+}
+
+int event_loop_group_run(event_loop_group_t *group) {
+    (void)group;
+    return -1;
+}
+
+void event_loop_group_destroy(event_loop_group_t *group) {
+    (void)group;
+}
+
+#endif /* __linux__ */
+
+/*
+ * Convert engine to its option name
+ */
+const char *event_engine_to_string(event_engine_t engine) {
+    return engine == EVENT_ENGINE_URING ? "uring" : "epoll";
+}
@@ -0,0 +1,1342 @@
+/*
+ * C-HTTP Payment Server - Static File Server Implementation
+ *
+ * Lookups go through a cache keyed by the request path. Each entry holds
+ * everything a response needs: the open file (or, for small files, its
+ * contents), size, validators and the pre-rendered Content-Type / ETag /
+ * Last-Modified lines. A repeat request costs a hash lookup and, for large
+ * files, one sendfile() - no open(), stat() or header formatting.
+ *
+ * Entries are reference counted: the cache holds one reference and every
+ * response that borrows the entry holds another, so an entry evicted or
+ * invalidated mid-transfer stays valid until the transfer ends.
+ *
+ * Staleness: on Linux a watcher thread reads inotify events for the
+ * directories of cached files and drops the matching entries; elsewhere
+ * (or if inotify cannot be set up) entries are re-checked with stat() at
+ * most every FILESERVER_REVALIDATE_MS.
+ */
+
+#include "fileserver.h"
+#include "logger.h"
+#include "utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+
+/* Whether variants can be built on demand (otherwise only offline ones exist) */
+#if defined(HAVE_ZLIB) || defined(HAVE_BROTLI)
+#define FILESERVER_CAN_COMPRESS true
+#else
+#define FILESERVER_CAN_COMPRESS false
+#endif
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+
+/* Events that make a cached file stale */
+#define FILESERVER_WATCH_MASK                                                         \
+    (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | \
+     IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+#endif
+
+/*
+ * MIME Type Table
+ */
+typedef struct {
+    const char *extension;
+    const char *type;
+} mime_type_t;
+
+static const mime_type_t mime_types[] = {
+    { "html",  "text/html; charset=utf-8" },
+    { "htm",   "text/html; charset=utf-8" },
+    { "css",   "text/css; charset=utf-8" },
+    { "js",    "text/javascript; charset=utf-8" },
+    { "json",  "application/json" },
+    { "map",   "application/json" },
+    { "txt",   "text/plain; charset=utf-8" },
+    { "xml",   "application/xml" },
+    { "svg",   "image/svg+xml" },
+    { "png",   "image/png" },
+    { "jpg",   "image/jpeg" },
+    { "jpeg",  "image/jpeg" },
+    { "gif",   "image/gif" },
+    { "webp",  "image/webp" },
+    { "ico",   "image/x-icon" },
+    { "woff",  "font/woff" },
+    { "woff2", "font/woff2" },
+    { "wasm",  "application/wasm" },
+    { "pdf",   "application/pdf" },
+};
+
+/*
+ * Content Coding Table (indexed by fileserver_encoding_t)
+ */
+typedef struct {
+    const char *name;           /* Accept-Encoding / Content-Encoding token */
+    const char *suffix;         /* Offline variant file suffix */
+} encoding_info_t;
+
+static const encoding_info_t encodings[FILESERVER_ENCODING_COUNT] = {
+    [FILESERVER_ENCODING_IDENTITY] = { "identity", "" },
+    [FILESERVER_ENCODING_GZIP]     = { "gzip",     ".gz" },
+    [FILESERVER_ENCODING_BR]       = { "br",       ".br" },
+};
+
+/*
+ * Helper function: Monotonic clock in milliseconds
+ */
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/*
+ * Helper function: FNV-1a hash of a cache key
+ */
+static uint64_t key_hash(const char *key, size_t length) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)key[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/*
+ * Helper function: Value of a hex digit, -1 if c is not one
+ */
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/*
+ * Get MIME type for file extension
+ * Returns MIME type string
+ */
+const char *get_mime_type(const char *filename) {
+    if (filename == NULL) {
+        return "application/octet-stream";
+    }
+
+    const char *slash = strrchr(filename, '/');
+    const char *dot = strrchr(slash != NULL ? slash : filename, '.');
+    if (dot == NULL) {
+        return "application/octet-stream";
+    }
+
+    for (size_t i = 0; i < sizeof(mime_types) / sizeof(mime_types[0]); i++) {
+        if (strcasecmp(dot + 1, mime_types[i].extension) == 0) {
+            return mime_types[i].type;
+        }
+    }
+    return "application/octet-stream";
+}
+
+/*
+ * Resolve a URI path (below the mount point) to a path relative to the root
+ * Returns the length written to out, -1 if the path must not be served
+ */
+int resolve_file_path(const char *uri_path, size_t length, char *out, size_t out_size) {
+    if (uri_path == NULL || out == NULL || out_size == 0) {
+        return -1;
+    }
+
+    size_t used = 0;
+    for (size_t i = 0; i < length; i++) {
+        char c = uri_path[i];
+        if (c == '%') {
+            if (i + 2 >= length) {
+                return -1;
+            }
+            int high = hex_value(uri_path[i + 1]);
+            int low = hex_value(uri_path[i + 2]);
+            if (high < 0 || low < 0) {
+                return -1;
+            }
+            c = (char)((high << 4) | low);
+            i += 2;
+        }
+        if (c == '\0' || used + 1 >= out_size) {
+            return -1;
+        }
+        out[used++] = c;
+    }
+    out[used] = '\0';
+
+    /* Checked after decoding, so %2e%2e and %2f are caught too */
+    if (path_has_traversal(out)) {
+        return -1;
+    }
+    return (int)used;
+}
+
+/*
+ * Helper function: Free what a representation holds
+ */
+static void variant_clear(fileserver_variant_t *variant) {
+    if (variant->fd >= 0) {
+        close(variant->fd);
+    }
+    free(variant->data);
+    free(variant->headers);
+}
+
+/*
+ * Helper function: Drop one reference to an entry, freeing it on the last
+ * (also the release callback of borrowed response bodies)
+ */
+static void entry_release(void *arg) {
+    fileserver_entry_t *entry = arg;
+    if (entry == NULL || __atomic_sub_fetch(&entry->refcount, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+
+    variant_clear(&entry->identity);
+    for (int i = 0; i < FILESERVER_ENCODING_COUNT; i++) {
+        if (entry->variants[i] != NULL) {
+            variant_clear(entry->variants[i]);
+            free(entry->variants[i]);
+        }
+    }
+    free(entry->file);
+    free(entry->key);
+    free(entry);
+}
+
+/*
+ * Helper function: Unlink an entry from the LRU list (lock held)
+ */
+static void lru_remove(fileserver_t *server, fileserver_entry_t *entry) {
+    if (entry->lru_prev != NULL) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    } else {
+        server->lru_head = entry->lru_next;
+    }
+    if (entry->lru_next != NULL) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else {
+        server->lru_tail = entry->lru_prev;
+    }
+    entry->lru_prev = NULL;
+    entry->lru_next = NULL;
+}
+
+/*
+ * Helper function: Put an entry at the head of the LRU list (lock held)
+ */
+static void lru_push_front(fileserver_t *server, fileserver_entry_t *entry) {
+    entry->lru_prev = NULL;
+    entry->lru_next = server->lru_head;
+    if (server->lru_head != NULL) {
+        server->lru_head->lru_prev = entry;
+    } else {
+        server->lru_tail = entry;
+    }
+    server->lru_head = entry;
+}
+
+/*
+ * Helper function: Find a cached entry by key (lock held)
+ */
+static fileserver_entry_t *cache_find(fileserver_t *server, uint64_t hash, const char *key,
+                                      size_t key_length) {
+    fileserver_entry_t *entry = server->buckets[hash & (FILESERVER_BUCKETS - 1)];
+    while (entry != NULL) {
+        if (entry->hash == hash && entry->key_length == key_length &&
+            memcmp(entry->key, key, key_length) == 0) {
+            return entry;
+        }
+        entry = entry->hash_next;
+    }
+    return NULL;
+}
+
+/*
+ * Helper function: Remove an entry from the cache and drop the cache's
+ * reference (lock held)
+ */
+static void cache_remove(fileserver_t *server, fileserver_entry_t *entry) {
+    fileserver_entry_t **link = &server->buckets[entry->hash & (FILESERVER_BUCKETS - 1)];
+    while (*link != NULL && *link != entry) {
+        link = &(*link)->hash_next;
+    }
+    if (*link == entry) {
+        *link = entry->hash_next;
+    }
+
+    lru_remove(server, entry);
+    server->entry_count--;
+    server->memory_used -= entry->memory;
+    entry->cached = false;
+    entry_release(entry);
+}
+
+/*
+ * Helper function: Drop every cached entry (lock held)
+ */
+static void cache_flush(fileserver_t *server) {
+    while (server->lru_head != NULL) {
+        cache_remove(server, server->lru_head);
+    }
+}
+
+/*
+ * Helper function: Check that a canonical path lies inside the root
+ */
+static bool inside_root(const fileserver_t *server, const char *path) {
+    return strncmp(path, server->document_root, server->root_length) == 0 &&
+           (path[server->root_length] == '/' || path[server->root_length] == '\0');
+}
+
+/*
+ * Helper function: Canonicalize path, check it stays inside the root and
+ * open it; real receives the canonical path
+ * Returns the open fd, -1 if the file must not be (or cannot be) served
+ */
+static int open_inside_root(const fileserver_t *server, const char *path, char *real,
+                            struct stat *st) {
+    if (realpath(path, real) == NULL) {
+        return -1;
+    }
+    if (!inside_root(server, real)) {
+        LOG_WARN(NULL, "Refusing file outside the document root: %s", real);
+        return -1;
+    }
+
+    int fd = open(real, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, st) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * Helper function: Read a whole small file into memory
+ * Returns the buffer (malloc'd), NULL on error
+ */
+static char *read_contents(int fd, size_t size) {
+    char *data = malloc(size > 0 ? size : 1);
+    if (data == NULL) {
+        return NULL;
+    }
+
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = pread(fd, data + done, size - done, (off_t)done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            free(data);
+            return NULL;
+        }
+        done += (size_t)n;
+    }
+    return data;
+}
+
+/*
+ * Helper function: Check whether a MIME type is worth compressing
+ */
+static bool type_compressible(const char *type) {
+    return strncmp(type, "text/", 5) == 0 || strstr(type, "json") != NULL ||
+           strstr(type, "xml") != NULL || strcmp(type, "application/wasm") == 0;
+}
+
+/*
+ * Helper function: Fill in a representation's entity tag and header lines
+ * Returns 0 on success, -1 on error
+ */
+static int variant_render_headers(fileserver_variant_t *variant, const fileserver_entry_t *entry,
+                                  fileserver_encoding_t encoding) {
+    unsigned long long mtime_ns = (unsigned long long)entry->mtime.tv_sec * 1000000000ULL +
+                                  (unsigned long long)entry->mtime.tv_nsec;
+    bool identity = encoding == FILESERVER_ENCODING_IDENTITY;
+    snprintf(variant->etag, sizeof(variant->etag), "\"%llx-%llx%s%s\"",
+             (unsigned long long)entry->size, mtime_ns, identity ? "" : "-",
+             identity ? "" : encodings[encoding].name);
+
+    char coding[64] = "";
+    if (!identity) {
+        snprintf(coding, sizeof(coding), "Content-Encoding: %s\r\n", encodings[encoding].name);
+    }
+    const char *vary = entry->negotiable ? "Vary: Accept-Encoding\r\n" : "";
+
+    const char *format = "Content-Type: %s\r\n%s%sETag: %s\r\nLast-Modified: %s\r\n";
+    int length = snprintf(NULL, 0, format, entry->content_type, coding, vary, variant->etag,
+                          entry->last_modified);
+    if (length < 0) {
+        return -1;
+    }
+
+    variant->headers = malloc((size_t)length + 1);
+    if (variant->headers == NULL) {
+        return -1;
+    }
+    snprintf(variant->headers, (size_t)length + 1, format, entry->content_type, coding, vary,
+             variant->etag, entry->last_modified);
+    variant->block.data = variant->headers;
+    variant->block.length = (size_t)length;
+    return 0;
+}
+
+/*
+ * Helper function: Check for an offline "<file><suffix>" variant that is
+ * at least as new as the file
+ * Returns the open fd (st filled in), -1 if there is none
+ */
+static int open_offline_variant(const fileserver_t *server, const fileserver_entry_t *entry,
+                                fileserver_encoding_t encoding, struct stat *st) {
+    char path[PATH_MAX];
+    char real[PATH_MAX];
+    if (snprintf(path, sizeof(path), "%s/%s%s", server->document_root, entry->file,
+                 encodings[encoding].suffix) >= (int)sizeof(path)) {
+        return -1;
+    }
+
+    int fd = open_inside_root(server, path, real, st);
+    if (fd < 0) {
+        return -1;
+    }
+    if (!S_ISREG(st->st_mode) || st->st_mtim.tv_sec < entry->mtime.tv_sec) {
+        LOG_DEBUG(NULL, "Ignoring stale or irregular variant %s", real);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * Helper function: Open a file and build its (unpublished) cache entry
+ * Runs without the lock; *status is set to the HTTP error on failure
+ * Returns the entry with one reference, NULL on error
+ */
+static fileserver_entry_t *entry_load(const fileserver_t *server, const char *key,
+                                      size_t key_length, int *status) {
+    char path[PATH_MAX];
+    char real[PATH_MAX];
+    struct stat st;
+
+    *status = HTTP_NOT_FOUND;
+    if (snprintf(path, sizeof(path), "%s/%s", server->document_root, key) >= (int)sizeof(path)) {
+        return NULL;
+    }
+
+    int fd = open_inside_root(server, path, real, &st);
+    if (fd >= 0 && S_ISDIR(st.st_mode)) {
+        close(fd);
+        fd = -1;
+        if (snprintf(path, sizeof(path), "%s/%s", real, FILESERVER_INDEX) < (int)sizeof(path)) {
+            fd = open_inside_root(server, path, real, &st);
+        }
+    }
+    if (fd < 0) {
+        return NULL;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        close(fd);
+        return NULL;
+    }
+
+    *status = HTTP_INTERNAL_ERROR;
+    fileserver_entry_t *entry = calloc(1, sizeof(*entry));
+    if (entry == NULL) {
+        close(fd);
+        return NULL;
+    }
+
+    entry->refcount = 1;
+    entry->identity.fd = fd;
+    entry->size = (size_t)st.st_size;
+    entry->dev = st.st_dev;
+    entry->ino = st.st_ino;
+    entry->mtime = st.st_mtim;
+    entry->key = strndup(key, key_length);
+    entry->key_length = key_length;
+    entry->hash = key_hash(key, key_length);
+    entry->file = strdup(real[server->root_length] == '/' ? real + server->root_length + 1 : "");
+    if (entry->key == NULL || entry->file == NULL) {
+        entry_release(entry);
+        return NULL;
+    }
+
+    struct tm tm;
+    time_t seconds = entry->mtime.tv_sec;
+    if (gmtime_r(&seconds, &tm) == NULL ||
+        strftime(entry->last_modified, sizeof(entry->last_modified),
+                 "%a, %d %b %Y %H:%M:%S GMT", &tm) == 0) {
+        entry_release(entry);
+        return NULL;
+    }
+    entry->content_type = get_mime_type(entry->file);
+
+    /* Which codings could be offered decides whether responses carry Vary */
+    for (int i = FILESERVER_ENCODING_IDENTITY + 1; i < FILESERVER_ENCODING_COUNT; i++) {
+        struct stat variant_st;
+        int variant_fd = open_offline_variant(server, entry, (fileserver_encoding_t)i, &variant_st);
+        if (variant_fd >= 0) {
+            close(variant_fd);
+            entry->offline |= (uint8_t)(1u << i);
+        }
+    }
+    entry->negotiable = entry->offline != 0 ||
+                        (FILESERVER_CAN_COMPRESS && type_compressible(entry->content_type) &&
+                         entry->size >= FILESERVER_COMPRESS_MIN &&
+                         entry->size <= FILESERVER_COMPRESS_MAX);
+
+    if (variant_render_headers(&entry->identity, entry, FILESERVER_ENCODING_IDENTITY) != 0) {
+        entry_release(entry);
+        return NULL;
+    }
+
+    /* Small files are served from memory; the descriptor is not kept */
+    entry->identity.size = entry->size;
+    if (entry->size <= FILESERVER_SMALL_FILE) {
+        entry->identity.data = read_contents(fd, entry->size);
+        if (entry->identity.data == NULL) {
+            LOG_ERROR(NULL, "Failed to read %s", real);
+            entry_release(entry);
+            return NULL;
+        }
+        close(fd);
+        entry->identity.fd = -1;
+        entry->memory = entry->size;
+    }
+
+    *status = 0;
+    return entry;
+}
+
+/*
+ * Helper function: Watch the directory holding a cached file (lock held)
+ * Failure only costs invalidation for that directory, so it is not fatal
+ */
+static void watch_directory(fileserver_t *server, const fileserver_entry_t *entry) {
+#ifdef __linux__
+    if (server->inotify_fd < 0) {
+        return;
+    }
+
+    const char *slash = strrchr(entry->file, '/');
+    size_t dir_length = slash != NULL ? (size_t)(slash - entry->file) : 0;
+    char path[PATH_MAX];
+    if (snprintf(path, sizeof(path), "%s/%.*s", server->document_root, (int)dir_length,
+                 entry->file) >= (int)sizeof(path)) {
+        return;
+    }
+
+    int wd = inotify_add_watch(server->inotify_fd, path, FILESERVER_WATCH_MASK);
+    if (wd < 0) {
+        LOG_WARN(NULL, "Failed to watch %s: %s", path, strerror(errno));
+        return;
+    }
+    for (size_t i = 0; i < server->watch_count; i++) {
+        if (server->watches[i].wd == wd) {
+            return;
+        }
+    }
+
+    if (server->watch_count == server->watch_capacity) {
+        size_t capacity = server->watch_capacity > 0 ? server->watch_capacity * 2 : 16;
+        fileserver_watch_t *watches = realloc(server->watches, capacity * sizeof(*watches));
+        if (watches == NULL) {
+            return;
+        }
+        server->watches = watches;
+        server->watch_capacity = capacity;
+    }
+
+    char *dir = strndup(entry->file, dir_length);
+    if (dir == NULL) {
+        return;
+    }
+    server->watches[server->watch_count].wd = wd;
+    server->watches[server->watch_count].dir = dir;
+    server->watch_count++;
+#else
+    (void)server;
+    (void)entry;
+#endif
+}
+
+/*
+ * Helper function: Check a cached entry against the file on disk (lock held)
+ * Only used without inotify, at most every FILESERVER_REVALIDATE_MS; offline
+ * variants are trusted until the file itself changes
+ * Returns true if the entry is still current
+ */
+static bool entry_revalidate(fileserver_t *server, fileserver_entry_t *entry) {
+    uint64_t now = now_ms();
+    if (server->inotify_fd >= 0 || now - entry->checked_ms < FILESERVER_REVALIDATE_MS) {
+        return true;
+    }
+    entry->checked_ms = now;
+
+    char path[PATH_MAX];
+    struct stat st;
+    snprintf(path, sizeof(path), "%s/%s", server->document_root, entry->file);
+    return stat(path, &st) == 0 && st.st_dev == entry->dev && st.st_ino == entry->ino &&
+           (size_t)st.st_size == entry->size && st.st_mtim.tv_sec == entry->mtime.tv_sec &&
+           st.st_mtim.tv_nsec == entry->mtime.tv_nsec;
+}
+
+/*
+ * Helper function: Evict least recently served entries beyond the limits,
+ * never keep itself (lock held)
+ */
+static void cache_trim(fileserver_t *server, const fileserver_entry_t *keep) {
+    while (server->lru_tail != NULL && server->lru_tail != keep &&
+           (server->entry_count > FILESERVER_MAX_ENTRIES ||
+            server->memory_used > FILESERVER_MEMORY_LIMIT)) {
+        cache_remove(server, server->lru_tail);
+    }
+}
+
+/*
+ * Helper function: Look a path up, loading it on a miss
+ * Returns the entry with a reference for the caller, NULL with *status set
+ */
+static fileserver_entry_t *cache_acquire(fileserver_t *server, const char *key,
+                                         size_t key_length, int *status) {
+    uint64_t hash = key_hash(key, key_length);
+
+    pthread_mutex_lock(&server->lock);
+    fileserver_entry_t *entry = cache_find(server, hash, key, key_length);
+    if (entry != NULL && !entry_revalidate(server, entry)) {
+        LOG_DEBUG(NULL, "Cached file changed: %s", entry->file);
+        cache_remove(server, entry);
+        entry = NULL;
+    }
+    if (entry != NULL) {
+        lru_remove(server, entry);
+        lru_push_front(server, entry);
+        __atomic_add_fetch(&entry->refcount, 1, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&server->lock);
+        return entry;
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    /* Miss: do the file system work without holding the lock */
+    fileserver_entry_t *loaded = entry_load(server, key, key_length, status);
+    if (loaded == NULL) {
+        return NULL;
+    }
+    loaded->checked_ms = now_ms();
+
+    pthread_mutex_lock(&server->lock);
+    entry = cache_find(server, hash, key, key_length);
+    if (entry != NULL) {
+        /* Another thread loaded it meanwhile; serve theirs */
+        __atomic_add_fetch(&entry->refcount, 1, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&server->lock);
+        entry_release(loaded);
+        return entry;
+    }
+
+    size_t bucket = hash & (FILESERVER_BUCKETS - 1);
+    loaded->hash_next = server->buckets[bucket];
+    server->buckets[bucket] = loaded;
+    lru_push_front(server, loaded);
+    loaded->cached = true;
+    loaded->refcount = 2;       /* Cache + caller */
+    server->entry_count++;
+    server->memory_used += loaded->memory;
+    watch_directory(server, loaded);
+
+    cache_trim(server, loaded);
+    pthread_mutex_unlock(&server->lock);
+
+    LOG_DEBUG(NULL, "Cached file %s (%zu bytes, %s)", loaded->file, loaded->size,
+              loaded->identity.data != NULL ? "memory" : "sendfile");
+    return loaded;
+}
+
+#ifdef __linux__
+/*
+ * Helper function: Check whether a changed path (relative to the root)
+ * affects an entry: the file itself, an offline variant of it, or a
+ * directory above it
+ */
+static bool entry_depends_on(const fileserver_entry_t *entry, const char *changed,
+                             size_t length) {
+    size_t file_length = strlen(entry->file);
+    if (length <= file_length) {
+        return strncmp(entry->file, changed, length) == 0 &&
+               (entry->file[length] == '\0' || entry->file[length] == '/');
+    }
+
+    if (strncmp(changed, entry->file, file_length) != 0) {
+        return false;
+    }
+    for (int i = FILESERVER_ENCODING_IDENTITY + 1; i < FILESERVER_ENCODING_COUNT; i++) {
+        if (strcmp(changed + file_length, encodings[i].suffix) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Helper function: Drop entries for a changed name in a watched directory
+ * (lock held); a changed directory also drops everything below it
+ */
+static void invalidate_name(fileserver_t *server, int wd, const char *name) {
+    const char *dir = NULL;
+    for (size_t i = 0; i < server->watch_count; i++) {
+        if (server->watches[i].wd == wd) {
+            dir = server->watches[i].dir;
+            break;
+        }
+    }
+    if (dir == NULL) {
+        return;
+    }
+
+    char changed[PATH_MAX];
+    int length = snprintf(changed, sizeof(changed), "%s%s%s", dir, dir[0] != '\0' ? "/" : "",
+                          name);
+    if (length < 0 || length >= (int)sizeof(changed)) {
+        cache_flush(server);
+        return;
+    }
+
+    fileserver_entry_t *entry = server->lru_head;
+    while (entry != NULL) {
+        fileserver_entry_t *next = entry->lru_next;
+        if (entry_depends_on(entry, changed, (size_t)length)) {
+            LOG_DEBUG(NULL, "Invalidated cached file: %s", entry->file);
+            cache_remove(server, entry);
+        }
+        entry = next;
+    }
+}
+
+/*
+ * Helper function: Forget a watch the kernel removed (lock held)
+ */
+static void forget_watch(fileserver_t *server, int wd) {
+    for (size_t i = 0; i < server->watch_count; i++) {
+        if (server->watches[i].wd == wd) {
+            free(server->watches[i].dir);
+            server->watches[i] = server->watches[--server->watch_count];
+            return;
+        }
+    }
+}
+
+/*
+ * Helper function: Watcher thread - applies inotify events to the cache
+ */
+static void *watcher_main(void *arg) {
+    fileserver_t *server = arg;
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd fds[2] = {
+        { .fd = server->inotify_fd, .events = POLLIN },
+        { .fd = server->wake_fd, .events = POLLIN },
+    };
+
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_ERROR(NULL, "File watcher poll failed: %s", strerror(errno));
+            break;
+        }
+        if (fds[1].revents != 0) {
+            break;
+        }
+
+        ssize_t n = read(server->inotify_fd, buffer, sizeof(buffer));
+        if (n <= 0) {
+            if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+                continue;
+            }
+            break;
+        }
+
+        pthread_mutex_lock(&server->lock);
+        for (char *p = buffer; p < buffer + n;) {
+            const struct inotify_event *event = (const struct inotify_event *)p;
+            if (event->mask & IN_Q_OVERFLOW) {
+                /* Events were lost: nothing in the cache can be trusted */
+                cache_flush(server);
+            } else if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                cache_flush(server);
+                if (event->mask & IN_IGNORED) {
+                    forget_watch(server, event->wd);
+                }
+            } else if (event->len > 0) {
+                invalidate_name(server, event->wd, event->name);
+            }
+            p += sizeof(*event) + event->len;
+        }
+        pthread_mutex_unlock(&server->lock);
+    }
+
+    return NULL;
+}
+#endif
+
+/*
+ * Initialize file server with document root
+ * Returns 0 on success, -1 on error
+ */
+int fileserver_init(fileserver_t *server, const char *document_root) {
+    if (server == NULL || document_root == NULL) {
+        LOG_ERROR(NULL, "fileserver_init: NULL parameter");
+        return -1;
+    }
+
+    memset(server, 0, sizeof(*server));
+    server->inotify_fd = -1;
+    server->wake_fd = -1;
+
+    server->document_root = realpath(document_root, NULL);
+    struct stat st;
+    if (server->document_root == NULL || stat(server->document_root, &st) < 0 ||
+        !S_ISDIR(st.st_mode)) {
+        LOG_ERROR(NULL, "Invalid document root: %s", document_root);
+        free(server->document_root);
+        server->document_root = NULL;
+        return -1;
+    }
+    server->root_length = strlen(server->document_root);
+    if (server->root_length == 1) {
+        server->root_length = 0;    /* "/" - every path is below it */
+    }
+
+    if (pthread_mutex_init(&server->lock, NULL) != 0) {
+        LOG_ERROR(NULL, "Failed to initialize file cache lock");
+        free(server->document_root);
+        server->document_root = NULL;
+        return -1;
+    }
+
+    LOG_INFO(NULL, "Serving static files from %s", server->document_root);
+    return 0;
+}
+
+/*
+ * Start the thread that drops cache entries when their files change
+ * Returns 0 on success, -1 on error
+ */
+int fileserver_start(fileserver_t *server) {
+    if (server == NULL) {
+        return -1;
+    }
+
+#ifdef __linux__
+    server->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    server->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (server->inotify_fd >= 0 && server->wake_fd >= 0 &&
+        pthread_create(&server->watcher, NULL, watcher_main, server) == 0) {
+        server->watcher_started = true;
+        return 0;
+    }
+
+    LOG_WARN(NULL, "File watcher unavailable (%s); revalidating with stat()", strerror(errno));
+    if (server->inotify_fd >= 0) {
+        close(server->inotify_fd);
+        server->inotify_fd = -1;
+    }
+    if (server->wake_fd >= 0) {
+        close(server->wake_fd);
+        server->wake_fd = -1;
+    }
+#endif
+    return -1;
+}
+
+#ifdef HAVE_ZLIB
+/*
+ * Helper function: gzip a buffer
+ * Returns the compressed bytes (malloc'd), NULL on error
+ */
+static char *gzip_compress(const char *data, size_t length, size_t *out_length) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    /* windowBits + 16 selects the gzip wrapper */
+    if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) !=
+        Z_OK) {
+        return NULL;
+    }
+
+    uLong bound = deflateBound(&stream, (uLong)length);
+    char *out = malloc(bound);
+    if (out == NULL) {
+        deflateEnd(&stream);
+        return NULL;
+    }
+
+    stream.next_in = (Bytef *)data;
+    stream.avail_in = (uInt)length;
+    stream.next_out = (Bytef *)out;
+    stream.avail_out = (uInt)bound;
+    int result = deflate(&stream, Z_FINISH);
+    *out_length = stream.total_out;
+    deflateEnd(&stream);
+
+    if (result != Z_STREAM_END) {
+        free(out);
+        return NULL;
+    }
+    return out;
+}
+#endif
+
+#ifdef HAVE_BROTLI
+/*
+ * Helper function: Brotli-compress a buffer
+ * Returns the compressed bytes (malloc'd), NULL on error
+ */
+static char *brotli_compress(const char *data, size_t length, size_t *out_length) {
+    size_t bound = BrotliEncoderMaxCompressedSize(length);
+    char *out = bound > 0 ? malloc(bound) : NULL;
+    if (out == NULL) {
+        return NULL;
+    }
+
+    *out_length = bound;
+    if (!BrotliEncoderCompress(9, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, length,
+                               (const uint8_t *)data, out_length, (uint8_t *)out)) {
+        free(out);
+        return NULL;
+    }
+    return out;
+}
+#endif
+
+/*
+ * Helper function: Compress a file for a coding (without the lock)
+ * Returns the compressed bytes (malloc'd), NULL if the coding is not
+ * built in, the file does not qualify or compressing does not pay off
+ */
+static char *compress_contents(const fileserver_entry_t *entry, fileserver_encoding_t encoding,
+                               size_t *out_length) {
+    if (!type_compressible(entry->content_type) || entry->size < FILESERVER_COMPRESS_MIN ||
+        entry->size > FILESERVER_COMPRESS_MAX) {
+        return NULL;
+    }
+
+    const char *source = entry->identity.data;
+    char *loaded = NULL;
+    if (source == NULL) {
+        loaded = read_contents(entry->identity.fd, entry->size);
+        if (loaded == NULL) {
+            return NULL;
+        }
+        source = loaded;
+    }
+
+    char *out = NULL;
+    switch (encoding) {
+#ifdef HAVE_ZLIB
+        case FILESERVER_ENCODING_GZIP:
+            out = gzip_compress(source, entry->size, out_length);
+            break;
+#endif
+#ifdef HAVE_BROTLI
+        case FILESERVER_ENCODING_BR:
+            out = brotli_compress(source, entry->size, out_length);
+            break;
+#endif
+        default:
+            (void)source;
+            break;
+    }
+    free(loaded);
+
+    /* Not worth a variant unless it saves at least 1/16 */
+    if (out != NULL && *out_length > entry->size - entry->size / 16) {
+        free(out);
+        out = NULL;
+    }
+    return out;
+}
+
+/*
+ * Helper function: Build the variant of a file for a coding, from an
+ * offline "<file>.gz"/".br" or by compressing the file (without the lock)
+ * Returns the variant (malloc'd), NULL if the coding is not available
+ */
+static fileserver_variant_t *variant_build(const fileserver_t *server,
+                                           const fileserver_entry_t *entry,
+                                           fileserver_encoding_t encoding) {
+    fileserver_variant_t *variant = calloc(1, sizeof(*variant));
+    if (variant == NULL) {
+        return NULL;
+    }
+    variant->fd = -1;
+
+    struct stat st;
+    int fd = (entry->offline & (1u << encoding)) ? open_offline_variant(server, entry, encoding, &st)
+                                                 : -1;
+    if (fd >= 0) {
+        variant->size = (size_t)st.st_size;
+        if (variant->size <= FILESERVER_SMALL_FILE) {
+            variant->data = read_contents(fd, variant->size);
+            close(fd);
+        } else {
+            variant->fd = fd;
+        }
+    } else {
+        variant->data = compress_contents(entry, encoding, &variant->size);
+    }
+
+    if ((variant->data == NULL && variant->fd < 0) ||
+        variant_render_headers(variant, entry, encoding) != 0) {
+        variant_clear(variant);
+        free(variant);
+        return NULL;
+    }
+
+    LOG_DEBUG(NULL, "Built %s variant of %s: %zu -> %zu bytes (%s)", encodings[encoding].name,
+              entry->file, entry->size, variant->size, fd >= 0 ? "offline" : "compressed");
+    return variant;
+}
+
+/*
+ * Helper function: Get the variant of an entry for a coding, building it
+ * on first use; concurrent first requests may both build it, and the loser
+ * discards its copy
+ * Returns the variant, NULL if the coding is not available for this file
+ */
+static const fileserver_variant_t *entry_variant(fileserver_t *server, fileserver_entry_t *entry,
+                                                 fileserver_encoding_t encoding) {
+    uint8_t bit = (uint8_t)(1u << encoding);
+    const fileserver_variant_t *variant;
+
+    pthread_mutex_lock(&server->lock);
+    bool tried = (entry->tried & bit) != 0;
+    variant = entry->variants[encoding];
+    pthread_mutex_unlock(&server->lock);
+    if (tried) {
+        return variant;
+    }
+
+    fileserver_variant_t *built = variant_build(server, entry, encoding);
+
+    pthread_mutex_lock(&server->lock);
+    if (entry->tried & bit) {
+        if (built != NULL) {
+            variant_clear(built);
+            free(built);
+        }
+    } else {
+        entry->variants[encoding] = built;
+        entry->tried |= bit;
+        if (built != NULL && built->data != NULL) {
+            entry->memory += built->size;
+            if (entry->cached) {
+                server->memory_used += built->size;
+                cache_trim(server, entry);
+            }
+        }
+    }
+    variant = entry->variants[encoding];
+    pthread_mutex_unlock(&server->lock);
+    return variant;
+}
+
+/*
+ * Helper function: Parse a q-value ("0", "0.5", "1.000") into thousandths
+ * Returns the weight, 1000 if the value is malformed
+ */
+static int parse_qvalue(const char *p, const char *end) {
+    if (p == end || (*p != '0' && *p != '1')) {
+        return 1000;
+    }
+
+    int weight = (*p++ - '0') * 1000;
+    if (p < end && *p == '.') {
+        p++;
+        for (int scale = 100; scale > 0 && p < end && *p >= '0' && *p <= '9'; scale /= 10) {
+            weight += (*p++ - '0') * scale;
+        }
+    }
+    return weight > 1000 ? 1000 : weight;
+}
+
+/*
+ * Helper function: Rank the non-identity codings a client accepts
+ * Accept-Encoding is a list of "coding[;q=weight]"; "*" covers codings not
+ * listed. Equal weights keep the server's preference (br, then gzip)
+ * Returns how many codings were written to order, best first
+ */
+static int accepted_encodings(const http_str_t *header, fileserver_encoding_t *order) {
+    int weight[FILESERVER_ENCODING_COUNT];
+    int star = -1;
+    for (int i = 0; i < FILESERVER_ENCODING_COUNT; i++) {
+        weight[i] = -1;
+    }
+
+    const char *p = header->ptr;
+    const char *end = header->ptr + header->len;
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) {
+            p++;
+        }
+        const char *name = p;
+        while (p < end && *p != ',' && *p != ';' && *p != ' ' && *p != '\t') {
+            p++;
+        }
+        size_t name_length = (size_t)(p - name);
+
+        int q = 1000;
+        while (p < end && *p != ',') {
+            if (*p == ';') {
+                p++;
+                while (p < end && (*p == ' ' || *p == '\t')) {
+                    p++;
+                }
+                if (end - p >= 2 && (p[0] == 'q' || p[0] == 'Q') && p[1] == '=') {
+                    const char *value = p + 2;
+                    p = value;
+                    while (p < end && *p != ',' && *p != ';' && *p != ' ' && *p != '\t') {
+                        p++;
+                    }
+                    q = parse_qvalue(value, p);
+                    continue;
+                }
+            }
+            p++;
+        }
+
+        if (name_length == 1 && name[0] == '*') {
+            star = q;
+        } else if ((name_length == 4 && strncasecmp(name, "gzip", 4) == 0) ||
+                   (name_length == 6 && strncasecmp(name, "x-gzip", 6) == 0)) {
+            weight[FILESERVER_ENCODING_GZIP] = q;
+        } else if (name_length == 2 && strncasecmp(name, "br", 2) == 0) {
+            weight[FILESERVER_ENCODING_BR] = q;
+        }
+    }
+
+    static const fileserver_encoding_t preference[] = {
+        FILESERVER_ENCODING_BR, FILESERVER_ENCODING_GZIP
+    };
+    int ranked[FILESERVER_ENCODING_COUNT];
+    int count = 0;
+    for (size_t i = 0; i < sizeof(preference) / sizeof(preference[0]); i++) {
+        fileserver_encoding_t encoding = preference[i];
+        int q = weight[encoding] >= 0 ? weight[encoding] : (star >= 0 ? star : 0);
+        if (q <= 0) {
+            continue;
+        }
+
+        /* Insertion by weight; ties stay in preference order */
+        int at = count;
+        while (at > 0 && ranked[at - 1] < q) {
+            ranked[at] = ranked[at - 1];
+            order[at] = order[at - 1];
+            at--;
+        }
+        ranked[at] = q;
+        order[at] = encoding;
+        count++;
+    }
+    return count;
+}
+
+/*
+ * Helper function: Check If-None-Match against an entity tag
+ * The header is "*" or a list of (possibly weak) tags; comparison is weak
+ */
+static bool etag_matches(const http_str_t *header, const char *etag) {
+    size_t etag_length = strlen(etag);
+    const char *p = header->ptr;
+    const char *end = header->ptr + header->len;
+
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) {
+            p++;
+        }
+        const char *start = p;
+        while (p < end && *p != ',') {
+            p++;
+        }
+        const char *stop = p;
+        while (stop > start && (stop[-1] == ' ' || stop[-1] == '\t')) {
+            stop--;
+        }
+
+        if (stop - start == 1 && *start == '*') {
+            return true;
+        }
+        if (stop - start > 2 && start[0] == 'W' && start[1] == '/') {
+            start += 2;
+        }
+        if ((size_t)(stop - start) == etag_length && memcmp(start, etag, etag_length) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Helper function: Check If-Modified-Since (IMF-fixdate) against mtime
+ * Returns true if the file has not changed since the given date
+ */
+static bool not_modified_since(const http_str_t *header, const struct timespec *mtime) {
+    char date[64];
+    if (header->len >= sizeof(date)) {
+        return false;
+    }
+    memcpy(date, header->ptr, header->len);
+    date[header->len] = '\0';
+
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char *end = strptime(date, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (end == NULL || *end != '\0') {
+        return false;
+    }
+    return mtime->tv_sec <= timegm(&tm);
+}
+
+/*
+ * Serve file for given request
+ * Returns 0 if the response was built, otherwise the HTTP error status
+ */
+int serve_file(fileserver_t *server, const http_request_t *request, http_str_t path,
+               http_response_t *response) {
+    if (server == NULL || request == NULL || response == NULL) {
+        LOG_ERROR(NULL, "serve_file: NULL parameter");
+        return HTTP_INTERNAL_ERROR;
+    }
+
+    char key[FILESERVER_MAX_PATH];
+    int key_length = resolve_file_path(path.ptr, path.len, key, sizeof(key));
+    if (key_length < 0) {
+        LOG_WARN(NULL, "Rejected static file path: %.*s", (int)path.len, path.ptr);
+        return HTTP_NOT_FOUND;
+    }
+
+    int status = HTTP_NOT_FOUND;
+    fileserver_entry_t *entry = cache_acquire(server, key, (size_t)key_length, &status);
+    if (entry == NULL) {
+        return status;
+    }
+
+    /* Pick the coding: the best accepted variant that exists, else identity */
+    const fileserver_variant_t *variant = &entry->identity;
+    const http_str_t *accept_encoding =
+        http_get_known_header(request, HTTP_HEADER_ACCEPT_ENCODING);
+    if (entry->negotiable && accept_encoding != NULL) {
+        fileserver_encoding_t order[FILESERVER_ENCODING_COUNT];
+        int count = accepted_encodings(accept_encoding, order);
+        for (int i = 0; i < count; i++) {
+            const fileserver_variant_t *candidate = entry_variant(server, entry, order[i]);
+            if (candidate != NULL) {
+                variant = candidate;
+                break;
+            }
+        }
+    }
+
+    /* If-None-Match takes precedence; If-Modified-Since only applies without it */
+    const http_str_t *if_none_match = http_get_known_header(request, HTTP_HEADER_IF_NONE_MATCH);
+    const http_str_t *if_modified_since =
+        http_get_known_header(request, HTTP_HEADER_IF_MODIFIED_SINCE);
+    bool not_modified = if_none_match != NULL
+                            ? etag_matches(if_none_match, variant->etag)
+                            : if_modified_since != NULL &&
+                                  not_modified_since(if_modified_since, &entry->mtime);
+
+    /* The response borrows the entry (which owns its variants); release drops our reference */
+    http_borrow_t borrow = { .fd = -1, .release = entry_release, .arg = entry };
+
+    if (http_response_init(response, not_modified ? HTTP_NOT_MODIFIED : HTTP_OK) != 0 ||
+        http_response_add_block(response, &variant->block) != 0) {
+        entry_release(entry);
+        return HTTP_INTERNAL_ERROR;
+    }
+
+    if (!not_modified) {
+        if (variant->data != NULL) {
+            if (http_response_set_body_ref(response, variant->data, variant->size) != 0) {
+                http_response_free(response);
+                entry_release(entry);
+                return HTTP_INTERNAL_ERROR;
+            }
+        } else {
+            borrow.fd = variant->fd;
+            borrow.offset = 0;
+            borrow.length = variant->size;
+        }
+    }
+    http_response_set_borrow(response, &borrow);
+
+    if (request->method == HTTP_METHOD_HEAD) {
+        http_response_omit_body(response);
+    }
+    return 0;
+}
+
+/*
+ * Cleanup file server resources
+ * Entries still referenced by responses are freed when those finish
+ */
+void fileserver_destroy(fileserver_t *server) {
+    if (server == NULL || server->document_root == NULL) {
+        return;
+    }
+
+#ifdef __linux__
+    if (server->watcher_started) {
+        uint64_t one = 1;
+        if (write(server->wake_fd, &one, sizeof(one)) != (ssize_t)sizeof(one)) {
+            LOG_WARN(NULL, "Failed to wake file watcher");
+        }
+        pthread_join(server->watcher, NULL);
+        server->watcher_started = false;
+    }
+#endif
+    if (server->inotify_fd >= 0) {
+        close(server->inotify_fd);
+    }
+    if (server->wake_fd >= 0) {
+        close(server->wake_fd);
+    }
+
+    pthread_mutex_lock(&server->lock);
+    cache_flush(server);
+    pthread_mutex_unlock(&server->lock);
+    pthread_mutex_destroy(&server->lock);
+
+    for (size_t i = 0; i < server->watch_count; i++) {
+        free(server->watches[i].dir);
+    }
+    free(server->watches);
+    free(server->document_root);
+    memset(server, 0, sizeof(*server));
+    server->inotify_fd = -1;
+    server->wake_fd = -1;
+}
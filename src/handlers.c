@@ -0,0 +1,196 @@
+/*
+ * C-HTTP Payment Server - Route Handlers Implementation
+ *
+ * Handlers run after the connection layer has consumed the body and
+ * settled idempotency (replays never reach them), so each one only turns
+ * a request into a response.
+ */
+
+#include "handlers.h"
+#include "cluster.h"
+#include "logger.h"
+#include "metrics.h"
+#include <stdio.h>
+#include <string.h>
+
+/* Largest JSON body a handler formats */
+#define HANDLER_BODY_MAX 1024
+
+/*
+ * Helper function: Finish a JSON response from a formatted body
+ * Returns 0 on success, -1 on error
+ */
+static int respond_json(dispatch_context_t *context, http_response_t *response, int status_code,
+                        const char *body, int length) {
+    if (length < 0 || length >= HANDLER_BODY_MAX) {
+        LOG_ERROR(NULL, "Failed to format response body (fd=%d)", context->client_fd);
+        return dispatch_error(context, response, HTTP_INTERNAL_ERROR, "Failed to format response");
+    }
+
+    if (http_response_init(response, status_code) != 0 ||
+        http_response_add_block(response, &HTTP_BLOCK_JSON) != 0 ||
+        http_response_set_body(response, body, (size_t)length) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Helper function: Write a client-supplied slice as a JSON string literal
+ * Quotes, backslashes and bytes outside printable ASCII are escaped, so the
+ * value cannot end the string early or add fields
+ * Returns the literal's length, -1 if it does not fit in capacity
+ */
+static int json_string(char *out, size_t capacity, const char *str, size_t length) {
+    size_t used = 0;
+
+    if (capacity < 3) {
+        return -1;
+    }
+
+    out[used++] = '"';
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)str[i];
+        /* Room for the longest escape plus the closing quote and terminator */
+        if (used + 8 > capacity) {
+            return -1;
+        }
+        if (c == '"' || c == '\\') {
+            out[used++] = '\\';
+            out[used++] = (char)c;
+        } else if (c < 0x20 || c >= 0x7f) {
+            used += (size_t)snprintf(out + used, capacity - used, "\\u%04x", c);
+        } else {
+            out[used++] = (char)c;
+        }
+    }
+    out[used++] = '"';
+    out[used] = '\0';
+    return (int)used;
+}
+
+/*
+ * GET /health
+ */
+static int handle_health(dispatch_context_t *context, http_response_t *response) {
+    static const char body[] = "{\"status\":\"ok\"}";
+    return respond_json(context, response, HTTP_OK, body, (int)(sizeof(body) - 1));
+}
+
+/*
+ * POST /payments
+ */
+static int handle_payment_create(dispatch_context_t *context, http_response_t *response) {
+    const http_request_t *request = context->request;
+    char key[HANDLER_BODY_MAX];
+    char body[HANDLER_BODY_MAX];
+
+    int length = -1;
+    if (json_string(key, sizeof(key), request->idempotency_key.ptr,
+                    request->idempotency_key.len) >= 0) {
+        length = snprintf(body, sizeof(body),
+                          "{\"status\":\"success\",\"message\":\"Payment processed\","
+                          "\"idempotency_key\":%s,\"body_size\":%zu}",
+                          key, request->body_length);
+    }
+    return respond_json(context, response, HTTP_OK, body, length);
+}
+
+/*
+ * GET /payments/:key
+ */
+static int handle_payment_status(dispatch_context_t *context, http_response_t *response) {
+    idempotency_store_t *store = (idempotency_store_t *)context->arg;
+    http_str_t key = dispatch_param(context, "key");
+    idempotency_response_t *cached = NULL;
+    char quoted[HANDLER_BODY_MAX];
+    char body[HANDLER_BODY_MAX];
+    int length;
+
+    int found = store != NULL ? cluster_peek(store, key.ptr, key.len, &cached) : -1;
+    if (found < 0) {
+        return dispatch_error(context, response, HTTP_NOT_FOUND, "Payment not found");
+    }
+
+    int response_status = 0;
+    if (found > 0) {
+        response_status = cached->status_code;
+        idempotency_response_release(cached);
+    }
+
+    if (json_string(quoted, sizeof(quoted), key.ptr, key.len) < 0) {
+        length = -1;
+    } else if (found == 0) {
+        length = snprintf(body, sizeof(body),
+                          "{\"status\":\"processing\",\"idempotency_key\":%s}", quoted);
+    } else {
+        length = snprintf(body, sizeof(body),
+                          "{\"status\":\"completed\",\"idempotency_key\":%s,"
+                          "\"response_status\":%d}",
+                          quoted, response_status);
+    }
+
+    return respond_json(context, response, HTTP_OK, body, length);
+}
+
+/*
+ * GET/HEAD /static/...: a file below the document root
+ */
+static int handle_static(dispatch_context_t *context, http_response_t *response) {
+    fileserver_t *files = (fileserver_t *)context->arg;
+    int status = serve_file(files, context->request, dispatch_param(context, "path"), response);
+    if (status == 0) {
+        return 0;
+    }
+
+    if (status == HTTP_NOT_FOUND) {
+        return dispatch_error(context, response, HTTP_NOT_FOUND, "File not found");
+    }
+    return dispatch_error(context, response, HTTP_INTERNAL_ERROR, "Failed to serve file");
+}
+
+/*
+ * GET /metrics: counters and histograms in the Prometheus text format
+ */
+static int handle_metrics(dispatch_context_t *context, http_response_t *response) {
+    if (http_response_init(response, HTTP_OK) != 0) {
+        return -1;
+    }
+
+    /* Rendered straight into the arena, which outlives the output */
+    char *body = (char *)arena_alloc(response->arena, METRICS_RENDER_MAX);
+    int length = body != NULL ? metrics_render(body, METRICS_RENDER_MAX) : -1;
+    if (length < 0) {
+        return dispatch_error(context, response, HTTP_INTERNAL_ERROR, "Failed to render metrics");
+    }
+
+    if (http_response_add_header(response, "Content-Type",
+                                 "text/plain; version=0.0.4; charset=utf-8") != 0 ||
+        http_response_set_body_ref(response, body, (size_t)length) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Register the server's routes
+ * Returns 0 on success, -1 on error
+ */
+int handlers_register(dispatcher_t *dispatcher, idempotency_store_t *store, fileserver_t *files) {
+    if (dispatcher_add(dispatcher, HTTP_METHOD_GET, "/health", handle_health, NULL) < 0 ||
+        dispatcher_add(dispatcher, HTTP_METHOD_GET, "/metrics", handle_metrics, NULL) < 0 ||
+        dispatcher_add(dispatcher, HTTP_METHOD_POST, "/payments", handle_payment_create, NULL) < 0 ||
+        dispatcher_add(dispatcher, HTTP_METHOD_GET, "/payments/:key", handle_payment_status,
+                       store) < 0) {
+        LOG_ERROR(NULL, "Failed to register routes");
+        return -1;
+    }
+
+    if (files != NULL &&
+        (dispatcher_add(dispatcher, HTTP_METHOD_GET, "/static/*path", handle_static, files) < 0 ||
+         dispatcher_add(dispatcher, HTTP_METHOD_HEAD, "/static/*path", handle_static, files) < 0)) {
+        LOG_ERROR(NULL, "Failed to register static file routes");
+        return -1;
+    }
+    return 0;
+}
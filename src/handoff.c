@@ -0,0 +1,492 @@
+/*
+ * C-HTTP Payment Server - Warm Restart Handoff
+ *
+ * The new server connects to the Unix socket the old one listens on and
+ * sends the request magic. The old server stops accepting (the listen
+ * sockets stay open, so new connections queue in their backlog instead of
+ * being refused), closes idle connections and lets open requests finish
+ * without keep-alive for up to drain_ms. It then stops taking payments
+ * (late ones get 503 with Retry-After), joins its workers, waits for the
+ * ones in flight (giving up on the handoff if any are left), closes the
+ * write-ahead log and writes the idempotency store as an image
+ * to an anonymous file. The reply passes the listen sockets and the image
+ * with SCM_RIGHTS; the new server maps the image, adopts the sockets and
+ * carries on the log from the next generation.
+ *
+ * If the old server has gone, or closes the connection without a reply,
+ * the new server starts cold: it binds the port and replays the log.
+ */
+
+#include "handoff.h"
+#include "connection.h"
+#include "logger.h"
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* How long payments already running may take once new ones are refused */
+#define HANDOFF_SETTLE_MS 1000
+
+/* How long the old server waits for a successor to send its request */
+#define HANDOFF_REQUEST_TIMEOUT_MS 1000
+
+/* Reply sent with the descriptors */
+typedef struct {
+    char magic[8];          /* HANDOFF_REPLY_MAGIC */
+    uint32_t num_fds;       /* Descriptors attached, image included */
+    uint16_t port;          /* Port the listen sockets are bound to */
+    uint16_t flags;         /* HANDOFF_FLAG_* */
+} handoff_reply_t;
+
+/*
+ * Fill handoff settings with built-in defaults
+ */
+void handoff_config_init_defaults(handoff_config_t *config) {
+    if (config == NULL) {
+        return;
+    }
+
+    config->path = NULL;
+    config->drain_ms = HANDOFF_DEFAULT_DRAIN_MS;
+}
+
+/*
+ * Helper function: Fill a Unix socket address
+ * Returns 0 on success, -1 if the path is too long
+ */
+static int unix_address(const char *path, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        LOG_ERROR(NULL, "Handoff socket path too long: %s", path);
+        return -1;
+    }
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+/*
+ * Helper function: Sleep for ms milliseconds
+ */
+static void sleep_ms(int ms) {
+    struct timespec pause = { .tv_sec = ms / 1000, .tv_nsec = (long)(ms % 1000) * 1000000 };
+    nanosleep(&pause, NULL);
+}
+
+/*
+ * Ask a running predecessor for its sockets and store image
+ * Returns 1 with *inherit filled, 0 if there is no predecessor, -1 on error
+ */
+int handoff_receive(const char *path, handoff_inherit_t *inherit) {
+    if (path == NULL || inherit == NULL) {
+        LOG_ERROR(NULL, "handoff_receive: invalid parameters");
+        return -1;
+    }
+
+    memset(inherit, 0, sizeof(*inherit));
+    inherit->image_fd = -1;
+    inherit->started_ns = metrics_now_ns();
+
+    struct sockaddr_un addr;
+    if (unix_address(path, &addr) < 0) {
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        LOG_ERROR(NULL, "Failed to create handoff socket: %s", strerror(errno));
+        return -1;
+    }
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        int saved = errno;
+        close(fd);
+        if (saved == ENOENT || saved == ECONNREFUSED) {
+            LOG_INFO(NULL, "No running server at %s, starting cold", path);
+            return 0;
+        }
+        LOG_ERROR(NULL, "Failed to connect to handoff socket %s: %s", path, strerror(saved));
+        return -1;
+    }
+
+    /* The predecessor only replies once its open requests are done */
+    struct timeval timeout = { .tv_sec = HANDOFF_RECEIVE_TIMEOUT_SEC, .tv_usec = 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    if (write(fd, HANDOFF_REQUEST_MAGIC, 8) != 8) {
+        LOG_ERROR(NULL, "Failed to send handoff request: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    LOG_INFO(NULL, "Waiting for the running server at %s to hand over", path);
+
+    handoff_reply_t reply;
+    union {
+        char buffer[CMSG_SPACE(sizeof(int) * (HANDOFF_MAX_FDS + 1))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = { .iov_base = &reply, .iov_len = sizeof(reply) };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+
+    int flags = 0;
+#ifdef MSG_CMSG_CLOEXEC
+    flags |= MSG_CMSG_CLOEXEC;
+#endif
+    ssize_t received;
+    do {
+        received = recvmsg(fd, &msg, flags);
+    } while (received < 0 && errno == EINTR);
+    int saved = errno;
+    close(fd);
+
+    /* Collect the descriptors first so none leak whatever the reply says */
+    int fds[HANDOFF_MAX_FDS + 1];
+    int num_fds = 0;
+    for (struct cmsghdr *cmsg = received > 0 ? CMSG_FIRSTHDR(&msg) : NULL; cmsg != NULL;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            int count = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+            for (int i = 0; i < count && num_fds < HANDOFF_MAX_FDS + 1; i++) {
+                memcpy(&fds[num_fds++], CMSG_DATA(cmsg) + sizeof(int) * (size_t)i, sizeof(int));
+            }
+        }
+    }
+
+    if (received <= 0 || (size_t)received != sizeof(reply) ||
+        memcmp(reply.magic, HANDOFF_REPLY_MAGIC, sizeof(reply.magic)) != 0 ||
+        (msg.msg_flags & MSG_CTRUNC) != 0 || reply.num_fds != (uint32_t)num_fds) {
+        for (int i = 0; i < num_fds; i++) {
+            close(fds[i]);
+        }
+        if (received < 0) {
+            LOG_ERROR(NULL, "No handoff from %s: %s", path, strerror(saved));
+            return -1;
+        }
+        LOG_WARN(NULL, "Running server at %s declined the handoff, starting cold", path);
+        return 0;
+    }
+
+    if ((reply.flags & HANDOFF_FLAG_IMAGE) != 0 && num_fds > 0) {
+        inherit->image_fd = fds[--num_fds];
+    }
+    if (num_fds == 0) {
+        handoff_inherit_close(inherit);
+        LOG_WARN(NULL, "Running server at %s handed over no sockets, starting cold", path);
+        return 0;
+    }
+
+    memcpy(inherit->fds, fds, sizeof(int) * (size_t)num_fds);
+    inherit->num_fds = num_fds;
+    inherit->port = reply.port;
+    LOG_INFO(NULL, "Inherited %d listen socket(s) on port %d%s", num_fds, reply.port,
+             inherit->image_fd >= 0 ? " and a store image" : "");
+    return 1;
+}
+
+/*
+ * Close whatever handoff_receive() passed on and was not used
+ */
+void handoff_inherit_close(handoff_inherit_t *inherit) {
+    if (inherit == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < inherit->num_fds; i++) {
+        close(inherit->fds[i]);
+    }
+    inherit->num_fds = 0;
+    if (inherit->image_fd >= 0) {
+        close(inherit->image_fd);
+        inherit->image_fd = -1;
+    }
+}
+
+/*
+ * Helper function: Read the request magic from a connected successor
+ * Returns true if it is a handoff request
+ */
+static bool read_request(int fd) {
+    char magic[8];
+    size_t length = 0;
+    while (length < sizeof(magic)) {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN, .revents = 0 };
+        if (poll(&pfd, 1, HANDOFF_REQUEST_TIMEOUT_MS) <= 0) {
+            return false;
+        }
+        ssize_t got = read(fd, magic + length, sizeof(magic) - length);
+        if (got <= 0) {
+            return false;
+        }
+        length += (size_t)got;
+    }
+    return memcmp(magic, HANDOFF_REQUEST_MAGIC, sizeof(magic)) == 0;
+}
+
+/*
+ * Helper function: Wait for a successor, then start draining
+ */
+static void *handoff_thread(void *arg) {
+    handoff_t *handoff = (handoff_t *)arg;
+
+    for (;;) {
+        struct pollfd pfds[2] = {
+            { .fd = handoff->server_fd, .events = POLLIN, .revents = 0 },
+            { .fd = handoff->stop_pipe[0], .events = POLLIN, .revents = 0 }
+        };
+        if (poll(pfds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_ERROR(NULL, "Handoff poll failed: %s", strerror(errno));
+            return NULL;
+        }
+        if (pfds[1].revents != 0) {
+            return NULL;
+        }
+
+        int fd = accept(handoff->server_fd, NULL, NULL);
+        if (fd < 0) {
+            continue;
+        }
+        if (!read_request(fd)) {
+            LOG_WARN(NULL, "Ignoring malformed handoff request");
+            close(fd);
+            continue;
+        }
+
+        handoff->peer_fd = fd;
+        __atomic_store_n(&handoff->pending, true, __ATOMIC_RELEASE);
+        LOG_INFO(NULL, "Successor connected, draining for up to %dms", handoff->drain_ms);
+
+        /* Finish what is open without keep-alive; the loops stop accepting */
+        connection_set_drain(CONN_DRAIN_CLOSE);
+        listener_drain(handoff->listener, handoff->drain_ms);
+        return NULL;
+    }
+}
+
+/*
+ * Accept successors on the configured path from now on
+ * Returns 0 on success, -1 on error
+ */
+int handoff_listen(handoff_t *handoff, const handoff_config_t *config, listener_t *listener) {
+    if (handoff == NULL || config == NULL || config->path == NULL || listener == NULL) {
+        LOG_ERROR(NULL, "handoff_listen: invalid parameters");
+        return -1;
+    }
+
+    memset(handoff, 0, sizeof(*handoff));
+    handoff->server_fd = -1;
+    handoff->peer_fd = -1;
+    handoff->stop_pipe[0] = -1;
+    handoff->stop_pipe[1] = -1;
+    handoff->drain_ms = config->drain_ms;
+    handoff->listener = listener;
+
+    struct sockaddr_un addr;
+    if (unix_address(config->path, &addr) < 0) {
+        return -1;
+    }
+
+    handoff->path = strdup(config->path);
+    if (handoff->path == NULL) {
+        return -1;
+    }
+
+    /* A predecessor's socket (or a stale one) is replaced */
+    unlink(config->path);
+    handoff->server_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (handoff->server_fd < 0 ||
+        bind(handoff->server_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(handoff->server_fd, 1) < 0 || pipe(handoff->stop_pipe) < 0) {
+        LOG_ERROR(NULL, "Failed to listen for successors on %s: %s", config->path,
+                  strerror(errno));
+        handoff_stop(handoff);
+        return -1;
+    }
+
+    if (pthread_create(&handoff->thread, NULL, handoff_thread, handoff) != 0) {
+        LOG_ERROR(NULL, "Failed to start handoff thread");
+        handoff_stop(handoff);
+        return -1;
+    }
+    handoff->started = true;
+
+    LOG_INFO(NULL, "Accepting warm restarts on %s (drain %dms)", config->path,
+             config->drain_ms);
+    return 0;
+}
+
+/*
+ * Stop accepting successors; a successor that already arrived stays pending
+ */
+void handoff_stop(handoff_t *handoff) {
+    if (handoff == NULL || handoff->path == NULL) {
+        return;
+    }
+
+    if (handoff->started) {
+        char signal = 1;
+        if (write(handoff->stop_pipe[1], &signal, 1) < 0) {
+            LOG_WARN(NULL, "Failed to stop handoff thread: %s", strerror(errno));
+        }
+        pthread_join(handoff->thread, NULL);
+        handoff->started = false;
+    }
+
+    if (handoff->server_fd >= 0) {
+        close(handoff->server_fd);
+        handoff->server_fd = -1;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (handoff->stop_pipe[i] >= 0) {
+            close(handoff->stop_pipe[i]);
+            handoff->stop_pipe[i] = -1;
+        }
+    }
+
+    /* A successor binds its own socket at the path once it is up */
+    if (!handoff_pending(handoff)) {
+        unlink(handoff->path);
+    }
+    free(handoff->path);
+    handoff->path = NULL;
+}
+
+/*
+ * Returns true if a successor is waiting for handoff_send()
+ */
+bool handoff_pending(handoff_t *handoff) {
+    return handoff != NULL && __atomic_load_n(&handoff->pending, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Helper function: Write the store image to an anonymous file
+ * Returns the descriptor, -1 on error
+ */
+static int image_create(idempotency_store_t *store) {
+#ifdef __linux__
+    int fd = memfd_create("nanoserve-idempotency", MFD_CLOEXEC);
+#else
+    FILE *fp = tmpfile();
+    int fd = fp != NULL ? dup(fileno(fp)) : -1;
+    if (fp != NULL) {
+        fclose(fp);
+    }
+#endif
+    if (fd < 0) {
+        LOG_ERROR(NULL, "Failed to create store image: %s", strerror(errno));
+        return -1;
+    }
+
+    uint64_t start = metrics_now_ns();
+    long count = idempotency_store_export(store, fd);
+    if (count < 0) {
+        close(fd);
+        return -1;
+    }
+
+    LOG_INFO(NULL, "Wrote %ld cached responses to the store image in %.1fms", count,
+             (double)(metrics_now_ns() - start) / 1e6);
+    return fd;
+}
+
+/*
+ * Answer the pending successor with the listen sockets and a store image
+ * Returns 0 on success, -1 on error
+ */
+int handoff_send(handoff_t *handoff, listener_t *listener, idempotency_store_t *store,
+                 wal_t *wal) {
+    if (handoff == NULL || listener == NULL || !handoff_pending(handoff)) {
+        return -1;
+    }
+
+    /* The image must hold every payment: refuse new ones, let running ones finish */
+    connection_set_drain(CONN_DRAIN_REFUSE);
+    int waited = 0;
+    while (connection_payments_in_flight() > 0 && waited < HANDOFF_SETTLE_MS) {
+        sleep_ms(1);
+        waited++;
+    }
+    if (connection_payments_in_flight() > 0) {
+        /* An image without them would forget payments the log may not hold either */
+        LOG_ERROR(NULL, "%d payments still running, abandoning handoff (successor starts cold)",
+                  connection_payments_in_flight());
+        close(handoff->peer_fd);
+        handoff->peer_fd = -1;
+        return -1;
+    }
+
+    /* Everything logged is synced; the successor carries on from the next segment */
+    wal_close(wal);
+
+    int image_fd = store != NULL ? image_create(store) : -1;
+
+    int num_fds = listener->num_sockets < HANDOFF_MAX_FDS ? listener->num_sockets
+                                                          : HANDOFF_MAX_FDS;
+    int fds[HANDOFF_MAX_FDS + 1];
+    memcpy(fds, listener->socket_fds, sizeof(int) * (size_t)num_fds);
+    if (image_fd >= 0) {
+        fds[num_fds++] = image_fd;
+    }
+
+    handoff_reply_t reply;
+    memset(&reply, 0, sizeof(reply));
+    memcpy(reply.magic, HANDOFF_REPLY_MAGIC, sizeof(reply.magic));
+    reply.num_fds = (uint32_t)num_fds;
+    reply.port = listener->port;
+    reply.flags = image_fd >= 0 ? HANDOFF_FLAG_IMAGE : 0;
+
+    union {
+        char buffer[CMSG_SPACE(sizeof(int) * (HANDOFF_MAX_FDS + 1))];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct iovec iov = { .iov_base = &reply, .iov_len = sizeof(reply) };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * (size_t)num_fds);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * (size_t)num_fds);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * (size_t)num_fds);
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(handoff->peer_fd, &msg, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+
+    if (image_fd >= 0) {
+        close(image_fd);
+    }
+    close(handoff->peer_fd);
+    handoff->peer_fd = -1;
+
+    if (sent != (ssize_t)sizeof(reply)) {
+        LOG_ERROR(NULL, "Failed to hand over listen sockets: %s", strerror(errno));
+        return -1;
+    }
+
+    LOG_INFO(NULL, "Handed over %d listen socket(s) to the successor",
+             num_fds - (image_fd >= 0 ? 1 : 0));
+    return 0;
+}
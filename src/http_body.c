@@ -0,0 +1,233 @@
+/*
+ * C-HTTP Payment Server - Streaming Request Body Decoder Implementation
+ *
+ * A byte-level state machine, so bodies can be fed in windows of any size
+ * (a chunk-size line split across two reads is fine). Chunked framing:
+ *
+ *   chunk   = chunk-size [ ";" ext ] CRLF chunk-data CRLF
+ *   last    = "0" [ ";" ext ] CRLF *( trailer-field CRLF ) CRLF
+ *
+ * Bare LF line endings are accepted like in the header parser; trailer
+ * fields are read and discarded.
+ */
+
+#include "http_body.h"
+#include "logger.h"
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Start decoding the body of a parsed request
+ * Returns 0 on success, -1 on error
+ */
+int http_body_init(http_body_t *body, const http_request_t *request, size_t max_size,
+                   http_body_sink_t sink, void *sink_arg) {
+    if (body == NULL || request == NULL) {
+        LOG_ERROR(NULL, "http_body_init: NULL parameter");
+        return -1;
+    }
+
+    memset(body, 0, sizeof(*body));
+    body->chunked = request->chunked;
+    body->max_size = max_size;
+    body->sink = sink;
+    body->sink_arg = sink_arg;
+
+    if (body->chunked) {
+        body->state = HTTP_BODY_STATE_CHUNK_SIZE;
+    } else if (request->content_length > 0) {
+        body->state = HTTP_BODY_STATE_DATA;
+        body->remaining = request->content_length;
+    } else {
+        body->state = HTTP_BODY_STATE_DONE;
+    }
+
+    return 0;
+}
+
+/*
+ * Helper function: Record a decoding failure
+ */
+static http_body_result_t body_fail(http_body_t *body, const char *reason) {
+    body->state = HTTP_BODY_STATE_FAILED;
+    body->error = reason;
+    return HTTP_BODY_ERROR;
+}
+
+/*
+ * Helper function: Record that the body exceeds max_size
+ */
+static http_body_result_t body_too_large(http_body_t *body) {
+    body->state = HTTP_BODY_STATE_FAILED;
+    body->error = "Request body too large";
+    body->too_large = true;
+    return HTTP_BODY_TOO_LARGE;
+}
+
+/*
+ * Helper function: Value of a hex digit, -1 if c is not one
+ */
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/*
+ * Helper function: A chunk-size line ended; start its data or the trailer
+ */
+static http_body_result_t chunk_line_done(http_body_t *body) {
+    if (!body->size_digits) {
+        return body_fail(body, "Missing chunk size");
+    }
+
+    body->line_length = 0;
+    if (body->remaining == 0) {
+        body->state = HTTP_BODY_STATE_TRAILER;
+        return HTTP_BODY_NEED_MORE;
+    }
+
+    /* Reject an oversized body before any of the chunk is read */
+    if (body->remaining > body->max_size - body->received) {
+        return body_too_large(body);
+    }
+
+    body->state = HTTP_BODY_STATE_DATA;
+    return HTTP_BODY_NEED_MORE;
+}
+
+/*
+ * Decode framed bytes
+ * Returns HTTP_BODY_DONE, HTTP_BODY_NEED_MORE, HTTP_BODY_TOO_LARGE or HTTP_BODY_ERROR
+ */
+http_body_result_t http_body_feed(http_body_t *body, const char *data, size_t length,
+                                  size_t *consumed) {
+    size_t pos = 0;
+    http_body_result_t result = HTTP_BODY_NEED_MORE;
+
+    if (consumed != NULL) {
+        *consumed = 0;
+    }
+    if (body == NULL || (data == NULL && length > 0)) {
+        return HTTP_BODY_ERROR;
+    }
+
+    /* A Content-Length body over the limit is refused before reading it */
+    if (body->state == HTTP_BODY_STATE_DATA && !body->chunked && body->received == 0 &&
+        body->remaining > body->max_size) {
+        return body_too_large(body);
+    }
+
+    while (result == HTTP_BODY_NEED_MORE && body->state != HTTP_BODY_STATE_DONE) {
+        if (body->state == HTTP_BODY_STATE_FAILED) {
+            result = body->too_large ? HTTP_BODY_TOO_LARGE : HTTP_BODY_ERROR;
+            break;
+        }
+        if (pos == length) {
+            break;
+        }
+
+        /* Data: hand the bytes to the sink in place */
+        if (body->state == HTTP_BODY_STATE_DATA) {
+            size_t take = length - pos < body->remaining ? length - pos : body->remaining;
+            if (body->sink != NULL && body->sink(body->sink_arg, data + pos, take) != 0) {
+                result = body_fail(body, "Body rejected by handler");
+                break;
+            }
+
+            pos += take;
+            body->remaining -= take;
+            body->received += take;
+            if (body->remaining == 0) {
+                body->state = body->chunked ? HTTP_BODY_STATE_CHUNK_DATA_END : HTTP_BODY_STATE_DONE;
+                body->line_length = 0;
+            }
+            continue;
+        }
+
+        char c = data[pos++];
+
+        switch (body->state) {
+            case HTTP_BODY_STATE_CHUNK_SIZE: {
+                int digit = hex_value(c);
+                if (digit >= 0) {
+                    if (body->remaining > (SIZE_MAX >> 4)) {
+                        result = body_fail(body, "Chunk size overflow");
+                        break;
+                    }
+                    body->remaining = (body->remaining << 4) | (size_t)digit;
+                    body->size_digits = true;
+                    if (++body->line_length > HTTP_BODY_MAX_CHUNK_LINE) {
+                        result = body_fail(body, "Chunk size line too long");
+                    }
+                } else if (c == ';' || c == ' ' || c == '\t' || c == '\r') {
+                    body->state = HTTP_BODY_STATE_CHUNK_EXT;
+                } else if (c == '\n') {
+                    result = chunk_line_done(body);
+                } else {
+                    result = body_fail(body, "Invalid chunk size");
+                }
+                break;
+            }
+
+            case HTTP_BODY_STATE_CHUNK_EXT:
+                if (c == '\n') {
+                    result = chunk_line_done(body);
+                } else if (++body->line_length > HTTP_BODY_MAX_CHUNK_LINE) {
+                    result = body_fail(body, "Chunk size line too long");
+                }
+                break;
+
+            case HTTP_BODY_STATE_CHUNK_DATA_END:
+                if (c == '\r' && body->line_length == 0) {
+                    body->line_length = 1;
+                } else if (c == '\n') {
+                    body->state = HTTP_BODY_STATE_CHUNK_SIZE;
+                    body->line_length = 0;
+                    body->size_digits = false;
+                } else {
+                    result = body_fail(body, "Missing CRLF after chunk data");
+                }
+                break;
+
+            case HTTP_BODY_STATE_TRAILER:
+                if (c == '\n') {
+                    if (body->line_length == 0) {
+                        body->state = HTTP_BODY_STATE_DONE;
+                    }
+                    body->line_length = 0;
+                } else if (c != '\r' && ++body->line_length > MAX_HEADER_VALUE_LENGTH) {
+                    result = body_fail(body, "Trailer line too long");
+                }
+                break;
+
+            default:
+                result = body_fail(body, "Invalid body decoder state");
+                break;
+        }
+    }
+
+    if (consumed != NULL) {
+        *consumed = pos;
+    }
+    if (body->state == HTTP_BODY_STATE_DONE) {
+        LOG_DEBUG(NULL, "Decoded request body: %zu bytes", body->received);
+        return HTTP_BODY_DONE;
+    }
+    return result;
+}
+
+/*
+ * Check whether http_body_init() was called
+ */
+bool http_body_started(const http_body_t *body) {
+    return body != NULL && body->state != HTTP_BODY_STATE_IDLE;
+}
+
+/*
+ * Check whether the whole body was decoded
+ */
+bool http_body_done(const http_body_t *body) {
+    return body != NULL && body->state == HTTP_BODY_STATE_DONE;
+}
@@ -4,12 +4,12 @@
  */
 
 #include "http_parser.h"
+#include "http_scan.h"
 #include "logger.h"
+#include "metrics.h"
 #include <string.h>
 #include <stdlib.h>
-#include <strings.h>  /* For strcasecmp */
-#include <errno.h>    /* For errno */
-#include <sys/socket.h>  /* For recv() */
+#include <strings.h>  /* For strncasecmp */
 
 /*
  * Initialize HTTP request structure
@@ -28,7 +28,6 @@ int http_request_init(http_request_t *request) {
     request->method = HTTP_METHOD_UNKNOWN;
     request->version = HTTP_VERSION_UNKNOWN;
     request->header_count = 0;
-    request->body = NULL;
     request->body_length = 0;
     request->content_length = 0;
     request->has_idempotency_key = false;
@@ -46,13 +45,7 @@ void http_request_free(http_request_t *request) {
         return;
     }
 
-    /* Free request body if allocated */
-    if (request->body != NULL) {
-        free(request->body);
-        request->body = NULL;
-    }
-
-    /* Zero out the structure */
+    /* Zero out the structure (the body was streamed, never stored) */
     request->body_length = 0;
     request->content_length = 0;
     request->header_count = 0;
@@ -78,6 +71,93 @@ const char *http_method_to_string(http_method_t method) {
     }
 }
 
+/*
+ * Helper function: Map a method token to its enum
+ * Dispatches on length and first byte, then confirms with one memcmp
+ */
+static http_method_t method_from_token(const char *token, size_t length) {
+    switch (length) {
+        case 3:
+            if (token[0] == 'G' && memcmp(token, "GET", 3) == 0) return HTTP_METHOD_GET;
+            if (token[0] == 'P' && memcmp(token, "PUT", 3) == 0) return HTTP_METHOD_PUT;
+            break;
+        case 4:
+            if (token[0] == 'P' && memcmp(token, "POST", 4) == 0) return HTTP_METHOD_POST;
+            if (token[0] == 'H' && memcmp(token, "HEAD", 4) == 0) return HTTP_METHOD_HEAD;
+            break;
+        case 5:
+            if (memcmp(token, "PATCH", 5) == 0) return HTTP_METHOD_PATCH;
+            break;
+        case 6:
+            if (memcmp(token, "DELETE", 6) == 0) return HTTP_METHOD_DELETE;
+            break;
+        case 7:
+            if (memcmp(token, "OPTIONS", 7) == 0) return HTTP_METHOD_OPTIONS;
+            break;
+        default:
+            break;
+    }
+
+    return HTTP_METHOD_UNKNOWN;
+}
+
+/*
+ * Helper function: Confirm a header name candidate (case-insensitive)
+ */
+static http_header_id_t header_match(const char *name, const char *literal, size_t length,
+                                     http_header_id_t id) {
+    return strncasecmp(name, literal, length) == 0 ? id : HTTP_HEADER_OTHER;
+}
+
+/*
+ * Map a header name to its known header ID (case-insensitive)
+ * Dispatches on length and first byte so each name is compared at most once
+ */
+http_header_id_t http_header_lookup(const char *name, size_t length) {
+    if (name == NULL || length == 0) {
+        return HTTP_HEADER_OTHER;
+    }
+
+    /* ASCII letters fold to lower case with a single bit */
+    char first = (char)(name[0] | 0x20);
+
+    switch (length) {
+        case 4:
+            if (first == 'h') return header_match(name, "Host", 4, HTTP_HEADER_HOST);
+            break;
+        case 6:
+            if (first == 'e') return header_match(name, "Expect", 6, HTTP_HEADER_EXPECT);
+            break;
+        case 10:
+            if (first == 'c') return header_match(name, "Connection", 10, HTTP_HEADER_CONNECTION);
+            break;
+        case 12:
+            if (first == 'c') return header_match(name, "Content-Type", 12, HTTP_HEADER_CONTENT_TYPE);
+            break;
+        case 13:
+            if (first == 'i') return header_match(name, "If-None-Match", 13, HTTP_HEADER_IF_NONE_MATCH);
+            break;
+        case 14:
+            if (first == 'c') return header_match(name, "Content-Length", 14, HTTP_HEADER_CONTENT_LENGTH);
+            break;
+        case 15:
+            if (first == 'a') return header_match(name, "Accept-Encoding", 15, HTTP_HEADER_ACCEPT_ENCODING);
+            break;
+        case 17:
+            switch (first) {
+                case 't': return header_match(name, "Transfer-Encoding", 17, HTTP_HEADER_TRANSFER_ENCODING);
+                case 'i': return header_match(name, "If-Modified-Since", 17, HTTP_HEADER_IF_MODIFIED_SINCE);
+                case 'x': return header_match(name, "X-Idempotency-Key", 17, HTTP_HEADER_X_IDEMPOTENCY_KEY);
+                default:  break;
+            }
+            break;
+        default:
+            break;
+    }
+
+    return HTTP_HEADER_OTHER;
+}
+
 /*
  * Convert string to HTTP method enum
  */
@@ -86,23 +166,7 @@ http_method_t http_string_to_method(const char *method_str) {
         return HTTP_METHOD_UNKNOWN;
     }
 
-    if (strcmp(method_str, "GET") == 0) {
-        return HTTP_METHOD_GET;
-    } else if (strcmp(method_str, "POST") == 0) {
-        return HTTP_METHOD_POST;
-    } else if (strcmp(method_str, "PUT") == 0) {
-        return HTTP_METHOD_PUT;
-    } else if (strcmp(method_str, "DELETE") == 0) {
-        return HTTP_METHOD_DELETE;
-    } else if (strcmp(method_str, "HEAD") == 0) {
-        return HTTP_METHOD_HEAD;
-    } else if (strcmp(method_str, "OPTIONS") == 0) {
-        return HTTP_METHOD_OPTIONS;
-    } else if (strcmp(method_str, "PATCH") == 0) {
-        return HTTP_METHOD_PATCH;
-    }
-
-    return HTTP_METHOD_UNKNOWN;
+    return method_from_token(method_str, strlen(method_str));
 }
 
 /*
@@ -117,149 +181,394 @@ const char *http_version_to_string(http_version_t version) {
     }
 }
 
+/*
+ * Compare a slice with a null-terminated string (case-insensitive)
+ */
+bool http_str_case_equals(const http_str_t *str, const char *literal) {
+    size_t length = strlen(literal);
+    return str->len == length && strncasecmp(str->ptr, literal, length) == 0;
+}
+
+/*
+ * Get a known header's value in O(1)
+ * Returns pointer to the value slice, or NULL if not present
+ */
+const http_str_t *http_get_known_header(const http_request_t *request, http_header_id_t id) {
+    if (request == NULL || id <= HTTP_HEADER_OTHER || id >= HTTP_HEADER_KNOWN_COUNT) {
+        return NULL;
+    }
+
+    uint8_t slot = request->known_headers[id];
+    return slot != 0 ? &request->headers[slot - 1].value : NULL;
+}
+
 /*
  * Get header value by name (case-insensitive)
- * Returns pointer to value string, or NULL if not found
+ * Returns pointer to the value slice, or NULL if not found
  */
-const char *http_get_header(const http_request_t *request, const char *name) {
+const http_str_t *http_get_header(const http_request_t *request, const char *name) {
     if (request == NULL || name == NULL) {
         return NULL;
     }
 
+    /* Known headers come straight from the slot table */
+    http_header_id_t id = http_header_lookup(name, strlen(name));
+    if (id != HTTP_HEADER_OTHER) {
+        return http_get_known_header(request, id);
+    }
+
     /* Search through headers for matching name (case-insensitive) */
     for (int i = 0; i < request->header_count; i++) {
-        if (strcasecmp(request->headers[i].name, name) == 0) {
-            return request->headers[i].value;
+        if (http_str_case_equals(&request->headers[i].name, name)) {
+            return &request->headers[i].value;
         }
     }
 
     return NULL;  /* Header not found */
 }
 
+/*
+ * Helper function: Check a comma-separated header value for a token
+ * Comparison is case-insensitive, surrounding whitespace is ignored
+ */
+static bool header_has_token(const http_str_t *value, const char *token) {
+    size_t token_len = strlen(token);
+    const char *p = value->ptr;
+    const char *limit = value->ptr + value->len;
+
+    while (p < limit) {
+        while (p < limit && (*p == ' ' || *p == '\t' || *p == ',')) {
+            p++;
+        }
+
+        const char *start = p;
+        while (p < limit && *p != ',') {
+            p++;
+        }
+
+        const char *end = p;
+        while (end > start && (end[-1] == ' ' || end[-1] == '\t')) {
+            end--;
+        }
+
+        if ((size_t)(end - start) == token_len && strncasecmp(start, token, token_len) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Check whether the client wants the connection kept open
+ */
+bool http_request_keep_alive(const http_request_t *request) {
+    if (request == NULL) {
+        return false;
+    }
+
+    const http_str_t *connection = http_get_known_header(request, HTTP_HEADER_CONNECTION);
+
+    if (request->version == HTTP_VERSION_1_1) {
+        return connection == NULL || !header_has_token(connection, "close");
+    }
+
+    if (request->version == HTTP_VERSION_1_0) {
+        return connection != NULL && header_has_token(connection, "keep-alive");
+    }
+
+    return false;
+}
+
+/*
+ * Helper function: Split the next space-separated token off a line
+ * Runs of spaces are treated as one separator (as strtok did)
+ * Returns token length, 0 if the line is exhausted
+ */
+static size_t next_token(const char **cursor, const char *end, const char **token) {
+    const char *p = *cursor;
+
+    while (p < end && *p == ' ') {
+        p++;
+    }
+
+    *token = p;
+    p += http_scan_find2(p, (size_t)(end - p), ' ', ' ');
+
+    *cursor = p;
+    return (size_t)(p - *token);
+}
+
 /*
  * Parse HTTP request line
  * Example: "POST /api/payment HTTP/1.1"
  * Returns 0 on success, -1 on error
  */
-int parse_request_line(http_request_t *request, const char *line) {
+int parse_request_line(http_request_t *request, const char *line, size_t length) {
     if (request == NULL || line == NULL) {
         LOG_ERROR(NULL, "parse_request_line: NULL parameter");
         return -1;
     }
 
-    /* Create a mutable copy of the line for parsing */
-    char line_copy[MAX_URI_LENGTH + 256];  /* METHOD + URI + VERSION + spaces */
-    size_t line_len = strlen(line);
+    /* Remove trailing \r\n if present */
+    const char *end = line + http_scan_find2(line, length, '\r', '\n');
 
-    if (line_len >= sizeof(line_copy)) {
-        LOG_ERROR(NULL, "Request line too long: %zu bytes", line_len);
+    if ((size_t)(end - line) >= MAX_URI_LENGTH + 256) {
+        LOG_ERROR(NULL, "Request line too long: %zu bytes", (size_t)(end - line));
         return -1;
     }
 
-    strncpy(line_copy, line, sizeof(line_copy) - 1);
-    line_copy[sizeof(line_copy) - 1] = '\0';
-
-    /* Remove trailing \r\n if present */
-    char *newline = strchr(line_copy, '\r');
-    if (newline) *newline = '\0';
-    newline = strchr(line_copy, '\n');
-    if (newline) *newline = '\0';
+    const char *cursor = line;
+    const char *token;
+    size_t token_len;
 
     /* Parse method (first token) */
-    char *saveptr = NULL;
-    char *method_str = strtok_r(line_copy, " ", &saveptr);
-    if (method_str == NULL) {
+    token_len = next_token(&cursor, end, &token);
+    if (token_len == 0) {
         LOG_ERROR(NULL, "Missing HTTP method in request line");
         return -1;
     }
 
-    /* Convert method string to enum */
-    request->method = http_string_to_method(method_str);
+    /* Convert method token to enum */
+    request->method = method_from_token(token, token_len);
     if (request->method == HTTP_METHOD_UNKNOWN) {
-        LOG_WARN(NULL, "Unknown HTTP method: %s", method_str);
+        LOG_WARN(NULL, "Unknown HTTP method: %.*s", (int)token_len, token);
         /* Continue parsing - we'll handle unknown methods */
     }
 
     /* Parse URI (second token) */
-    char *uri_str = strtok_r(NULL, " ", &saveptr);
-    if (uri_str == NULL) {
+    token_len = next_token(&cursor, end, &token);
+    if (token_len == 0) {
         LOG_ERROR(NULL, "Missing URI in request line");
         return -1;
     }
 
     /* Validate URI format (must start with /) */
-    if (uri_str[0] != '/') {
-        LOG_ERROR(NULL, "Invalid URI format (must start with /): %s", uri_str);
+    if (token[0] != '/') {
+        LOG_ERROR(NULL, "Invalid URI format (must start with /): %.*s", (int)token_len, token);
         return -1;
     }
 
-    /* Copy URI to request structure */
-    size_t uri_len = strlen(uri_str);
-    if (uri_len >= MAX_URI_LENGTH) {
-        LOG_ERROR(NULL, "URI too long: %zu bytes (max %d)", uri_len, MAX_URI_LENGTH);
+    if (token_len >= MAX_URI_LENGTH) {
+        LOG_ERROR(NULL, "URI too long: %zu bytes (max %d)", token_len, MAX_URI_LENGTH);
         return -1;
     }
-    strncpy(request->uri, uri_str, MAX_URI_LENGTH - 1);
-    request->uri[MAX_URI_LENGTH - 1] = '\0';
+    request->uri.ptr = token;
+    request->uri.len = token_len;
 
     /* Parse HTTP version (third token) */
-    char *version_str = strtok_r(NULL, " ", &saveptr);
-    if (version_str == NULL) {
+    token_len = next_token(&cursor, end, &token);
+    if (token_len == 0) {
         LOG_ERROR(NULL, "Missing HTTP version in request line");
         return -1;
     }
 
     /* Parse HTTP version */
-    if (strcmp(version_str, "HTTP/1.1") == 0) {
+    if (token_len == 8 && memcmp(token, "HTTP/1.1", 8) == 0) {
         request->version = HTTP_VERSION_1_1;
-    } else if (strcmp(version_str, "HTTP/1.0") == 0) {
+    } else if (token_len == 8 && memcmp(token, "HTTP/1.0", 8) == 0) {
         request->version = HTTP_VERSION_1_0;
     } else {
-        LOG_ERROR(NULL, "Unsupported HTTP version: %s", version_str);
+        LOG_ERROR(NULL, "Unsupported HTTP version: %.*s", (int)token_len, token);
         request->version = HTTP_VERSION_UNKNOWN;
         return -1;
     }
 
     /* Check for extra tokens (malformed request) */
-    char *extra = strtok_r(NULL, " ", &saveptr);
-    if (extra != NULL) {
-        LOG_WARN(NULL, "Extra data in request line: %s", extra);
+    token_len = next_token(&cursor, end, &token);
+    if (token_len > 0) {
+        LOG_WARN(NULL, "Extra data in request line: %.*s", (int)token_len, token);
     }
 
-    LOG_DEBUG(NULL, "Parsed request line: %s %s %s",
+    LOG_DEBUG(NULL, "Parsed request line: %s %.*s %s",
               http_method_to_string(request->method),
-              request->uri,
+              (int)request->uri.len, request->uri.ptr,
               http_version_to_string(request->version));
 
     return 0;
 }
 
 /*
- * Helper function: Trim leading and trailing whitespace from string
- * Modifies string in place
+ * Helper function: Trim leading and trailing whitespace from a slice
  */
-static void trim_whitespace(char *str) {
-    if (str == NULL || *str == '\0') {
-        return;
+static void trim_whitespace(http_str_t *str) {
+    while (str->len > 0 && (*str->ptr == ' ' || *str->ptr == '\t')) {
+        str->ptr++;
+        str->len--;
+    }
+
+    while (str->len > 0 && (str->ptr[str->len - 1] == ' ' || str->ptr[str->len - 1] == '\t')) {
+        str->len--;
+    }
+}
+
+/*
+ * Helper function: Parse a decimal Content-Length value
+ * Returns 0 on success, -1 if the slice is not a valid length
+ */
+static int parse_content_length(const http_str_t *value, size_t *out) {
+    size_t result = 0;
+
+    if (value->len == 0) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < value->len; i++) {
+        char c = value->ptr[i];
+        if (c < '0' || c > '9' || result > ((size_t)-1 - 9) / 10) {
+            return -1;
+        }
+        result = result * 10 + (size_t)(c - '0');
+    }
+
+    *out = result;
+    return 0;
+}
+
+/*
+ * Helper function: Parse a single header line (without its line ending)
+ * colon is the first ':' in the line, NULL if there is none
+ * Returns 0 on success, -1 on error
+ */
+static int parse_header_line(http_request_t *request, const char *line, size_t length,
+                             const char *colon) {
+    const char *line_end = line + length;
+
+    /* Skip empty lines */
+    if (length == 0) {
+        return 0;
+    }
+
+    /* Require the colon separator (RFC 9112 5.1: proxies disagree on lines without one) */
+    if (colon == NULL) {
+        LOG_WARN(NULL, "Malformed header line (missing colon): %.*s", (int)length, line);
+        return -1;
+    }
+
+    /* Split into name and value, trimming whitespace from the value only */
+    http_str_t name = { line, (size_t)(colon - line) };
+    http_str_t value = { colon + 1, (size_t)(line_end - colon - 1) };
+    trim_whitespace(&value);
+
+    /* Validate header name: whitespace before the colon or a folded line is a 400 (RFC 9112) */
+    if (name.len == 0) {
+        LOG_WARN(NULL, "Empty header name");
+        return -1;
+    }
+    if (name.ptr[0] == ' ' || name.ptr[0] == '\t' ||
+        name.ptr[name.len - 1] == ' ' || name.ptr[name.len - 1] == '\t') {
+        LOG_WARN(NULL, "Whitespace around header name: %.*s", (int)name.len, name.ptr);
+        return -1;
+    }
+    if (name.len >= MAX_HEADER_NAME_LENGTH) {
+        LOG_ERROR(NULL, "Header name too long: %zu bytes (max %d)",
+                  name.len, MAX_HEADER_NAME_LENGTH);
+        return -1;
     }
 
-    /* Trim leading whitespace */
-    char *start = str;
-    while (*start == ' ' || *start == '\t' || *start == '\r' || *start == '\n') {
-        start++;
+    /* Validate header value length (a truncated Host or Content-Length is not what was sent) */
+    if (value.len >= MAX_HEADER_VALUE_LENGTH) {
+        LOG_ERROR(NULL, "Header value too long: %zu bytes (max %d)",
+                  value.len, MAX_HEADER_VALUE_LENGTH);
+        return -1;
     }
 
-    /* Trim trailing whitespace */
-    char *end = start + strlen(start) - 1;
-    while (end > start && (*end == ' ' || *end == '\t' || *end == '\r' || *end == '\n')) {
-        end--;
+    /* Check if we've exceeded maximum header count */
+    if (request->header_count >= MAX_HEADERS) {
+        LOG_ERROR(NULL, "Too many headers: maximum %d headers allowed", MAX_HEADERS);
+        return -1;
     }
-    *(end + 1) = '\0';
 
-    /* Move trimmed string to beginning if needed */
-    if (start != str) {
-        memmove(str, start, strlen(start) + 1);
+    /* Store header slices, recording the first occurrence of known headers */
+    http_header_id_t id = http_header_lookup(name.ptr, name.len);
+    http_header_t *header = &request->headers[request->header_count];
+    header->name = name;
+    header->value = value;
+    header->id = id;
+    if (id != HTTP_HEADER_OTHER && request->known_headers[id] == 0) {
+        request->known_headers[id] = (uint8_t)(request->header_count + 1);
     }
+
+    LOG_DEBUG(NULL, "Parsed header: %.*s: %.*s",
+              (int)name.len, name.ptr, (int)value.len, value.ptr);
+
+    /* Check for special headers */
+    switch (id) {
+        case HTTP_HEADER_X_IDEMPOTENCY_KEY:
+            /* Truncating would let two long keys with one prefix share a cached response */
+            if (value.len >= MAX_IDEMPOTENCY_KEY_LENGTH) {
+                LOG_WARN(NULL, "Idempotency key too long: %zu bytes (max %d)",
+                         value.len, MAX_IDEMPOTENCY_KEY_LENGTH - 1);
+                return -1;
+            }
+            /* known_headers[] points at the first copy, so a second could be read instead */
+            if (request->has_idempotency_key) {
+                LOG_WARN(NULL, "Repeated X-Idempotency-Key header");
+                return -1;
+            }
+            request->idempotency_key = value;
+            request->has_idempotency_key = true;
+            LOG_DEBUG(NULL, "Extracted Idempotency-Key: %.*s", (int)value.len, value.ptr);
+            break;
+
+        case HTTP_HEADER_CONTENT_LENGTH: {
+            /* A length that cannot be trusted would leave body bytes to parse as a request */
+            size_t content_length;
+            if (parse_content_length(&value, &content_length) != 0) {
+                LOG_WARN(NULL, "Invalid Content-Length value: %.*s", (int)value.len, value.ptr);
+                return -1;
+            }
+            /* A repeat is harmless only if it agrees with the first */
+            if (request->has_content_length) {
+                if (content_length != request->content_length) {
+                    LOG_WARN(NULL, "Conflicting Content-Length headers");
+                    return -1;
+                }
+                break;
+            }
+            request->content_length = content_length;
+            request->has_content_length = true;
+            LOG_DEBUG(NULL, "Extracted Content-Length: %zu bytes", content_length);
+            break;
+        }
+
+        case HTTP_HEADER_TRANSFER_ENCODING:
+            /* Only "chunked" alone is decoded; anything else is refused with 501 */
+            if (http_str_case_equals(&value, "chunked") && !request->chunked) {
+                request->chunked = true;
+            } else {
+                request->transfer_encoding_unsupported = true;
+            }
+            break;
+
+        case HTTP_HEADER_EXPECT:
+            if (http_str_case_equals(&value, "100-continue")) {
+                request->expect_continue = true;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    request->header_count++;
+    return 0;
+}
+
+/*
+ * Helper function: Check that the headers give the body one unambiguous length
+ * Repeated Content-Length headers already agree (see parse_header_line), but
+ * one may not come with Transfer-Encoding; otherwise a proxy and this server
+ * could split the stream differently
+ * Returns 0 on success, -1 on error
+ */
+static int check_framing(const http_request_t *request) {
+    if (request->has_content_length &&
+        (request->chunked || request->transfer_encoding_unsupported)) {
+        LOG_WARN(NULL, "Both Content-Length and Transfer-Encoding present");
+        return -1;
+    }
+    return 0;
 }
 
 /*
@@ -267,11 +576,10 @@ static void trim_whitespace(char *str) {
  * Example header section:
  *   "Host: example.com\r\n"
  *   "Content-Length: 123\r\n"
- *   "X-Idempotency-Key: abc123\r\n"
- *   "\r\n"
+ *   "X-Idempotency-Key: abc123"
  * Returns 0 on success, -1 on error
  */
-int parse_headers(http_request_t *request, const char *header_section) {
+int parse_headers(http_request_t *request, const char *header_section, size_t length) {
     if (request == NULL || header_section == NULL) {
         LOG_ERROR(NULL, "parse_headers: NULL parameter");
         return -1;
@@ -279,208 +587,168 @@ int parse_headers(http_request_t *request, const char *header_section) {
 
     /* Initialize header-related fields */
     request->header_count = 0;
+    memset(request->known_headers, 0, sizeof(request->known_headers));
     request->content_length = 0;
+    request->has_content_length = false;
     request->has_idempotency_key = false;
-    request->idempotency_key[0] = '\0';
+    request->idempotency_key.ptr = NULL;
+    request->idempotency_key.len = 0;
 
-    /* Create a mutable copy of the header section */
-    char *header_copy = strdup(header_section);
-    if (header_copy == NULL) {
-        LOG_ERROR(NULL, "Failed to allocate memory for header copy");
-        return -1;
-    }
+    const char *cursor = header_section;
+    const char *section_end = header_section + length;
 
     /* Parse headers line by line */
-    char *saveptr = NULL;
-    char *line = strtok_r(header_copy, "\r\n", &saveptr);
-
-    while (line != NULL) {
-        /* Skip empty lines (signals end of headers) */
-        if (strlen(line) == 0) {
-            break;
+    while (cursor < section_end) {
+        const char *line = cursor;
+        const char *line_end = cursor + http_scan_find2(cursor, (size_t)(section_end - cursor),
+                                                        '\n', '\n');
+        cursor = line_end < section_end ? line_end + 1 : section_end;
+        if (line_end > line && line_end[-1] == '\r') {
+            line_end--;
         }
 
-        /* Find the colon separator */
-        char *colon = strchr(line, ':');
-        if (colon == NULL) {
-            LOG_WARN(NULL, "Malformed header line (missing colon): %s", line);
-            line = strtok_r(NULL, "\r\n", &saveptr);
-            continue;
+        size_t line_length = (size_t)(line_end - line);
+        size_t colon = http_scan_find2(line, line_length, ':', ':');
+        if (parse_header_line(request, line, line_length,
+                              colon < line_length ? line + colon : NULL) != 0) {
+            return -1;
         }
+    }
 
-        /* Split into name and value */
-        *colon = '\0';  /* Terminate name string */
-        char *name = line;
-        char *value = colon + 1;
+    if (check_framing(request) != 0) {
+        return -1;
+    }
 
-        /* Trim whitespace from both parts */
-        trim_whitespace(name);
-        trim_whitespace(value);
+    LOG_DEBUG(NULL, "Parsed %d headers successfully", request->header_count);
+    return 0;
+}
 
-        /* Validate header name length */
-        size_t name_len = strlen(name);
-        if (name_len == 0) {
-            LOG_WARN(NULL, "Empty header name");
-            line = strtok_r(NULL, "\r\n", &saveptr);
-            continue;
-        }
-        if (name_len >= MAX_HEADER_NAME_LENGTH) {
-            LOG_ERROR(NULL, "Header name too long: %zu bytes (max %d)",
-                      name_len, MAX_HEADER_NAME_LENGTH);
-            free(header_copy);
-            return -1;
-        }
+/*
+ * Helper function: Record a parse failure
+ */
+static http_parse_result_t parse_fail(http_request_t *request, const char *reason) {
+    request->parse_state = HTTP_PARSE_STATE_FAILED;
+    request->parse_error = reason;
+    return HTTP_PARSE_ERROR;
+}
 
-        /* Validate header value length */
-        size_t value_len = strlen(value);
-        if (value_len >= MAX_HEADER_VALUE_LENGTH) {
-            LOG_WARN(NULL, "Header value too long: %zu bytes (max %d), truncating",
-                     value_len, MAX_HEADER_VALUE_LENGTH);
-            value[MAX_HEADER_VALUE_LENGTH - 1] = '\0';
-            value_len = MAX_HEADER_VALUE_LENGTH - 1;
+/*
+ * Helper function: Consume complete lines from where the last call stopped
+ * A partial line is left for the next call
+ */
+static http_parse_result_t parse_lines(http_request_t *request, const char *raw_request,
+                                       size_t length) {
+    while (request->parse_state == HTTP_PARSE_STATE_REQUEST_LINE ||
+           request->parse_state == HTTP_PARSE_STATE_HEADERS) {
+        const char *line = raw_request + request->parse_offset;
+        size_t remaining = length - request->parse_offset;
+        const char *colon = NULL;
+        size_t end;
+
+        /* Header lines: one pass finds the colon, a second the line end */
+        if (request->parse_state == HTTP_PARSE_STATE_HEADERS) {
+            end = http_scan_find2(line, remaining, ':', '\n');
+            if (end < remaining && line[end] == ':') {
+                colon = line + end;
+                end += 1 + http_scan_find2(colon + 1, remaining - end - 1, '\n', '\n');
+            }
+        } else {
+            end = http_scan_find2(line, remaining, '\n', '\n');
         }
 
-        /* Check if we've exceeded maximum header count */
-        if (request->header_count >= MAX_HEADERS) {
-            LOG_ERROR(NULL, "Too many headers: maximum %d headers allowed", MAX_HEADERS);
-            free(header_copy);
-            return -1;
+        if (end >= remaining) {
+            return HTTP_PARSE_NEED_MORE;
         }
 
-        /* Store header in array */
-        strncpy(request->headers[request->header_count].name, name,
-                MAX_HEADER_NAME_LENGTH - 1);
-        request->headers[request->header_count].name[MAX_HEADER_NAME_LENGTH - 1] = '\0';
-
-        strncpy(request->headers[request->header_count].value, value,
-                MAX_HEADER_VALUE_LENGTH - 1);
-        request->headers[request->header_count].value[MAX_HEADER_VALUE_LENGTH - 1] = '\0';
-
-        LOG_DEBUG(NULL, "Parsed header: %s: %s", name, value);
-
-        /* Check for special headers (case-insensitive) */
+        const char *newline = line + end;
+        size_t line_length = (size_t)(newline - line);
+        if (line_length > 0 && line[line_length - 1] == '\r') {
+            line_length--;
+        }
+        request->parse_offset = (size_t)(newline + 1 - raw_request);
 
-        /* X-Idempotency-Key header */
-        if (strcasecmp(name, "X-Idempotency-Key") == 0) {
-            size_t key_len = strlen(value);
-            if (key_len >= MAX_IDEMPOTENCY_KEY_LENGTH) {
-                LOG_WARN(NULL, "Idempotency key too long: %zu bytes (max %d), truncating",
-                         key_len, MAX_IDEMPOTENCY_KEY_LENGTH);
-                value[MAX_IDEMPOTENCY_KEY_LENGTH - 1] = '\0';
+        if (request->parse_state == HTTP_PARSE_STATE_REQUEST_LINE) {
+            /* Tolerate stray CRLFs between pipelined requests */
+            if (line_length == 0) {
+                continue;
             }
-            strncpy(request->idempotency_key, value, MAX_IDEMPOTENCY_KEY_LENGTH - 1);
-            request->idempotency_key[MAX_IDEMPOTENCY_KEY_LENGTH - 1] = '\0';
-            request->has_idempotency_key = true;
-            LOG_DEBUG(NULL, "Extracted Idempotency-Key: %s", request->idempotency_key);
+            if (parse_request_line(request, line, line_length) != 0) {
+                return parse_fail(request, "Invalid request line");
+            }
+            request->parse_state = HTTP_PARSE_STATE_HEADERS;
+            continue;
         }
 
-        /* Content-Length header */
-        if (strcasecmp(name, "Content-Length") == 0) {
-            char *endptr;
-            unsigned long content_len = strtoul(value, &endptr, 10);
-
-            /* Validate conversion */
-            if (*endptr != '\0') {
-                LOG_WARN(NULL, "Invalid Content-Length value: %s", value);
-                request->content_length = 0;
-            } else {
-                request->content_length = (size_t)content_len;
-                LOG_DEBUG(NULL, "Extracted Content-Length: %zu bytes", request->content_length);
+        /* Blank line ends the header block */
+        if (line_length == 0) {
+            /* Ambiguous framing is how requests get smuggled: refuse it */
+            if (check_framing(request) != 0) {
+                return parse_fail(request, "Invalid headers");
             }
+            request->header_length = request->parse_offset;
+            request->parse_state = HTTP_PARSE_STATE_COMPLETE;
+            LOG_DEBUG(NULL, "Parsed %d headers successfully", request->header_count);
+            break;
         }
 
-        request->header_count++;
-
-        /* Move to next line */
-        line = strtok_r(NULL, "\r\n", &saveptr);
+        if (parse_header_line(request, line, line_length, colon) != 0) {
+            return parse_fail(request, "Invalid headers");
+        }
     }
 
-    free(header_copy);
-
-    LOG_INFO(NULL, "Parsed %d headers successfully", request->header_count);
-    return 0;
+    return request->parse_state == HTTP_PARSE_STATE_COMPLETE ? HTTP_PARSE_DONE
+                                                              : HTTP_PARSE_ERROR;
 }
 
 /*
- * Parse HTTP request body (POST/PUT support)
- * Reads Content-Length bytes from socket file descriptor
- * Returns 0 on success, -1 on error
+ * Parse HTTP request line and headers incrementally
+ * Consumes one complete line at a time; a partial line is left for the next call
  */
-int parse_request_body(http_request_t *request, int socket_fd) {
-    if (request == NULL) {
-        LOG_ERROR(NULL, "parse_request_body: NULL request pointer");
-        return -1;
+http_parse_result_t http_parse_request(http_request_t *request, const char *raw_request,
+                                       size_t length) {
+    if (request == NULL || raw_request == NULL) {
+        LOG_ERROR(NULL, "http_parse_request: NULL parameter");
+        return HTTP_PARSE_ERROR;
     }
 
-    if (socket_fd < 0) {
-        LOG_ERROR(NULL, "parse_request_body: Invalid socket file descriptor");
-        return -1;
+    /* Already settled: nothing left to parse or to time */
+    if (request->parse_state == HTTP_PARSE_STATE_COMPLETE ||
+        request->parse_state == HTTP_PARSE_STATE_FAILED) {
+        return parse_lines(request, raw_request, length);
     }
 
-    /* Initialize body fields */
-    request->body = NULL;
-    request->body_length = 0;
+    /* Time across calls adds up; the request's total is recorded once it is settled */
+    uint64_t start = metrics_now_ns();
+    http_parse_result_t result = parse_lines(request, raw_request, length);
+    request->parse_ns += metrics_now_ns() - start;
 
-    /* Check if Content-Length is set */
-    if (request->content_length == 0) {
-        /* No body to read (valid for GET, HEAD, OPTIONS) */
-        LOG_DEBUG(NULL, "No Content-Length specified, skipping body read");
-        return 0;
+    if (result != HTTP_PARSE_NEED_MORE) {
+        metrics_observe(METRIC_PARSE_TIME, request->parse_ns);
     }
+    return result;
+}
 
-    /* Validate body size against maximum limit */
-    if (request->content_length > MAX_REQUEST_BODY_SIZE) {
-        LOG_ERROR(NULL, "Request body too large: %zu bytes (max %d bytes)",
-                  request->content_length, MAX_REQUEST_BODY_SIZE);
-        return -1;  /* Caller should return HTTP 413 Payload Too Large */
+/*
+ * Helper function: Move one slice from old_base to new_base
+ */
+static void rebase_slice(http_str_t *str, const char *old_base, const char *new_base) {
+    if (str->ptr != NULL) {
+        str->ptr = new_base + (str->ptr - old_base);
     }
+}
 
-    LOG_DEBUG(NULL, "Reading request body: %zu bytes", request->content_length);
-
-    /* Allocate buffer for body (+1 for null terminator) */
-    request->body = (char *)malloc(request->content_length + 1);
-    if (request->body == NULL) {
-        LOG_ERROR(NULL, "Failed to allocate %zu bytes for request body",
-                  request->content_length);
-        return -1;
+/*
+ * Re-point slices after the parsed bytes were copied to a new buffer
+ */
+void http_request_rebase(http_request_t *request, const char *old_base, const char *new_base) {
+    if (request == NULL || old_base == NULL || new_base == NULL) {
+        return;
     }
 
-    /* Read body from socket in loop (handle partial reads) */
-    size_t total_read = 0;
-    while (total_read < request->content_length) {
-        size_t remaining = request->content_length - total_read;
-        ssize_t bytes_read = recv(socket_fd,
-                                   request->body + total_read,
-                                   remaining,
-                                   0);
-
-        if (bytes_read < 0) {
-            /* Error reading from socket */
-            LOG_ERROR(NULL, "Error reading request body from socket: %s",
-                      strerror(errno));
-            free(request->body);
-            request->body = NULL;
-            return -1;
-        }
-
-        if (bytes_read == 0) {
-            /* Connection closed before reading complete body */
-            LOG_ERROR(NULL, "Connection closed after reading %zu of %zu bytes",
-                      total_read, request->content_length);
-            free(request->body);
-            request->body = NULL;
-            return -1;
-        }
-
-        total_read += bytes_read;
-        LOG_DEBUG(NULL, "Read %zd bytes from socket (%zu / %zu total)",
-                  bytes_read, total_read, request->content_length);
+    rebase_slice(&request->uri, old_base, new_base);
+    rebase_slice(&request->idempotency_key, old_base, new_base);
+    for (int i = 0; i < request->header_count; i++) {
+        rebase_slice(&request->headers[i].name, old_base, new_base);
+        rebase_slice(&request->headers[i].value, old_base, new_base);
     }
-
-    /* Null-terminate body (for JSON/text processing) */
-    request->body[request->content_length] = '\0';
-    request->body_length = request->content_length;
-
-    LOG_INFO(NULL, "Successfully read request body: %zu bytes", request->body_length);
-    return 0;
 }
@@ -1,15 +1,55 @@
 /*
  * C-HTTP Payment Server - HTTP Response Implementation
- * Builds and serializes HTTP/1.1 responses
+ * Builds and renders HTTP/1.1 responses
  */
 
 #include "http_response.h"
 #include "logger.h"
+#include <pthread.h>
 #include <string.h>
-#include <stdlib.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <time.h>
 
+/* Constant header lines */
+#define SERVER_LINE "Server: C-HTTP-Payment-Server/1.0\r\n"
+#define CONNECTION_KEEP_ALIVE_LINE "Connection: keep-alive\r\n"
+#define CONNECTION_CLOSE_LINE "Connection: close\r\n"
+#define CONTENT_LENGTH_PREFIX "Content-Length: "
+
+/* Shed requests (503) may be retried after a second */
+#define RETRY_AFTER_LINE "Retry-After: 1\r\n"
+
+/* Longest decimal size_t */
+#define SIZE_DIGITS_MAX 20
+
+const http_header_block_t HTTP_BLOCK_JSON = HTTP_HEADER_BLOCK("Content-Type", "application/json");
+
+/*
+ * Shared Date line
+ * Rendered into a ring of slots and published with an atomic pointer swap,
+ * so readers copy a complete line without locking. A slot is rewritten only
+ * after HTTP_DATE_SLOTS further refreshes (seconds), long after any reader
+ * that loaded it has finished copying
+ */
+#define HTTP_DATE_SLOTS 16
+
+typedef struct {
+    time_t second;                          /* Second the line was rendered for */
+    char line[HTTP_DATE_LINE_LENGTH + 1];   /* "Date: ...\r\n" */
+} date_slot_t;
+
+static date_slot_t g_date_slots[HTTP_DATE_SLOTS];
+static date_slot_t *g_date_current = NULL;
+static unsigned int g_date_next = 0;
+
+/* Refresh thread state */
+static pthread_t g_date_thread;
+static pthread_mutex_t g_date_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_date_cond = PTHREAD_COND_INITIALIZER;
+static bool g_date_ticking = false;
+static bool g_date_stop = false;
+
 /*
  * Get status message for HTTP status code
  * Returns string representation of status code
@@ -18,10 +58,14 @@ const char *status_code_to_message(int status_code) {
     switch (status_code) {
         case HTTP_OK:
             return "OK";
+        case HTTP_NOT_MODIFIED:
+            return "Not Modified";
         case HTTP_BAD_REQUEST:
             return "Bad Request";
         case HTTP_NOT_FOUND:
             return "Not Found";
+        case HTTP_METHOD_NOT_ALLOWED:
+            return "Method Not Allowed";
         case HTTP_CONFLICT:
             return "Conflict";
         case HTTP_PAYLOAD_TOO_LARGE:
@@ -32,6 +76,8 @@ const char *status_code_to_message(int status_code) {
             return "Internal Server Error";
         case HTTP_NOT_IMPLEMENTED:
             return "Not Implemented";
+        case HTTP_SERVICE_UNAVAILABLE:
+            return "Service Unavailable";
         default:
             return "Unknown";
     }
@@ -47,23 +93,34 @@ int http_response_init(http_response_t *response, int status_code) {
         return -1;
     }
 
-    /* Initialize status line */
-    response->status_code = status_code;
-    response->status_message = strdup(status_code_to_message(status_code));
-    if (response->status_message == NULL) {
-        LOG_ERROR(NULL, "Failed to allocate status message");
+    /* All response memory comes from the worker's arena */
+    response->arena = arena_thread();
+    if (response->arena == NULL) {
+        LOG_ERROR(NULL, "No arena available for response");
         return -1;
     }
 
+    /* Initialize status line */
+    response->status_code = status_code;
+    response->status_message = status_code_to_message(status_code);
+
     /* Initialize headers array */
     response->header_names = NULL;
     response->header_values = NULL;
     response->header_count = 0;
     response->header_capacity = 0;
 
+    response->block_count = 0;
+
     /* Initialize body */
     response->body = NULL;
     response->body_length = 0;
+    memset(&response->borrow, 0, sizeof(response->borrow));
+    response->borrow.fd = -1;
+    response->omit_body = false;
+
+    /* Close the connection unless the caller opts in to keep-alive */
+    response->keep_alive = false;
 
     LOG_DEBUG(NULL, "Initialized response with status %d %s",
               status_code, response->status_message);
@@ -81,48 +138,106 @@ int http_response_add_header(http_response_t *response, const char *name, const
         return -1;
     }
 
-    /* Expand header arrays if needed */
+    /* Expand header arrays if needed (old arrays are reclaimed with the arena) */
     if (response->header_count >= response->header_capacity) {
-        size_t new_capacity = response->header_capacity == 0 ? 8 : response->header_capacity * 2;
-
-        char **new_names = (char **)realloc(response->header_names, new_capacity * sizeof(char *));
-        if (new_names == NULL) {
-            LOG_ERROR(NULL, "Failed to allocate memory for header names");
+        size_t new_capacity = response->header_capacity == 0
+                                  ? HTTP_RESPONSE_INITIAL_HEADERS
+                                  : response->header_capacity * 2;
+
+        const char **new_names = (const char **)arena_alloc(response->arena,
+                                                            new_capacity * sizeof(char *));
+        const char **new_values = (const char **)arena_alloc(response->arena,
+                                                             new_capacity * sizeof(char *));
+        if (new_names == NULL || new_values == NULL) {
+            LOG_ERROR(NULL, "Failed to allocate memory for response headers");
             return -1;
         }
-        response->header_names = new_names;
 
-        char **new_values = (char **)realloc(response->header_values, new_capacity * sizeof(char *));
-        if (new_values == NULL) {
-            LOG_ERROR(NULL, "Failed to allocate memory for header values");
-            return -1;
+        if (response->header_count > 0) {
+            memcpy(new_names, response->header_names, response->header_count * sizeof(char *));
+            memcpy(new_values, response->header_values, response->header_count * sizeof(char *));
         }
+        response->header_names = new_names;
         response->header_values = new_values;
-
         response->header_capacity = new_capacity;
     }
 
     /* Add header */
-    response->header_names[response->header_count] = strdup(name);
-    if (response->header_names[response->header_count] == NULL) {
-        LOG_ERROR(NULL, "Failed to allocate memory for header name");
+    const char *name_copy = arena_strndup(response->arena, name, strlen(name));
+    const char *value_copy = arena_strndup(response->arena, value, strlen(value));
+    if (name_copy == NULL || value_copy == NULL) {
+        LOG_ERROR(NULL, "Failed to allocate memory for header");
         return -1;
     }
 
-    response->header_values[response->header_count] = strdup(value);
-    if (response->header_values[response->header_count] == NULL) {
-        LOG_ERROR(NULL, "Failed to allocate memory for header value");
-        free(response->header_names[response->header_count]);
+    response->header_names[response->header_count] = name_copy;
+    response->header_values[response->header_count] = value_copy;
+    response->header_count++;
+
+    LOG_DEBUG(NULL, "Added header: %s: %s", name, value);
+
+    return 0;
+}
+
+/*
+ * Add a pre-rendered header block
+ * Returns 0 on success, -1 on error
+ */
+int http_response_add_block(http_response_t *response, const http_header_block_t *block) {
+    if (response == NULL || block == NULL || block->data == NULL) {
+        LOG_ERROR(NULL, "http_response_add_block: NULL parameter");
         return -1;
     }
 
-    response->header_count++;
+    if (response->block_count >= HTTP_RESPONSE_MAX_BLOCKS) {
+        LOG_ERROR(NULL, "Too many header blocks (max %d)", HTTP_RESPONSE_MAX_BLOCKS);
+        return -1;
+    }
 
-    LOG_DEBUG(NULL, "Added header: %s: %s", name, value);
+    response->blocks[response->block_count++] = block;
+    return 0;
+}
 
+/*
+ * Render "name: value\r\n" once into a heap block
+ * Returns 0 on success, -1 on error
+ */
+int http_header_block_init(http_header_block_t *block, const char *name, const char *value) {
+    if (block == NULL || name == NULL || value == NULL) {
+        return -1;
+    }
+
+    size_t name_length = strlen(name);
+    size_t value_length = strlen(value);
+    char *data = (char *)malloc(name_length + value_length + 5);
+    if (data == NULL) {
+        LOG_ERROR(NULL, "Failed to allocate header block for %s", name);
+        return -1;
+    }
+
+    memcpy(data, name, name_length);
+    memcpy(data + name_length, ": ", 2);
+    memcpy(data + name_length + 2, value, value_length);
+    memcpy(data + name_length + 2 + value_length, "\r\n", 3);
+
+    block->data = data;
+    block->length = name_length + value_length + 4;
     return 0;
 }
 
+/*
+ * Free a block from http_header_block_init()
+ */
+void http_header_block_destroy(http_header_block_t *block) {
+    if (block == NULL) {
+        return;
+    }
+
+    free((void *)block->data);
+    block->data = NULL;
+    block->length = 0;
+}
+
 /*
  * Set response body
  * Returns 0 on success, -1 on error
@@ -133,12 +248,9 @@ int http_response_set_body(http_response_t *response, const char *body, size_t l
         return -1;
     }
 
-    /* Free existing body if present */
-    if (response->body != NULL) {
-        free(response->body);
-        response->body = NULL;
-        response->body_length = 0;
-    }
+    /* Drop existing body (reclaimed with the arena) */
+    response->body = NULL;
+    response->body_length = 0;
 
     /* Handle NULL or empty body */
     if (body == NULL || length == 0) {
@@ -147,7 +259,7 @@ int http_response_set_body(http_response_t *response, const char *body, size_t l
     }
 
     /* Allocate and copy body */
-    response->body = (char *)malloc(length);
+    response->body = (char *)arena_alloc(response->arena, length);
     if (response->body == NULL) {
         LOG_ERROR(NULL, "Failed to allocate %zu bytes for response body", length);
         return -1;
@@ -162,115 +274,408 @@ int http_response_set_body(http_response_t *response, const char *body, size_t l
 }
 
 /*
- * Serialize response to string (ready to send)
- * Automatically adds Server, Date, and Content-Length headers
- * Returns serialized response string (caller must free), NULL on error
+ * Reference body bytes in place (no copy)
+ * Returns 0 on success, -1 on error
  */
-char *http_response_serialize(http_response_t *response, size_t *out_length) {
-    if (response == NULL || out_length == NULL) {
-        LOG_ERROR(NULL, "http_response_serialize: NULL parameter");
-        return NULL;
+int http_response_set_body_ref(http_response_t *response, const char *body, size_t length) {
+    if (response == NULL || (body == NULL && length > 0)) {
+        LOG_ERROR(NULL, "http_response_set_body_ref: invalid parameter");
+        return -1;
     }
 
-    /* Calculate response size estimate */
-    size_t estimated_size = 1024;  /* Status line + headers estimate */
-    estimated_size += response->body_length;
+    response->body = (char *)body;
+    response->body_length = length;
+    return 0;
+}
 
-    /* Allocate buffer for serialized response */
-    char *buffer = (char *)malloc(estimated_size);
-    if (buffer == NULL) {
-        LOG_ERROR(NULL, "Failed to allocate serialization buffer");
-        return NULL;
+/*
+ * Hand the response something it borrows
+ */
+void http_response_set_borrow(http_response_t *response, const http_borrow_t *borrow) {
+    if (response == NULL || borrow == NULL) {
+        return;
+    }
+
+    response->borrow = *borrow;
+}
+
+/*
+ * Send headers only (HEAD)
+ */
+void http_response_omit_body(http_response_t *response) {
+    if (response == NULL) {
+        return;
     }
 
-    size_t offset = 0;
+    response->omit_body = true;
+}
+
+/*
+ * Set whether the connection persists after this response
+ */
+void http_response_set_keep_alive(http_response_t *response, bool keep_alive) {
+    if (response == NULL) {
+        return;
+    }
+
+    response->keep_alive = keep_alive;
+}
+
+/* Pre-rendered status lines for the codes the server sends */
+#define STATUS_LINE(code, text) { code, "HTTP/1.1 " #code " " text "\r\n", \
+                                  sizeof("HTTP/1.1 " #code " " text "\r\n") - 1 }
+
+static const struct {
+    int status_code;
+    const char *line;
+    size_t length;
+} g_status_lines[] = {
+    STATUS_LINE(200, "OK"),
+    STATUS_LINE(304, "Not Modified"),
+    STATUS_LINE(400, "Bad Request"),
+    STATUS_LINE(404, "Not Found"),
+    STATUS_LINE(405, "Method Not Allowed"),
+    STATUS_LINE(409, "Conflict"),
+    STATUS_LINE(413, "Payload Too Large"),
+    STATUS_LINE(422, "Unprocessable Entity"),
+    STATUS_LINE(500, "Internal Server Error"),
+    STATUS_LINE(501, "Not Implemented"),
+};
+
+#undef STATUS_LINE
+
+/*
+ * Helper function: Find or render the status line for a response
+ * Returns status line on success, NULL on error
+ */
+static const char *render_status_line(http_response_t *response, size_t *length) {
+    for (size_t i = 0; i < sizeof(g_status_lines) / sizeof(g_status_lines[0]); i++) {
+        if (g_status_lines[i].status_code == response->status_code) {
+            *length = g_status_lines[i].length;
+            return g_status_lines[i].line;
+        }
+    }
 
-    /* Write status line: HTTP/1.1 200 OK\r\n */
-    int written = snprintf(buffer + offset, estimated_size - offset,
-                          "HTTP/1.1 %d %s\r\n",
-                          response->status_code,
-                          response->status_message);
-    if (written < 0 || (size_t)written >= estimated_size - offset) {
-        LOG_ERROR(NULL, "Buffer overflow writing status line");
-        free(buffer);
+    /* Uncommon code: format it in the arena */
+    size_t capacity = 32 + strlen(response->status_message);
+    char *line = (char *)arena_alloc(response->arena, capacity);
+    if (line == NULL) {
         return NULL;
     }
-    offset += written;
 
-    /* Add Server header */
-    written = snprintf(buffer + offset, estimated_size - offset,
-                      "Server: C-HTTP-Payment-Server/1.0\r\n");
-    if (written < 0 || (size_t)written >= estimated_size - offset) {
-        LOG_ERROR(NULL, "Buffer overflow writing Server header");
-        free(buffer);
+    int written = snprintf(line, capacity, "HTTP/1.1 %d %s\r\n",
+                           response->status_code, response->status_message);
+    if (written < 0 || (size_t)written >= capacity) {
         return NULL;
     }
-    offset += written;
 
-    /* Add Date header */
+    *length = (size_t)written;
+    return line;
+}
+
+/*
+ * Helper function: Write a value in 0..99 as two digits
+ */
+static inline void put_two_digits(char *out, int value) {
+    out[0] = (char)('0' + value / 10 % 10);
+    out[1] = (char)('0' + value % 10);
+}
+
+/*
+ * Helper function: Render the Date line for now into a fresh slot and publish it
+ * Safe to call from any thread; concurrent callers get different slots
+ */
+static const date_slot_t *date_refresh(time_t now) {
+    static const char days[7][4] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+    static const char months[12][4] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                        "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+    unsigned int index = __atomic_fetch_add(&g_date_next, 1, __ATOMIC_RELAXED) % HTTP_DATE_SLOTS;
+    date_slot_t *slot = &g_date_slots[index];
+
+    struct tm gmt;
+    gmtime_r(&now, &gmt);
+    int year = gmt.tm_year + 1900;
+
+    /* Fixed layout: "Date: Www, DD Mmm YYYY HH:MM:SS GMT\r\n" */
+    char *p = slot->line;
+    memcpy(p, "Date: ", 6);
+    memcpy(p + 6, days[gmt.tm_wday % 7], 3);
+    memcpy(p + 9, ", ", 2);
+    put_two_digits(p + 11, gmt.tm_mday);
+    p[13] = ' ';
+    memcpy(p + 14, months[gmt.tm_mon % 12], 3);
+    p[17] = ' ';
+    put_two_digits(p + 18, year / 100 % 100);
+    put_two_digits(p + 20, year % 100);
+    p[22] = ' ';
+    put_two_digits(p + 23, gmt.tm_hour);
+    p[25] = ':';
+    put_two_digits(p + 26, gmt.tm_min);
+    p[28] = ':';
+    put_two_digits(p + 29, gmt.tm_sec);
+    memcpy(p + 31, " GMT\r\n", 7);
+    p[HTTP_DATE_LINE_LENGTH] = '\0';
+    __atomic_store_n(&slot->second, now, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&g_date_current, slot, __ATOMIC_RELEASE);
+    return slot;
+}
+
+/*
+ * Get the current "Date: ...\r\n" line
+ */
+const char *http_date_line(void) {
+    date_slot_t *slot = __atomic_load_n(&g_date_current, __ATOMIC_ACQUIRE);
+    if (slot != NULL && __atomic_load_n(&g_date_ticking, __ATOMIC_RELAXED)) {
+        return slot->line;
+    }
+
+    /* No refresh thread: re-render when the second has moved on */
     time_t now = time(NULL);
-    struct tm *gmt = gmtime(&now);
-    char date_buf[128];
-    strftime(date_buf, sizeof(date_buf), "%a, %d %b %Y %H:%M:%S GMT", gmt);
-    written = snprintf(buffer + offset, estimated_size - offset,
-                      "Date: %s\r\n", date_buf);
-    if (written < 0 || (size_t)written >= estimated_size - offset) {
-        LOG_ERROR(NULL, "Buffer overflow writing Date header");
-        free(buffer);
-        return NULL;
+    if (slot != NULL && __atomic_load_n(&slot->second, __ATOMIC_RELAXED) == now) {
+        return slot->line;
     }
-    offset += written;
+    return date_refresh(now)->line;
+}
 
-    /* Add Content-Length header */
-    written = snprintf(buffer + offset, estimated_size - offset,
-                      "Content-Length: %zu\r\n", response->body_length);
-    if (written < 0 || (size_t)written >= estimated_size - offset) {
-        LOG_ERROR(NULL, "Buffer overflow writing Content-Length header");
-        free(buffer);
-        return NULL;
+/*
+ * Helper function: Date refresh thread, wakes on each second boundary
+ */
+static void *date_thread(void *arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&g_date_mutex);
+    while (!g_date_stop) {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        date_refresh(now.tv_sec);
+
+        struct timespec deadline = { .tv_sec = now.tv_sec + 1, .tv_nsec = 0 };
+        while (!g_date_stop && pthread_cond_timedwait(&g_date_cond, &g_date_mutex, &deadline) == 0) {
+        }
+    }
+    pthread_mutex_unlock(&g_date_mutex);
+
+    return NULL;
+}
+
+/*
+ * Start the Date refresh thread
+ * Returns 0 on success, -1 on error
+ */
+int http_date_start(void) {
+    if (__atomic_load_n(&g_date_ticking, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+
+    /* Publish a line before readers stop checking the clock */
+    date_refresh(time(NULL));
+    g_date_stop = false;
+
+    if (pthread_create(&g_date_thread, NULL, date_thread, NULL) != 0) {
+        LOG_ERROR(NULL, "Failed to create Date refresh thread");
+        return -1;
+    }
+
+    __atomic_store_n(&g_date_ticking, true, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/*
+ * Stop the Date refresh thread
+ */
+void http_date_stop(void) {
+    if (!__atomic_load_n(&g_date_ticking, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    __atomic_store_n(&g_date_ticking, false, __ATOMIC_RELEASE);
+
+    pthread_mutex_lock(&g_date_mutex);
+    g_date_stop = true;
+    pthread_cond_signal(&g_date_cond);
+    pthread_mutex_unlock(&g_date_mutex);
+
+    pthread_join(g_date_thread, NULL);
+}
+
+/*
+ * Helper function: Copy bytes to cursor, returning the new cursor
+ */
+static inline char *append_bytes(char *cursor, const char *data, size_t length) {
+    memcpy(cursor, data, length);
+    return cursor + length;
+}
+
+/*
+ * Helper function: Write value in decimal at cursor, returning the new cursor
+ */
+static char *append_decimal(char *cursor, size_t value) {
+    char digits[SIZE_DIGITS_MAX];
+    size_t count = 0;
+
+    do {
+        digits[count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+
+    while (count > 0) {
+        *cursor++ = digits[--count];
+    }
+    return cursor;
+}
+
+/*
+ * Render response as an iovec (ready to send)
+ * Automatically adds Server, Date, Content-Length and Connection headers
+ * from pre-rendered pieces (no formatting on this path)
+ * Returns 0 on success, -1 on error
+ */
+int http_response_render(http_response_t *response, http_output_t *output) {
+    if (response == NULL || output == NULL) {
+        LOG_ERROR(NULL, "http_response_render: NULL parameter");
+        return -1;
     }
-    offset += written;
 
-    /* Write custom headers */
+    if (response->arena == NULL || response->status_message == NULL) {
+        LOG_ERROR(NULL, "http_response_render: response not initialized");
+        return -1;
+    }
+
+    /* Segment 1: status line */
+    size_t status_length = 0;
+    const char *status_line = render_status_line(response, &status_length);
+    if (status_line == NULL) {
+        LOG_ERROR(NULL, "Failed to render status line");
+        return -1;
+    }
+
+    /* Size the header block: automatic headers, blocks and custom headers */
+    size_t estimated_size = sizeof(SERVER_LINE) + HTTP_DATE_LINE_LENGTH +
+                            sizeof(CONTENT_LENGTH_PREFIX) + SIZE_DIGITS_MAX + 2 +
+                            sizeof(CONNECTION_KEEP_ALIVE_LINE) + 2;
+    for (size_t i = 0; i < response->block_count; i++) {
+        estimated_size += response->blocks[i]->length;
+    }
     for (size_t i = 0; i < response->header_count; i++) {
-        written = snprintf(buffer + offset, estimated_size - offset,
-                          "%s: %s\r\n",
-                          response->header_names[i],
-                          response->header_values[i]);
-        if (written < 0 || (size_t)written >= estimated_size - offset) {
-            LOG_ERROR(NULL, "Buffer overflow writing header %zu", i);
-            free(buffer);
-            return NULL;
-        }
-        offset += written;
+        estimated_size += strlen(response->header_names[i]) +
+                          strlen(response->header_values[i]) + 4;
     }
 
-    /* Write blank line after headers */
-    written = snprintf(buffer + offset, estimated_size - offset, "\r\n");
-    if (written < 0 || (size_t)written >= estimated_size - offset) {
-        LOG_ERROR(NULL, "Buffer overflow writing header separator");
-        free(buffer);
-        return NULL;
+    char *buffer = (char *)arena_alloc(response->arena, estimated_size);
+    if (buffer == NULL) {
+        LOG_ERROR(NULL, "Failed to allocate header block");
+        return -1;
+    }
+
+    /* Server, Date, Content-Length and Connection come from pre-rendered pieces */
+    char *cursor = buffer;
+    cursor = append_bytes(cursor, SERVER_LINE, sizeof(SERVER_LINE) - 1);
+    cursor = append_bytes(cursor, http_date_line(), HTTP_DATE_LINE_LENGTH);
+    size_t content_length = response->body_length +
+                            (response->borrow.fd >= 0 ? response->borrow.length : 0);
+    if (response->status_code != HTTP_NOT_MODIFIED) {
+        cursor = append_bytes(cursor, CONTENT_LENGTH_PREFIX, sizeof(CONTENT_LENGTH_PREFIX) - 1);
+        cursor = append_decimal(cursor, content_length);
+        cursor = append_bytes(cursor, "\r\n", 2);
+    }
+    if (response->keep_alive) {
+        cursor = append_bytes(cursor, CONNECTION_KEEP_ALIVE_LINE, sizeof(CONNECTION_KEEP_ALIVE_LINE) - 1);
+    } else {
+        cursor = append_bytes(cursor, CONNECTION_CLOSE_LINE, sizeof(CONNECTION_CLOSE_LINE) - 1);
     }
-    offset += written;
 
-    /* Write body if present */
-    if (response->body != NULL && response->body_length > 0) {
-        if (offset + response->body_length > estimated_size) {
-            LOG_ERROR(NULL, "Buffer overflow writing body");
-            free(buffer);
-            return NULL;
+    /* Registered blocks, then headers added one by one */
+    for (size_t i = 0; i < response->block_count; i++) {
+        cursor = append_bytes(cursor, response->blocks[i]->data, response->blocks[i]->length);
+    }
+    for (size_t i = 0; i < response->header_count; i++) {
+        cursor = append_bytes(cursor, response->header_names[i], strlen(response->header_names[i]));
+        cursor = append_bytes(cursor, ": ", 2);
+        cursor = append_bytes(cursor, response->header_values[i], strlen(response->header_values[i]));
+        cursor = append_bytes(cursor, "\r\n", 2);
+    }
+
+    /* Blank line after headers */
+    cursor = append_bytes(cursor, "\r\n", 2);
+    size_t offset = (size_t)(cursor - buffer);
+
+    /* Segments 2-3: header block and body, both referenced in place */
+    size_t body_length = response->omit_body ? 0 : response->body_length;
+    output->iov[0].iov_base = (void *)status_line;
+    output->iov[0].iov_len = status_length;
+    output->iov[1].iov_base = buffer;
+    output->iov[1].iov_len = offset;
+    output->iov_count = 2;
+    if (response->body != NULL && body_length > 0) {
+        output->iov[2].iov_base = response->body;
+        output->iov[2].iov_len = body_length;
+        output->iov_count = 3;
+    }
+    output->iov_index = 0;
+    output->body_length = body_length;
+    output->sent = 0;
+
+    /* A borrowed file follows the segments; the output now owns the borrow */
+    output->borrow = response->borrow;
+    if (output->borrow.fd < 0 || response->omit_body) {
+        output->borrow.length = 0;
+    }
+    output->length = status_length + offset + body_length + output->borrow.length;
+    memset(&response->borrow, 0, sizeof(response->borrow));
+    response->borrow.fd = -1;
+
+    LOG_DEBUG(NULL, "Rendered response: %zu bytes in %d segments (status %d)",
+              output->length, output->iov_count, response->status_code);
+
+    return 0;
+}
+
+/*
+ * Advance output past bytes the kernel accepted
+ */
+void http_output_advance(http_output_t *output, size_t bytes) {
+    if (output == NULL) {
+        return;
+    }
+
+    output->sent += bytes;
+    while (bytes > 0 && output->iov_index < output->iov_count) {
+        struct iovec *iov = &output->iov[output->iov_index];
+        if (bytes < iov->iov_len) {
+            iov->iov_base = (char *)iov->iov_base + bytes;
+            iov->iov_len -= bytes;
+            return;
         }
-        memcpy(buffer + offset, response->body, response->body_length);
-        offset += response->body_length;
+        bytes -= iov->iov_len;
+        iov->iov_len = 0;
+        output->iov_index++;
     }
+}
 
-    *out_length = offset;
+/*
+ * Release what the output borrows
+ */
+void http_output_release(http_output_t *output) {
+    if (output == NULL || output->borrow.release == NULL) {
+        return;
+    }
 
-    LOG_INFO(NULL, "Serialized response: %zu bytes (status %d)",
-             offset, response->status_code);
+    void (*release)(void *) = output->borrow.release;
+    output->borrow.release = NULL;
+    output->borrow.fd = -1;
+    output->borrow.length = 0;
+    release(output->borrow.arg);
+}
 
-    return buffer;
+/*
+ * Helper function: Format the JSON body of an error response
+ * Returns snprintf()'s result
+ */
+static int format_error_body(char *out, size_t size, int status_code, const char *error_message) {
+    return snprintf(out, size, "{\"error\":\"%s\",\"status\":%d,\"message\":\"%s\"}",
+                    error_message, status_code, status_code_to_message(status_code));
 }
 
 /*
@@ -290,7 +695,7 @@ int http_response_create_error(http_response_t *response, int status_code, const
     }
 
     /* Add Content-Type: application/json header */
-    result = http_response_add_header(response, "Content-Type", "application/json");
+    result = http_response_add_block(response, &HTTP_BLOCK_JSON);
     if (result != 0) {
         http_response_free(response);
         return -1;
@@ -298,11 +703,7 @@ int http_response_create_error(http_response_t *response, int status_code, const
 
     /* Create JSON error body */
     char error_body[1024];
-    int written = snprintf(error_body, sizeof(error_body),
-                          "{\"error\":\"%s\",\"status\":%d,\"message\":\"%s\"}",
-                          error_message,
-                          status_code,
-                          status_code_to_message(status_code));
+    int written = format_error_body(error_body, sizeof(error_body), status_code, error_message);
 
     if (written < 0 || (size_t)written >= sizeof(error_body)) {
         LOG_ERROR(NULL, "Failed to format error response body");
@@ -317,7 +718,7 @@ int http_response_create_error(http_response_t *response, int status_code, const
         return -1;
     }
 
-    LOG_INFO(NULL, "Created error response: %d %s - %s",
+    LOG_DEBUG(NULL, "Created error response: %d %s - %s",
              status_code, status_code_to_message(status_code), error_message);
 
     return 0;
@@ -331,38 +732,179 @@ void http_response_free(http_response_t *response) {
         return;
     }
 
-    /* Free status message */
-    if (response->status_message != NULL) {
-        free(response->status_message);
-        response->status_message = NULL;
+    /* Memory belongs to the arena; only detach it here */
+    response->status_message = NULL;
+    response->header_names = NULL;
+    response->header_values = NULL;
+    response->body = NULL;
+    response->header_count = 0;
+    response->header_capacity = 0;
+    response->block_count = 0;
+    response->body_length = 0;
+
+    /* Never rendered: nothing else will release the borrow */
+    if (response->borrow.release != NULL) {
+        response->borrow.release(response->borrow.arg);
     }
+    memset(&response->borrow, 0, sizeof(response->borrow));
+    response->borrow.fd = -1;
+
+    LOG_DEBUG(NULL, "Freed response resources");
+}
+
+/* Errors the request path sends; each gets a canned response */
+static http_canned_t g_canned[] = {
+    { .status_code = HTTP_BAD_REQUEST, .message = "Invalid request line" },
+    { .status_code = HTTP_BAD_REQUEST, .message = "Invalid headers" },
+    { .status_code = HTTP_BAD_REQUEST, .message = "Malformed HTTP request" },
+    { .status_code = HTTP_BAD_REQUEST, .message = "Failed to read request body" },
+    { .status_code = HTTP_BAD_REQUEST, .message = "Invalid chunked body" },
+    { .status_code = HTTP_NOT_FOUND, .message = "Not found" },
+    { .status_code = HTTP_NOT_FOUND, .message = "Payment not found" },
+    { .status_code = HTTP_NOT_FOUND, .message = "File not found" },
+    { .status_code = HTTP_CONFLICT, .message = "A request with this X-Idempotency-Key is in progress" },
+    { .status_code = HTTP_PAYLOAD_TOO_LARGE, .message = "Request body exceeds 1MB limit" },
+    { .status_code = HTTP_UNPROCESSABLE, .message = "POST requests require X-Idempotency-Key header" },
+    { .status_code = HTTP_UNPROCESSABLE,
+      .message = "X-Idempotency-Key was already used for a different request" },
+    { .status_code = HTTP_INTERNAL_ERROR, .message = "Out of memory" },
+    { .status_code = HTTP_INTERNAL_ERROR, .message = "Failed to format response" },
+    { .status_code = HTTP_INTERNAL_ERROR, .message = "Request handler failed" },
+    { .status_code = HTTP_INTERNAL_ERROR, .message = "Failed to serve file" },
+    { .status_code = HTTP_NOT_IMPLEMENTED, .message = "Unsupported Transfer-Encoding" },
+    { .status_code = HTTP_SERVICE_UNAVAILABLE, .message = "Server overloaded, retry later",
+      .headers = RETRY_AFTER_LINE },
+    { .status_code = HTTP_SERVICE_UNAVAILABLE, .message = "Server restarting, retry later",
+      .headers = RETRY_AFTER_LINE },
+    { .status_code = HTTP_SERVICE_UNAVAILABLE,
+      .message = "Idempotency key owner unavailable, retry later",
+      .headers = RETRY_AFTER_LINE },
+};
+
+#define CANNED_COUNT (sizeof(g_canned) / sizeof(g_canned[0]))
+
+static pthread_once_t g_canned_once = PTHREAD_ONCE_INIT;
+static bool g_canned_ready = false;
+
+/*
+ * Helper function: Serialize one canned response
+ * Returns 0 on success, -1 on error
+ */
+static int canned_build(http_canned_t *canned) {
+    char body[1024];
+    int body_length = format_error_body(body, sizeof(body), canned->status_code, canned->message);
+    if (body_length < 0 || (size_t)body_length >= sizeof(body)) {
+        return -1;
+    }
+
+    char prefix[256];
+    int prefix_length = snprintf(prefix, sizeof(prefix), "HTTP/1.1 %d %s\r\n" SERVER_LINE,
+                                 canned->status_code, status_code_to_message(canned->status_code));
+    if (prefix_length < 0 || (size_t)prefix_length >= sizeof(prefix)) {
+        return -1;
+    }
+
+    canned->prefix = strdup(prefix);
+    if (canned->prefix == NULL) {
+        return -1;
+    }
+    canned->prefix_length = (size_t)prefix_length;
+
+    for (int keep_alive = 0; keep_alive < 2; keep_alive++) {
+        size_t capacity = (size_t)body_length + 256;
+        char *suffix = (char *)malloc(capacity);
+        if (suffix == NULL) {
+            return -1;
+        }
 
-    /* Free headers */
-    if (response->header_names != NULL) {
-        for (size_t i = 0; i < response->header_count; i++) {
-            free(response->header_names[i]);
+        int length = snprintf(suffix, capacity, CONTENT_LENGTH_PREFIX "%d\r\n%s%s%.*s\r\n%s",
+                              body_length, canned->headers != NULL ? canned->headers : "",
+                              keep_alive ? CONNECTION_KEEP_ALIVE_LINE : CONNECTION_CLOSE_LINE,
+                              (int)HTTP_BLOCK_JSON.length, HTTP_BLOCK_JSON.data, body);
+        if (length < 0 || (size_t)length >= capacity) {
+            free(suffix);
+            return -1;
         }
-        free(response->header_names);
-        response->header_names = NULL;
+
+        canned->suffix[keep_alive] = suffix;
+        canned->suffix_length[keep_alive] = (size_t)length;
     }
 
-    if (response->header_values != NULL) {
-        for (size_t i = 0; i < response->header_count; i++) {
-            free(response->header_values[i]);
+    canned->body_length = (size_t)body_length;
+    return 0;
+}
+
+/*
+ * Helper function: Build every canned response (runs once)
+ * The table lives until exit
+ */
+static void canned_build_all(void) {
+    for (size_t i = 0; i < CANNED_COUNT; i++) {
+        if (canned_build(&g_canned[i]) != 0) {
+            LOG_ERROR(NULL, "Failed to build canned %d response", g_canned[i].status_code);
+            return;
         }
-        free(response->header_values);
-        response->header_values = NULL;
     }
 
-    /* Free body */
-    if (response->body != NULL) {
-        free(response->body);
-        response->body = NULL;
+    __atomic_store_n(&g_canned_ready, true, __ATOMIC_RELEASE);
+    LOG_DEBUG(NULL, "Built %zu canned error responses", CANNED_COUNT);
+}
+
+/*
+ * Build the canned error table
+ * Returns 0 on success, -1 on error
+ */
+int http_canned_init(void) {
+    pthread_once(&g_canned_once, canned_build_all);
+    return __atomic_load_n(&g_canned_ready, __ATOMIC_ACQUIRE) ? 0 : -1;
+}
+
+/*
+ * Find the canned response for (status_code, error_message)
+ * Returns NULL if the pair is not in the table
+ */
+const http_canned_t *http_canned_find(int status_code, const char *error_message) {
+    if (error_message == NULL || http_canned_init() != 0) {
+        return NULL;
     }
 
-    response->header_count = 0;
-    response->header_capacity = 0;
-    response->body_length = 0;
+    /* Callers pass the same literals, so pointer equality usually decides */
+    for (size_t i = 0; i < CANNED_COUNT; i++) {
+        if (g_canned[i].status_code == status_code &&
+            (g_canned[i].message == error_message || strcmp(g_canned[i].message, error_message) == 0)) {
+            return &g_canned[i];
+        }
+    }
+    return NULL;
+}
 
-    LOG_DEBUG(NULL, "Freed response resources");
+/*
+ * Point output at a canned response, copying in the current Date line
+ */
+void http_canned_render(const http_canned_t *canned, bool keep_alive, bool omit_body,
+                        http_output_t *output) {
+    if (canned == NULL || output == NULL) {
+        return;
+    }
+
+    int variant = keep_alive ? 1 : 0;
+    memcpy(output->date, http_date_line(), HTTP_DATE_LINE_LENGTH);
+
+    /* The body ends the suffix, so HEAD only sends less of it (Content-Length stays) */
+    size_t body_length = omit_body ? 0 : canned->body_length;
+    size_t suffix_length = canned->suffix_length[variant] - canned->body_length + body_length;
+
+    output->iov[0].iov_base = canned->prefix;
+    output->iov[0].iov_len = canned->prefix_length;
+    output->iov[1].iov_base = output->date;
+    output->iov[1].iov_len = HTTP_DATE_LINE_LENGTH;
+    output->iov[2].iov_base = canned->suffix[variant];
+    output->iov[2].iov_len = suffix_length;
+    output->iov_count = 3;
+    output->iov_index = 0;
+    output->length = canned->prefix_length + HTTP_DATE_LINE_LENGTH + suffix_length;
+    output->body_length = body_length;
+    output->sent = 0;
+    memset(&output->borrow, 0, sizeof(output->borrow));
+    output->borrow.fd = -1;
 }
@@ -0,0 +1,218 @@
+/*
+ * C-HTTP Payment Server - Delimiter Scanning
+ * Vectorized search for CR/LF/colon/space in request bytes
+ *
+ * Each kernel compares a whole register of input against the two
+ * delimiters, collapses the matches to a bitmask and returns the lowest
+ * set bit. Loads are unaligned and never run past length; the tail that
+ * does not fill a register falls through to the next narrower kernel.
+ */
+
+#include "http_scan.h"
+#include "logger.h"
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HTTP_SCAN_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define HTTP_SCAN_HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+typedef size_t (*scan_find2_fn)(const char *data, size_t length, char a, char b);
+
+/*
+ * Helper function: Portable byte-at-a-time search
+ */
+static size_t find2_scalar(const char *data, size_t length, char a, char b) {
+    for (size_t i = 0; i < length; i++) {
+        if (data[i] == a || data[i] == b) {
+            return i;
+        }
+    }
+    return length;
+}
+
+#if defined(HTTP_SCAN_HAVE_X86) && defined(__SSE2__)
+
+/*
+ * Helper function: SSE2 search, 16 bytes per step
+ */
+static size_t find2_sse2(const char *data, size_t length, char a, char b) {
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+    size_t i = 0;
+
+    for (; i + 16 <= length; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i hits = _mm_or_si128(_mm_cmpeq_epi8(chunk, va), _mm_cmpeq_epi8(chunk, vb));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(hits);
+        if (mask != 0) {
+            return i + (size_t)__builtin_ctz(mask);
+        }
+    }
+
+    return i + find2_scalar(data + i, length - i, a, b);
+}
+
+/*
+ * Helper function: AVX2 search, 32 bytes per step
+ * Compiled for AVX2 regardless of -march; only called after CPU detection
+ */
+__attribute__((target("avx2")))
+static size_t find2_avx2(const char *data, size_t length, char a, char b) {
+    const __m256i va = _mm256_set1_epi8(a);
+    const __m256i vb = _mm256_set1_epi8(b);
+    size_t i = 0;
+
+    for (; i + 32 <= length; i += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(data + i));
+        __m256i hits = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, va), _mm256_cmpeq_epi8(chunk, vb));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(hits);
+        if (mask != 0) {
+            return i + (size_t)__builtin_ctz(mask);
+        }
+    }
+
+    /* 16-byte step stays VEX-encoded here; calling the SSE2 kernel would mix encodings */
+    if (i + 16 <= length) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i hits = _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm256_castsi256_si128(va)),
+                                    _mm_cmpeq_epi8(chunk, _mm256_castsi256_si128(vb)));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(hits);
+        if (mask != 0) {
+            return i + (size_t)__builtin_ctz(mask);
+        }
+        i += 16;
+    }
+
+    return i + find2_scalar(data + i, length - i, a, b);
+}
+
+#endif /* HTTP_SCAN_HAVE_X86 && __SSE2__ */
+
+#ifdef HTTP_SCAN_HAVE_NEON
+
+/*
+ * Helper function: NEON search, 16 bytes per step
+ * Narrowing shift packs the byte mask into 4 bits per lane of a 64-bit word
+ */
+static size_t find2_neon(const char *data, size_t length, char a, char b) {
+    const uint8x16_t va = vdupq_n_u8((uint8_t)a);
+    const uint8x16_t vb = vdupq_n_u8((uint8_t)b);
+    size_t i = 0;
+
+    for (; i + 16 <= length; i += 16) {
+        uint8x16_t chunk = vld1q_u8((const uint8_t *)(data + i));
+        uint8x16_t hits = vorrq_u8(vceqq_u8(chunk, va), vceqq_u8(chunk, vb));
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(
+            vshrn_n_u16(vreinterpretq_u16_u8(hits), 4)), 0);
+        if (mask != 0) {
+            return i + ((size_t)__builtin_ctzll(mask) >> 2);
+        }
+    }
+
+    return i + find2_scalar(data + i, length - i, a, b);
+}
+
+#endif /* HTTP_SCAN_HAVE_NEON */
+
+/* Active kernel; the compile-time baseline until http_scan_init() runs */
+#if defined(HTTP_SCAN_HAVE_X86) && defined(__SSE2__)
+static scan_find2_fn g_find2 = find2_sse2;
+static http_scan_kernel_t g_kernel = HTTP_SCAN_SSE2;
+#elif defined(HTTP_SCAN_HAVE_NEON)
+static scan_find2_fn g_find2 = find2_neon;
+static http_scan_kernel_t g_kernel = HTTP_SCAN_NEON;
+#else
+static scan_find2_fn g_find2 = find2_scalar;
+static http_scan_kernel_t g_kernel = HTTP_SCAN_SCALAR;
+#endif
+
+/*
+ * Force a specific kernel
+ * Returns 0 on success, -1 if unavailable
+ */
+int http_scan_select(http_scan_kernel_t kernel) {
+    scan_find2_fn fn = NULL;
+
+    switch (kernel) {
+        case HTTP_SCAN_SCALAR:
+            fn = find2_scalar;
+            break;
+#if defined(HTTP_SCAN_HAVE_X86) && defined(__SSE2__)
+        case HTTP_SCAN_SSE2:
+            fn = find2_sse2;
+            break;
+        case HTTP_SCAN_AVX2:
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2")) {
+                fn = find2_avx2;
+            }
+            break;
+#endif
+#ifdef HTTP_SCAN_HAVE_NEON
+        case HTTP_SCAN_NEON:
+            fn = find2_neon;
+            break;
+#endif
+        default:
+            break;
+    }
+
+    if (fn == NULL) {
+        return -1;
+    }
+
+    g_find2 = fn;
+    g_kernel = kernel;
+    return 0;
+}
+
+/*
+ * Select the fastest kernel the CPU supports
+ */
+void http_scan_init(void) {
+    static const http_scan_kernel_t preferred[] = {
+        HTTP_SCAN_AVX2, HTTP_SCAN_SSE2, HTTP_SCAN_NEON, HTTP_SCAN_SCALAR
+    };
+
+    for (size_t i = 0; i < sizeof(preferred) / sizeof(preferred[0]); i++) {
+        if (http_scan_select(preferred[i]) == 0) {
+            break;
+        }
+    }
+
+    LOG_INFO(NULL, "Header scanning kernel: %s", http_scan_kernel_name(g_kernel));
+}
+
+/*
+ * Get the kernel currently in use
+ */
+http_scan_kernel_t http_scan_active(void) {
+    return g_kernel;
+}
+
+/*
+ * Convert kernel enum to string
+ */
+const char *http_scan_kernel_name(http_scan_kernel_t kernel) {
+    switch (kernel) {
+        case HTTP_SCAN_SCALAR: return "scalar";
+        case HTTP_SCAN_SSE2:   return "sse2";
+        case HTTP_SCAN_AVX2:   return "avx2";
+        case HTTP_SCAN_NEON:   return "neon";
+        default:               return "unknown";
+    }
+}
+
+/*
+ * Find the first byte equal to a or b
+ * Returns its offset, or length if neither occurs
+ */
+size_t http_scan_find2(const char *data, size_t length, char a, char b) {
+    return g_find2(data, length, a, b);
+}
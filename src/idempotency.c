@@ -0,0 +1,1175 @@
+/*
+ * C-HTTP Payment Server - Idempotency Store
+ * Sharded in-memory cache of responses keyed by X-Idempotency-Key
+ */
+
+#include "idempotency.h"
+#include "logger.h"
+#include "metrics.h"
+#include "wal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* FNV-1a parameters */
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+/* Store image: magic, format version and byte-order marker */
+#define IMAGE_MAGIC "CHTIDIMG"
+#define IMAGE_VERSION 1
+#define IMAGE_BYTE_ORDER 0x01020304u
+
+/* Image write buffer */
+#define IMAGE_BUFFER_SIZE (1024 * 1024)
+
+/*
+ * Store image header
+ * The image is position independent: records are found by their lengths,
+ * so it can be mapped anywhere and walked in place
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t size;          /* Whole image in bytes */
+    uint64_t count;         /* Records that follow */
+    int64_t written_unix;   /* Wall-clock second the TTLs were taken */
+} image_header_t;
+
+/* Image record, followed by the key and body bytes and padding to 8 bytes */
+typedef struct {
+    uint32_t length;        /* Whole record in bytes (multiple of 8) */
+    uint32_t ttl_sec;       /* Seconds left when written */
+    uint64_t digest;        /* Digest of the original request */
+    uint32_t body_length;
+    uint16_t key_length;
+    uint16_t status_code;
+    char content_type[IDEMPOTENCY_MAX_CONTENT_TYPE];
+} image_record_t;
+
+/*
+ * Fill settings with built-in defaults
+ */
+void idempotency_config_init_defaults(idempotency_config_t *config) {
+    if (config == NULL) {
+        return;
+    }
+
+    config->num_shards = IDEMPOTENCY_DEFAULT_SHARDS;
+    config->ttl_sec = IDEMPOTENCY_DEFAULT_TTL_SEC;
+    config->max_bytes = IDEMPOTENCY_DEFAULT_MAX_BYTES;
+    config->wait_ms = IDEMPOTENCY_DEFAULT_WAIT_MS;
+}
+
+/*
+ * Compute a request digest (FNV-1a), chained through seed
+ */
+uint64_t idempotency_digest(uint64_t seed, const void *data, size_t length) {
+    const unsigned char *bytes = (const unsigned char *)data;
+    uint64_t hash = seed ^ FNV_OFFSET_BASIS;
+
+    for (size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+
+    return hash ^ FNV_OFFSET_BASIS;
+}
+
+/*
+ * Helper function: Hash a key
+ * FNV-1a with a final avalanche so both high (shard) and low (bucket) bits mix
+ */
+static uint64_t hash_key(const char *key, size_t length) {
+    uint64_t hash = idempotency_digest(0, key, length);
+
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+/*
+ * Helper function: Current monotonic time in seconds
+ */
+static uint64_t monotonic_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec;
+}
+
+/*
+ * Helper function: Current store tick
+ */
+static uint64_t store_tick(const idempotency_store_t *store) {
+    return monotonic_sec() - store->epoch_sec;
+}
+
+/*
+ * Helper function: Select the shard owning a hash
+ */
+static idempotency_shard_t *shard_for(idempotency_store_t *store, uint64_t hash) {
+    size_t index = store->shard_shift < 64 ? (size_t)(hash >> store->shard_shift) : 0;
+    return &store->shards[index];
+}
+
+/*
+ * Helper function: Find an entry in a shard (shard lock held)
+ */
+static idempotency_entry_t *shard_find(idempotency_shard_t *shard, uint64_t hash,
+                                       const char *key, size_t key_length) {
+    idempotency_entry_t *entry = shard->buckets[hash & (shard->bucket_count - 1)];
+
+    while (entry != NULL) {
+        if (entry->hash == hash && entry->key_length == key_length &&
+            memcmp(entry->key, key, key_length) == 0) {
+            return entry;
+        }
+        entry = entry->hash_next;
+    }
+
+    return NULL;
+}
+
+/*
+ * Helper function: Rehash into new_count buckets, a power of two (shard lock held)
+ * Keeps the old table if allocation fails
+ */
+static void shard_resize(idempotency_shard_t *shard, size_t new_count) {
+    idempotency_entry_t **buckets = (idempotency_entry_t **)calloc(new_count, sizeof(*buckets));
+    if (buckets == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < shard->bucket_count; i++) {
+        idempotency_entry_t *entry = shard->buckets[i];
+        while (entry != NULL) {
+            idempotency_entry_t *next = entry->hash_next;
+            size_t index = entry->hash & (new_count - 1);
+            entry->hash_next = buckets[index];
+            buckets[index] = entry;
+            entry = next;
+        }
+    }
+
+    free(shard->buckets);
+    shard->buckets = buckets;
+    shard->bucket_count = new_count;
+}
+
+/*
+ * Helper function: Double the bucket array (shard lock held)
+ */
+static void shard_grow(idempotency_shard_t *shard) {
+    shard_resize(shard, shard->bucket_count * 2);
+}
+
+/*
+ * Helper function: Unlink an entry from the LRU list
+ */
+static void lru_remove(idempotency_shard_t *shard, idempotency_entry_t *entry) {
+    if (entry->lru_prev != NULL) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    } else if (shard->lru_head == entry) {
+        shard->lru_head = entry->lru_next;
+    }
+    if (entry->lru_next != NULL) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else if (shard->lru_tail == entry) {
+        shard->lru_tail = entry->lru_prev;
+    }
+    entry->lru_prev = NULL;
+    entry->lru_next = NULL;
+}
+
+/*
+ * Helper function: Insert an entry at the most-recently-used end
+ */
+static void lru_push_front(idempotency_shard_t *shard, idempotency_entry_t *entry) {
+    entry->lru_prev = NULL;
+    entry->lru_next = shard->lru_head;
+    if (shard->lru_head != NULL) {
+        shard->lru_head->lru_prev = entry;
+    }
+    shard->lru_head = entry;
+    if (shard->lru_tail == NULL) {
+        shard->lru_tail = entry;
+    }
+}
+
+/*
+ * Helper function: Unlink an entry from its timer wheel slot
+ */
+static void wheel_remove(idempotency_shard_t *shard, idempotency_entry_t *entry) {
+    if (entry->wheel_prev != NULL) {
+        entry->wheel_prev->wheel_next = entry->wheel_next;
+    } else {
+        idempotency_entry_t **slot = &shard->wheel[entry->expire_tick % IDEMPOTENCY_WHEEL_SLOTS];
+        if (*slot == entry) {
+            *slot = entry->wheel_next;
+        }
+    }
+    if (entry->wheel_next != NULL) {
+        entry->wheel_next->wheel_prev = entry->wheel_prev;
+    }
+    entry->wheel_prev = NULL;
+    entry->wheel_next = NULL;
+}
+
+/*
+ * Helper function: Schedule an entry in the slot for its expiry tick
+ */
+static void wheel_insert(idempotency_shard_t *shard, idempotency_entry_t *entry) {
+    idempotency_entry_t **slot = &shard->wheel[entry->expire_tick % IDEMPOTENCY_WHEEL_SLOTS];
+
+    entry->wheel_prev = NULL;
+    entry->wheel_next = *slot;
+    if (*slot != NULL) {
+        (*slot)->wheel_prev = entry;
+    }
+    *slot = entry;
+}
+
+/*
+ * Release a reference returned by idempotency_begin()
+ */
+void idempotency_response_release(idempotency_response_t *response) {
+    if (response == NULL) {
+        return;
+    }
+
+    if (__atomic_sub_fetch(&response->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(response);
+    }
+}
+
+/*
+ * Helper function: Remove an entry from every shard structure and free it
+ * (shard lock held)
+ */
+static void shard_remove(idempotency_shard_t *shard, idempotency_entry_t *entry) {
+    idempotency_entry_t **link = &shard->buckets[entry->hash & (shard->bucket_count - 1)];
+
+    while (*link != NULL && *link != entry) {
+        link = &(*link)->hash_next;
+    }
+    if (*link == entry) {
+        *link = entry->hash_next;
+    }
+
+    if (entry->state == IDEMPOTENCY_ENTRY_COMPLETE) {
+        lru_remove(shard, entry);
+        wheel_remove(shard, entry);
+    }
+
+    shard->bytes_used -= entry->charge;
+    shard->entry_count--;
+
+    idempotency_response_release(entry->response);
+    free(entry->key);
+    free(entry);
+}
+
+/*
+ * Initialize store
+ * Returns 0 on success, -1 on error
+ */
+int idempotency_store_init(idempotency_store_t *store, const idempotency_config_t *config) {
+    if (store == NULL || config == NULL || config->num_shards <= 0 || config->ttl_sec <= 0) {
+        LOG_ERROR(NULL, "idempotency_store_init: invalid parameters");
+        return -1;
+    }
+
+    memset(store, 0, sizeof(*store));
+
+    /* Round shard count up to a power of two; the top hash bits select a shard */
+    int num_shards = 1;
+    int shard_bits = 0;
+    while (num_shards < config->num_shards) {
+        num_shards <<= 1;
+        shard_bits++;
+    }
+
+    store->shards = (idempotency_shard_t *)calloc((size_t)num_shards, sizeof(idempotency_shard_t));
+    if (store->shards == NULL) {
+        LOG_ERROR(NULL, "Failed to allocate idempotency shards: %s", strerror(errno));
+        return -1;
+    }
+
+    store->num_shards = num_shards;
+    store->shard_shift = 64 - shard_bits;
+    store->ttl_sec = config->ttl_sec;
+    store->wait_ms = config->wait_ms;
+    store->epoch_sec = monotonic_sec();
+
+    size_t shard_limit = config->max_bytes / (size_t)num_shards;
+
+    for (int i = 0; i < num_shards; i++) {
+        idempotency_shard_t *shard = &store->shards[i];
+
+        shard->buckets = (idempotency_entry_t **)calloc(IDEMPOTENCY_INITIAL_BUCKETS,
+                                                        sizeof(idempotency_entry_t *));
+        if (shard->buckets == NULL) {
+            LOG_ERROR(NULL, "Failed to allocate idempotency buckets: %s", strerror(errno));
+            store->num_shards = i;
+            idempotency_store_destroy(store);
+            return -1;
+        }
+
+        shard->bucket_count = IDEMPOTENCY_INITIAL_BUCKETS;
+        shard->bytes_limit = shard_limit;
+        pthread_mutex_init(&shard->mutex, NULL);
+        pthread_cond_init(&shard->completed, NULL);
+    }
+
+    pthread_mutex_init(&store->reaper_lock, NULL);
+    pthread_cond_init(&store->reaper_cond, NULL);
+
+    LOG_INFO(NULL, "Idempotency store initialized (shards=%d, ttl=%ds, max=%zu bytes)",
+             num_shards, store->ttl_sec, config->max_bytes);
+    return 0;
+}
+
+/*
+ * Helper function: Expire every entry due up to the current tick in one shard
+ */
+static void shard_reap(idempotency_shard_t *shard, uint64_t now) {
+    pthread_mutex_lock(&shard->mutex);
+
+    /* A full turn of the wheel visits every slot; no need to go further */
+    uint64_t first = shard->reaped_tick + 1;
+    if (now >= IDEMPOTENCY_WHEEL_SLOTS && first + IDEMPOTENCY_WHEEL_SLOTS <= now) {
+        first = now - IDEMPOTENCY_WHEEL_SLOTS + 1;
+    }
+
+    for (uint64_t tick = first; tick <= now; tick++) {
+        idempotency_entry_t *entry = shard->wheel[tick % IDEMPOTENCY_WHEEL_SLOTS];
+        while (entry != NULL) {
+            idempotency_entry_t *next = entry->wheel_next;
+            /* Entries more than one turn out stay for a later pass */
+            if (entry->expire_tick <= now) {
+                shard_remove(shard, entry);
+            }
+            entry = next;
+        }
+    }
+
+    shard->reaped_tick = now;
+    pthread_mutex_unlock(&shard->mutex);
+}
+
+/*
+ * Helper function: Expiry thread
+ * Advances the timer wheels once per second, locking one shard at a time
+ */
+static void *reaper_thread(void *arg) {
+    idempotency_store_t *store = (idempotency_store_t *)arg;
+
+    pthread_mutex_lock(&store->reaper_lock);
+    while (!store->shutdown) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += 1;
+        pthread_cond_timedwait(&store->reaper_cond, &store->reaper_lock, &deadline);
+        if (store->shutdown) {
+            break;
+        }
+        pthread_mutex_unlock(&store->reaper_lock);
+
+        uint64_t now = store_tick(store);
+        for (int i = 0; i < store->num_shards; i++) {
+            shard_reap(&store->shards[i], now);
+        }
+
+        pthread_mutex_lock(&store->reaper_lock);
+    }
+    pthread_mutex_unlock(&store->reaper_lock);
+
+    return NULL;
+}
+
+/*
+ * Start the background thread that expires entries
+ * Returns 0 on success, -1 on error
+ */
+int idempotency_store_start(idempotency_store_t *store) {
+    if (store == NULL || store->shards == NULL) {
+        LOG_ERROR(NULL, "idempotency_store_start: invalid store");
+        return -1;
+    }
+
+    int rc = pthread_create(&store->reaper, NULL, reaper_thread, store);
+    if (rc != 0) {
+        LOG_ERROR(NULL, "Failed to create idempotency reaper thread: %s", strerror(rc));
+        return -1;
+    }
+
+    store->reaper_started = true;
+    return 0;
+}
+
+/*
+ * Stop the expiry thread and free all entries
+ */
+void idempotency_store_destroy(idempotency_store_t *store) {
+    if (store == NULL) {
+        return;
+    }
+
+    if (store->reaper_started) {
+        pthread_mutex_lock(&store->reaper_lock);
+        store->shutdown = true;
+        pthread_cond_signal(&store->reaper_cond);
+        pthread_mutex_unlock(&store->reaper_lock);
+        pthread_join(store->reaper, NULL);
+        store->reaper_started = false;
+    }
+
+    if (store->shards != NULL) {
+        for (int i = 0; i < store->num_shards; i++) {
+            idempotency_shard_t *shard = &store->shards[i];
+
+            for (size_t b = 0; b < shard->bucket_count; b++) {
+                while (shard->buckets[b] != NULL) {
+                    shard_remove(shard, shard->buckets[b]);
+                }
+            }
+
+            free(shard->buckets);
+            pthread_mutex_destroy(&shard->mutex);
+            pthread_cond_destroy(&shard->completed);
+        }
+
+        free(store->shards);
+        store->shards = NULL;
+
+        pthread_mutex_destroy(&store->reaper_lock);
+        pthread_cond_destroy(&store->reaper_cond);
+    }
+
+    store->num_shards = 0;
+}
+
+/*
+ * Helper function: Reserve a new in-flight entry (shard lock held)
+ * Returns the entry, NULL if out of memory
+ */
+static idempotency_entry_t *shard_reserve(idempotency_shard_t *shard, uint64_t hash,
+                                          const char *key, size_t key_length, uint64_t digest) {
+    idempotency_entry_t *entry = (idempotency_entry_t *)calloc(1, sizeof(*entry));
+    if (entry == NULL) {
+        return NULL;
+    }
+
+    entry->key = (char *)malloc(key_length + 1);
+    if (entry->key == NULL) {
+        free(entry);
+        return NULL;
+    }
+
+    memcpy(entry->key, key, key_length);
+    entry->key[key_length] = '\0';
+    entry->key_length = key_length;
+    entry->hash = hash;
+    entry->digest = digest;
+    entry->state = IDEMPOTENCY_ENTRY_IN_FLIGHT;
+
+    if (shard->entry_count >= shard->bucket_count) {
+        shard_grow(shard);
+    }
+
+    size_t index = hash & (shard->bucket_count - 1);
+    entry->hash_next = shard->buckets[index];
+    shard->buckets[index] = entry;
+    shard->entry_count++;
+
+    return entry;
+}
+
+/*
+ * Helper function: Look up a key and reserve it if unseen
+ * wait_ms: how long a duplicate waits for its in-flight original (0 = not at all)
+ */
+static idempotency_result_t begin_key(idempotency_store_t *store, const char *key,
+                                      size_t key_length, uint64_t digest,
+                                      idempotency_response_t **cached, int wait_ms) {
+    if (store == NULL || key == NULL || cached == NULL) {
+        return IDEMPOTENCY_ERROR;
+    }
+
+    *cached = NULL;
+
+    uint64_t hash = hash_key(key, key_length);
+    idempotency_shard_t *shard = shard_for(store, hash);
+    idempotency_result_t result;
+
+    struct timespec deadline;
+    if (wait_ms > 0) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += wait_ms / 1000;
+        deadline.tv_nsec += (long)(wait_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    pthread_mutex_lock(&shard->mutex);
+
+    for (;;) {
+        idempotency_entry_t *entry = shard_find(shard, hash, key, key_length);
+
+        /* Expired but not yet reaped: treat as unseen */
+        if (entry != NULL && entry->state == IDEMPOTENCY_ENTRY_COMPLETE &&
+            entry->expire_tick <= store_tick(store)) {
+            shard_remove(shard, entry);
+            entry = NULL;
+        }
+
+        if (entry == NULL) {
+            result = shard_reserve(shard, hash, key, key_length, digest) != NULL
+                         ? IDEMPOTENCY_PROCEED : IDEMPOTENCY_ERROR;
+            break;
+        }
+
+        if (entry->digest != digest) {
+            result = IDEMPOTENCY_MISMATCH;
+            break;
+        }
+
+        if (entry->state == IDEMPOTENCY_ENTRY_COMPLETE) {
+            __atomic_add_fetch(&entry->response->refcount, 1, __ATOMIC_RELAXED);
+            *cached = entry->response;
+            lru_remove(shard, entry);
+            lru_push_front(shard, entry);
+            result = IDEMPOTENCY_REPLAY;
+            break;
+        }
+
+        /* Original still running: wait for it to resolve, or report the conflict */
+        if (wait_ms <= 0 ||
+            pthread_cond_timedwait(&shard->completed, &shard->mutex, &deadline) == ETIMEDOUT) {
+            result = IDEMPOTENCY_IN_FLIGHT;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&shard->mutex);
+    return result;
+}
+
+/*
+ * Look up a key and reserve it if unseen
+ */
+idempotency_result_t idempotency_begin(idempotency_store_t *store, const char *key,
+                                       size_t key_length, uint64_t digest,
+                                       idempotency_response_t **cached) {
+    return begin_key(store, key, key_length, digest, cached, store != NULL ? store->wait_ms : 0);
+}
+
+/*
+ * Look up a key and reserve it if unseen, without waiting for an original
+ */
+idempotency_result_t idempotency_try_begin(idempotency_store_t *store, const char *key,
+                                           size_t key_length, uint64_t digest,
+                                           idempotency_response_t **cached) {
+    return begin_key(store, key, key_length, digest, cached, 0);
+}
+
+/*
+ * Look up a key without reserving it
+ * Returns 1 if cached (*cached referenced), 0 if in flight, -1 if unknown
+ */
+int idempotency_peek(idempotency_store_t *store, const char *key, size_t key_length,
+                     idempotency_response_t **cached) {
+    if (store == NULL || key == NULL || cached == NULL) {
+        return -1;
+    }
+
+    *cached = NULL;
+
+    uint64_t hash = hash_key(key, key_length);
+    idempotency_shard_t *shard = shard_for(store, hash);
+    int result = -1;
+
+    pthread_mutex_lock(&shard->mutex);
+
+    /* Expired entries are left for the reaper; a lookup does not refresh LRU order */
+    idempotency_entry_t *entry = shard_find(shard, hash, key, key_length);
+    if (entry != NULL && entry->state == IDEMPOTENCY_ENTRY_IN_FLIGHT) {
+        result = 0;
+    } else if (entry != NULL && entry->expire_tick > store_tick(store)) {
+        __atomic_add_fetch(&entry->response->refcount, 1, __ATOMIC_RELAXED);
+        *cached = entry->response;
+        result = 1;
+    }
+
+    pthread_mutex_unlock(&shard->mutex);
+    return result;
+}
+
+/*
+ * Build an immutable response (refcount 1)
+ * Returns the response, NULL if out of memory
+ */
+idempotency_response_t *idempotency_response_create(int status_code, const char *content_type,
+                                                    const char *body, size_t body_length) {
+    idempotency_response_t *response =
+        (idempotency_response_t *)malloc(sizeof(*response) + body_length + 1);
+    if (response == NULL) {
+        return NULL;
+    }
+
+    response->refcount = 1;
+    response->status_code = status_code;
+    response->content_type[0] = '\0';
+    if (content_type != NULL) {
+        strncpy(response->content_type, content_type, sizeof(response->content_type) - 1);
+        response->content_type[sizeof(response->content_type) - 1] = '\0';
+    }
+    if (body_length > 0) {
+        memcpy(response->body, body, body_length);
+    }
+    response->body[body_length] = '\0';
+    response->body_length = body_length;
+    return response;
+}
+
+/*
+ * Helper function: Bytes an entry with this key and body charges its shard
+ */
+static size_t entry_charge(size_t key_length, size_t body_length) {
+    return sizeof(idempotency_entry_t) + key_length + 1 +
+           sizeof(idempotency_response_t) + body_length + 1;
+}
+
+/*
+ * Helper function: Make an in-flight entry replayable for ttl_sec (shard lock held)
+ * Takes over the caller's response reference
+ */
+static void shard_install(idempotency_store_t *store, idempotency_shard_t *shard,
+                          idempotency_entry_t *entry, idempotency_response_t *response,
+                          size_t charge, int ttl_sec) {
+    /* Evict least recently used responses until the new one fits */
+    while (shard->bytes_used + charge > shard->bytes_limit && shard->lru_tail != NULL) {
+        LOG_DEBUG(NULL, "Evicting idempotency key %s", shard->lru_tail->key);
+        shard_remove(shard, shard->lru_tail);
+    }
+
+    entry->state = IDEMPOTENCY_ENTRY_COMPLETE;
+    entry->response = response;
+    entry->charge = charge;
+    entry->expire_tick = store_tick(store) + (uint64_t)ttl_sec;
+    shard->bytes_used += charge;
+    lru_push_front(shard, entry);
+    wheel_insert(shard, entry);
+}
+
+/*
+ * Helper function: Install a recovered response, replacing any entry for
+ * its key (shard lock held); takes over the response reference on success
+ * Returns 0 on success, -1 if out of memory
+ */
+static int shard_restore(idempotency_store_t *store, idempotency_shard_t *shard, uint64_t hash,
+                         const char *key, size_t key_length, uint64_t digest,
+                         idempotency_response_t *response, size_t charge, int ttl_sec) {
+    /* A later record for the key supersedes the earlier one */
+    idempotency_entry_t *entry = shard_find(shard, hash, key, key_length);
+    if (entry != NULL) {
+        shard_remove(shard, entry);
+    }
+
+    entry = shard_reserve(shard, hash, key, key_length, digest);
+    if (entry == NULL) {
+        return -1;
+    }
+
+    shard_install(store, shard, entry, response, charge, ttl_sec);
+    return 0;
+}
+
+/*
+ * Helper function: Log a response and wait until it is durable
+ * *ticketed is set if a ticket was taken (release it with wal_applied())
+ * Returns 0 if durable or there was nothing to log, -1 if the log failed
+ */
+static int store_log(idempotency_store_t *store, idempotency_shard_t *shard, uint64_t hash,
+                     const char *key, size_t key_length, const idempotency_response_t *response,
+                     wal_ticket_t *ticket, bool *ticketed) {
+    /* The digest was recorded at reservation; only this request resolves the entry */
+    pthread_mutex_lock(&shard->mutex);
+    idempotency_entry_t *entry = shard_find(shard, hash, key, key_length);
+    bool reserved = entry != NULL && entry->state == IDEMPOTENCY_ENTRY_IN_FLIGHT;
+    uint64_t digest = reserved ? entry->digest : 0;
+    pthread_mutex_unlock(&shard->mutex);
+
+    if (!reserved) {
+        return 0;
+    }
+
+    uint64_t start = metrics_now_ns();
+    if (wal_append(store->wal, key, key_length, digest, response->status_code,
+                   response->content_type, response->body, response->body_length,
+                   (int64_t)time(NULL) + store->ttl_sec, ticket) != 0) {
+        LOG_ERROR(NULL, "Idempotency key %.*s not logged, dropping it", (int)key_length, key);
+        return -1;
+    }
+    *ticketed = true;
+
+    if (wal_wait(store->wal, ticket) != 0) {
+        LOG_ERROR(NULL, "Idempotency key %.*s not durable, dropping it", (int)key_length, key);
+        return -1;
+    }
+    metrics_observe(METRIC_WAL_COMMIT, metrics_now_ns() - start);
+    return 0;
+}
+
+/*
+ * Store the response for a key reserved by idempotency_begin()
+ * Returns 0 on success, -1 if the response could not be cached
+ */
+int idempotency_complete(idempotency_store_t *store, const char *key, size_t key_length,
+                         int status_code, const char *content_type,
+                         const char *body, size_t body_length) {
+    if (store == NULL || key == NULL || (body == NULL && body_length > 0)) {
+        return -1;
+    }
+
+    uint64_t hash = hash_key(key, key_length);
+    idempotency_shard_t *shard = shard_for(store, hash);
+
+    /* Build the immutable response outside the shard lock */
+    idempotency_response_t *response =
+        idempotency_response_create(status_code, content_type, body, body_length);
+    size_t charge = entry_charge(key_length, body_length);
+    int result = -1;
+
+    /* Durable before replayable: a duplicate must never see a response a crash could lose */
+    wal_ticket_t ticket;
+    bool ticketed = false;
+    int logged = 0;
+    if (store->wal != NULL && response != NULL && charge <= shard->bytes_limit) {
+        logged = store_log(store, shard, hash, key, key_length, response, &ticket, &ticketed);
+    }
+
+    pthread_mutex_lock(&shard->mutex);
+
+    idempotency_entry_t *entry = shard_find(shard, hash, key, key_length);
+    if (entry == NULL || entry->state != IDEMPOTENCY_ENTRY_IN_FLIGHT) {
+        LOG_WARN(NULL, "Idempotency key %.*s completed without a reservation",
+                 (int)key_length, key);
+    } else if (logged != 0) {
+        /* A crash could forget it: processing it again beats replaying a lost answer */
+        shard_remove(shard, entry);
+        result = IDEMPOTENCY_NOT_DURABLE;
+    } else if (response == NULL || charge > shard->bytes_limit) {
+        LOG_WARN(NULL, "Idempotency key %.*s not cached (%zu bytes)",
+                 (int)key_length, key, charge);
+        shard_remove(shard, entry);
+    } else {
+        shard_install(store, shard, entry, response, charge, store->ttl_sec);
+        response = NULL;
+        result = 0;
+    }
+
+    pthread_cond_broadcast(&shard->completed);
+    pthread_mutex_unlock(&shard->mutex);
+
+    if (ticketed) {
+        wal_applied(store->wal, &ticket);
+    }
+    idempotency_response_release(response);
+    return result;
+}
+
+/*
+ * Install a completed response recovered from the log
+ * Returns 0 on success, -1 if it could not be cached
+ */
+int idempotency_restore(idempotency_store_t *store, const char *key, size_t key_length,
+                        uint64_t digest, int status_code, const char *content_type,
+                        const char *body, size_t body_length, int ttl_sec) {
+    if (store == NULL || key == NULL || (body == NULL && body_length > 0) || ttl_sec <= 0) {
+        return -1;
+    }
+
+    uint64_t hash = hash_key(key, key_length);
+    idempotency_shard_t *shard = shard_for(store, hash);
+    size_t charge = entry_charge(key_length, body_length);
+    if (charge > shard->bytes_limit) {
+        return -1;
+    }
+
+    idempotency_response_t *response =
+        idempotency_response_create(status_code, content_type, body, body_length);
+    if (response == NULL) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&shard->mutex);
+    int result = shard_restore(store, shard, hash, key, key_length, digest, response,
+                               charge, ttl_sec);
+    pthread_mutex_unlock(&shard->mutex);
+
+    if (result != 0) {
+        idempotency_response_release(response);
+    }
+    return result;
+}
+
+/*
+ * Log every completed response to wal before it becomes replayable
+ */
+void idempotency_store_set_wal(idempotency_store_t *store, struct wal *wal) {
+    if (store != NULL) {
+        store->wal = wal;
+    }
+}
+
+/*
+ * Route keys owned by other nodes through cluster
+ */
+void idempotency_store_set_cluster(idempotency_store_t *store, struct cluster *cluster) {
+    if (store != NULL) {
+        store->cluster = cluster;
+    }
+}
+
+/*
+ * Visit every replayable response, one shard locked at a time
+ * Least recently used first, so re-inserting in visit order keeps recency
+ * Returns 0 once every entry was visited, otherwise what fn returned
+ */
+int idempotency_store_visit(idempotency_store_t *store, idempotency_visit_fn fn, void *arg) {
+    if (store == NULL || fn == NULL) {
+        return -1;
+    }
+
+    for (int i = 0; i < store->num_shards; i++) {
+        idempotency_shard_t *shard = &store->shards[i];
+        int result = 0;
+
+        pthread_mutex_lock(&shard->mutex);
+        uint64_t now = store_tick(store);
+        for (idempotency_entry_t *entry = shard->lru_tail; entry != NULL && result == 0;
+             entry = entry->lru_prev) {
+            if (entry->expire_tick > now) {
+                result = fn(arg, entry, (int)(entry->expire_tick - now));
+            }
+        }
+        pthread_mutex_unlock(&shard->mutex);
+
+        if (result != 0) {
+            return result;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Helper function: Write a whole buffer, retrying short writes
+ * Returns 0 on success, -1 on error
+ */
+static int write_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += written;
+        length -= (size_t)written;
+    }
+    return 0;
+}
+
+/* Image being written (state for image_visit) */
+typedef struct {
+    int fd;
+    char *buffer;           /* IMAGE_BUFFER_SIZE bytes */
+    size_t length;
+    uint64_t size;          /* Bytes written so far, header included */
+    uint64_t count;
+} image_writer_t;
+
+/*
+ * Helper function: Append bytes to the image, flushing the buffer when full
+ * Returns 0 on success, -1 on write error
+ */
+static int image_put(image_writer_t *writer, const void *data, size_t length) {
+    const char *bytes = (const char *)data;
+    while (length > 0) {
+        size_t space = IMAGE_BUFFER_SIZE - writer->length;
+        if (space == 0) {
+            if (write_all(writer->fd, writer->buffer, writer->length) != 0) {
+                return -1;
+            }
+            writer->length = 0;
+            space = IMAGE_BUFFER_SIZE;
+        }
+        size_t chunk = length < space ? length : space;
+        memcpy(writer->buffer + writer->length, bytes, chunk);
+        writer->length += chunk;
+        writer->size += chunk;
+        bytes += chunk;
+        length -= chunk;
+    }
+    return 0;
+}
+
+/*
+ * Helper function: Append one store entry to the image (shard lock held)
+ * Returns 0 to continue, -1 on write error
+ */
+static int image_visit(void *arg, const idempotency_entry_t *entry, int ttl_sec) {
+    image_writer_t *writer = (image_writer_t *)arg;
+    const idempotency_response_t *response = entry->response;
+    if (entry->key_length > UINT16_MAX || response->body_length > UINT32_MAX) {
+        return 0;
+    }
+
+    size_t payload = sizeof(image_record_t) + entry->key_length + response->body_length;
+    size_t padded = (payload + 7) & ~(size_t)7;
+    if (padded > UINT32_MAX) {
+        return 0;
+    }
+
+    image_record_t record;
+    memset(&record, 0, sizeof(record));
+    record.length = (uint32_t)padded;
+    record.ttl_sec = (uint32_t)ttl_sec;
+    record.digest = entry->digest;
+    record.body_length = (uint32_t)response->body_length;
+    record.key_length = (uint16_t)entry->key_length;
+    record.status_code = (uint16_t)response->status_code;
+    memcpy(record.content_type, response->content_type, sizeof(record.content_type));
+
+    static const char padding[8] = { 0 };
+    if (image_put(writer, &record, sizeof(record)) != 0 ||
+        image_put(writer, entry->key, entry->key_length) != 0 ||
+        image_put(writer, response->body, response->body_length) != 0 ||
+        image_put(writer, padding, padded - payload) != 0) {
+        return -1;
+    }
+    writer->count++;
+    return 0;
+}
+
+/*
+ * Write every replayable response to fd as a store image
+ * Returns the number of responses written, -1 on error
+ */
+long idempotency_store_export(idempotency_store_t *store, int fd) {
+    if (store == NULL || fd < 0) {
+        return -1;
+    }
+
+    image_writer_t writer = { .fd = fd };
+    writer.buffer = (char *)malloc(IMAGE_BUFFER_SIZE);
+    if (writer.buffer == NULL) {
+        return -1;
+    }
+
+    /* The header is rewritten with the totals once the records are out */
+    image_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+    header.version = IMAGE_VERSION;
+    header.byte_order = IMAGE_BYTE_ORDER;
+    header.written_unix = (int64_t)time(NULL);
+
+    int result = image_put(&writer, &header, sizeof(header));
+    if (result == 0) {
+        result = idempotency_store_visit(store, image_visit, &writer);
+    }
+    if (result == 0) {
+        result = write_all(fd, writer.buffer, writer.length);
+    }
+    free(writer.buffer);
+
+    header.size = writer.size;
+    header.count = writer.count;
+    if (result != 0 || pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+        LOG_ERROR(NULL, "Failed to write idempotency store image: %s", strerror(errno));
+        return -1;
+    }
+
+    return (long)writer.count;
+}
+
+/*
+ * Helper function: Check that a mapped image is one export wrote
+ * Returns the header, NULL if the image is invalid
+ */
+static const image_header_t *image_validate(const char *image, size_t size) {
+    const image_header_t *header = (const image_header_t *)image;
+    if (size < sizeof(*header) || memcmp(header->magic, IMAGE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != IMAGE_VERSION || header->byte_order != IMAGE_BYTE_ORDER ||
+        header->size != size) {
+        return NULL;
+    }
+
+    /* Walk the lengths once so the import never reads past the mapping */
+    size_t offset = sizeof(*header);
+    for (uint64_t i = 0; i < header->count; i++) {
+        if (size - offset < sizeof(image_record_t)) {
+            return NULL;
+        }
+        const image_record_t *record = (const image_record_t *)(image + offset);
+        size_t payload = sizeof(*record) + record->key_length + record->body_length;
+        if (record->length < payload || record->length % 8 != 0 ||
+            record->length > size - offset) {
+            return NULL;
+        }
+        offset += record->length;
+    }
+
+    return offset == size ? header : NULL;
+}
+
+/*
+ * Load a store image from fd (mapped, not read)
+ * Returns the number of responses restored, -1 if fd holds no valid image
+ */
+long idempotency_store_import(idempotency_store_t *store, int fd) {
+    struct stat st;
+    if (store == NULL || fd < 0 || fstat(fd, &st) != 0 || st.st_size <= 0) {
+        return -1;
+    }
+
+    size_t size = (size_t)st.st_size;
+    int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+    flags |= MAP_POPULATE;
+#endif
+    char *image = (char *)mmap(NULL, size, PROT_READ, flags, fd, 0);
+    if (image == MAP_FAILED) {
+        LOG_ERROR(NULL, "Cannot map idempotency store image: %s", strerror(errno));
+        return -1;
+    }
+
+    const image_header_t *header = image_validate(image, size);
+    if (header == NULL) {
+        LOG_ERROR(NULL, "Invalid idempotency store image (%zu bytes)", size);
+        munmap(image, size);
+        return -1;
+    }
+
+    int64_t elapsed = (int64_t)time(NULL) - header->written_unix;
+    if (elapsed < 0) {
+        elapsed = 0;
+    }
+
+    /* Size every hash table once up front instead of doubling as entries arrive */
+    size_t *counts = (size_t *)calloc((size_t)store->num_shards, sizeof(size_t));
+    if (counts != NULL) {
+        size_t offset = sizeof(*header);
+        for (uint64_t i = 0; i < header->count; i++) {
+            const image_record_t *record = (const image_record_t *)(image + offset);
+            const char *key = image + offset + sizeof(*record);
+            counts[shard_for(store, hash_key(key, record->key_length)) - store->shards]++;
+            offset += record->length;
+        }
+        for (int i = 0; i < store->num_shards; i++) {
+            idempotency_shard_t *shard = &store->shards[i];
+            pthread_mutex_lock(&shard->mutex);
+            size_t needed = shard->entry_count + counts[i];
+            size_t buckets = shard->bucket_count;
+            while (buckets < needed) {
+                buckets *= 2;
+            }
+            if (buckets != shard->bucket_count) {
+                shard_resize(shard, buckets);
+            }
+            pthread_mutex_unlock(&shard->mutex);
+        }
+        free(counts);
+    }
+
+    /* Records are grouped by shard: each lock is taken once per run */
+    long restored = 0;
+    idempotency_shard_t *locked = NULL;
+    size_t offset = sizeof(*header);
+    for (uint64_t i = 0; i < header->count; i++) {
+        const image_record_t *record = (const image_record_t *)(image + offset);
+        const char *key = image + offset + sizeof(*record);
+        const char *body = key + record->key_length;
+        offset += record->length;
+
+        if ((int64_t)record->ttl_sec <= elapsed) {
+            continue;
+        }
+        int ttl = (int)((int64_t)record->ttl_sec - elapsed);
+        if (ttl > store->ttl_sec) {
+            ttl = store->ttl_sec;
+        }
+
+        uint64_t hash = hash_key(key, record->key_length);
+        idempotency_shard_t *shard = shard_for(store, hash);
+        size_t charge = entry_charge(record->key_length, record->body_length);
+        if (charge > shard->bytes_limit) {
+            continue;
+        }
+
+        char content_type[IDEMPOTENCY_MAX_CONTENT_TYPE];
+        memcpy(content_type, record->content_type, sizeof(content_type));
+        content_type[sizeof(content_type) - 1] = '\0';
+        idempotency_response_t *response =
+            idempotency_response_create(record->status_code, content_type, body,
+                                        record->body_length);
+        if (response == NULL) {
+            break;
+        }
+
+        if (shard != locked) {
+            if (locked != NULL) {
+                pthread_mutex_unlock(&locked->mutex);
+            }
+            pthread_mutex_lock(&shard->mutex);
+            locked = shard;
+        }
+
+        if (shard_restore(store, shard, hash, key, record->key_length, record->digest,
+                          response, charge, ttl) == 0) {
+            restored++;
+        } else {
+            idempotency_response_release(response);
+        }
+    }
+    if (locked != NULL) {
+        pthread_mutex_unlock(&locked->mutex);
+    }
+
+    munmap(image, size);
+    return restored;
+}
+
+/*
+ * Drop the reservation for a key whose request failed
+ */
+void idempotency_abort(idempotency_store_t *store, const char *key, size_t key_length) {
+    if (store == NULL || key == NULL) {
+        return;
+    }
+
+    uint64_t hash = hash_key(key, key_length);
+    idempotency_shard_t *shard = shard_for(store, hash);
+
+    pthread_mutex_lock(&shard->mutex);
+
+    idempotency_entry_t *entry = shard_find(shard, hash, key, key_length);
+    if (entry != NULL && entry->state == IDEMPOTENCY_ENTRY_IN_FLIGHT) {
+        shard_remove(shard, entry);
+    }
+
+    pthread_cond_broadcast(&shard->completed);
+    pthread_mutex_unlock(&shard->mutex);
+}
@@ -5,6 +5,8 @@
 
 #include "listener.h"
 #include "logger.h"
+#include "metrics.h"
+#include "uring.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -13,9 +15,23 @@
 #include <fcntl.h>
 #include <sys/socket.h>
 #include <sys/select.h>
+#include <poll.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
+#ifdef __linux__
+#include <linux/filter.h>
+#endif
+
+/* Tags of the listener's io_uring requests */
+#define LISTENER_RING_ACCEPT 1
+#define LISTENER_RING_SHUTDOWN 2
+#define LISTENER_RING_CANCEL 3
+
+/* One accepting thread: a small ring is plenty */
+#define LISTENER_RING_ENTRIES 8
+#define LISTENER_RING_CQ_ENTRIES 256
+
 /*
  * Initialize listener with configuration
  * Returns 0 on success, -1 on error
@@ -32,6 +48,15 @@ int listener_init(listener_t *listener, uint16_t port, int backlog) {
     listener->socket_fd = -1;
     listener->shutdown_pipe[0] = -1;
     listener->shutdown_pipe[1] = -1;
+    listener->reuseport = false;
+    listener->num_sockets = 1;
+    listener->socket_fds = NULL;
+    listener->steer = LISTENER_STEER_NONE;
+    listener->draining = false;
+    listener->drain_timeout_ms = 0;
+    listener->ring = NULL;
+    listener->ring_stopping = false;
+    listener->ring_accepting = false;
 
     /* Create shutdown pipe (self-pipe trick) */
     if (pipe(listener->shutdown_pipe) < 0) {
@@ -49,34 +74,60 @@ int listener_init(listener_t *listener, uint16_t port, int backlog) {
 }
 
 /*
- * Start listening on the configured port
+ * Bind num_sockets SO_REUSEPORT sockets instead of one
  * Returns 0 on success, -1 on error
  */
-int listener_start(listener_t *listener) {
-    if (listener == NULL) {
-        LOG_ERROR(NULL, "listener_start: listener is NULL");
+int listener_set_reuseport(listener_t *listener, int num_sockets, listener_steer_t steer) {
+    if (listener == NULL || num_sockets < 1 || listener->socket_fds != NULL) {
+        LOG_ERROR(NULL, "listener_set_reuseport: invalid parameters");
         return -1;
     }
 
+#ifndef SO_REUSEPORT
+    LOG_ERROR(NULL, "SO_REUSEPORT is not supported on this platform");
+    return -1;
+#else
+    listener->reuseport = true;
+    listener->num_sockets = num_sockets;
+    listener->steer = steer;
+    return 0;
+#endif
+}
+
+/*
+ * Helper function: Create, bind and listen on one socket
+ * Returns socket fd on success, -1 on error
+ */
+static int open_socket(listener_t *listener) {
     /* Step 1: Create socket */
     LOG_DEBUG(NULL, "Creating TCP socket...");
-    listener->socket_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (listener->socket_fd < 0) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
         LOG_ERROR(NULL, "Failed to create socket: %s", strerror(errno));
         return -1;
     }
-    LOG_DEBUG(NULL, "Socket created: fd=%d", listener->socket_fd);
+    LOG_DEBUG(NULL, "Socket created: fd=%d", fd);
 
     /* Step 2: Set SO_REUSEADDR option */
     /* This allows immediate reuse of the port after server restart */
     int opt = 1;
-    if (setsockopt(listener->socket_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
         LOG_WARN(NULL, "Failed to set SO_REUSEADDR: %s", strerror(errno));
         /* Not fatal, continue anyway */
     } else {
         LOG_DEBUG(NULL, "SO_REUSEADDR enabled");
     }
 
+#ifdef SO_REUSEPORT
+    /* Every socket in the group must set SO_REUSEPORT before bind() */
+    if (listener->reuseport &&
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        LOG_ERROR(NULL, "Failed to set SO_REUSEPORT: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+#endif
+
     /* Step 3: Prepare address structure */
     struct sockaddr_in server_addr;
     memset(&server_addr, 0, sizeof(server_addr));
@@ -86,25 +137,265 @@ int listener_start(listener_t *listener) {
 
     /* Step 4: Bind socket to address */
     LOG_DEBUG(NULL, "Binding to 0.0.0.0:%d...", listener->port);
-    if (bind(listener->socket_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+    if (bind(fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
         LOG_ERROR(NULL, "Failed to bind to port %d: %s", listener->port, strerror(errno));
-        close(listener->socket_fd);
-        listener->socket_fd = -1;
+        close(fd);
         return -1;
     }
     LOG_INFO(NULL, "Socket bound to 0.0.0.0:%d", listener->port);
 
     /* Step 5: Start listening */
     LOG_DEBUG(NULL, "Starting to listen (backlog=%d)...", listener->backlog);
-    if (listen(listener->socket_fd, listener->backlog) < 0) {
+    if (listen(fd, listener->backlog) < 0) {
         LOG_ERROR(NULL, "Failed to listen on socket: %s", strerror(errno));
-        close(listener->socket_fd);
-        listener->socket_fd = -1;
+        close(fd);
         return -1;
     }
 
-    LOG_INFO(NULL, "Listening on port %d (backlog=%d)", listener->port, listener->backlog);
+    return fd;
+}
+
+/*
+ * Helper function: Attach the CPU-steering program to the reuseport group
+ * The program returns the index of the socket to use: RX CPU % num_sockets
+ * Returns 0 on success, -1 on error
+ */
+static int attach_steering_bpf(listener_t *listener) {
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+    struct sock_filter code[] = {
+        { BPF_LD | BPF_W | BPF_ABS, 0, 0, (uint32_t)(SKF_AD_OFF + SKF_AD_CPU) },
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, (uint32_t)listener->num_sockets },
+        { BPF_RET | BPF_A, 0, 0, 0 },
+    };
+    struct sock_fprog prog = {
+        .len = (unsigned short)(sizeof(code) / sizeof(code[0])),
+        .filter = code
+    };
+
+    /* Attaching to any member applies to the whole group */
+    if (setsockopt(listener->socket_fds[0], SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+                   &prog, sizeof(prog)) < 0) {
+        LOG_ERROR(NULL, "Failed to attach reuseport steering program: %s", strerror(errno));
+        return -1;
+    }
+
+    LOG_INFO(NULL, "Reuseport CPU steering program attached (%d sockets)",
+             listener->num_sockets);
     return 0;
+#else
+    (void)listener;
+    LOG_ERROR(NULL, "Reuseport BPF steering is not supported on this platform");
+    return -1;
+#endif
+}
+
+/*
+ * Start listening on the configured port
+ * Returns 0 on success, -1 on error
+ */
+int listener_start(listener_t *listener) {
+    if (listener == NULL) {
+        LOG_ERROR(NULL, "listener_start: listener is NULL");
+        return -1;
+    }
+
+    listener->socket_fds = (int *)malloc(sizeof(int) * (size_t)listener->num_sockets);
+    if (listener->socket_fds == NULL) {
+        LOG_ERROR(NULL, "Failed to allocate listen socket array: %s", strerror(errno));
+        return -1;
+    }
+
+    /* Sockets join the reuseport group in index order (the BPF program relies on it) */
+    for (int i = 0; i < listener->num_sockets; i++) {
+        listener->socket_fds[i] = open_socket(listener);
+        if (listener->socket_fds[i] < 0) {
+            for (int j = 0; j < i; j++) {
+                close(listener->socket_fds[j]);
+            }
+            free(listener->socket_fds);
+            listener->socket_fds = NULL;
+            return -1;
+        }
+    }
+    listener->socket_fd = listener->socket_fds[0];
+
+    if (listener->reuseport && listener->steer == LISTENER_STEER_BPF &&
+        attach_steering_bpf(listener) < 0) {
+        LOG_WARN(NULL, "Falling back to kernel hash steering");
+        listener->steer = LISTENER_STEER_NONE;
+    }
+
+    if (listener->reuseport) {
+        LOG_INFO(NULL, "Listening on port %d with %d SO_REUSEPORT sockets (backlog=%d, steer=%s)",
+                 listener->port, listener->num_sockets, listener->backlog,
+                 listener_steer_to_string(listener->steer));
+    } else {
+        LOG_INFO(NULL, "Listening on port %d (backlog=%d)", listener->port, listener->backlog);
+    }
+    return 0;
+}
+
+/*
+ * Take over already listening sockets
+ * Returns 0 on success, -1 on error
+ */
+int listener_adopt(listener_t *listener, const int *fds, int num_fds) {
+    if (listener == NULL || fds == NULL || num_fds < 1 || listener->socket_fds != NULL) {
+        LOG_ERROR(NULL, "listener_adopt: invalid parameters");
+        return -1;
+    }
+
+    listener->socket_fds = (int *)malloc(sizeof(int) * (size_t)num_fds);
+    if (listener->socket_fds == NULL) {
+        LOG_ERROR(NULL, "Failed to allocate listen socket array: %s", strerror(errno));
+        return -1;
+    }
+
+    /* The sockets keep their options, including SO_REUSEPORT and a steering program */
+    memcpy(listener->socket_fds, fds, sizeof(int) * (size_t)num_fds);
+    if (listener->num_sockets != num_fds) {
+        LOG_WARN(NULL, "Inherited %d listen sockets (configured for %d)",
+                 num_fds, listener->num_sockets);
+    }
+    listener->num_sockets = num_fds;
+    listener->reuseport = num_fds > 1;
+    listener->socket_fd = listener->socket_fds[0];
+
+    LOG_INFO(NULL, "Listening on port %d with %d inherited socket(s)",
+             listener->port, listener->num_sockets);
+    return 0;
+}
+
+/*
+ * Tie reuseport socket index to cpu for SO_INCOMING_CPU steering
+ * Returns 0 on success, -1 on error
+ */
+int listener_steer_socket(listener_t *listener, int index, int cpu) {
+    if (listener == NULL || listener->socket_fds == NULL ||
+        index < 0 || index >= listener->num_sockets) {
+        return -1;
+    }
+
+    if (listener->steer != LISTENER_STEER_CPU || cpu < 0) {
+        return 0;
+    }
+
+#ifdef SO_INCOMING_CPU
+    if (setsockopt(listener->socket_fds[index], SOL_SOCKET, SO_INCOMING_CPU,
+                   &cpu, sizeof(cpu)) < 0) {
+        LOG_WARN(NULL, "Failed to set SO_INCOMING_CPU=%d on socket %d: %s",
+                 cpu, index, strerror(errno));
+        return -1;
+    }
+    LOG_DEBUG(NULL, "Listen socket %d steered to CPU %d", index, cpu);
+    return 0;
+#else
+    LOG_WARN(NULL, "SO_INCOMING_CPU is not supported on this platform");
+    return -1;
+#endif
+}
+
+/*
+ * Convert steering enum to string
+ */
+const char *listener_steer_to_string(listener_steer_t steer) {
+    switch (steer) {
+        case LISTENER_STEER_NONE: return "none";
+        case LISTENER_STEER_CPU:  return "cpu";
+        case LISTENER_STEER_BPF:  return "bpf";
+        default:                  return "unknown";
+    }
+}
+
+/*
+ * Accept through an io_uring multishot accept instead of select() + accept()
+ * Returns 0 on success, -1 if io_uring is unavailable
+ */
+int listener_use_uring(listener_t *listener) {
+    if (listener == NULL || listener->socket_fd < 0 || listener->ring != NULL) {
+        LOG_ERROR(NULL, "listener_use_uring: invalid listener");
+        return -1;
+    }
+
+    uring_t *ring = (uring_t *)calloc(1, sizeof(uring_t));
+    if (ring == NULL) {
+        LOG_ERROR(NULL, "Failed to allocate accept ring");
+        return -1;
+    }
+
+    if (uring_init(ring, LISTENER_RING_ENTRIES, LISTENER_RING_CQ_ENTRIES) < 0 ||
+        !uring_accept_multishot_supported(ring) ||
+        uring_accept(ring, listener->socket_fd, 0, LISTENER_RING_ACCEPT) < 0 ||
+        uring_poll(ring, listener->shutdown_pipe[0], POLLIN, LISTENER_RING_SHUTDOWN) < 0 ||
+        uring_submit(ring) < 0) {
+        LOG_WARN(NULL, "io_uring accept unavailable (%s), using select()", strerror(errno));
+        uring_destroy(ring);
+        free(ring);
+        return -1;
+    }
+
+    listener->ring = ring;
+    listener->ring_stopping = false;
+    listener->ring_accepting = true;
+    LOG_INFO(NULL, "Listener accepting through io_uring (fd=%d)", listener->socket_fd);
+    return 0;
+}
+
+/*
+ * Helper function: Wait on the accept ring
+ * After the shutdown signal, sockets the accept took before its cancellation
+ * are still handed out, then -2 is returned
+ * Returns client socket FD on success, -1 on error, -2 on shutdown
+ */
+static int listener_accept_ring(listener_t *listener) {
+    uring_t *ring = listener->ring;
+
+    for (;;) {
+        uring_cqe_t cqe;
+        while (uring_next(ring, &cqe)) {
+            if (cqe.user_data == LISTENER_RING_SHUTDOWN) {
+                char buf[1];
+                read(listener->shutdown_pipe[0], buf, 1);  /* Drain pipe */
+                LOG_DEBUG(NULL, "Shutdown signal received via pipe");
+                listener->ring_stopping = true;
+                if (uring_cancel(ring, LISTENER_RING_ACCEPT, LISTENER_RING_CANCEL) < 0) {
+                    listener->ring_accepting = false;
+                }
+                continue;
+            }
+            if (cqe.user_data != LISTENER_RING_ACCEPT) {
+                continue;
+            }
+
+            /* The kernel ends a multishot accept on errors: start another */
+            if ((cqe.flags & URING_CQE_MORE) == 0) {
+                if (listener->ring_stopping) {
+                    listener->ring_accepting = false;
+                } else if (uring_accept(ring, listener->socket_fd, 0, LISTENER_RING_ACCEPT) < 0) {
+                    LOG_ERROR(NULL, "Failed to re-arm io_uring accept");
+                }
+            }
+            if (cqe.res == -ECANCELED) {
+                continue;
+            }
+            if (cqe.res < 0) {
+                LOG_ERROR(NULL, "accept() failed: %s", strerror(-cqe.res));
+                return -1;
+            }
+
+            metrics_add(METRIC_CONNECTIONS_ACCEPTED, 1);
+            LOG_DEBUG(NULL, "Accepted connection (fd=%d)", cqe.res);
+            return cqe.res;
+        }
+
+        if (listener->ring_stopping && !listener->ring_accepting) {
+            return -2;
+        }
+        if (uring_wait(ring, -1) < 0) {
+            LOG_ERROR(NULL, "io_uring_enter() failed: %s", strerror(errno));
+            return -1;
+        }
+    }
 }
 
 /*
@@ -117,6 +408,10 @@ int listener_accept(listener_t *listener) {
         return -1;
     }
 
+    if (listener->ring != NULL) {
+        return listener_accept_ring(listener);
+    }
+
     /* Use select() to wait for either:
      * 1. Incoming connection on socket_fd
      * 2. Shutdown signal on shutdown_pipe[0]
@@ -164,13 +459,14 @@ int listener_accept(listener_t *listener) {
             LOG_ERROR(NULL, "accept() failed: %s", strerror(errno));
             return -1;
         }
+        metrics_add(METRIC_CONNECTIONS_ACCEPTED, 1);
 
         /* Get client IP and port for logging */
         char client_ip[INET_ADDRSTRLEN];
         inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
         uint16_t client_port = ntohs(client_addr.sin_port);
 
-        LOG_INFO(NULL, "Accepted connection from %s:%d (fd=%d)",
+        LOG_DEBUG(NULL, "Accepted connection from %s:%d (fd=%d)",
                  client_ip, client_port, client_fd);
 
         return client_fd;
@@ -200,6 +496,21 @@ int listener_shutdown(listener_t *listener) {
     return 0;
 }
 
+/*
+ * Signal listener to stop accepting while open connections finish
+ * Returns 0 on success, -1 on error
+ */
+int listener_drain(listener_t *listener, int timeout_ms) {
+    if (listener == NULL) {
+        return -1;
+    }
+
+    /* Published before the signal that makes the loops look at it */
+    listener->drain_timeout_ms = timeout_ms;
+    __atomic_store_n(&listener->draining, true, __ATOMIC_RELEASE);
+    return listener_shutdown(listener);
+}
+
 /*
  * Close listener socket and cleanup
  */
@@ -208,11 +519,21 @@ void listener_destroy(listener_t *listener) {
         return;
     }
 
-    /* Close listening socket */
-    if (listener->socket_fd >= 0) {
-        LOG_DEBUG(NULL, "Closing listener socket (fd=%d)", listener->socket_fd);
-        close(listener->socket_fd);
-        listener->socket_fd = -1;
+    /* Close listening sockets */
+    if (listener->socket_fds != NULL) {
+        for (int i = 0; i < listener->num_sockets; i++) {
+            LOG_DEBUG(NULL, "Closing listener socket (fd=%d)", listener->socket_fds[i]);
+            close(listener->socket_fds[i]);
+        }
+        free(listener->socket_fds);
+        listener->socket_fds = NULL;
+    }
+    listener->socket_fd = -1;
+
+    if (listener->ring != NULL) {
+        uring_destroy(listener->ring);
+        free(listener->ring);
+        listener->ring = NULL;
     }
 
     /* Close shutdown pipe */
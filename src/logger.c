@@ -1,6 +1,22 @@
 /*
  * C-HTTP Payment Server - Logging Subsystem
  * Thread-safe logging with multiple log levels
+ *
+ * Synchronous mode (startup, shutdown, tools) formats each line and writes
+ * it to stderr under the logger mutex. Once logger_start_async() runs,
+ * every thread owns a single-producer/single-consumer byte ring: a log call
+ * formats into a stack buffer, copies the finished line into its ring and
+ * publishes it with one release store - no lock, no syscall. A flusher
+ * thread sweeps all rings every few milliseconds (or as soon as a ring is
+ * half full) and writes the pending bytes of every ring with one writev().
+ * Lines from one thread stay in order; lines from different threads are
+ * interleaved per flush.
+ *
+ * Besides text, the logger carries a binary sink for pre-encoded records
+ * (see audit.h). Each sink has its own per-thread rings and fd, so records
+ * never interleave with text and are written whole.
+ *
+ * Timestamps are formatted at most once per second per thread.
  */
 
 #include "logger.h"
@@ -9,13 +25,58 @@
 #include <stdarg.h>
 #include <time.h>
 #include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+/* Most rings written by one writev() call */
+#define LOGGER_FLUSH_IOV 64
+
+/*
+ * Per-thread log ring
+ * head is advanced only by the owning thread, tail only by the flusher
+ */
+typedef struct log_ring {
+    struct log_ring *next;      /* Next registered ring */
+    log_sink_t sink;            /* Stream the ring feeds */
+    char *data;                 /* LOGGER_RING_SIZE bytes */
+    _Alignas(64) size_t head;   /* Bytes published (producer) */
+    _Alignas(64) size_t tail;   /* Bytes written out (flusher) */
+    bool orphaned;              /* Owning thread exited; free once drained */
+} log_ring_t;
 
 /* Global logger instance */
-static logger_t g_logger = {
+logger_t g_logger = {
     .min_level = LOG_INFO,
     .mutex = PTHREAD_MUTEX_INITIALIZER
 };
 
+/* Async backend state */
+static bool g_async_running = false;
+static log_overflow_t g_overflow = LOG_OVERFLOW_DROP;
+static uint64_t g_dropped = 0;
+static pthread_t g_flusher;
+
+/* Destination fd per sink (-1 = discarded) */
+static int g_sink_fds[LOG_SINK_COUNT] = { STDERR_FILENO, -1 };
+
+/* Registered rings; the mutex also guards flusher sleep/wakeup */
+static log_ring_t *g_rings = NULL;
+static pthread_mutex_t g_rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_flush_cond = PTHREAD_COND_INITIALIZER;
+static bool g_flush_requested = false;
+
+/* Calling thread's rings and the keys that orphan them on thread exit */
+static _Thread_local log_ring_t *t_rings[LOG_SINK_COUNT];
+static pthread_key_t g_ring_keys[LOG_SINK_COUNT];
+static pthread_once_t g_ring_key_once = PTHREAD_ONCE_INIT;
+
+/* Per-thread timestamp cache ("[YYYY-MM-DD HH:MM:SS] ") */
+static _Thread_local time_t t_stamp_second = (time_t)-1;
+static _Thread_local char t_stamp[32];
+static _Thread_local size_t t_stamp_length = 0;
+
 /*
  * Initialize logger with minimum log level
  */
@@ -49,13 +110,338 @@ const char *log_level_to_string(log_level_t level) {
 }
 
 /*
- * Get current timestamp in format: YYYY-MM-DD HH:MM:SS
+ * Parse a log level name (debug, info, warn, error)
+ * Returns 0 on success, -1 if the name is unknown
+ */
+int log_level_from_string(const char *name, log_level_t *level) {
+    static const log_level_t levels[] = { LOG_DEBUG, LOG_INFO, LOG_WARN, LOG_ERROR };
+
+    if (name == NULL || level == NULL) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+        if (strcasecmp(name, log_level_to_string(levels[i])) == 0) {
+            *level = levels[i];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Get current timestamp prefix in format: [YYYY-MM-DD HH:MM:SS]
+ * Reformatted only when the second changes
+ * Returns prefix length
  */
-static void get_timestamp(char *buffer, size_t buffer_size) {
+static size_t get_timestamp(const char **stamp) {
     time_t now = time(NULL);
-    struct tm *tm_info = localtime(&now);
 
-    strftime(buffer, buffer_size, "%Y-%m-%d %H:%M:%S", tm_info);
+    if (now != t_stamp_second) {
+        struct tm tm_info;
+
+        /* localtime() re-reads the zone and strdup()s on every call; _r does not */
+        localtime_r(&now, &tm_info);
+        t_stamp_length = strftime(t_stamp, sizeof(t_stamp), "[%Y-%m-%d %H:%M:%S] ", &tm_info);
+        t_stamp_second = now;
+    }
+
+    *stamp = t_stamp;
+    return t_stamp_length;
+}
+
+/*
+ * Helper function: Level tag including brackets and trailing space
+ */
+static const char *level_tag(log_level_t level, size_t *length) {
+    switch (level) {
+        case LOG_DEBUG: *length = 8; return "[DEBUG] ";
+        case LOG_INFO:  *length = 7; return "[INFO] ";
+        case LOG_WARN:  *length = 7; return "[WARN] ";
+        case LOG_ERROR: *length = 8; return "[ERROR] ";
+        default:        *length = 10; return "[UNKNOWN] ";
+    }
+}
+
+/*
+ * Helper function: Format one complete line (with newline) into buffer
+ * Returns line length
+ */
+static size_t format_line(char *buffer, log_level_t level, const char *format, va_list args) {
+    const size_t limit = LOGGER_LINE_MAX - 1;   /* Room for the newline */
+
+    /* Prefix is copied, not formatted: only the message goes through vsnprintf */
+    const char *stamp;
+    size_t stamp_length = get_timestamp(&stamp);
+    size_t tag_length;
+    const char *tag = level_tag(level, &tag_length);
+
+    memcpy(buffer, stamp, stamp_length);
+    memcpy(buffer + stamp_length, tag, tag_length);
+    size_t length = stamp_length + tag_length;
+
+    int body = vsnprintf(buffer + length, limit - length, format, args);
+    if (body > 0) {
+        length += (size_t)body;
+    }
+
+    if (length >= limit) {
+        /* Truncated: mark it so the cut is visible */
+        length = limit - 1;
+        memcpy(buffer + length - 3, "...", 3);
+    }
+
+    buffer[length++] = '\n';
+    return length;
+}
+
+/*
+ * Helper function: Write all bytes to fd, retrying short writes
+ */
+static void write_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        data += written;
+        length -= (size_t)written;
+    }
+}
+
+/*
+ * Helper function: Mark the exiting thread's ring for the flusher to free
+ */
+static void ring_release(void *ptr) {
+    log_ring_t *ring = (log_ring_t *)ptr;
+    __atomic_store_n(&ring->orphaned, true, __ATOMIC_RELEASE);
+}
+
+/*
+ * Helper function: Create the thread-exit keys (runs once)
+ */
+static void ring_key_create(void) {
+    for (int sink = 0; sink < LOG_SINK_COUNT; sink++) {
+        if (pthread_key_create(&g_ring_keys[sink], ring_release) != 0) {
+            fprintf(stderr, "Failed to create logger thread key\n");
+        }
+    }
+}
+
+/*
+ * Helper function: Get the calling thread's ring, registering it on first use
+ * Returns ring on success, NULL on error
+ */
+static log_ring_t *ring_thread(log_sink_t sink) {
+    if (t_rings[sink] != NULL) {
+        return t_rings[sink];
+    }
+
+    pthread_once(&g_ring_key_once, ring_key_create);
+
+    log_ring_t *ring = (log_ring_t *)aligned_alloc(64, sizeof(log_ring_t));
+    char *data = (char *)malloc(LOGGER_RING_SIZE);
+    if (ring == NULL || data == NULL) {
+        free(ring);
+        free(data);
+        return NULL;
+    }
+
+    memset(ring, 0, sizeof(*ring));
+    ring->data = data;
+    ring->sink = sink;
+
+    pthread_mutex_lock(&g_rings_mutex);
+    ring->next = g_rings;
+    g_rings = ring;
+    pthread_mutex_unlock(&g_rings_mutex);
+
+    pthread_setspecific(g_ring_keys[sink], ring);
+    t_rings[sink] = ring;
+    return ring;
+}
+
+/*
+ * Helper function: Wake the flusher before its next interval
+ */
+static void flush_request(void) {
+    pthread_mutex_lock(&g_rings_mutex);
+    g_flush_requested = true;
+    pthread_cond_signal(&g_flush_cond);
+    pthread_mutex_unlock(&g_rings_mutex);
+}
+
+/*
+ * Helper function: Copy a line or record into the calling thread's ring
+ * Returns true if queued, false if dropped (or no ring)
+ */
+static bool ring_push(log_sink_t sink, const char *line, size_t length) {
+    log_ring_t *ring = ring_thread(sink);
+    if (ring == NULL) {
+        return false;
+    }
+
+    size_t head = ring->head;
+    size_t used = head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    while (LOGGER_RING_SIZE - used < length) {
+        if (g_overflow == LOG_OVERFLOW_DROP) {
+            __atomic_fetch_add(&g_dropped, 1, __ATOMIC_RELAXED);
+            return false;
+        }
+
+        /* Block: let the flusher catch up */
+        flush_request();
+        struct timespec pause = { 0, 50 * 1000 };
+        nanosleep(&pause, NULL);
+        used = head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    }
+
+    size_t offset = head & (LOGGER_RING_SIZE - 1);
+    size_t first = LOGGER_RING_SIZE - offset;
+    if (first > length) {
+        first = length;
+    }
+    memcpy(ring->data + offset, line, first);
+    memcpy(ring->data, line + first, length - first);
+
+    __atomic_store_n(&ring->head, head + length, __ATOMIC_RELEASE);
+
+    /* Crossing half full: flush now instead of waiting for the interval */
+    if (used < LOGGER_RING_SIZE / 2 && used + length >= LOGGER_RING_SIZE / 2) {
+        flush_request();
+    }
+    return true;
+}
+
+/*
+ * Helper function: Write out the pending bytes of one sink's rings
+ * Called by the flusher with g_rings_mutex held
+ */
+static void flush_sink(log_sink_t sink) {
+    struct iovec iov[LOGGER_FLUSH_IOV];
+    size_t ends[LOGGER_FLUSH_IOV / 2];
+    log_ring_t *rings[LOGGER_FLUSH_IOV / 2];
+    int fd = g_sink_fds[sink];
+
+    log_ring_t *ring = g_rings;
+    while (ring != NULL) {
+        /* Gather up to LOGGER_FLUSH_IOV / 2 rings (each may wrap: two iovecs) */
+        int iov_count = 0;
+        int ring_count = 0;
+        size_t total = 0;
+
+        for (; ring != NULL && ring_count < LOGGER_FLUSH_IOV / 2; ring = ring->next) {
+            if (ring->sink != sink) {
+                continue;
+            }
+
+            size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+            size_t tail = ring->tail;
+            if (head == tail) {
+                continue;
+            }
+
+            size_t offset = tail & (LOGGER_RING_SIZE - 1);
+            size_t length = head - tail;
+            size_t first = LOGGER_RING_SIZE - offset;
+            if (first > length) {
+                first = length;
+            }
+
+            iov[iov_count].iov_base = ring->data + offset;
+            iov[iov_count++].iov_len = first;
+            if (length > first) {
+                iov[iov_count].iov_base = ring->data;
+                iov[iov_count++].iov_len = length - first;
+            }
+
+            rings[ring_count] = ring;
+            ends[ring_count++] = head;
+            total += length;
+        }
+
+        /* One writev() per batch; finish short writes iovec by iovec */
+        ssize_t written = iov_count > 0 && fd >= 0 ? writev(fd, iov, iov_count) : 0;
+        size_t done = written > 0 ? (size_t)written : 0;
+        if (done < total && fd >= 0) {
+            for (int i = 0; i < iov_count; i++) {
+                if (done >= iov[i].iov_len) {
+                    done -= iov[i].iov_len;
+                    continue;
+                }
+                write_all(fd, (const char *)iov[i].iov_base + done, iov[i].iov_len - done);
+                done = 0;
+            }
+        }
+
+        for (int i = 0; i < ring_count; i++) {
+            __atomic_store_n(&rings[i]->tail, ends[i], __ATOMIC_RELEASE);
+        }
+    }
+}
+
+/*
+ * Helper function: Write out every ring's pending bytes (flusher only)
+ * Orphaned rings are freed once empty
+ */
+static void flush_rings(void) {
+    pthread_mutex_lock(&g_rings_mutex);
+
+    for (int sink = 0; sink < LOG_SINK_COUNT; sink++) {
+        flush_sink((log_sink_t)sink);
+    }
+
+    /* Free rings of exited threads that have been fully written */
+    log_ring_t **link = &g_rings;
+    while (*link != NULL) {
+        log_ring_t *current = *link;
+        if (__atomic_load_n(&current->orphaned, __ATOMIC_ACQUIRE) &&
+            __atomic_load_n(&current->head, __ATOMIC_ACQUIRE) == current->tail) {
+            *link = current->next;
+            free(current->data);
+            free(current);
+        } else {
+            link = &current->next;
+        }
+    }
+
+    pthread_mutex_unlock(&g_rings_mutex);
+}
+
+/*
+ * Helper function: Flusher thread body
+ */
+static void *flusher_thread(void *arg) {
+    (void)arg;
+
+    while (__atomic_load_n(&g_async_running, __ATOMIC_ACQUIRE)) {
+        flush_rings();
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += LOGGER_FLUSH_INTERVAL_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        pthread_mutex_lock(&g_rings_mutex);
+        while (!g_flush_requested && __atomic_load_n(&g_async_running, __ATOMIC_ACQUIRE)) {
+            if (pthread_cond_timedwait(&g_flush_cond, &g_rings_mutex, &deadline) == ETIMEDOUT) {
+                break;
+            }
+        }
+        g_flush_requested = false;
+        pthread_mutex_unlock(&g_rings_mutex);
+    }
+
+    /* Final sweep after stop */
+    flush_rings();
+    return NULL;
 }
 
 /*
@@ -72,30 +458,109 @@ void log_message(logger_t *logger, log_level_t level, const char *format, ...) {
         return;
     }
 
-    /* Lock mutex for thread-safe logging */
+    char line[LOGGER_LINE_MAX];
+    va_list args;
+    va_start(args, format);
+    size_t length = format_line(line, level, format, args);
+    va_end(args);
+
+    if (__atomic_load_n(&g_async_running, __ATOMIC_ACQUIRE)) {
+        ring_push(LOG_SINK_TEXT, line, length);
+        return;
+    }
+
+    /* Synchronous: one write per line keeps lines whole */
     pthread_mutex_lock(&logger->mutex);
+    write_all(g_sink_fds[LOG_SINK_TEXT], line, length);
+    pthread_mutex_unlock(&logger->mutex);
+}
 
-    /* Get timestamp */
-    char timestamp[32];
-    get_timestamp(timestamp, sizeof(timestamp));
+/*
+ * Queue pre-encoded bytes (one whole record) for a sink
+ */
+void log_write(log_sink_t sink, const void *data, size_t length) {
+    if (sink < 0 || sink >= LOG_SINK_COUNT || data == NULL || length > LOGGER_LINE_MAX ||
+        __atomic_load_n(&g_sink_fds[sink], __ATOMIC_ACQUIRE) < 0) {
+        return;
+    }
 
-    /* Print timestamp and log level */
-    fprintf(stderr, "[%s] [%s] ", timestamp, log_level_to_string(level));
+    if (__atomic_load_n(&g_async_running, __ATOMIC_ACQUIRE)) {
+        ring_push(sink, (const char *)data, length);
+        return;
+    }
 
-    /* Print formatted message */
-    va_list args;
-    va_start(args, format);
-    vfprintf(stderr, format, args);
-    va_end(args);
+    pthread_mutex_lock(&g_logger.mutex);
+    write_all(g_sink_fds[sink], (const char *)data, length);
+    pthread_mutex_unlock(&g_logger.mutex);
+}
 
-    /* Add newline */
-    fprintf(stderr, "\n");
+/*
+ * Set the fd a sink writes to (-1 discards its output)
+ */
+void logger_set_sink_fd(log_sink_t sink, int fd) {
+    if (sink < 0 || sink >= LOG_SINK_COUNT) {
+        return;
+    }
 
-    /* Flush to ensure immediate output */
-    fflush(stderr);
+    /* Drain what was queued for the old fd first */
+    if (__atomic_load_n(&g_async_running, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_lock(&g_rings_mutex);
+        flush_sink(sink);
+        __atomic_store_n(&g_sink_fds[sink], fd, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&g_rings_mutex);
+    } else {
+        __atomic_store_n(&g_sink_fds[sink], fd, __ATOMIC_RELEASE);
+    }
+}
 
-    /* Unlock mutex */
-    pthread_mutex_unlock(&logger->mutex);
+/*
+ * Start the async backend
+ * Returns 0 on success, -1 on error
+ */
+int logger_start_async(log_overflow_t overflow) {
+    if (__atomic_load_n(&g_async_running, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+
+    g_overflow = overflow;
+    __atomic_store_n(&g_async_running, true, __ATOMIC_RELEASE);
+
+    int rc = pthread_create(&g_flusher, NULL, flusher_thread, NULL);
+    if (rc != 0) {
+        __atomic_store_n(&g_async_running, false, __ATOMIC_RELEASE);
+        LOG_ERROR(NULL, "Failed to start log flusher: %s", strerror(rc));
+        return -1;
+    }
+
+    LOG_DEBUG(NULL, "Async logging started (ring=%d bytes/thread, overflow=%s)",
+              LOGGER_RING_SIZE, overflow == LOG_OVERFLOW_DROP ? "drop" : "block");
+    return 0;
+}
+
+/*
+ * Stop the async backend after writing out everything queued
+ */
+void logger_stop_async(void) {
+    if (!__atomic_load_n(&g_async_running, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    __atomic_store_n(&g_async_running, false, __ATOMIC_RELEASE);
+    flush_request();
+    pthread_join(g_flusher, NULL);
+
+    uint64_t dropped = logger_dropped();
+    if (dropped > 0) {
+        LOG_WARN(NULL, "Async logging dropped %llu lines (rings full)",
+                 (unsigned long long)dropped);
+    }
+}
+
+/*
+ * Number of lines dropped because a ring was full
+ */
+uint64_t logger_dropped(void) {
+    return __atomic_load_n(&g_dropped, __ATOMIC_RELAXED);
 }
 
 /*
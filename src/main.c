@@ -6,17 +6,46 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <signal.h>
+#include <time.h>
 #include <unistd.h>
 #include "logger.h"
+#include "audit.h"
+#include "config.h"
 #include "listener.h"
 #include "connection.h"
+#include "event_loop.h"
+#include "idempotency.h"
+#include "dispatcher.h"
+#include "fileserver.h"
+#include "handlers.h"
+#include "http_response.h"
+#include "http_scan.h"
+#include "metrics.h"
+#include "overload.h"
 #include "task_queue.h"
+#include "trace.h"
+#include "wal.h"
+#include "handoff.h"
+#include "cluster.h"
+#include "uring.h"
 #include "thread_pool.h"
+#include "scheduler.h"
 
 /* Global components for signal handler */
 static listener_t g_listener;
 static task_queue_t g_queue;
 static thread_pool_t g_pool;
+static scheduler_t g_sched;
+static scheduler_mode_t g_sched_mode;
+static event_loop_t g_loop;
+static event_loop_group_t g_group;
+static bool g_workers_enabled;
+static idempotency_store_t g_store;
+static wal_t g_wal;
+static handoff_t g_handoff;
+static cluster_t g_cluster;
+static dispatcher_t g_dispatcher;
+static fileserver_t g_files;
 static volatile sig_atomic_t g_running = 1;
 
 /*
@@ -31,65 +60,162 @@ void signal_handler(int signum) {
     listener_shutdown(&g_listener);
 }
 
-int main(int argc, char *argv[]) {
-    /* Suppress unused parameter warnings */
-    (void)argc;
-    (void)argv;
+/*
+ * Helper function: Leave the cluster, close the idempotency log and free
+ * cached responses
+ */
+static void store_destroy(void) {
+    cluster_destroy(&g_cluster);
+    wal_close(&g_wal);
+    idempotency_store_destroy(&g_store);
+}
 
-    /* Initialize logger with DEBUG level to see all messages */
-    logger_set_level(LOG_DEBUG);
+/*
+ * Helper function: Create the worker pool selected by --scheduler
+ * Returns 0 on success, -1 on error
+ */
+static int workers_init(server_config_t *config) {
+    g_sched_mode = config->scheduler;
 
-    LOG_INFO(NULL, "NanoServe v2.0 - Starting...");
-    LOG_INFO(NULL, "High-Reliability Idempotent HTTP Server");
+    /* Reuseport loops answer requests themselves: no pool, no queue */
+    g_workers_enabled = config->io_mode != IO_MODE_REUSEPORT;
+    if (!g_workers_enabled) {
+        if (config->num_threads == 0) {
+            int cpus[SCHEDULER_MAX_CPUS];
+            int num_cpus = scheduler_allowed_cpus(cpus, SCHEDULER_MAX_CPUS);
+            long online = sysconf(_SC_NPROCESSORS_ONLN);
+            config->num_threads = num_cpus > 0 ? num_cpus : (online > 0 ? (int)online : 1);
+        }
+        return 0;
+    }
 
-    /* Register signal handlers for graceful shutdown */
-    signal(SIGINT, signal_handler);   /* Ctrl+C */
-    signal(SIGTERM, signal_handler);  /* kill command */
+    if (g_sched_mode == SCHEDULER_MODE_STEALING) {
+        if (scheduler_init(&g_sched, config->num_threads, config->pin) < 0) {
+            return -1;
+        }
+        config->num_threads = g_sched.num_workers;
+        scheduler_set_queue_limit(&g_sched, config->overload.queue_limit);
+        return 0;
+    }
+
+    if (config->num_threads == 0) {
+        config->num_threads = DEFAULT_THREAD_POOL_SIZE;
+    }
 
-    /* Initialize task queue (unlimited size) */
+    /* Initialize task queue (default ring capacity) */
     if (task_queue_init(&g_queue, 0) < 0) {
         LOG_ERROR(NULL, "Failed to initialize task queue");
-        return EXIT_FAILURE;
+        return -1;
     }
 
-    /* Initialize thread pool with 10 worker threads */
-    if (thread_pool_init(&g_pool, 10, &g_queue) < 0) {
-        LOG_ERROR(NULL, "Failed to initialize thread pool");
+    task_queue_set_limit(&g_queue, config->overload.queue_limit);
+
+    if (thread_pool_init(&g_pool, config->num_threads, &g_queue) < 0) {
         task_queue_destroy(&g_queue);
-        return EXIT_FAILURE;
+        return -1;
     }
 
-    /* Start worker threads */
-    if (thread_pool_start(&g_pool) < 0) {
-        LOG_ERROR(NULL, "Failed to start thread pool");
-        thread_pool_destroy(&g_pool);
-        task_queue_destroy(&g_queue);
-        return EXIT_FAILURE;
+    return 0;
+}
+
+/*
+ * Helper function: Submit function and pool for handing off connections
+ */
+static task_submit_t workers_submit_fn(void **arg) {
+    if (g_sched_mode == SCHEDULER_MODE_STEALING) {
+        *arg = &g_sched;
+        return scheduler_submit;
     }
 
-    /* Initialize listener on port 8080 with backlog of 128 */
-    if (listener_init(&g_listener, 8080, 128) < 0) {
-        LOG_ERROR(NULL, "Failed to initialize listener");
-        thread_pool_shutdown(&g_pool);
-        thread_pool_destroy(&g_pool);
-        task_queue_destroy(&g_queue);
-        return EXIT_FAILURE;
+    *arg = &g_pool;
+    return thread_pool_submit;
+}
+
+/*
+ * Helper function: Set the per-task handler on the selected pool
+ */
+static void workers_set_handler(task_handler_t handler, void *arg) {
+    if (g_sched_mode == SCHEDULER_MODE_STEALING) {
+        scheduler_set_handler(&g_sched, handler, arg);
+    } else {
+        thread_pool_set_handler(&g_pool, handler, arg);
     }
+}
 
-    /* Start listening for connections */
-    if (listener_start(&g_listener) < 0) {
-        LOG_ERROR(NULL, "Failed to start listener");
-        listener_destroy(&g_listener);
+/*
+ * Helper function: Start the selected pool's worker threads
+ * Returns 0 on success, -1 on error
+ */
+static int workers_start(void) {
+    if (!g_workers_enabled) {
+        return 0;
+    }
+    if (g_sched_mode == SCHEDULER_MODE_STEALING) {
+        return scheduler_start(&g_sched);
+    }
+    return thread_pool_start(&g_pool);
+}
+
+/*
+ * Helper function: Stop worker threads (no-op if never started)
+ */
+static void workers_shutdown(void) {
+    if (!g_workers_enabled) {
+        return;
+    }
+    if (g_sched_mode == SCHEDULER_MODE_STEALING) {
+        scheduler_shutdown(&g_sched);
+    } else {
         thread_pool_shutdown(&g_pool);
+    }
+}
+
+/*
+ * Helper function: Free the selected pool and its queues
+ */
+static void workers_destroy(void) {
+    if (!g_workers_enabled) {
+        return;
+    }
+    if (g_sched_mode == SCHEDULER_MODE_STEALING) {
+        scheduler_destroy(&g_sched);
+    } else {
         thread_pool_destroy(&g_pool);
         task_queue_destroy(&g_queue);
-        return EXIT_FAILURE;
     }
+}
 
-    LOG_INFO(NULL, "Server initialization complete");
-    LOG_INFO(NULL, "Press Ctrl+C to shutdown");
+/*
+ * Helper function: Connections waiting for a worker (metrics gauge)
+ */
+static double workers_queue_depth(void *arg) {
+    (void)arg;
+    if (g_sched_mode == SCHEDULER_MODE_STEALING) {
+        return (double)scheduler_pending(&g_sched);
+    }
+    return (double)task_queue_size(&g_queue);
+}
+
+/*
+ * Helper function: Wait up to timeout_ms for queued connections and
+ * payments to finish before a handoff (threaded accept stops at once)
+ */
+static void workers_drain(int timeout_ms) {
+    uint64_t deadline = metrics_now_ns() + (uint64_t)timeout_ms * 1000000;
+    while ((workers_queue_depth(NULL) > 0 || connection_payments_in_flight() > 0) &&
+           metrics_now_ns() < deadline) {
+        struct timespec pause = { .tv_sec = 0, .tv_nsec = 1000000 };
+        nanosleep(&pause, NULL);
+    }
+}
+
+/*
+ * Threaded accept loop: one blocking connection per worker
+ */
+static void run_accept_loop(void) {
+    void *submit_arg;
+    task_submit_t submit = workers_submit_fn(&submit_arg);
 
-    /* Main server loop - accept connections */
     while (g_running) {
         LOG_DEBUG(NULL, "Waiting for incoming connection...");
 
@@ -109,26 +235,319 @@ int main(int argc, char *argv[]) {
             continue;
         }
 
-        /* Connection accepted - enqueue for thread pool processing */
-        if (task_queue_enqueue(&g_queue, client_fd) < 0) {
-            LOG_ERROR(NULL, "Failed to enqueue client_fd=%d, closing connection", client_fd);
+        /* Connection accepted - hand off to the worker pool (503 if it is full) */
+        if (submit(submit_arg, client_fd, client_fd) < 0) {
+            LOG_WARN(NULL, "Workers unavailable, shedding client_fd=%d", client_fd);
+            connection_send_overloaded(client_fd);
             close(client_fd);
         }
     }
+}
+
+int main(int argc, char *argv[]) {
+    server_config_t config;
+
+    /* Parse command-line options */
+    config_init_defaults(&config);
+    int parse_result = config_parse_args(&config, argc, argv);
+    if (parse_result != 0) {
+        return parse_result > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    /* Log asynchronously from here on; atexit() drains the rings on every exit path */
+    logger_set_level(config.log_level);
+    if (logger_start_async(config.log_overflow) == 0) {
+        atexit(logger_stop_async);
+    }
+
+    /* Registered after the logger so it runs first: queued records reach the file */
+    if (config.audit_log_path != NULL) {
+        if (audit_open(config.audit_log_path) < 0) {
+            return EXIT_FAILURE;
+        }
+        atexit(audit_close);
+    }
+
+    /* Stamp request phases (optional); written out at shutdown */
+    if (config.trace_path != NULL &&
+        trace_start(config.trace_path, config.trace_threshold_us) < 0) {
+        return EXIT_FAILURE;
+    }
+
+    LOG_INFO(NULL, "NanoServe v2.0 - Starting...");
+    LOG_INFO(NULL, "High-Reliability Idempotent HTTP Server");
+
+    /* Register signal handlers for graceful shutdown */
+    signal(SIGINT, signal_handler);   /* Ctrl+C */
+    signal(SIGTERM, signal_handler);  /* kill command */
+
+    /* Client disconnects mid-write must surface as EPIPE, not kill the process */
+    signal(SIGPIPE, SIG_IGN);
+
+    /* Pick the fastest delimiter scanning kernel for this CPU */
+    http_scan_init();
+
+    /* Render the Date header once a second instead of per response */
+    if (http_date_start() < 0) {
+        LOG_WARN(NULL, "Date refresh thread unavailable; responses refresh it instead");
+    }
+
+    /* Serialize the error responses up front; they are sent without allocating */
+    if (http_canned_init() < 0) {
+        LOG_WARN(NULL, "Canned error responses unavailable; errors are built per request");
+    }
+
+    /* Initialize idempotency store (replays POST responses by key) */
+    if (idempotency_store_init(&g_store, &config.idempotency) < 0 ||
+        idempotency_store_start(&g_store) < 0) {
+        LOG_ERROR(NULL, "Failed to initialize idempotency store");
+        idempotency_store_destroy(&g_store);
+        return EXIT_FAILURE;
+    }
+
+    /* Take over a running server's sockets and cached responses (optional) */
+    handoff_inherit_t inherit = { .num_fds = 0, .image_fd = -1 };
+    int inherited = config.handoff.path != NULL
+        ? handoff_receive(config.handoff.path, &inherit) : 0;
+    if (inherited < 0) {
+        store_destroy();
+        return EXIT_FAILURE;
+    }
+
+    /* Inherited sockets decide the I/O mode: each reuseport socket needs its own loop */
+    if (inherit.num_fds > 1 && config.io_mode != IO_MODE_REUSEPORT) {
+        LOG_WARN(NULL, "Inherited %d reuseport sockets, switching to --io reuseport",
+                 inherit.num_fds);
+        config.io_mode = IO_MODE_REUSEPORT;
+        config.num_threads = inherit.num_fds;
+    } else if (inherit.num_fds == 1 && config.io_mode == IO_MODE_REUSEPORT) {
+        LOG_WARN(NULL, "Inherited a single listen socket, switching to --io epoll");
+        config.io_mode = IO_MODE_EPOLL;
+    }
+
+    bool imported = false;
+    if (inherit.image_fd >= 0) {
+        long restored = idempotency_store_import(&g_store, inherit.image_fd);
+        if (restored >= 0) {
+            LOG_INFO(NULL, "Restored %ld cached responses from the store image", restored);
+            imported = true;
+        }
+        close(inherit.image_fd);
+        inherit.image_fd = -1;
+    }
+
+    /* Replay (unless the image already holds it) and keep logging cached responses */
+    if (config.wal.dir != NULL &&
+        (wal_open(&g_wal, &config.wal, &g_store, !imported) < 0 || wal_start(&g_wal) < 0)) {
+        LOG_ERROR(NULL, "Failed to open idempotency log %s", config.wal.dir);
+        store_destroy();
+        return EXIT_FAILURE;
+    }
+
+    /* Share key ownership with the other nodes */
+    if (config.cluster.peers != NULL &&
+        (cluster_init(&g_cluster, &config.cluster, &g_store) < 0 ||
+         cluster_start(&g_cluster) < 0)) {
+        LOG_ERROR(NULL, "Failed to join cluster %s", config.cluster.peers);
+        store_destroy();
+        return EXIT_FAILURE;
+    }
+
+    /* Open the static file cache (optional) */
+    fileserver_t *files = NULL;
+    if (config.static_root != NULL) {
+        if (fileserver_init(&g_files, config.static_root) < 0) {
+            store_destroy();
+            return EXIT_FAILURE;
+        }
+        fileserver_start(&g_files);
+        files = &g_files;
+    }
+
+    /* Build the route table; it is read-only once compiled */
+    if (dispatcher_init(&g_dispatcher) < 0 ||
+        handlers_register(&g_dispatcher, &g_store, files) < 0 ||
+        dispatcher_compile(&g_dispatcher) < 0) {
+        LOG_ERROR(NULL, "Failed to build route table");
+        dispatcher_destroy(&g_dispatcher);
+        fileserver_destroy(files);
+        store_destroy();
+        return EXIT_FAILURE;
+    }
+
+    /* Apply keep-alive settings */
+    connection_config_t conn_config = {
+        .idle_timeout_ms = config.idle_timeout_ms,
+        .max_requests = config.max_requests,
+        .idempotency = &g_store,
+        .dispatcher = &g_dispatcher,
+        .zerocopy_min_bytes = config.zerocopy_min_bytes,
+        .send_zc = config.io_engine == EVENT_ENGINE_URING && uring_send_zc_supported()
+    };
+    connection_configure(&conn_config);
+    overload_configure(&config.overload);
+
+    /* Initialize worker pool (shared-queue thread pool or stealing scheduler; none for reuseport) */
+    if (workers_init(&config) < 0) {
+        LOG_ERROR(NULL, "Failed to initialize worker pool");
+        store_destroy();
+        return EXIT_FAILURE;
+    }
+
+    /* Reuseport loops answer on the accepting thread: nothing is ever queued */
+    if (g_workers_enabled) {
+        metrics_register_gauge("task_queue_depth", "Connections waiting for a worker thread",
+                               workers_queue_depth, NULL);
+    }
+
+    /* Initialize listener */
+    if (inherit.num_fds > 0) {
+        config.port = inherit.port;
+    }
+    if (listener_init(&g_listener, config.port, config.backlog) < 0) {
+        LOG_ERROR(NULL, "Failed to initialize listener");
+        workers_destroy();
+        store_destroy();
+        return EXIT_FAILURE;
+    }
+
+    /* One SO_REUSEPORT socket per loop thread */
+    if (config.io_mode == IO_MODE_REUSEPORT &&
+        listener_set_reuseport(&g_listener, config.num_threads, config.steer) < 0) {
+        LOG_ERROR(NULL, "Failed to configure SO_REUSEPORT listener");
+        listener_destroy(&g_listener);
+        store_destroy();
+        return EXIT_FAILURE;
+    }
+
+    /* Start listening for connections, or keep using the predecessor's sockets */
+    int listen_result = inherit.num_fds > 0
+        ? listener_adopt(&g_listener, inherit.fds, inherit.num_fds)
+        : listener_start(&g_listener);
+    if (listen_result == 0) {
+        inherit.num_fds = 0;
+    }
+    if (listen_result < 0) {
+        LOG_ERROR(NULL, "Failed to start listener");
+        handoff_inherit_close(&inherit);
+        listener_destroy(&g_listener);
+        workers_destroy();
+        store_destroy();
+        return EXIT_FAILURE;
+    }
+
+    /* Set up the epoll reactor, falling back to thread-per-connection */
+    if (config.io_mode == IO_MODE_EPOLL) {
+        void *submit_arg;
+        task_submit_t submit = workers_submit_fn(&submit_arg);
+        if (event_loop_init(&g_loop, &g_listener, 0, config.io_engine, submit, submit_arg) == 0) {
+            workers_set_handler(event_loop_process, &g_loop);
+            config.io_engine = g_loop.engine;
+        } else {
+            LOG_WARN(NULL, "epoll unavailable, falling back to threaded I/O");
+            config.io_mode = IO_MODE_THREADED;
+        }
+    }
+
+    /* Per-core loops, each owning one reuseport socket */
+    if (config.io_mode == IO_MODE_REUSEPORT &&
+        event_loop_group_init(&g_group, &g_listener, config.pin, config.io_engine) < 0) {
+        LOG_ERROR(NULL, "Failed to initialize reuseport event loops");
+        listener_destroy(&g_listener);
+        store_destroy();
+        return EXIT_FAILURE;
+    }
+    if (config.io_mode == IO_MODE_REUSEPORT) {
+        config.io_engine = g_group.loops[0].engine;
+    }
+
+    /* The blocking accept loop takes its connections off a multishot accept */
+    if (config.io_mode == IO_MODE_THREADED && config.io_engine == EVENT_ENGINE_URING &&
+        listener_use_uring(&g_listener) < 0) {
+        config.io_engine = EVENT_ENGINE_EPOLL;
+    }
+
+    /* Start worker threads */
+    if (workers_start() < 0) {
+        LOG_ERROR(NULL, "Failed to start worker pool");
+        if (config.io_mode == IO_MODE_EPOLL) {
+            event_loop_destroy(&g_loop);
+        }
+        listener_destroy(&g_listener);
+        workers_destroy();
+        store_destroy();
+        return EXIT_FAILURE;
+    }
+
+    LOG_INFO(NULL, "Server initialization complete (io=%s, engine=%s, scheduler=%s, threads=%d)",
+             config_io_mode_to_string(config.io_mode), event_engine_to_string(config.io_engine),
+             config_scheduler_mode_to_string(config.scheduler), config.num_threads);
+    LOG_INFO(NULL, "Press Ctrl+C to shutdown");
+
+    /* Hand over to the next server started with the same path */
+    if (config.handoff.path != NULL &&
+        handoff_listen(&g_handoff, &config.handoff, &g_listener) < 0) {
+        LOG_WARN(NULL, "Warm restart unavailable; a successor will start cold");
+    }
+    if (inherited > 0) {
+        LOG_INFO(NULL, "Warm restart complete in %.1fms",
+                 (double)(metrics_now_ns() - inherit.started_ns) / 1e6);
+    }
+
+    /* Main server loop - accept connections */
+    if (config.io_mode == IO_MODE_EPOLL) {
+        event_loop_run(&g_loop);
+    } else if (config.io_mode == IO_MODE_REUSEPORT) {
+        event_loop_group_run(&g_group);
+    } else {
+        run_accept_loop();
+    }
 
     /* Cleanup */
     LOG_INFO(NULL, "Shutting down server...");
 
-    /* Shutdown thread pool and wait for workers to finish */
-    thread_pool_shutdown(&g_pool);
-    thread_pool_destroy(&g_pool);
+    /* Stop taking successors; one that arrived gets the sockets once work is done */
+    handoff_stop(&g_handoff);
+    bool handing_off = handoff_pending(&g_handoff);
+    if (handing_off) {
+        if (config.io_mode == IO_MODE_THREADED) {
+            workers_drain(config.handoff.drain_ms);
+        }
+        /* Late payments get 503 and blocked reads give up, so the workers can be joined */
+        connection_set_drain(CONN_DRAIN_REFUSE);
+    }
+
+    /* Shutdown worker pool and wait for workers to finish (none may be in the store below) */
+    workers_shutdown();
+
+    if (handing_off) {
+        /* The successor binds the peer port and serves the keys from the image */
+        cluster_destroy(&g_cluster);
+        handoff_send(&g_handoff, &g_listener, &g_store, &g_wal);
+    }
+
+    /* Close connections still owned by the reactor */
+    if (config.io_mode == IO_MODE_EPOLL) {
+        event_loop_destroy(&g_loop);
+    } else if (config.io_mode == IO_MODE_REUSEPORT) {
+        event_loop_group_destroy(&g_group);
+    }
 
-    /* Destroy task queue */
-    task_queue_destroy(&g_queue);
+    /* Destroy worker pool and its queues */
+    workers_destroy();
 
     /* Destroy listener */
     listener_destroy(&g_listener);
 
+    /* Sync the idempotency log and free cached responses */
+    store_destroy();
+    dispatcher_destroy(&g_dispatcher);
+    fileserver_destroy(files);
+
+    http_date_stop();
+    metrics_destroy();
+    trace_stop();
+
     LOG_INFO(NULL, "Server shutdown complete");
 
     return EXIT_SUCCESS;
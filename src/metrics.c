@@ -0,0 +1,247 @@
+/*
+ * C-HTTP Payment Server - Metrics Registry
+ * Per-thread counters and latency histograms, merged only when scraped
+ *
+ * Every thread that records a sample gets its own cache-line aligned
+ * shard on first use; after that, recording is a thread-local add with no
+ * lock and no shared cache line. Shards are linked into a registry that
+ * only the scraper walks: it sums them with relaxed loads, so a scrape
+ * sees each value whole but not a snapshot across values (a histogram's
+ * sum may run a sample ahead of its buckets). Shards of threads that
+ * exit stay registered so their counts are not lost.
+ */
+
+#include "metrics.h"
+#include "logger.h"
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+_Thread_local metrics_shard_t *t_metrics_shard = NULL;
+
+/* Registered gauge */
+typedef struct {
+    const char *name;
+    const char *help;
+    metrics_gauge_fn fn;
+    void *arg;
+} metrics_gauge_t;
+
+/* Registry: shard list and gauges (the lock is taken on registration and scrapes only) */
+static pthread_mutex_t g_metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+static metrics_shard_t *g_metrics_shards = NULL;
+static metrics_gauge_t g_metrics_gauges[METRICS_MAX_GAUGES];
+static size_t g_metrics_gauge_count = 0;
+
+/* Counter and histogram names, in enum order */
+static const struct {
+    const char *family;
+    const char *label;
+    const char *help;
+} g_counter_info[METRIC_COUNTER_COUNT] = {
+#define METRICS_COUNTER_INFO(id, family, label, help) { family, label, help },
+    METRICS_COUNTERS(METRICS_COUNTER_INFO)
+#undef METRICS_COUNTER_INFO
+};
+
+static const struct {
+    const char *family;
+    const char *help;
+} g_histogram_info[METRIC_HISTOGRAM_COUNT] = {
+#define METRICS_HISTOGRAM_INFO(id, family, help) { family, help },
+    METRICS_HISTOGRAMS(METRICS_HISTOGRAM_INFO)
+#undef METRICS_HISTOGRAM_INFO
+};
+
+/*
+ * Create and register the calling thread's shard
+ * Returns the shard, NULL on error
+ */
+metrics_shard_t *metrics_shard_create(void) {
+    void *memory = NULL;
+    if (posix_memalign(&memory, METRICS_CACHE_LINE, sizeof(metrics_shard_t)) != 0) {
+        LOG_ERROR(NULL, "Failed to allocate metrics shard");
+        return NULL;
+    }
+
+    metrics_shard_t *shard = (metrics_shard_t *)memory;
+    memset(shard, 0, sizeof(*shard));
+
+    pthread_mutex_lock(&g_metrics_lock);
+    shard->next = g_metrics_shards;
+    g_metrics_shards = shard;
+    pthread_mutex_unlock(&g_metrics_lock);
+
+    t_metrics_shard = shard;
+    return shard;
+}
+
+/*
+ * Register a gauge read on every scrape
+ * Returns 0 on success, -1 on error
+ */
+int metrics_register_gauge(const char *name, const char *help, metrics_gauge_fn fn, void *arg) {
+    if (name == NULL || help == NULL || fn == NULL) {
+        LOG_ERROR(NULL, "metrics_register_gauge: NULL parameter");
+        return -1;
+    }
+
+    pthread_mutex_lock(&g_metrics_lock);
+    if (g_metrics_gauge_count == METRICS_MAX_GAUGES) {
+        pthread_mutex_unlock(&g_metrics_lock);
+        LOG_ERROR(NULL, "Too many gauges (max %d)", METRICS_MAX_GAUGES);
+        return -1;
+    }
+
+    metrics_gauge_t *gauge = &g_metrics_gauges[g_metrics_gauge_count++];
+    gauge->name = name;
+    gauge->help = help;
+    gauge->fn = fn;
+    gauge->arg = arg;
+    pthread_mutex_unlock(&g_metrics_lock);
+    return 0;
+}
+
+/*
+ * Helper function: Relaxed read of a value another thread writes
+ */
+static uint64_t load(const uint64_t *value) {
+    return __atomic_load_n(value, __ATOMIC_RELAXED);
+}
+
+/*
+ * Helper function: Append formatted text
+ * Returns false (and leaves *length past size) once the buffer is full
+ */
+__attribute__((format(printf, 4, 5)))
+static bool append(char *buffer, size_t size, size_t *length, const char *format, ...) {
+    if (*length >= size) {
+        return false;
+    }
+
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(buffer + *length, size - *length, format, args);
+    va_end(args);
+
+    *length += written < 0 ? size : (size_t)written;
+    return *length < size;
+}
+
+/*
+ * Merge every shard and render the Prometheus text exposition
+ * Returns the length written to buffer, -1 if it does not fit
+ */
+int metrics_render(char *buffer, size_t size) {
+    uint64_t counters[METRIC_COUNTER_COUNT];
+    uint64_t status[METRICS_STATUS_COUNT];
+    metrics_histogram_t histograms[METRIC_HISTOGRAM_COUNT];
+    size_t length = 0;
+
+    if (buffer == NULL || size == 0) {
+        return -1;
+    }
+
+    memset(counters, 0, sizeof(counters));
+    memset(status, 0, sizeof(status));
+    memset(histograms, 0, sizeof(histograms));
+
+    pthread_mutex_lock(&g_metrics_lock);
+    for (const metrics_shard_t *shard = g_metrics_shards; shard != NULL; shard = shard->next) {
+        for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {
+            counters[i] += load(&shard->counters[i]);
+        }
+        for (int i = 0; i < METRICS_STATUS_COUNT; i++) {
+            status[i] += load(&shard->status[i]);
+        }
+        for (int h = 0; h < METRIC_HISTOGRAM_COUNT; h++) {
+            for (int b = 0; b <= METRICS_HISTOGRAM_BUCKETS; b++) {
+                histograms[h].buckets[b] += load(&shard->histograms[h].buckets[b]);
+            }
+            histograms[h].sum_ns += load(&shard->histograms[h].sum_ns);
+        }
+    }
+
+    /* Gauges are sampled while registration is locked out */
+    for (size_t i = 0; i < g_metrics_gauge_count; i++) {
+        const metrics_gauge_t *gauge = &g_metrics_gauges[i];
+        append(buffer, size, &length,
+               "# HELP " METRICS_PREFIX "%s %s\n# TYPE " METRICS_PREFIX "%s gauge\n"
+               METRICS_PREFIX "%s %.17g\n",
+               gauge->name, gauge->help, gauge->name, gauge->name, gauge->fn(gauge->arg));
+    }
+    pthread_mutex_unlock(&g_metrics_lock);
+
+    for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {
+        const char *family = g_counter_info[i].family;
+        if (i == 0 || strcmp(family, g_counter_info[i - 1].family) != 0) {
+            append(buffer, size, &length,
+                   "# HELP " METRICS_PREFIX "%s %s\n# TYPE " METRICS_PREFIX "%s counter\n",
+                   family, g_counter_info[i].help, family);
+        }
+        append(buffer, size, &length, METRICS_PREFIX "%s%s %llu\n",
+               family, g_counter_info[i].label, (unsigned long long)counters[i]);
+    }
+
+    /* Only codes that were answered at least once */
+    append(buffer, size, &length,
+           "# HELP " METRICS_PREFIX "http_responses_total Responses sent by status code\n"
+           "# TYPE " METRICS_PREFIX "http_responses_total counter\n");
+    for (int i = 0; i < METRICS_STATUS_COUNT; i++) {
+        if (status[i] != 0) {
+            append(buffer, size, &length, METRICS_PREFIX "http_responses_total{code=\"%d\"} %llu\n",
+                   i + METRICS_STATUS_MIN, (unsigned long long)status[i]);
+        }
+    }
+
+    for (int h = 0; h < METRIC_HISTOGRAM_COUNT; h++) {
+        const char *family = g_histogram_info[h].family;
+        append(buffer, size, &length,
+               "# HELP " METRICS_PREFIX "%s %s\n# TYPE " METRICS_PREFIX "%s histogram\n",
+               family, g_histogram_info[h].help, family);
+
+        /* Buckets are exported cumulatively; +Inf is the total count */
+        uint64_t cumulative = 0;
+        for (int b = 0; b < METRICS_HISTOGRAM_BUCKETS; b++) {
+            cumulative += histograms[h].buckets[b];
+            double bound = (double)((uint64_t)METRICS_HISTOGRAM_BASE_NS << b) / 1e9;
+            append(buffer, size, &length, METRICS_PREFIX "%s_bucket{le=\"%.10g\"} %llu\n",
+                   family, bound, (unsigned long long)cumulative);
+        }
+        cumulative += histograms[h].buckets[METRICS_HISTOGRAM_BUCKETS];
+        append(buffer, size, &length,
+               METRICS_PREFIX "%s_bucket{le=\"+Inf\"} %llu\n"
+               METRICS_PREFIX "%s_sum %.9f\n"
+               METRICS_PREFIX "%s_count %llu\n",
+               family, (unsigned long long)cumulative,
+               family, (double)histograms[h].sum_ns / 1e9,
+               family, (unsigned long long)cumulative);
+    }
+
+    if (length >= size) {
+        LOG_ERROR(NULL, "Metrics exposition exceeds %zu bytes", size);
+        return -1;
+    }
+    return (int)length;
+}
+
+/*
+ * Free every shard and forget the gauges
+ */
+void metrics_destroy(void) {
+    pthread_mutex_lock(&g_metrics_lock);
+    metrics_shard_t *shard = g_metrics_shards;
+    g_metrics_shards = NULL;
+    g_metrics_gauge_count = 0;
+    pthread_mutex_unlock(&g_metrics_lock);
+
+    while (shard != NULL) {
+        metrics_shard_t *next = shard->next;
+        free(shard);
+        shard = next;
+    }
+    t_metrics_shard = NULL;
+}
@@ -0,0 +1,148 @@
+/*
+ * C-HTTP Payment Server - Overload Protection
+ * Queue-time deadlines and CoDel load shedding
+ *
+ * Work is judged when a worker picks it up, by how long it waited: during
+ * a spike, queued connections age past the point where their clients are
+ * still listening, and serving them only delays the requests behind them.
+ *
+ * The deadline is a hard cap. CoDel (Nichols and Jacobson) adapts instead:
+ * a standing queue is one whose wait stays above target for a whole
+ * interval. While it stands, tasks above target are shed, the n-th one
+ * interval / sqrt(n) after the previous, until a wait below target shows
+ * the queue has drained. Short bursts that clear within an interval are
+ * never shed. The state is shared by every worker; it is only locked once
+ * waits exceed target, so an unloaded server pays one relaxed load.
+ */
+
+#include "overload.h"
+#include "logger.h"
+#include "metrics.h"
+#include <pthread.h>
+
+/* Active settings (written before serving traffic) */
+static overload_config_t g_overload_config = {
+    .queue_limit = OVERLOAD_DEFAULT_QUEUE_LIMIT,
+    .deadline_ms = OVERLOAD_DEFAULT_DEADLINE_MS,
+    .codel_target_ms = OVERLOAD_DEFAULT_CODEL_TARGET_MS,
+    .codel_interval_ms = OVERLOAD_DEFAULT_CODEL_INTERVAL_MS
+};
+
+/* CoDel state */
+static struct {
+    pthread_mutex_t lock;
+    bool above;                 /* Last wait was above target (read unlocked) */
+    bool dropping;              /* Standing queue: shedding */
+    uint64_t first_above_ns;    /* When a wait above target turns into a standing queue */
+    uint64_t drop_next_ns;      /* Next shed while dropping */
+    uint64_t count;             /* Tasks shed since dropping started */
+} g_codel = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/*
+ * Fill overload settings with built-in defaults
+ */
+void overload_config_init_defaults(overload_config_t *config) {
+    if (config == NULL) {
+        return;
+    }
+
+    config->queue_limit = OVERLOAD_DEFAULT_QUEUE_LIMIT;
+    config->deadline_ms = OVERLOAD_DEFAULT_DEADLINE_MS;
+    config->codel_target_ms = OVERLOAD_DEFAULT_CODEL_TARGET_MS;
+    config->codel_interval_ms = OVERLOAD_DEFAULT_CODEL_INTERVAL_MS;
+}
+
+/*
+ * Apply overload settings
+ */
+void overload_configure(const overload_config_t *config) {
+    if (config == NULL) {
+        return;
+    }
+
+    g_overload_config = *config;
+    if (g_overload_config.codel_interval_ms <= 0) {
+        g_overload_config.codel_interval_ms = OVERLOAD_DEFAULT_CODEL_INTERVAL_MS;
+    }
+
+    if (config->queue_limit > 0 || config->deadline_ms > 0 || config->codel_target_ms > 0) {
+        LOG_INFO(NULL, "Overload protection: queue limit %d, deadline %dms, CoDel target %dms "
+                 "interval %dms", config->queue_limit, config->deadline_ms,
+                 config->codel_target_ms, g_overload_config.codel_interval_ms);
+    }
+}
+
+/*
+ * Helper function: Integer square root (n >= 1)
+ */
+static uint64_t isqrt(uint64_t n) {
+    uint64_t x = n;
+    uint64_t y = (x + 1) / 2;
+    while (y < x) {
+        x = y;
+        y = (x + n / x) / 2;
+    }
+    return x;
+}
+
+/*
+ * Helper function: CoDel verdict for one queue wait
+ * Returns true if the task should be shed
+ */
+static bool codel_shed(uint64_t wait_ns) {
+    uint64_t target_ns = (uint64_t)g_overload_config.codel_target_ms * 1000000;
+    uint64_t interval_ns = (uint64_t)g_overload_config.codel_interval_ms * 1000000;
+
+    /* Common case: no queue building up */
+    if (wait_ns < target_ns && !__atomic_load_n(&g_codel.above, __ATOMIC_RELAXED)) {
+        return false;
+    }
+
+    uint64_t now = metrics_now_ns();
+    bool shed = false;
+
+    pthread_mutex_lock(&g_codel.lock);
+    if (wait_ns < target_ns) {
+        /* Queue drained: leave the dropping state */
+        g_codel.first_above_ns = 0;
+        g_codel.dropping = false;
+        __atomic_store_n(&g_codel.above, false, __ATOMIC_RELAXED);
+    } else if (g_codel.first_above_ns == 0) {
+        /* Above target: give it one interval to drain */
+        g_codel.first_above_ns = now + interval_ns;
+        __atomic_store_n(&g_codel.above, true, __ATOMIC_RELAXED);
+    } else if (!g_codel.dropping) {
+        if (now >= g_codel.first_above_ns) {
+            g_codel.dropping = true;
+            g_codel.count = 1;
+            g_codel.drop_next_ns = now + interval_ns;
+            shed = true;
+        }
+    } else if (now >= g_codel.drop_next_ns) {
+        g_codel.count++;
+        g_codel.drop_next_ns += interval_ns / isqrt(g_codel.count);
+        shed = true;
+    }
+    pthread_mutex_unlock(&g_codel.lock);
+
+    return shed;
+}
+
+/*
+ * Decide whether a task that waited wait_ns for a worker should be shed
+ * Returns true if the caller should answer 503 instead of serving the task
+ */
+bool overload_shed(uint64_t wait_ns) {
+    if (g_overload_config.deadline_ms > 0 &&
+        wait_ns > (uint64_t)g_overload_config.deadline_ms * 1000000) {
+        metrics_add(METRIC_SHED_DEADLINE, 1);
+        return true;
+    }
+
+    if (g_overload_config.codel_target_ms > 0 && codel_shed(wait_ns)) {
+        metrics_add(METRIC_SHED_CODEL, 1);
+        return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,615 @@
+/*
+ * C-HTTP Payment Server - Work-Stealing Scheduler
+ * One pinned worker per core with local deques and work stealing
+ *
+ * Every connection has a home worker (affinity % num_workers). Tasks
+ * submitted from the home worker itself go on its Chase-Lev deque, which
+ * only the owner pushes and pops; tasks from other threads (the reactor or
+ * accept loop) go into the home worker's inbox ring. A worker serves its
+ * own deque first, newest task first while its data is still in cache,
+ * then its inbox. Only when both are empty does it steal, oldest first,
+ * from its neighbours' deques and inboxes, so a connection migrates only
+ * when its home core is busy and another core would otherwise sit idle.
+ *
+ * Idle workers park on their own futex word. Submitters wake the home
+ * worker if it is asleep, or else any sleeping worker so it can steal;
+ * while every worker is busy a submit costs no syscall.
+ */
+
+#include "scheduler.h"
+#include "connection.h"
+#include "logger.h"
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sched.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+/* Worker running on the current thread (NULL outside the scheduler) */
+static _Thread_local scheduler_worker_t *t_worker = NULL;
+
+/* Empty polls before an idle worker parks (0 on one CPU) */
+static int g_spin_limit = 0;
+
+/*
+ * Helper function: Hint to the CPU that we are spinning
+ */
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/*
+ * Helper function: Owner push onto the bottom of the deque
+ * Returns true on success, false if the deque is full
+ */
+static bool deque_push(sched_deque_t *deque, int client_fd) {
+    long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+    long top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+
+    if (bottom - top >= SCHEDULER_DEQUE_CAPACITY) {
+        return false;
+    }
+
+    __atomic_store_n(&deque->slots[bottom & (SCHEDULER_DEQUE_CAPACITY - 1)], client_fd,
+                     __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+/*
+ * Helper function: Owner pop from the bottom of the deque
+ * Returns client_fd on success, -1 if the deque is empty
+ */
+static int deque_pop(sched_deque_t *deque) {
+    long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+
+    if (top > bottom) {
+        /* Empty: restore bottom */
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    int client_fd = __atomic_load_n(&deque->slots[bottom & (SCHEDULER_DEQUE_CAPACITY - 1)],
+                                    __ATOMIC_RELAXED);
+    if (top == bottom) {
+        /* Last task: race thieves for it */
+        if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, false,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            client_fd = -1;
+        }
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+    }
+
+    return client_fd;
+}
+
+/*
+ * Helper function: Thief steal from the top of the deque
+ * Returns client_fd on success, -1 if empty or lost the race
+ */
+static int deque_steal(sched_deque_t *deque) {
+    long top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+
+    if (top >= bottom) {
+        return -1;
+    }
+
+    int client_fd = __atomic_load_n(&deque->slots[top & (SCHEDULER_DEQUE_CAPACITY - 1)],
+                                    __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return -1;
+    }
+
+    return client_fd;
+}
+
+/*
+ * Helper function: Find the next task for a worker
+ * Own deque, then own inbox, then neighbours starting with the next index
+ * wait_ns receives how long an inbox task was queued (0 for deque tasks)
+ * Returns client_fd on success, -1 if no work is queued anywhere
+ */
+static int worker_next_task(scheduler_worker_t *worker, uint64_t *wait_ns) {
+    scheduler_t *sched = worker->sched;
+
+    *wait_ns = 0;
+    int client_fd = deque_pop(&worker->deque);
+    if (client_fd >= 0) {
+        return client_fd;
+    }
+
+    client_fd = task_queue_try_dequeue(&worker->inbox, wait_ns);
+    if (client_fd >= 0) {
+        return client_fd;
+    }
+
+    for (int i = 1; i < sched->num_workers; i++) {
+        scheduler_worker_t *victim = &sched->workers[(worker->index + i) % sched->num_workers];
+
+        client_fd = deque_steal(&victim->deque);
+        if (client_fd < 0) {
+            client_fd = task_queue_try_dequeue(&victim->inbox, wait_ns);
+        }
+        if (client_fd >= 0) {
+            LOG_DEBUG(NULL, "Worker %d stole client_fd=%d from worker %d",
+                      worker->index, client_fd, victim->index);
+            return client_fd;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Helper function: Wake a parked worker
+ * Returns true if the worker was parked (and is now woken)
+ */
+static bool worker_wake(scheduler_worker_t *worker) {
+    if (__atomic_exchange_n(&worker->parked, 0, __ATOMIC_ACQ_REL) == 0) {
+        return false;
+    }
+
+    __atomic_fetch_add(&worker->park_sequence, 1, __ATOMIC_SEQ_CST);
+#ifdef __linux__
+    syscall(SYS_futex, &worker->park_sequence, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#else
+    pthread_mutex_lock(&worker->park_mutex);
+    pthread_cond_broadcast(&worker->park_cond);
+    pthread_mutex_unlock(&worker->park_mutex);
+#endif
+    return true;
+}
+
+/*
+ * Helper function: Sleep until woken, unless work shows up first
+ * wait_ns receives the queue wait of a task found (see worker_next_task())
+ * Returns client_fd found while preparing to park, or -1 after waking
+ */
+static int worker_park(scheduler_worker_t *worker, uint64_t *wait_ns) {
+    uint32_t seq = __atomic_load_n(&worker->park_sequence, __ATOMIC_ACQUIRE);
+
+    /* Announce, then re-check: pairs with the fence in scheduler_submit() */
+    __atomic_store_n(&worker->parked, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    int client_fd = worker_next_task(worker, wait_ns);
+    if (client_fd >= 0 || __atomic_load_n(&worker->sched->shutdown, __ATOMIC_ACQUIRE)) {
+        __atomic_store_n(&worker->parked, 0, __ATOMIC_RELAXED);
+        return client_fd;
+    }
+
+#ifdef __linux__
+    syscall(SYS_futex, &worker->park_sequence, FUTEX_WAIT_PRIVATE, seq, NULL, NULL, 0);
+#else
+    pthread_mutex_lock(&worker->park_mutex);
+    while (__atomic_load_n(&worker->park_sequence, __ATOMIC_ACQUIRE) == seq) {
+        pthread_cond_wait(&worker->park_cond, &worker->park_mutex);
+    }
+    pthread_mutex_unlock(&worker->park_mutex);
+#endif
+
+    __atomic_store_n(&worker->parked, 0, __ATOMIC_RELAXED);
+    return -1;
+}
+
+/*
+ * Helper function: Pin the calling thread to the worker's CPU
+ */
+static void worker_pin(scheduler_worker_t *worker) {
+    if (worker->cpu >= 0 && scheduler_pin_self(worker->cpu) < 0) {
+        LOG_WARN(NULL, "Worker %d: failed to pin to CPU %d", worker->index, worker->cpu);
+        worker->cpu = -1;
+    }
+}
+
+/*
+ * Worker thread function
+ * Runs local, inbox and stolen tasks until shutdown
+ */
+static void *scheduler_worker_thread(void *arg) {
+    scheduler_worker_t *worker = (scheduler_worker_t *)arg;
+    scheduler_t *sched = worker->sched;
+
+    t_worker = worker;
+    worker_pin(worker);
+
+    LOG_INFO(NULL, "Worker %d started (cpu=%d)", worker->index, worker->cpu);
+
+    int spins = 0;
+    while (!__atomic_load_n(&sched->shutdown, __ATOMIC_ACQUIRE)) {
+        uint64_t wait_ns;
+        int client_fd = worker_next_task(worker, &wait_ns);
+
+        if (client_fd < 0) {
+            /* Nothing queued: spin briefly on multi-core hosts, then park */
+            if (spins < g_spin_limit) {
+                spins++;
+                cpu_relax();
+                continue;
+            }
+            spins = 0;
+            client_fd = worker_park(worker, &wait_ns);
+            if (client_fd < 0) {
+                continue;
+            }
+        }
+        spins = 0;
+
+        LOG_DEBUG(NULL, "Worker %d processing client_fd=%d", worker->index, client_fd);
+
+        if (sched->handler != NULL) {
+            /* Custom handler takes ownership of the fd */
+            sched->handler(client_fd, sched->handler_arg);
+        } else {
+            connection_run(client_fd, wait_ns);
+        }
+    }
+
+    LOG_INFO(NULL, "Worker %d exited", worker->index);
+    t_worker = NULL;
+    return NULL;
+}
+
+/*
+ * Helper function: Assign CPUs to workers according to the pinning policy
+ * Workers are spread round-robin over the CPUs this process may run on
+ */
+static void scheduler_assign_cpus(scheduler_t *sched) {
+    int cpus[SCHEDULER_MAX_CPUS];
+    int num_cpus = sched->pin == SCHED_PIN_CORES
+                   ? scheduler_allowed_cpus(cpus, SCHEDULER_MAX_CPUS) : 0;
+
+    for (int i = 0; i < sched->num_workers; i++) {
+        sched->workers[i].cpu = num_cpus > 0 ? cpus[i % num_cpus] : -1;
+    }
+}
+
+/*
+ * Initialize scheduler
+ * num_workers: Number of workers (0 = one per online CPU)
+ * pin: CPU pinning policy
+ * Returns 0 on success, -1 on error
+ */
+int scheduler_init(scheduler_t *sched, int num_workers, sched_pin_t pin) {
+    if (sched == NULL || num_workers < 0) {
+        LOG_ERROR(NULL, "scheduler_init: invalid parameters");
+        return -1;
+    }
+
+    int cpus[SCHEDULER_MAX_CPUS];
+    int num_cpus = scheduler_allowed_cpus(cpus, SCHEDULER_MAX_CPUS);
+    if (num_cpus <= 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        num_cpus = online > 0 ? (int)online : 1;
+    }
+    if (num_workers == 0) {
+        num_workers = num_cpus;
+    }
+    g_spin_limit = num_cpus > 1 ? TASK_QUEUE_SPIN_LIMIT : 0;
+
+    /* Workers carry cache-line aligned members */
+    sched->workers = (scheduler_worker_t *)aligned_alloc(TASK_QUEUE_CACHE_LINE,
+                                                         sizeof(scheduler_worker_t) * num_workers);
+    if (sched->workers == NULL) {
+        LOG_ERROR(NULL, "Failed to allocate scheduler workers: %s", strerror(errno));
+        return -1;
+    }
+    memset(sched->workers, 0, sizeof(scheduler_worker_t) * num_workers);
+
+    sched->num_workers = num_workers;
+    sched->pin = pin;
+    sched->shutdown = false;
+    sched->handler = NULL;
+    sched->handler_arg = NULL;
+
+    for (int i = 0; i < num_workers; i++) {
+        scheduler_worker_t *worker = &sched->workers[i];
+        worker->sched = sched;
+        worker->index = i;
+
+        if (task_queue_init(&worker->inbox, SCHEDULER_INBOX_CAPACITY) < 0) {
+            LOG_ERROR(NULL, "Failed to initialize inbox for worker %d", i);
+            for (int j = 0; j < i; j++) {
+                task_queue_destroy(&sched->workers[j].inbox);
+            }
+            free(sched->workers);
+            sched->workers = NULL;
+            return -1;
+        }
+
+#ifndef __linux__
+        pthread_mutex_init(&worker->park_mutex, NULL);
+        pthread_cond_init(&worker->park_cond, NULL);
+#endif
+    }
+
+    scheduler_assign_cpus(sched);
+
+    LOG_INFO(NULL, "Scheduler initialized with %d workers on %d CPUs (pin=%s)",
+             num_workers, num_cpus, scheduler_pin_to_string(pin));
+    return 0;
+}
+
+/*
+ * Set the handler workers run for each task
+ */
+void scheduler_set_handler(scheduler_t *sched, task_handler_t handler, void *arg) {
+    if (sched == NULL) {
+        return;
+    }
+
+    sched->handler = handler;
+    sched->handler_arg = arg;
+}
+
+/*
+ * Refuse submissions once limit tasks wait in a worker's inbox
+ */
+void scheduler_set_queue_limit(scheduler_t *sched, int limit) {
+    if (sched == NULL || sched->workers == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < sched->num_workers; i++) {
+        task_queue_set_limit(&sched->workers[i].inbox, limit);
+    }
+}
+
+/*
+ * Start all workers (pinned according to the policy)
+ * Returns 0 on success, -1 on error
+ */
+int scheduler_start(scheduler_t *sched) {
+    if (sched == NULL || sched->workers == NULL) {
+        LOG_ERROR(NULL, "scheduler_start: invalid scheduler");
+        return -1;
+    }
+
+    LOG_INFO(NULL, "Starting %d scheduler workers...", sched->num_workers);
+
+    int started = 0;
+    for (int i = 0; i < sched->num_workers; i++) {
+        scheduler_worker_t *worker = &sched->workers[i];
+        int rc = pthread_create(&worker->thread, NULL, scheduler_worker_thread, worker);
+        if (rc != 0) {
+            LOG_ERROR(NULL, "Failed to create worker %d: %s", i, strerror(rc));
+
+            /* Its inbox is still drained by the others through stealing */
+            worker->thread = 0;
+        } else {
+            started++;
+        }
+    }
+
+    if (started == 0) {
+        LOG_ERROR(NULL, "No scheduler workers could be started");
+        return -1;
+    }
+
+    LOG_INFO(NULL, "Scheduler started");
+    return 0;
+}
+
+/*
+ * Submit a client_fd to its home worker
+ * Returns 0 on success, -1 on error
+ */
+int scheduler_submit(void *arg, int client_fd, int affinity) {
+    scheduler_t *sched = (scheduler_t *)arg;
+    if (sched == NULL || sched->workers == NULL || client_fd < 0) {
+        return -1;
+    }
+
+    if (__atomic_load_n(&sched->shutdown, __ATOMIC_ACQUIRE)) {
+        LOG_WARN(NULL, "Cannot submit task: scheduler is shutting down");
+        return -1;
+    }
+
+    unsigned int home_index = (unsigned int)affinity % (unsigned int)sched->num_workers;
+    scheduler_worker_t *home = &sched->workers[home_index];
+
+    /* From the home worker itself the task stays on its own core */
+    if (t_worker != home || !deque_push(&home->deque, client_fd)) {
+        if (task_queue_enqueue(&home->inbox, client_fd) < 0) {
+            return -1;
+        }
+    }
+
+    /* Publish before checking for sleepers: pairs with the fence in worker_park() */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (worker_wake(home)) {
+        return 0;
+    }
+
+    /* Home worker is busy: let an idle neighbour steal the task */
+    for (int i = 1; i < sched->num_workers; i++) {
+        if (worker_wake(&sched->workers[(home_index + i) % sched->num_workers])) {
+            break;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Count tasks waiting in every worker's deque and inbox
+ * Returns number of queued tasks
+ */
+int scheduler_pending(scheduler_t *sched) {
+    if (sched == NULL || sched->workers == NULL) {
+        return 0;
+    }
+
+    int pending = 0;
+    for (int i = 0; i < sched->num_workers; i++) {
+        scheduler_worker_t *worker = &sched->workers[i];
+        long top = __atomic_load_n(&worker->deque.top, __ATOMIC_ACQUIRE);
+        long bottom = __atomic_load_n(&worker->deque.bottom, __ATOMIC_ACQUIRE);
+
+        /* bottom dips below top while the owner pops the last entry */
+        if (bottom > top) {
+            pending += (int)(bottom - top);
+        }
+        pending += task_queue_size(&worker->inbox);
+    }
+    return pending;
+}
+
+/*
+ * Shutdown scheduler gracefully
+ * Waits for all workers to finish
+ * Returns 0 on success, -1 on error
+ */
+int scheduler_shutdown(scheduler_t *sched) {
+    if (sched == NULL || sched->workers == NULL) {
+        return -1;
+    }
+
+    LOG_INFO(NULL, "Shutting down scheduler...");
+
+    __atomic_store_n(&sched->shutdown, true, __ATOMIC_SEQ_CST);
+
+    for (int i = 0; i < sched->num_workers; i++) {
+        scheduler_worker_t *worker = &sched->workers[i];
+        task_queue_shutdown(&worker->inbox);
+
+        /* Wake unconditionally: the worker may be between its checks */
+        __atomic_store_n(&worker->parked, 1, __ATOMIC_RELAXED);
+        worker_wake(worker);
+    }
+
+    int joined = 0;
+    for (int i = 0; i < sched->num_workers; i++) {
+        scheduler_worker_t *worker = &sched->workers[i];
+        if (worker->thread == 0) {
+            continue;
+        }
+
+        int rc = pthread_join(worker->thread, NULL);
+        if (rc == 0) {
+            joined++;
+        } else {
+            LOG_WARN(NULL, "Failed to join worker %d: %s", i, strerror(rc));
+        }
+    }
+
+    LOG_INFO(NULL, "Scheduler shutdown complete (%d/%d workers joined)",
+             joined, sched->num_workers);
+    return 0;
+}
+
+/*
+ * Destroy scheduler and free resources
+ * Should be called after shutdown completes
+ */
+void scheduler_destroy(scheduler_t *sched) {
+    if (sched == NULL || sched->workers == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < sched->num_workers; i++) {
+        scheduler_worker_t *worker = &sched->workers[i];
+
+        /* Connections no worker got to: without a custom handler the scheduler owns them */
+        int client_fd;
+        while ((client_fd = deque_pop(&worker->deque)) >= 0 ||
+               (client_fd = task_queue_try_dequeue(&worker->inbox, NULL)) >= 0) {
+            if (sched->handler == NULL) {
+                LOG_WARN(NULL, "Closing unprocessed connection (client_fd=%d)", client_fd);
+                close(client_fd);
+            } else {
+                LOG_WARN(NULL, "Dropping unprocessed task (client_fd=%d)", client_fd);
+            }
+        }
+        task_queue_destroy(&worker->inbox);
+
+#ifndef __linux__
+        pthread_cond_destroy(&worker->park_cond);
+        pthread_mutex_destroy(&worker->park_mutex);
+#endif
+    }
+
+    free(sched->workers);
+    sched->workers = NULL;
+    sched->num_workers = 0;
+
+    LOG_INFO(NULL, "Scheduler destroyed");
+}
+
+/*
+ * Convert pinning policy enum to string
+ */
+const char *scheduler_pin_to_string(sched_pin_t pin) {
+    switch (pin) {
+        case SCHED_PIN_NONE:  return "none";
+        case SCHED_PIN_CORES: return "cores";
+        default:              return "unknown";
+    }
+}
+
+/*
+ * List the CPUs this process may run on
+ * Returns number of CPUs written to cpus, 0 if unknown
+ */
+int scheduler_allowed_cpus(int *cpus, int max_cpus) {
+    if (cpus == NULL || max_cpus <= 0) {
+        return 0;
+    }
+
+#ifdef __linux__
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        LOG_WARN(NULL, "sched_getaffinity failed: %s", strerror(errno));
+        return 0;
+    }
+
+    int count = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE && count < max_cpus; cpu++) {
+        if (CPU_ISSET(cpu, &allowed)) {
+            cpus[count++] = cpu;
+        }
+    }
+    return count;
+#else
+    return 0;
+#endif
+}
+
+/*
+ * Pin the calling thread to one CPU
+ * Returns 0 on success, -1 on error
+ */
+int scheduler_pin_self(int cpu) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (rc != 0) {
+        LOG_WARN(NULL, "pthread_setaffinity_np(cpu=%d) failed: %s", cpu, strerror(rc));
+        return -1;
+    }
+    return 0;
+#else
+    (void)cpu;
+    LOG_WARN(NULL, "CPU pinning not supported on this platform");
+    return -1;
+#endif
+}
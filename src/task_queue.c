@@ -1,17 +1,175 @@
 /*
- * C-HTTP Payment Server - Thread-Safe Task Queue
- * FIFO queue for distributing client connections to worker threads
+ * C-HTTP Payment Server - Lock-Free Task Queue
+ * Bounded MPMC ring for distributing client connections to worker threads
+ *
+ * The ring is Dmitry Vyukov's bounded MPMC queue: every slot carries a
+ * sequence number saying whether it is ready to be filled (sequence ==
+ * position) or drained (sequence == position + 1). Producers and consumers
+ * each advance their own index with a CAS, so enqueue and dequeue never
+ * contend on a shared lock and each side's index sits on its own cache line.
+ *
+ * Idle workers spin for a short while and then park. Parking follows the
+ * eventcount pattern: read the wakeup sequence, announce as a waiter,
+ * re-check the ring, then sleep only if the sequence is unchanged. Wakers
+ * publish their slot, then look for announced waiters, so the common case
+ * (workers busy) costs producers no syscall. "Not empty" and "not full"
+ * have separate parking words so a wakeup always reaches the right side.
  */
 
 #include "task_queue.h"
 #include "logger.h"
+#include "metrics.h"
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+/*
+ * Helper function: Hint to the CPU that we are spinning
+ */
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/*
+ * Helper function: Claim the next free slot and publish client_fd
+ * Returns true on success, false if the ring is full
+ */
+static bool ring_push(task_queue_t *queue, int client_fd) {
+    size_t pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+
+    for (;;) {
+        task_slot_t *slot = &queue->slots[pos & queue->mask];
+        size_t seq = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff == 0) {
+            /* Slot is free for this position: try to claim it (pos reloads on failure) */
+            if (__atomic_compare_exchange_n(&queue->enqueue_pos, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                slot->client_fd = client_fd;
+                slot->enqueued_ns = metrics_now_ns();
+                __atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+                return true;
+            }
+        } else if (diff < 0) {
+            /* Slot still holds the entry from one lap ago */
+            return false;
+        } else {
+            /* Another producer claimed pos; catch up */
+            pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/*
+ * Helper function: Claim the oldest filled slot
+ * enqueued_ns (may be NULL) receives the time the entry was queued
+ * Returns true on success, false if the ring is empty
+ */
+static bool ring_pop(task_queue_t *queue, int *client_fd, uint64_t *enqueued_ns) {
+    size_t pos = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED);
+
+    for (;;) {
+        task_slot_t *slot = &queue->slots[pos & queue->mask];
+        size_t seq = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&queue->dequeue_pos, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                *client_fd = slot->client_fd;
+                if (enqueued_ns != NULL) {
+                    *enqueued_ns = slot->enqueued_ns;
+                }
+                /* Hand the slot to the producer one lap ahead */
+                __atomic_store_n(&slot->sequence, pos + queue->mask + 1, __ATOMIC_RELEASE);
+                return true;
+            }
+        } else if (diff < 0) {
+            /* Slot not yet filled for this position */
+            return false;
+        } else {
+            pos = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/*
+ * Helper function: Sleep while the parking word still equals expected
+ * May return spuriously; callers re-check the ring
+ */
+static void park_wait(task_queue_t *queue, task_park_t *park, uint32_t expected) {
+#ifdef __linux__
+    (void)queue;
+    syscall(SYS_futex, &park->sequence, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+#else
+    pthread_mutex_lock(&queue->park_mutex);
+    while (__atomic_load_n(&park->sequence, __ATOMIC_ACQUIRE) == expected) {
+        pthread_cond_wait(&queue->park_cond, &queue->park_mutex);
+    }
+    pthread_mutex_unlock(&queue->park_mutex);
+#endif
+}
+
+/*
+ * Helper function: Bump the parking word and wake up to count waiters
+ */
+static void park_wake(task_queue_t *queue, task_park_t *park, int count) {
+    __atomic_fetch_add(&park->sequence, 1, __ATOMIC_SEQ_CST);
+#ifdef __linux__
+    (void)queue;
+    syscall(SYS_futex, &park->sequence, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+#else
+    (void)count;
+    pthread_mutex_lock(&queue->park_mutex);
+    pthread_cond_broadcast(&queue->park_cond);
+    pthread_mutex_unlock(&queue->park_mutex);
+#endif
+}
+
+/*
+ * Helper function: Wake one waiter if any announced itself
+ * The fence orders the caller's ring update before the waiter check, pairing
+ * with the fence in park_prepare()
+ */
+static void park_notify(task_queue_t *queue, task_park_t *park) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&park->waiters, __ATOMIC_RELAXED) > 0) {
+        park_wake(queue, park, 1);
+    }
+}
+
+/*
+ * Helper function: Announce a waiter before the final ring re-check
+ * Returns the parking word to pass to park_wait()
+ */
+static uint32_t park_prepare(task_park_t *park) {
+    uint32_t seq = __atomic_load_n(&park->sequence, __ATOMIC_ACQUIRE);
+    __atomic_fetch_add(&park->waiters, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return seq;
+}
+
+/*
+ * Helper function: Withdraw a waiter announced by park_prepare()
+ */
+static void park_cancel(task_park_t *park) {
+    __atomic_fetch_sub(&park->waiters, 1, __ATOMIC_RELAXED);
+}
 
 /*
  * Initialize task queue
- * max_size: Maximum number of tasks (0 = unlimited)
+ * max_size: Capacity, rounded up to a power of two (0 = default capacity)
  * Returns 0 on success, -1 on error
  */
 int task_queue_init(task_queue_t *queue, int max_size) {
@@ -20,169 +178,217 @@ int task_queue_init(task_queue_t *queue, int max_size) {
         return -1;
     }
 
-    /* Initialize queue structure */
-    queue->head = NULL;
-    queue->tail = NULL;
-    queue->count = 0;
-    queue->max_size = max_size;
-    queue->shutdown = false;
+    if (max_size < 0) {
+        LOG_ERROR(NULL, "task_queue_init: invalid max_size=%d", max_size);
+        return -1;
+    }
+
+    memset(queue, 0, sizeof(*queue));
+
+    /* Capacity must be a power of two so positions map to slots with a mask */
+    size_t capacity = max_size == 0 ? TASK_QUEUE_DEFAULT_CAPACITY : 2;
+    while (capacity < (size_t)max_size) {
+        capacity <<= 1;
+    }
+
+    void *slots = NULL;
+    if (posix_memalign(&slots, TASK_QUEUE_CACHE_LINE, capacity * sizeof(task_slot_t)) != 0) {
+        LOG_ERROR(NULL, "Failed to allocate task ring (%zu slots)", capacity);
+        return -1;
+    }
+
+    queue->slots = (task_slot_t *)slots;
+    queue->mask = capacity - 1;
+    queue->max_size = (int)capacity;
+    for (size_t i = 0; i < capacity; i++) {
+        queue->slots[i].sequence = i;
+        queue->slots[i].client_fd = -1;
+    }
+
+    /* Spinning only helps when the producer can run at the same time */
+    queue->spin_limit = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? TASK_QUEUE_SPIN_LIMIT : 0;
 
-    /* Initialize mutex */
-    if (pthread_mutex_init(&queue->mutex, NULL) != 0) {
+#ifndef __linux__
+    if (pthread_mutex_init(&queue->park_mutex, NULL) != 0) {
         LOG_ERROR(NULL, "Failed to initialize queue mutex: %s", strerror(errno));
+        free(queue->slots);
+        queue->slots = NULL;
         return -1;
     }
 
-    /* Initialize condition variable */
-    if (pthread_cond_init(&queue->cond, NULL) != 0) {
+    if (pthread_cond_init(&queue->park_cond, NULL) != 0) {
         LOG_ERROR(NULL, "Failed to initialize queue condition variable: %s", strerror(errno));
-        pthread_mutex_destroy(&queue->mutex);
+        pthread_mutex_destroy(&queue->park_mutex);
+        free(queue->slots);
+        queue->slots = NULL;
         return -1;
     }
+#endif
 
-    LOG_DEBUG(NULL, "Task queue initialized (max_size=%d)", max_size);
+    LOG_DEBUG(NULL, "Task queue initialized (capacity=%zu)", capacity);
     return 0;
 }
 
+/*
+ * Refuse new tasks once limit are queued instead of blocking producers
+ */
+void task_queue_set_limit(task_queue_t *queue, int limit) {
+    if (queue == NULL || limit < 0) {
+        return;
+    }
+    queue->limit = limit > queue->max_size ? queue->max_size : limit;
+}
+
 /*
  * Enqueue a new task (client connection)
- * Blocks if queue is full (when max_size > 0)
- * Returns 0 on success, -1 on error
+ * Blocks while the ring is full, unless a limit is set
+ * Returns 0 on success, -1 on error, shutdown or when the limit is reached
  */
 int task_queue_enqueue(task_queue_t *queue, int client_fd) {
-    if (queue == NULL) {
+    if (queue == NULL || queue->slots == NULL) {
         LOG_ERROR(NULL, "task_queue_enqueue: queue is NULL");
         return -1;
     }
 
-    /* Allocate new task */
-    task_t *task = (task_t *)malloc(sizeof(task_t));
-    if (task == NULL) {
-        LOG_ERROR(NULL, "Failed to allocate task: %s", strerror(errno));
-        return -1;
-    }
-
-    task->client_fd = client_fd;
-    task->next = NULL;
-
-    /* Lock mutex */
-    pthread_mutex_lock(&queue->mutex);
-
-    /* Check if shutdown */
-    if (queue->shutdown) {
-        pthread_mutex_unlock(&queue->mutex);
-        free(task);
-        LOG_WARN(NULL, "Cannot enqueue task: queue is shutting down");
+    /* Admission control: a fast refusal beats a reply nobody waits for */
+    if (queue->limit > 0 && task_queue_size(queue) >= queue->limit) {
+        metrics_add(METRIC_SHED_QUEUE_FULL, 1);
+        LOG_DEBUG(NULL, "Queue limit reached (%d tasks), refusing client_fd=%d",
+                  queue->limit, client_fd);
         return -1;
     }
 
-    /* Wait if queue is full (only when max_size > 0) */
-    while (queue->max_size > 0 && queue->count >= queue->max_size) {
-        LOG_DEBUG(NULL, "Queue full (%d/%d), waiting...", queue->count, queue->max_size);
-        pthread_cond_wait(&queue->cond, &queue->mutex);
-
-        /* Check shutdown again after waking up */
-        if (queue->shutdown) {
-            pthread_mutex_unlock(&queue->mutex);
-            free(task);
+    for (;;) {
+        if (__atomic_load_n(&queue->shutdown, __ATOMIC_ACQUIRE)) {
             LOG_WARN(NULL, "Cannot enqueue task: queue is shutting down");
             return -1;
         }
-    }
-
-    /* Add task to queue (FIFO: add to tail) */
-    if (queue->tail == NULL) {
-        /* Queue is empty */
-        queue->head = task;
-        queue->tail = task;
-    } else {
-        /* Queue has items */
-        queue->tail->next = task;
-        queue->tail = task;
-    }
-
-    queue->count++;
 
-    LOG_DEBUG(NULL, "Task enqueued (client_fd=%d, queue_size=%d)", client_fd, queue->count);
+        if (ring_push(queue, client_fd)) {
+            break;
+        }
 
-    /* Signal one waiting worker thread */
-    pthread_cond_signal(&queue->cond);
+        /* Ring full: park until a consumer frees a slot */
+        LOG_DEBUG(NULL, "Queue full (%d slots), waiting...", queue->max_size);
+        uint32_t seq = park_prepare(&queue->not_full);
+        if (ring_push(queue, client_fd)) {
+            park_cancel(&queue->not_full);
+            break;
+        }
+        if (!__atomic_load_n(&queue->shutdown, __ATOMIC_ACQUIRE)) {
+            park_wait(queue, &queue->not_full, seq);
+        }
+        park_cancel(&queue->not_full);
+    }
 
-    /* Unlock mutex */
-    pthread_mutex_unlock(&queue->mutex);
+    LOG_DEBUG(NULL, "Task enqueued (client_fd=%d)", client_fd);
 
+    /* Wake one parked worker, if any */
+    park_notify(queue, &queue->not_empty);
     return 0;
 }
 
 /*
  * Dequeue a task (blocking)
  * Blocks until a task is available or shutdown is signaled
+ * wait_ns (may be NULL) receives how long the task was queued
  * Returns client_fd on success, -1 on shutdown/error
  */
-int task_queue_dequeue(task_queue_t *queue) {
-    if (queue == NULL) {
+int task_queue_dequeue(task_queue_t *queue, uint64_t *wait_ns) {
+    if (queue == NULL || queue->slots == NULL) {
         LOG_ERROR(NULL, "task_queue_dequeue: queue is NULL");
         return -1;
     }
 
-    /* Lock mutex */
-    pthread_mutex_lock(&queue->mutex);
+    int client_fd = -1;
+    uint64_t enqueued_ns = 0;
+    int spins = 0;
 
-    /* Wait for task or shutdown */
-    while (queue->count == 0 && !queue->shutdown) {
-        LOG_DEBUG(NULL, "Queue empty, worker waiting...");
-        pthread_cond_wait(&queue->cond, &queue->mutex);
-    }
+    for (;;) {
+        if (ring_pop(queue, &client_fd, &enqueued_ns)) {
+            break;
+        }
 
-    /* Check if shutdown with no tasks remaining */
-    if (queue->shutdown && queue->count == 0) {
-        pthread_mutex_unlock(&queue->mutex);
-        LOG_DEBUG(NULL, "Queue shutdown, worker exiting");
-        return -1;
-    }
+        /* Queue drained after shutdown: worker exits */
+        if (__atomic_load_n(&queue->shutdown, __ATOMIC_ACQUIRE)) {
+            LOG_DEBUG(NULL, "Queue shutdown, worker exiting");
+            return -1;
+        }
 
-    /* Dequeue task from head (FIFO) */
-    task_t *task = queue->head;
-    queue->head = task->next;
+        /* A producer is often mid-publish; spin briefly before sleeping */
+        if (spins < queue->spin_limit) {
+            spins++;
+            cpu_relax();
+            continue;
+        }
 
-    if (queue->head == NULL) {
-        /* Queue is now empty */
-        queue->tail = NULL;
+        uint32_t seq = park_prepare(&queue->not_empty);
+        if (ring_pop(queue, &client_fd, &enqueued_ns)) {
+            park_cancel(&queue->not_empty);
+            break;
+        }
+        if (!__atomic_load_n(&queue->shutdown, __ATOMIC_ACQUIRE)) {
+            park_wait(queue, &queue->not_empty, seq);
+        }
+        park_cancel(&queue->not_empty);
+        spins = 0;
     }
 
-    queue->count--;
-    int client_fd = task->client_fd;
+    LOG_DEBUG(NULL, "Task dequeued (client_fd=%d)", client_fd);
+    uint64_t waited = metrics_now_ns() - enqueued_ns;
+    metrics_observe(METRIC_QUEUE_WAIT, waited);
+    if (wait_ns != NULL) {
+        *wait_ns = waited;
+    }
 
-    LOG_DEBUG(NULL, "Task dequeued (client_fd=%d, queue_size=%d)", client_fd, queue->count);
+    /* A slot just opened up for a blocked producer */
+    park_notify(queue, &queue->not_full);
+    return client_fd;
+}
 
-    /* Signal that queue has space (for bounded queues) */
-    if (queue->max_size > 0) {
-        pthread_cond_signal(&queue->cond);
+/*
+ * Dequeue a task without blocking
+ * wait_ns (may be NULL) receives how long the task was queued
+ * Returns client_fd on success, -1 if the queue is empty
+ */
+int task_queue_try_dequeue(task_queue_t *queue, uint64_t *wait_ns) {
+    if (queue == NULL || queue->slots == NULL) {
+        return -1;
     }
 
-    /* Unlock mutex */
-    pthread_mutex_unlock(&queue->mutex);
-
-    /* Free task memory */
-    free(task);
+    int client_fd;
+    uint64_t enqueued_ns;
+    if (!ring_pop(queue, &client_fd, &enqueued_ns)) {
+        return -1;
+    }
+    uint64_t waited = metrics_now_ns() - enqueued_ns;
+    metrics_observe(METRIC_QUEUE_WAIT, waited);
+    if (wait_ns != NULL) {
+        *wait_ns = waited;
+    }
 
+    park_notify(queue, &queue->not_full);
     return client_fd;
 }
 
 /*
- * Get current queue size (thread-safe)
+ * Get current queue size (approximate while producers/consumers run)
  * Returns number of tasks in queue
  */
 int task_queue_size(task_queue_t *queue) {
-    if (queue == NULL) {
+    if (queue == NULL || queue->slots == NULL) {
         return 0;
     }
 
-    pthread_mutex_lock(&queue->mutex);
-    int size = queue->count;
-    pthread_mutex_unlock(&queue->mutex);
+    size_t dequeued = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_ACQUIRE);
+    size_t enqueued = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_ACQUIRE);
 
-    return size;
+    /* A dequeue may overtake the enqueue index we read first */
+    if (enqueued <= dequeued) {
+        return 0;
+    }
+    size_t size = enqueued - dequeued;
+    return size > (size_t)queue->max_size ? queue->max_size : (int)size;
 }
 
 /*
@@ -190,18 +396,15 @@ int task_queue_size(task_queue_t *queue) {
  * Returns 0 on success, -1 on error
  */
 int task_queue_shutdown(task_queue_t *queue) {
-    if (queue == NULL) {
+    if (queue == NULL || queue->slots == NULL) {
         return -1;
     }
 
-    pthread_mutex_lock(&queue->mutex);
-
-    queue->shutdown = true;
+    __atomic_store_n(&queue->shutdown, true, __ATOMIC_SEQ_CST);
 
     /* Wake up all waiting threads */
-    pthread_cond_broadcast(&queue->cond);
-
-    pthread_mutex_unlock(&queue->mutex);
+    park_wake(queue, &queue->not_empty, INT32_MAX);
+    park_wake(queue, &queue->not_full, INT32_MAX);
 
     LOG_INFO(NULL, "Task queue shutdown signaled");
     return 0;
@@ -212,27 +415,25 @@ int task_queue_shutdown(task_queue_t *queue) {
  * Should be called after all threads have stopped
  */
 void task_queue_destroy(task_queue_t *queue) {
-    if (queue == NULL) {
+    if (queue == NULL || queue->slots == NULL) {
         return;
     }
 
-    /* Free any remaining tasks */
-    task_t *current = queue->head;
-    while (current != NULL) {
-        task_t *next = current->next;
-        LOG_WARN(NULL, "Dropping unprocessed task (client_fd=%d)", current->client_fd);
-        free(current);
-        current = next;
+    /* Report any remaining tasks (the caller drains the sockets it owns first) */
+    int client_fd;
+    while (ring_pop(queue, &client_fd, NULL)) {
+        LOG_WARN(NULL, "Dropping unprocessed task (client_fd=%d)", client_fd);
     }
 
-    /* Destroy synchronization primitives */
-    pthread_cond_destroy(&queue->cond);
-    pthread_mutex_destroy(&queue->mutex);
+#ifndef __linux__
+    pthread_cond_destroy(&queue->park_cond);
+    pthread_mutex_destroy(&queue->park_mutex);
+#endif
 
-    /* Reset queue */
-    queue->head = NULL;
-    queue->tail = NULL;
-    queue->count = 0;
+    free(queue->slots);
+    queue->slots = NULL;
+    queue->mask = 0;
+    queue->max_size = 0;
 
     LOG_INFO(NULL, "Task queue destroyed");
 }
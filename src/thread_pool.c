@@ -22,7 +22,8 @@ static void *worker_thread(void *arg) {
 
     while (!pool->shutdown) {
         /* Dequeue next task (blocks until task available) */
-        int client_fd = task_queue_dequeue(pool->queue);
+        uint64_t wait_ns = 0;
+        int client_fd = task_queue_dequeue(pool->queue, &wait_ns);
 
         if (client_fd < 0) {
             /* Shutdown signal received or error */
@@ -39,10 +40,12 @@ static void *worker_thread(void *arg) {
         LOG_DEBUG(NULL, "Worker thread %lu processing client_fd=%d",
                   (unsigned long)pthread_self(), client_fd);
 
-        connection_handle(client_fd);
-
-        /* Close the client connection */
-        close(client_fd);
+        if (pool->handler != NULL) {
+            /* Custom handler takes ownership of the fd */
+            pool->handler(client_fd, pool->handler_arg);
+        } else {
+            connection_run(client_fd, wait_ns);
+        }
 
         LOG_DEBUG(NULL, "Worker thread %lu completed client_fd=%d",
                   (unsigned long)pthread_self(), client_fd);
@@ -79,6 +82,8 @@ int thread_pool_init(thread_pool_t *pool, int num_threads, task_queue_t *queue)
     pool->num_threads = num_threads;
     pool->queue = queue;
     pool->shutdown = false;
+    pool->handler = NULL;
+    pool->handler_arg = NULL;
 
     /* Initialize thread IDs to zero */
     for (int i = 0; i < num_threads; i++) {
@@ -89,6 +94,18 @@ int thread_pool_init(thread_pool_t *pool, int num_threads, task_queue_t *queue)
     return 0;
 }
 
+/*
+ * Set the handler workers run for each task
+ */
+void thread_pool_set_handler(thread_pool_t *pool, task_handler_t handler, void *arg) {
+    if (pool == NULL) {
+        return;
+    }
+
+    pool->handler = handler;
+    pool->handler_arg = arg;
+}
+
 /*
  * Start all worker threads in the pool
  * Returns 0 on success, -1 on error
@@ -118,6 +135,21 @@ int thread_pool_start(thread_pool_t *pool) {
     return 0;
 }
 
+/*
+ * Enqueue a client_fd on the pool's shared queue
+ * Returns 0 on success, -1 on error
+ */
+int thread_pool_submit(void *pool, int client_fd, int affinity) {
+    (void)affinity;
+
+    thread_pool_t *thread_pool = (thread_pool_t *)pool;
+    if (thread_pool == NULL) {
+        return -1;
+    }
+
+    return task_queue_enqueue(thread_pool->queue, client_fd);
+}
+
 /*
  * Shutdown thread pool gracefully
  * Waits for all worker threads to finish
@@ -167,6 +199,15 @@ void thread_pool_destroy(thread_pool_t *pool) {
         return;
     }
 
+    /* Connections no worker got to: without a custom handler the pool owns them */
+    if (pool->handler == NULL && pool->queue != NULL) {
+        int client_fd;
+        while ((client_fd = task_queue_try_dequeue(pool->queue, NULL)) >= 0) {
+            LOG_WARN(NULL, "Closing unprocessed connection (client_fd=%d)", client_fd);
+            close(client_fd);
+        }
+    }
+
     /* Free thread array */
     if (pool->threads != NULL) {
         free(pool->threads);
@@ -0,0 +1,316 @@
+/*
+ * C-HTTP Payment Server - Request Phase Tracing
+ *
+ * Each request carries a small record of timestamps, one per phase
+ * boundary (received, parsed, body read, dequeued, handler start/end,
+ * serialized, sent). Stamps are raw TSC reads on x86, so a mark costs a
+ * few nanoseconds; with tracing off every mark is one predictable branch.
+ *
+ * When the response has been sent, the thread that sent it copies the
+ * record into its own ring, unless the request finished faster than the
+ * threshold. The rings are only read at shutdown, after every serving
+ * thread has stopped, so records are written without synchronization.
+ * TSC ticks are converted to time against CLOCK_MONOTONIC measured at
+ * start and stop (the TSC is assumed invariant, as on current x86).
+ *
+ * With <sys/sdt.h> available (HAVE_SDT), each finished request also fires
+ * the USDT probe nanoserve:request (status, ticks, record), so perf or
+ * bpftrace can aggregate them live.
+ */
+
+#include "trace.h"
+#include "logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#ifdef HAVE_SDT
+#include <sys/sdt.h>
+#endif
+
+bool g_trace_enabled = false;
+_Thread_local trace_request_t *t_trace_current = NULL;
+
+/* One thread's completed records */
+typedef struct trace_ring {
+    trace_request_t *records;   /* TRACE_RING_CAPACITY slots */
+    uint64_t written;           /* Records ever written (next slot = written % capacity) */
+    int thread_index;           /* tid in the trace output */
+    struct trace_ring *next;
+} trace_ring_t;
+
+static _Thread_local trace_ring_t *t_trace_ring = NULL;
+
+/* Rings of every thread that kept a record */
+static pthread_mutex_t g_trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static trace_ring_t *g_trace_rings = NULL;
+static int g_trace_ring_count = 0;
+
+/* Output path, threshold and the tick/clock origin */
+static char *g_trace_path = NULL;
+static uint64_t g_trace_threshold_ticks = 0;
+static uint64_t g_trace_origin_ticks = 0;
+static uint64_t g_trace_origin_ns = 0;
+static double g_trace_ticks_per_ns = 1.0;
+
+/* Span names, in mark order */
+static const char *const g_trace_spans[TRACE_MARK_COUNT] = {
+#define TRACE_MARK_SPAN(id, span) span,
+    TRACE_MARKS(TRACE_MARK_SPAN)
+#undef TRACE_MARK_SPAN
+};
+
+/*
+ * Helper function: Current CLOCK_MONOTONIC time in nanoseconds
+ */
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Helper function: Measure ticks per nanosecond since the origin
+ * Returns the rate, or the previous one if too little time has passed
+ */
+static double measure_tick_rate(void) {
+    uint64_t ticks = trace_ticks() - g_trace_origin_ticks;
+    uint64_t ns = monotonic_ns() - g_trace_origin_ns;
+    return ns >= 1000000 ? (double)ticks / (double)ns : g_trace_ticks_per_ns;
+}
+
+/*
+ * Start tracing
+ * Returns 0 on success, -1 on error
+ */
+int trace_start(const char *path, long threshold_us) {
+    if (path == NULL || threshold_us < 0) {
+        LOG_ERROR(NULL, "trace_start: invalid parameters");
+        return -1;
+    }
+
+    /* Fail now rather than after a long run */
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        LOG_ERROR(NULL, "Cannot open trace file %s", path);
+        return -1;
+    }
+    fclose(fp);
+
+    g_trace_path = strdup(path);
+    if (g_trace_path == NULL) {
+        return -1;
+    }
+
+    /* Short calibration for the threshold; the rate is re-measured at stop */
+    g_trace_origin_ticks = trace_ticks();
+    g_trace_origin_ns = monotonic_ns();
+    struct timespec pause = { .tv_sec = 0, .tv_nsec = 10 * 1000000 };
+    nanosleep(&pause, NULL);
+    g_trace_ticks_per_ns = measure_tick_rate();
+    g_trace_threshold_ticks = (uint64_t)((double)threshold_us * 1000.0 * g_trace_ticks_per_ns);
+
+    __atomic_store_n(&g_trace_enabled, true, __ATOMIC_RELEASE);
+    LOG_INFO(NULL, "Tracing requests of %ldus or more to %s (%.3f ticks/ns)",
+             threshold_us, path, g_trace_ticks_per_ns);
+    return 0;
+}
+
+/*
+ * Describe the request a record belongs to
+ */
+void trace_describe(trace_request_t *record, const char *method, const char *uri,
+                    size_t uri_length, int status_code) {
+    if (!trace_enabled() || record == NULL) {
+        return;
+    }
+
+    record->method = method;
+    record->status_code = status_code;
+
+    size_t length = uri_length < TRACE_URI_MAX - 1 ? uri_length : TRACE_URI_MAX - 1;
+    if (uri != NULL) {
+        memcpy(record->uri, uri, length);
+    } else {
+        length = 0;
+    }
+    record->uri[length] = '\0';
+}
+
+/*
+ * Helper function: Create the calling thread's ring
+ * Returns the ring, NULL on error
+ */
+static trace_ring_t *ring_create(void) {
+    trace_ring_t *ring = (trace_ring_t *)calloc(1, sizeof(trace_ring_t));
+    if (ring == NULL) {
+        return NULL;
+    }
+
+    ring->records = (trace_request_t *)malloc(TRACE_RING_CAPACITY * sizeof(trace_request_t));
+    if (ring->records == NULL) {
+        free(ring);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&g_trace_lock);
+    ring->thread_index = g_trace_ring_count++;
+    ring->next = g_trace_rings;
+    g_trace_rings = ring;
+    pthread_mutex_unlock(&g_trace_lock);
+
+    t_trace_ring = ring;
+    return ring;
+}
+
+/*
+ * Finish a record once its response is sent
+ */
+void trace_finish(trace_request_t *record) {
+    if (!trace_enabled() || record == NULL || record->marks[TRACE_RECEIVED] == 0) {
+        return;
+    }
+
+    uint64_t end = record->marks[TRACE_SENT] != 0 ? record->marks[TRACE_SENT] : trace_ticks();
+    uint64_t total = end - record->marks[TRACE_RECEIVED];
+
+#ifdef HAVE_SDT
+    DTRACE_PROBE3(nanoserve, request, record->status_code, total, record);
+#endif
+
+    if (total < g_trace_threshold_ticks) {
+        return;
+    }
+
+    trace_ring_t *ring = t_trace_ring != NULL ? t_trace_ring : ring_create();
+    if (ring == NULL) {
+        return;
+    }
+    ring->records[ring->written % TRACE_RING_CAPACITY] = *record;
+    ring->written++;
+}
+
+/*
+ * Helper function: Write a string as a JSON string literal
+ */
+static void write_json_string(FILE *fp, const char *str) {
+    fputc('"', fp);
+    for (const unsigned char *p = (const unsigned char *)str; *p != '\0'; p++) {
+        if (*p == '"' || *p == '\\') {
+            fputc('\\', fp);
+            fputc(*p, fp);
+        } else if (*p < 0x20 || *p >= 0x7f) {
+            fprintf(fp, "\\u%04x", *p);
+        } else {
+            fputc(*p, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+/*
+ * Helper function: Ticks since the origin in microseconds
+ */
+static double ticks_to_us(uint64_t ticks) {
+    return (double)(ticks - g_trace_origin_ticks) / g_trace_ticks_per_ns / 1000.0;
+}
+
+/*
+ * Helper function: Write one record as a request event plus one per phase
+ */
+static void write_record(FILE *fp, const trace_request_t *record, int tid, bool *first) {
+    uint64_t start = record->marks[TRACE_RECEIVED];
+    uint64_t end = start;
+    for (int m = 0; m < TRACE_MARK_COUNT; m++) {
+        if (record->marks[m] > end) {
+            end = record->marks[m];
+        }
+    }
+
+    fprintf(fp, "%s\n{\"name\":\"request\",\"cat\":\"request\",\"ph\":\"X\",\"pid\":1,"
+            "\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"method\":",
+            *first ? "" : ",", tid, ticks_to_us(start),
+            ticks_to_us(end) - ticks_to_us(start));
+    write_json_string(fp, record->method != NULL ? record->method : "UNKNOWN");
+    fputs(",\"uri\":", fp);
+    write_json_string(fp, record->uri);
+    fprintf(fp, ",\"status\":%d}}", record->status_code);
+    *first = false;
+
+    /* Each phase runs from the previous mark that was reached */
+    uint64_t previous = start;
+    for (int m = TRACE_RECEIVED + 1; m < TRACE_MARK_COUNT; m++) {
+        if (record->marks[m] == 0 || record->marks[m] < previous) {
+            continue;
+        }
+        fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"phase\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                "\"ts\":%.3f,\"dur\":%.3f}",
+                g_trace_spans[m], tid, ticks_to_us(previous),
+                ticks_to_us(record->marks[m]) - ticks_to_us(previous));
+        previous = record->marks[m];
+    }
+}
+
+/*
+ * Stop tracing and write every ring as Chrome trace-event JSON
+ */
+void trace_stop(void) {
+    if (!trace_enabled()) {
+        return;
+    }
+    __atomic_store_n(&g_trace_enabled, false, __ATOMIC_RELEASE);
+    g_trace_ticks_per_ns = measure_tick_rate();
+
+    pthread_mutex_lock(&g_trace_lock);
+    trace_ring_t *rings = g_trace_rings;
+    g_trace_rings = NULL;
+    g_trace_ring_count = 0;
+    pthread_mutex_unlock(&g_trace_lock);
+
+    FILE *fp = fopen(g_trace_path, "w");
+    if (fp == NULL) {
+        LOG_ERROR(NULL, "Cannot write trace file %s", g_trace_path);
+    }
+
+    uint64_t kept = 0;
+    bool first = true;
+    if (fp != NULL) {
+        fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", fp);
+    }
+
+    while (rings != NULL) {
+        trace_ring_t *ring = rings;
+        rings = ring->next;
+
+        if (fp != NULL) {
+            fprintf(fp, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                    "\"args\":{\"name\":\"thread %d\"}}",
+                    first ? "" : ",", ring->thread_index, ring->thread_index);
+            first = false;
+
+            /* Oldest first; a ring that wrapped starts at its next slot */
+            uint64_t count = ring->written < TRACE_RING_CAPACITY ? ring->written
+                                                                  : TRACE_RING_CAPACITY;
+            for (uint64_t i = ring->written - count; i < ring->written; i++) {
+                write_record(fp, &ring->records[i % TRACE_RING_CAPACITY],
+                             ring->thread_index, &first);
+            }
+            kept += count;
+        }
+
+        free(ring->records);
+        free(ring);
+    }
+
+    if (fp != NULL) {
+        fputs("\n]}\n", fp);
+        fclose(fp);
+        LOG_INFO(NULL, "Wrote %llu traced requests to %s", (unsigned long long)kept,
+                 g_trace_path);
+    }
+
+    free(g_trace_path);
+    g_trace_path = NULL;
+    t_trace_ring = NULL;
+}
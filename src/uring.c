@@ -0,0 +1,705 @@
+/*
+ * C-HTTP Payment Server - io_uring
+ * Raw system call bindings; see uring.h
+ *
+ * Only what the server uses is wrapped. Each ring has a single owner
+ * thread: SQEs are filled in locally and published to the kernel with the
+ * next uring_submit()/uring_wait(), so one system call both submits every
+ * request queued since the last one and reaps the completions.
+ */
+
+#include "uring.h"
+#include "logger.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+/* SENDMSG_ZC with usage reports: Linux 6.2 headers */
+#if defined(IORING_SEND_ZC_REPORT_USAGE)
+#define URING_HAVE_KERNEL 1
+#endif
+#endif
+#endif
+
+#ifdef URING_HAVE_KERNEL
+
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+/* SEND_ZC ring per thread: one send, its linked timeout and the notification */
+#define URING_ZC_ENTRIES 4
+
+/*
+ * Helper function: System call wrappers
+ */
+static int sys_setup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags,
+                     const void *arg, size_t arg_size) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_size);
+}
+
+static int sys_register(int fd, unsigned opcode, const void *arg, unsigned count) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+/*
+ * Set up a ring
+ * Returns 0 on success, -1 on error
+ */
+int uring_init(uring_t *ring, unsigned entries, unsigned cq_entries) {
+    if (ring == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+
+    /* Cooperative task running avoids an IPI per completion (Linux 5.19+) */
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+    params.cq_entries = cq_entries;
+    int fd = sys_setup(entries, &params);
+    if (fd < 0 && errno == EINVAL) {
+        memset(&params, 0, sizeof(params));
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = cq_entries;
+        fd = sys_setup(entries, &params);
+    }
+    if (fd < 0) {
+        return -1;
+    }
+
+    unsigned required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+    if ((params.features & required) != required) {
+        close(fd);
+        errno = ENOSYS;
+        return -1;
+    }
+
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->map_size = sq_size > cq_size ? sq_size : cq_size;
+    ring->map = mmap(NULL, ring->map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     fd, IORING_OFF_SQ_RING);
+    if (ring->map == MAP_FAILED) {
+        ring->map = NULL;
+        close(fd);
+        return -1;
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe *)mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                                             MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        munmap(ring->map, ring->map_size);
+        ring->map = NULL;
+        close(fd);
+        return -1;
+    }
+
+    char *base = (char *)ring->map;
+    ring->fd = fd;
+    ring->sq_head = (unsigned *)(base + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(base + params.sq_off.tail);
+    ring->sq_mask = *(unsigned *)(base + params.sq_off.ring_mask);
+    ring->sq_entries = *(unsigned *)(base + params.sq_off.ring_entries);
+    ring->sq_pending = *ring->sq_tail;
+    ring->cq_head = (unsigned *)(base + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(base + params.cq_off.tail);
+    ring->cq_mask = *(unsigned *)(base + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(base + params.cq_off.cqes);
+
+    /* Slot i of the index array always points at SQE i */
+    unsigned *array = (unsigned *)(base + params.sq_off.array);
+    for (unsigned i = 0; i < ring->sq_entries; i++) {
+        array[i] = i;
+    }
+    return 0;
+}
+
+/*
+ * Unmap and close a ring
+ */
+void uring_destroy(uring_t *ring) {
+    if (ring == NULL || ring->fd < 0) {
+        return;
+    }
+
+    munmap(ring->sqes, ring->sqes_size);
+    munmap(ring->map, ring->map_size);
+    close(ring->fd);
+    ring->fd = -1;
+    ring->sqes = NULL;
+    ring->map = NULL;
+}
+
+/*
+ * Check whether the kernel implements an opcode
+ */
+bool uring_supports(uring_t *ring, unsigned opcode) {
+    if (ring == NULL || ring->fd < 0) {
+        return false;
+    }
+
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = (struct io_uring_probe *)calloc(1, size);
+    if (probe == NULL) {
+        return false;
+    }
+
+    bool supported = sys_register(ring->fd, IORING_REGISTER_PROBE, probe, 256) == 0 &&
+                     opcode <= probe->last_op &&
+                     (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED) != 0;
+    free(probe);
+    return supported;
+}
+
+/*
+ * Check whether the kernel accepts multishot
+ * IORING_OP_SOCKET arrived in the same release, and the probe has no
+ * per-flag entries, so it stands in for the multishot flag
+ */
+bool uring_accept_multishot_supported(uring_t *ring) {
+    return uring_supports(ring, IORING_OP_SOCKET);
+}
+
+/*
+ * Submit queued requests without waiting
+ * Returns 0 on success, -1 on error
+ */
+int uring_submit(uring_t *ring) {
+    __atomic_store_n(ring->sq_tail, ring->sq_pending, __ATOMIC_RELEASE);
+    unsigned to_submit = ring->sq_pending - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (to_submit == 0) {
+        return 0;
+    }
+
+    while (sys_enter(ring->fd, to_submit, 0, 0, NULL, 0) < 0) {
+        if (errno == EINTR) {
+            continue;
+        }
+        /* Completions must be reaped first; the entries stay queued */
+        return errno == EAGAIN || errno == EBUSY ? 0 : -1;
+    }
+    return 0;
+}
+
+/*
+ * Helper function: Next free submission entry, zeroed
+ * Flushes the queue to the kernel when it is full
+ */
+static struct io_uring_sqe *get_sqe(uring_t *ring) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sq_pending - head >= ring->sq_entries) {
+        if (uring_submit(ring) < 0) {
+            return NULL;
+        }
+        head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        if (ring->sq_pending - head >= ring->sq_entries) {
+            return NULL;
+        }
+    }
+
+    struct io_uring_sqe *sqe = &ring->sqes[ring->sq_pending & ring->sq_mask];
+    ring->sq_pending++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+/*
+ * Queue a multishot accept
+ */
+int uring_accept(uring_t *ring, int fd, int flags, uint64_t user_data) {
+    struct io_uring_sqe *sqe = get_sqe(ring);
+    if (sqe == NULL) {
+        return -1;
+    }
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->accept_flags = (uint32_t)flags;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = user_data;
+    return 0;
+}
+
+/*
+ * Queue a receive
+ */
+int uring_recv(uring_t *ring, int fd, void *buffer, size_t length, uint16_t group,
+               uint64_t user_data) {
+    struct io_uring_sqe *sqe = get_sqe(ring);
+    if (sqe == NULL) {
+        return -1;
+    }
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buffer;
+    sqe->len = (uint32_t)length;
+    if (buffer == NULL) {
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = group;
+    }
+    sqe->user_data = user_data;
+    return 0;
+}
+
+/*
+ * Queue a one-shot poll
+ */
+int uring_poll(uring_t *ring, int fd, unsigned events, uint64_t user_data) {
+    struct io_uring_sqe *sqe = get_sqe(ring);
+    if (sqe == NULL) {
+        return -1;
+    }
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    sqe->user_data = user_data;
+    return 0;
+}
+
+/*
+ * Queue cancellation of a request
+ */
+int uring_cancel(uring_t *ring, uint64_t target, uint64_t user_data) {
+    struct io_uring_sqe *sqe = get_sqe(ring);
+    if (sqe == NULL) {
+        return -1;
+    }
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = target;
+    sqe->user_data = user_data;
+    return 0;
+}
+
+/*
+ * Submit queued requests and wait for a completion
+ * Returns 0 on success or timeout, -1 on error
+ */
+int uring_wait(uring_t *ring, int timeout_ms) {
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    if (timeout_ms >= 0) {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+    }
+
+    __atomic_store_n(ring->sq_tail, ring->sq_pending, __ATOMIC_RELEASE);
+    unsigned to_submit = ring->sq_pending - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (sys_enter(ring->fd, to_submit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                  &arg, sizeof(arg)) < 0) {
+        if (errno == ETIME || errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+            return 0;
+        }
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Take the next completion off the ring
+ */
+bool uring_next(uring_t *ring, uring_cqe_t *cqe) {
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+
+    const struct io_uring_cqe *entry = &ring->cqes[head & ring->cq_mask];
+    cqe->user_data = entry->user_data;
+    cqe->res = entry->res;
+    cqe->flags = entry->flags;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/*
+ * Helper function: Publish buffer id in the next free slot
+ */
+static void bufs_add(uring_bufs_t *bufs, uint16_t id) {
+    struct io_uring_buf *buf = &bufs->ring->bufs[bufs->tail & (bufs->entries - 1)];
+    buf->addr = (uint64_t)(uintptr_t)(bufs->base + (size_t)id * bufs->size);
+    buf->len = (uint32_t)bufs->size;
+    buf->bid = id;
+    bufs->tail++;
+}
+
+/*
+ * Register a buffer group
+ * Returns 0 on success, -1 on error
+ */
+int uring_bufs_init(uring_t *ring, uring_bufs_t *bufs, uint16_t group, unsigned entries,
+                    size_t size) {
+    if (ring == NULL || bufs == NULL || entries == 0 || entries > 32768 ||
+        (entries & (entries - 1)) != 0 || size == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(bufs, 0, sizeof(*bufs));
+    bufs->entries = entries;
+    bufs->size = size;
+    bufs->group = group;
+    bufs->ring_size = entries * sizeof(struct io_uring_buf);
+
+    /* The ring must be page aligned */
+    void *mapped = mmap(NULL, bufs->ring_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    bufs->base = (char *)malloc(entries * size);
+    if (mapped == MAP_FAILED || bufs->base == NULL) {
+        if (mapped != MAP_FAILED) {
+            munmap(mapped, bufs->ring_size);
+        }
+        free(bufs->base);
+        bufs->base = NULL;
+        errno = ENOMEM;
+        return -1;
+    }
+    bufs->ring = (struct io_uring_buf_ring *)mapped;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)bufs->ring;
+    reg.ring_entries = entries;
+    reg.bgid = group;
+    if (sys_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        int saved = errno;
+        munmap(bufs->ring, bufs->ring_size);
+        free(bufs->base);
+        memset(bufs, 0, sizeof(*bufs));
+        errno = saved;
+        return -1;
+    }
+    bufs->registered = true;
+
+    for (unsigned i = 0; i < entries; i++) {
+        bufs_add(bufs, (uint16_t)i);
+    }
+    __atomic_store_n(&bufs->ring->tail, bufs->tail, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/*
+ * Memory of a buffer
+ */
+char *uring_bufs_data(uring_bufs_t *bufs, uint16_t id) {
+    return bufs->base + (size_t)id * bufs->size;
+}
+
+/*
+ * Hand a buffer back to the kernel
+ */
+void uring_bufs_put(uring_bufs_t *bufs, uint16_t id) {
+    bufs_add(bufs, id);
+    __atomic_store_n(&bufs->ring->tail, bufs->tail, __ATOMIC_RELEASE);
+}
+
+/*
+ * Unregister and free a buffer group
+ */
+void uring_bufs_destroy(uring_t *ring, uring_bufs_t *bufs) {
+    if (bufs == NULL || bufs->ring == NULL) {
+        return;
+    }
+
+    if (bufs->registered && ring != NULL && ring->fd >= 0) {
+        struct io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.bgid = bufs->group;
+        sys_register(ring->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    }
+    munmap(bufs->ring, bufs->ring_size);
+    free(bufs->base);
+    memset(bufs, 0, sizeof(*bufs));
+}
+
+/* SEND_ZC support (probed once) and each thread's ring */
+static pthread_once_t g_zc_once = PTHREAD_ONCE_INIT;
+static bool g_zc_supported = false;
+static pthread_key_t g_zc_key;
+static __thread uring_t *t_zc_ring = NULL;
+static __thread uint64_t t_zc_sequence = 0;
+
+/*
+ * Helper function: Free a thread's SEND_ZC ring at thread exit
+ */
+static void zc_ring_free(void *arg) {
+    uring_t *ring = (uring_t *)arg;
+    uring_destroy(ring);
+    free(ring);
+}
+
+/*
+ * Helper function: Probe SEND_ZC support and create the ring key
+ */
+static void zc_probe(void) {
+    uring_t ring;
+    if (uring_init(&ring, URING_ZC_ENTRIES, URING_ZC_ENTRIES * 2) < 0) {
+        return;
+    }
+    g_zc_supported = uring_supports(&ring, IORING_OP_SENDMSG_ZC) &&
+                     uring_supports(&ring, IORING_OP_LINK_TIMEOUT) &&
+                     pthread_key_create(&g_zc_key, zc_ring_free) == 0;
+    uring_destroy(&ring);
+}
+
+/*
+ * Check once whether SENDMSG_ZC is usable
+ */
+bool uring_send_zc_supported(void) {
+    pthread_once(&g_zc_once, zc_probe);
+    return g_zc_supported;
+}
+
+/*
+ * Helper function: The calling thread's SEND_ZC ring (created on first use)
+ */
+static uring_t *zc_ring(void) {
+    if (t_zc_ring != NULL) {
+        return t_zc_ring;
+    }
+    if (!uring_send_zc_supported()) {
+        return NULL;
+    }
+
+    uring_t *ring = (uring_t *)malloc(sizeof(uring_t));
+    if (ring == NULL || uring_init(ring, URING_ZC_ENTRIES, URING_ZC_ENTRIES * 2) < 0) {
+        free(ring);
+        return NULL;
+    }
+    pthread_setspecific(g_zc_key, ring);
+    t_zc_ring = ring;
+    return ring;
+}
+
+/*
+ * Send iov with SENDMSG_ZC and wait for the pages to be released
+ * Returns bytes sent, -1 on error
+ */
+ssize_t uring_send_zc(int fd, const struct iovec *iov, int iov_count, int flags, int timeout_ms) {
+    uring_t *ring = zc_ring();
+    if (ring == NULL) {
+        errno = ENOSYS;
+        return -1;
+    }
+
+    /* Tags carry a sequence number so completions of an abandoned send are ignored */
+    uint64_t send_tag = ++t_zc_sequence << 1;
+    uint64_t timeout_tag = send_tag | 1;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (struct iovec *)iov;
+    msg.msg_iovlen = (size_t)iov_count;
+
+    struct __kernel_timespec ts;
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+
+    /* The send retries short writes itself (MSG_WAITALL); the timeout bounds it */
+    struct io_uring_sqe *send = get_sqe(ring);
+    struct io_uring_sqe *timeout = send != NULL ? get_sqe(ring) : NULL;
+    if (timeout == NULL) {
+        ring->sq_pending = *ring->sq_tail;
+        errno = EBUSY;
+        return -1;
+    }
+    send->opcode = IORING_OP_SENDMSG_ZC;
+    send->fd = fd;
+    send->addr = (uint64_t)(uintptr_t)&msg;
+    send->len = 1;
+    send->msg_flags = (uint32_t)(flags | MSG_NOSIGNAL | MSG_WAITALL);
+    send->flags = IOSQE_IO_LINK;
+    send->user_data = send_tag;
+
+    timeout->opcode = IORING_OP_LINK_TIMEOUT;
+    timeout->fd = -1;
+    timeout->addr = (uint64_t)(uintptr_t)&ts;
+    timeout->len = 1;
+    timeout->user_data = timeout_tag;
+
+    /* Result, then (if data went out) the notification; the timeout always completes */
+    int32_t result = 0;
+    bool have_result = false;
+    bool notified = false;
+    bool timed = false;
+    uint64_t deadline_wait = (uint64_t)timeout_ms * 2;
+    while (!have_result || !notified || !timed) {
+        if (uring_wait(ring, (int)deadline_wait) < 0) {
+            return -1;
+        }
+
+        uring_cqe_t cqe;
+        bool progress = false;
+        while (uring_next(ring, &cqe)) {
+            progress = true;
+            if (cqe.user_data == timeout_tag) {
+                timed = true;
+            } else if (cqe.user_data == send_tag && (cqe.flags & IORING_CQE_F_NOTIF) != 0) {
+                notified = true;
+            } else if (cqe.user_data == send_tag) {
+                have_result = true;
+                result = cqe.res;
+                if ((cqe.flags & IORING_CQE_F_MORE) == 0) {
+                    notified = true;
+                }
+            }
+        }
+        if (!progress) {
+            /* Pages still pinned after twice the timeout: the peer is gone */
+            LOG_WARN(NULL, "Timed out waiting for SEND_ZC completion (fd=%d)", fd);
+            errno = ETIMEDOUT;
+            return -1;
+        }
+    }
+
+    if (result < 0) {
+        errno = result == -ECANCELED ? ETIMEDOUT : -result;
+        return -1;
+    }
+    return result;
+}
+
+#else /* !URING_HAVE_KERNEL */
+
+int uring_init(uring_t *ring, unsigned entries, unsigned cq_entries) {
+    (void)entries;
+    (void)cq_entries;
+    if (ring != NULL) {
+        memset(ring, 0, sizeof(*ring));
+        ring->fd = -1;
+    }
+    errno = ENOSYS;
+    return -1;
+}
+
+void uring_destroy(uring_t *ring) {
+    (void)ring;
+}
+
+bool uring_supports(uring_t *ring, unsigned opcode) {
+    (void)ring;
+    (void)opcode;
+    return false;
+}
+
+bool uring_accept_multishot_supported(uring_t *ring) {
+    (void)ring;
+    return false;
+}
+
+int uring_accept(uring_t *ring, int fd, int flags, uint64_t user_data) {
+    (void)ring;
+    (void)fd;
+    (void)flags;
+    (void)user_data;
+    return -1;
+}
+
+int uring_recv(uring_t *ring, int fd, void *buffer, size_t length, uint16_t group,
+               uint64_t user_data) {
+    (void)ring;
+    (void)fd;
+    (void)buffer;
+    (void)length;
+    (void)group;
+    (void)user_data;
+    return -1;
+}
+
+int uring_poll(uring_t *ring, int fd, unsigned events, uint64_t user_data) {
+    (void)ring;
+    (void)fd;
+    (void)events;
+    (void)user_data;
+    return -1;
+}
+
+int uring_cancel(uring_t *ring, uint64_t target, uint64_t user_data) {
+    (void)ring;
+    (void)target;
+    (void)user_data;
+    return -1;
+}
+
+int uring_submit(uring_t *ring) {
+    (void)ring;
+    return -1;
+}
+
+int uring_wait(uring_t *ring, int timeout_ms) {
+    (void)ring;
+    (void)timeout_ms;
+    return -1;
+}
+
+bool uring_next(uring_t *ring, uring_cqe_t *cqe) {
+    (void)ring;
+    (void)cqe;
+    return false;
+}
+
+int uring_bufs_init(uring_t *ring, uring_bufs_t *bufs, uint16_t group, unsigned entries,
+                    size_t size) {
+    (void)ring;
+    (void)group;
+    (void)entries;
+    (void)size;
+    if (bufs != NULL) {
+        memset(bufs, 0, sizeof(*bufs));
+    }
+    errno = ENOSYS;
+    return -1;
+}
+
+char *uring_bufs_data(uring_bufs_t *bufs, uint16_t id) {
+    (void)bufs;
+    (void)id;
+    return NULL;
+}
+
+void uring_bufs_put(uring_bufs_t *bufs, uint16_t id) {
+    (void)bufs;
+    (void)id;
+}
+
+void uring_bufs_destroy(uring_t *ring, uring_bufs_t *bufs) {
+    (void)ring;
+    (void)bufs;
+}
+
+bool uring_send_zc_supported(void) {
+    return false;
+}
+
+ssize_t uring_send_zc(int fd, const struct iovec *iov, int iov_count, int flags, int timeout_ms) {
+    (void)fd;
+    (void)iov;
+    (void)iov_count;
+    (void)flags;
+    (void)timeout_ms;
+    errno = ENOSYS;
+    return -1;
+}
+
+#endif /* URING_HAVE_KERNEL */
@@ -0,0 +1,30 @@
+/*
+ * C-HTTP Payment Server - Utility Functions Implementation
+ */
+
+#include "utils.h"
+#include <string.h>
+
+/*
+ * Check if path contains directory traversal attempts
+ * Any ".." segment counts, with either '/' or '\' as the separator
+ * Returns 1 if it does, 0 otherwise
+ */
+int path_has_traversal(const char *path) {
+    if (path == NULL) {
+        return 0;
+    }
+
+    const char *segment = path;
+    for (const char *p = path;; p++) {
+        if (*p == '/' || *p == '\\' || *p == '\0') {
+            if (p - segment == 2 && segment[0] == '.' && segment[1] == '.') {
+                return 1;
+            }
+            if (*p == '\0') {
+                return 0;
+            }
+            segment = p + 1;
+        }
+    }
+}
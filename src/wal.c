@@ -0,0 +1,935 @@
+/*
+ * C-HTTP Payment Server - Idempotency Write-Ahead Log
+ *
+ * A cached response may only become replayable once it would survive a
+ * crash; otherwise a client that retries after a restart gets its payment
+ * processed twice. Every completed response is therefore appended to the
+ * log and synced before the store lets duplicates see it.
+ *
+ * Syncing per record would cap throughput at the device's sync rate, so
+ * commits are grouped: appenders copy their record into a pending buffer
+ * and sleep; a single flusher thread writes the whole batch and issues one
+ * fdatasync once commit_batch records are pending or the oldest has waited
+ * commit_us, then wakes every appender the sync covered.
+ *
+ * The log is a sequence of segments (wal-<generation>.log). A snapshot
+ * (snapshot-<generation>) holds every response replayable when it was
+ * taken and replaces all segments older than its generation. To take one,
+ * the snapshot thread has the flusher start a new segment, waits until each
+ * record of the old segment has been installed in the store, then dumps
+ * the store. Records of the new segment may also appear in the snapshot;
+ * replaying them again afterwards is harmless because later records for a
+ * key replace earlier ones. Responses the store evicted are not kept.
+ *
+ * Files are in host byte order (recorded in the header) and only read back
+ * by the machine that wrote them. A record is rejected by length or
+ * checksum, which marks where a crash tore the tail of a segment.
+ */
+
+#include "wal.h"
+#include "logger.h"
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+/* 32-bit FNV-1a parameters (record checksums) */
+#define WAL_FNV_OFFSET 2166136261u
+#define WAL_FNV_PRIME 16777619u
+
+/* Largest record accepted when reading (bounds a corrupt length) */
+#define WAL_RECORD_MAX ((uint32_t)64 * 1024 * 1024)
+
+/* Buffer for writing snapshots */
+#define WAL_SNAPSHOT_BUFFER (1024 * 1024)
+
+/*
+ * Record header, followed by key, content type and body bytes
+ * checksum covers everything after itself
+ */
+typedef struct {
+    uint32_t length;            /* Whole record in bytes */
+    uint32_t checksum;
+    uint64_t digest;            /* Digest of the original request */
+    int64_t expire_unix;        /* Wall-clock second the response stops being replayable */
+    uint32_t body_length;
+    uint16_t status_code;
+    uint16_t key_length;
+    uint16_t content_type_length;
+    uint16_t reserved[3];       /* Zero (pads to 8 bytes) */
+} wal_record_t;
+
+_Static_assert(sizeof(wal_record_t) == 40, "wal_record_t must not be padded");
+
+/* Kinds of log file */
+typedef enum {
+    WAL_FILE_NONE = 0,
+    WAL_FILE_SEGMENT,
+    WAL_FILE_SNAPSHOT
+} wal_file_t;
+
+/*
+ * Fill log settings with built-in defaults
+ */
+void wal_config_init_defaults(wal_config_t *config) {
+    if (config == NULL) {
+        return;
+    }
+
+    config->dir = NULL;
+    config->commit_us = WAL_DEFAULT_COMMIT_US;
+    config->commit_batch = WAL_DEFAULT_COMMIT_BATCH;
+    config->snapshot_sec = WAL_DEFAULT_SNAPSHOT_SEC;
+}
+
+/*
+ * Helper function: Checksum of a record's bytes after the checksum field
+ */
+static uint32_t record_checksum(const char *record, size_t length) {
+    uint32_t hash = WAL_FNV_OFFSET;
+    for (size_t i = offsetof(wal_record_t, digest); i < length; i++) {
+        hash ^= (unsigned char)record[i];
+        hash *= WAL_FNV_PRIME;
+    }
+    return hash;
+}
+
+/*
+ * Helper function: Path of a log file
+ */
+static void file_path(const wal_t *wal, wal_file_t kind, uint64_t generation,
+                      const char *suffix, char *path, size_t size) {
+    snprintf(path, size, "%s/%s-%llu%s%s", wal->dir,
+             kind == WAL_FILE_SEGMENT ? "wal" : "snapshot",
+             (unsigned long long)generation, kind == WAL_FILE_SEGMENT ? ".log" : "", suffix);
+}
+
+/*
+ * Helper function: Classify a directory entry by name
+ * Returns its kind, WAL_FILE_NONE if it is not a log file
+ */
+static wal_file_t parse_name(const char *name, uint64_t *generation) {
+    wal_file_t kind;
+    const char *digits;
+    if (strncmp(name, "wal-", 4) == 0) {
+        kind = WAL_FILE_SEGMENT;
+        digits = name + 4;
+    } else if (strncmp(name, "snapshot-", 9) == 0) {
+        kind = WAL_FILE_SNAPSHOT;
+        digits = name + 9;
+    } else {
+        return WAL_FILE_NONE;
+    }
+
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(digits, &end, 10);
+    if (errno != 0 || end == digits || value == 0) {
+        return WAL_FILE_NONE;
+    }
+    if (strcmp(end, kind == WAL_FILE_SEGMENT ? ".log" : "") != 0) {
+        return WAL_FILE_NONE;
+    }
+
+    *generation = value;
+    return kind;
+}
+
+/*
+ * Helper function: Sync the log directory so created, renamed and
+ * removed files persist
+ * Returns 0 on success, -1 on error
+ */
+static int sync_dir(const wal_t *wal) {
+    int fd = open(wal->dir, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        return -1;
+    }
+    int result = fsync(fd);
+    close(fd);
+    return result;
+}
+
+/*
+ * Helper function: Write a whole buffer, retrying short writes
+ * Returns 0 on success, -1 on error
+ */
+static int write_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += written;
+        length -= (size_t)written;
+    }
+    return 0;
+}
+
+/*
+ * Helper function: Fill a file header
+ */
+static void header_init(char header[WAL_HEADER_SIZE]) {
+    uint32_t version = WAL_VERSION;
+    uint32_t byte_order = WAL_BYTE_ORDER;
+    memcpy(header, WAL_MAGIC, 8);
+    memcpy(header + 8, &version, sizeof(version));
+    memcpy(header + 12, &byte_order, sizeof(byte_order));
+}
+
+/*
+ * Helper function: Open and validate a log file for reading
+ * Returns the stream positioned at the first record, NULL on error
+ */
+static FILE *file_open(const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        LOG_WARN(NULL, "Cannot open idempotency log file %s: %s", path, strerror(errno));
+        return NULL;
+    }
+
+    char expected[WAL_HEADER_SIZE];
+    char header[WAL_HEADER_SIZE];
+    header_init(expected);
+    if (fread(header, 1, sizeof(header), fp) != sizeof(header) ||
+        memcmp(header, expected, sizeof(header)) != 0) {
+        LOG_WARN(NULL, "Ignoring %s: torn header, or not a log of this version and byte order",
+                 path);
+        fclose(fp);
+        return NULL;
+    }
+
+    return fp;
+}
+
+/*
+ * Helper function: Replay every record of a file into the store, up to
+ * the first torn or corrupt one
+ * Returns the number of records read, -1 if the file could not be read
+ */
+static long replay_file(wal_t *wal, const char *path, time_t now) {
+    FILE *fp = file_open(path);
+    if (fp == NULL) {
+        return -1;
+    }
+
+    char *buffer = NULL;
+    size_t capacity = 0;
+    long records = 0;
+    long restored = 0;
+
+    for (;;) {
+        wal_record_t header;
+        size_t got = fread(&header, 1, sizeof(header), fp);
+        if (got == 0 && feof(fp)) {
+            break;
+        }
+        if (got != sizeof(header) || header.length < sizeof(header) ||
+            header.length > WAL_RECORD_MAX ||
+            header.length != sizeof(header) + (size_t)header.key_length +
+                             header.content_type_length + header.body_length) {
+            LOG_WARN(NULL, "%s: torn or corrupt record after %ld records, ignoring the rest",
+                     path, records);
+            break;
+        }
+
+        if (header.length > capacity) {
+            char *grown = (char *)realloc(buffer, header.length);
+            if (grown == NULL) {
+                LOG_ERROR(NULL, "%s: out of memory replaying the idempotency log", path);
+                break;
+            }
+            buffer = grown;
+            capacity = header.length;
+        }
+
+        memcpy(buffer, &header, sizeof(header));
+        size_t rest = header.length - sizeof(header);
+        if (fread(buffer + sizeof(header), 1, rest, fp) != rest ||
+            record_checksum(buffer, header.length) != header.checksum) {
+            LOG_WARN(NULL, "%s: torn or corrupt record after %ld records, ignoring the rest",
+                     path, records);
+            break;
+        }
+        records++;
+
+        if (header.expire_unix <= (int64_t)now) {
+            continue;
+        }
+
+        /* Never keep a response longer than the store's current TTL */
+        int64_t ttl = header.expire_unix - (int64_t)now;
+        if (ttl > wal->store->ttl_sec) {
+            ttl = wal->store->ttl_sec;
+        }
+
+        const char *key = buffer + sizeof(header);
+        const char *content_type = key + header.key_length;
+        const char *body = content_type + header.content_type_length;
+        char type[IDEMPOTENCY_MAX_CONTENT_TYPE];
+        size_t type_length = header.content_type_length < sizeof(type) - 1
+                                 ? header.content_type_length : sizeof(type) - 1;
+        memcpy(type, content_type, type_length);
+        type[type_length] = '\0';
+
+        if (idempotency_restore(wal->store, key, header.key_length, header.digest,
+                                header.status_code, type, body, header.body_length,
+                                (int)ttl) == 0) {
+            restored++;
+        }
+    }
+
+    free(buffer);
+    fclose(fp);
+    LOG_DEBUG(NULL, "Replayed %s: %ld records, %ld restored", path, records, restored);
+    return records;
+}
+
+/*
+ * Helper function: Find the log's files
+ * snapshot: newest snapshot generation (0 = none)
+ * newest: highest generation of any file (0 = empty directory)
+ * oldest: lowest segment generation at or after the snapshot (0 = none)
+ * Returns 0 on success, -1 on error
+ */
+static int scan_dir(const wal_t *wal, uint64_t *snapshot, uint64_t *newest, uint64_t *oldest) {
+    DIR *dir = opendir(wal->dir);
+    if (dir == NULL) {
+        LOG_ERROR(NULL, "Cannot read idempotency log directory %s: %s", wal->dir,
+                  strerror(errno));
+        return -1;
+    }
+
+    /* Two passes: segment bounds depend on the snapshot */
+    *snapshot = 0;
+    *newest = 0;
+    *oldest = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        rewinddir(dir);
+        struct dirent *dirent;
+        while ((dirent = readdir(dir)) != NULL) {
+            uint64_t generation;
+            wal_file_t kind = parse_name(dirent->d_name, &generation);
+            if (kind == WAL_FILE_NONE) {
+                continue;
+            }
+            if (pass == 0) {
+                if (kind == WAL_FILE_SNAPSHOT && generation > *snapshot) {
+                    *snapshot = generation;
+                }
+                if (generation > *newest) {
+                    *newest = generation;
+                }
+            } else if (kind == WAL_FILE_SEGMENT && generation >= *snapshot &&
+                       (*oldest == 0 || generation < *oldest)) {
+                *oldest = generation;
+            }
+        }
+    }
+
+    closedir(dir);
+    return 0;
+}
+
+/*
+ * Helper function: Remove every snapshot and segment older than generation
+ */
+static void remove_older(const wal_t *wal, uint64_t generation) {
+    DIR *dir = opendir(wal->dir);
+    if (dir == NULL) {
+        return;
+    }
+
+    int removed = 0;
+    struct dirent *dirent;
+    while ((dirent = readdir(dir)) != NULL) {
+        /* Snapshots left half-written by a crash go too */
+        uint64_t file_generation;
+        size_t name_length = strlen(dirent->d_name);
+        bool partial = strncmp(dirent->d_name, "snapshot-", 9) == 0 && name_length > 4 &&
+                       strcmp(dirent->d_name + name_length - 4, ".tmp") == 0;
+        if (!partial && (parse_name(dirent->d_name, &file_generation) == WAL_FILE_NONE ||
+                         file_generation >= generation)) {
+            continue;
+        }
+
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", wal->dir, dirent->d_name);
+        if (unlink(path) != 0) {
+            LOG_WARN(NULL, "Cannot remove %s: %s", path, strerror(errno));
+        } else {
+            removed++;
+        }
+    }
+    closedir(dir);
+
+    if (removed > 0) {
+        sync_dir(wal);
+    }
+}
+
+/*
+ * Open the log directory and, if replay is set, replay it into store
+ * Returns 0 on success, -1 on error
+ */
+int wal_open(wal_t *wal, const wal_config_t *config, idempotency_store_t *store, bool replay) {
+    if (wal == NULL || config == NULL || config->dir == NULL || store == NULL) {
+        LOG_ERROR(NULL, "wal_open: invalid parameters");
+        return -1;
+    }
+
+    memset(wal, 0, sizeof(*wal));
+    wal->fd = -1;
+    wal->store = store;
+    wal->commit_us = config->commit_us > 0 ? config->commit_us : WAL_DEFAULT_COMMIT_US;
+    wal->commit_batch = config->commit_batch > 0 ? config->commit_batch
+                                                 : WAL_DEFAULT_COMMIT_BATCH;
+    wal->snapshot_sec = config->snapshot_sec > 0 ? config->snapshot_sec
+                                                 : WAL_DEFAULT_SNAPSHOT_SEC;
+
+    wal->dir = strdup(config->dir);
+    if (wal->dir == NULL) {
+        return -1;
+    }
+
+    if (mkdir(wal->dir, 0700) != 0 && errno != EEXIST) {
+        LOG_ERROR(NULL, "Cannot create idempotency log directory %s: %s", wal->dir,
+                  strerror(errno));
+        free(wal->dir);
+        wal->dir = NULL;
+        return -1;
+    }
+
+    uint64_t snapshot, newest, oldest;
+    if (scan_dir(wal, &snapshot, &newest, &oldest) != 0) {
+        free(wal->dir);
+        wal->dir = NULL;
+        return -1;
+    }
+
+    time_t now = time(NULL);
+    long records = 0;
+    char path[PATH_MAX];
+
+    if (replay && snapshot > 0) {
+        file_path(wal, WAL_FILE_SNAPSHOT, snapshot, "", path, sizeof(path));
+        long read = replay_file(wal, path, now);
+        records += read > 0 ? read : 0;
+    }
+
+    /* Segments carry on from the snapshot; a missing one only means it was empty */
+    for (uint64_t generation = oldest; replay && oldest > 0 && generation <= newest;
+         generation++) {
+        file_path(wal, WAL_FILE_SEGMENT, generation, "", path, sizeof(path));
+        if (access(path, F_OK) == 0) {
+            long read = replay_file(wal, path, now);
+            records += read > 0 ? read : 0;
+        }
+    }
+
+    wal->snapshot_generation = snapshot;
+    wal->generation = newest + 1;
+    remove_older(wal, snapshot);
+
+    pthread_mutex_init(&wal->lock, NULL);
+    pthread_cond_init(&wal->wake, NULL);
+    pthread_cond_init(&wal->synced, NULL);
+    pthread_cond_init(&wal->applied, NULL);
+
+    LOG_INFO(NULL, "Idempotency log %s: replayed %ld records (snapshot %llu, segments to %llu)",
+             wal->dir, records, (unsigned long long)snapshot, (unsigned long long)newest);
+    return 0;
+}
+
+/*
+ * Helper function: Create a segment and write its header
+ * Returns the descriptor, -1 on error
+ */
+static int segment_create(const wal_t *wal, uint64_t generation) {
+    char path[PATH_MAX];
+    file_path(wal, WAL_FILE_SEGMENT, generation, "", path, sizeof(path));
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        LOG_ERROR(NULL, "Cannot create idempotency log segment %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    char header[WAL_HEADER_SIZE];
+    header_init(header);
+    if (write_all(fd, header, sizeof(header)) != 0 || fdatasync(fd) != 0 ||
+        sync_dir(wal) != 0) {
+        LOG_ERROR(NULL, "Cannot initialize idempotency log segment %s: %s", path,
+                  strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/*
+ * Helper function: Write and sync one batch (called without the lock)
+ * Returns 0 on success, -1 on error
+ */
+static int flush_batch(int fd, const char *batch, size_t length) {
+    if (write_all(fd, batch, length) != 0 || fdatasync(fd) != 0) {
+        LOG_ERROR(NULL, "Idempotency log write failed: %s; responses are no longer durable",
+                  strerror(errno));
+        return -1;
+    }
+    metrics_add(METRIC_WAL_SYNCS, 1);
+    return 0;
+}
+
+/*
+ * Helper function: Absolute CLOCK_REALTIME deadline delay_ns from now
+ */
+static struct timespec deadline_after(uint64_t delay_ns) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += (time_t)(delay_ns / 1000000000ull);
+    deadline.tv_nsec += (long)(delay_ns % 1000000000ull);
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    return deadline;
+}
+
+/*
+ * Helper function: Flusher thread
+ * Group commit: sleeps until a batch fills or its oldest record has waited
+ * commit_us, then writes and syncs the batch outside the lock
+ */
+static void *flusher_thread(void *arg) {
+    wal_t *wal = (wal_t *)arg;
+    char *spare = NULL;
+    size_t spare_capacity = 0;
+
+    pthread_mutex_lock(&wal->lock);
+    for (;;) {
+        while (wal->pending_records == 0 && !wal->rotate && !wal->shutdown) {
+            pthread_cond_wait(&wal->wake, &wal->lock);
+        }
+        if (wal->pending_records == 0 && wal->shutdown) {
+            break;
+        }
+
+        /* Let the batch fill until its oldest record has waited commit_us */
+        uint64_t due = wal->first_pending_ns + (uint64_t)wal->commit_us * 1000;
+        while (wal->pending_records > 0 && wal->pending_records < wal->commit_batch &&
+               !wal->rotate && !wal->shutdown) {
+            uint64_t now = metrics_now_ns();
+            if (now >= due) {
+                break;
+            }
+            struct timespec deadline = deadline_after(due - now);
+            if (pthread_cond_timedwait(&wal->wake, &wal->lock, &deadline) == ETIMEDOUT) {
+                break;
+            }
+        }
+
+        /* Take the batch; appenders fill the spare buffer meanwhile */
+        char *batch = wal->pending;
+        size_t length = wal->pending_length;
+        uint64_t lsn = wal->appended_lsn;
+        wal->pending = spare;
+        spare = batch;
+        size_t capacity = wal->pending_capacity;
+        wal->pending_capacity = spare_capacity;
+        spare_capacity = capacity;
+        wal->pending_length = 0;
+        wal->pending_records = 0;
+
+        /* Rotate after this batch: later appends belong to the next segment */
+        bool rotate = wal->rotate;
+        uint64_t generation = wal->generation;
+        if (rotate) {
+            wal->generation++;
+            wal->rotate = false;
+        }
+        int fd = wal->fd;
+        bool failed = wal->failed;
+        pthread_mutex_unlock(&wal->lock);
+
+        int result = failed ? -1 : 0;
+        if (!failed && length > 0) {
+            result = flush_batch(fd, batch, length);
+        }
+        int next_fd = fd;
+        if (rotate && result == 0) {
+            next_fd = segment_create(wal, generation + 1);
+            if (next_fd < 0) {
+                result = -1;
+            } else {
+                close(fd);
+            }
+        }
+
+        pthread_mutex_lock(&wal->lock);
+        wal->fd = next_fd;
+        if (result == 0) {
+            wal->durable_lsn = lsn;
+            wal->segment_bytes = rotate ? 0 : wal->segment_bytes + length;
+        } else {
+            wal->failed = true;
+        }
+        pthread_cond_broadcast(&wal->synced);
+    }
+    pthread_mutex_unlock(&wal->lock);
+
+    free(spare);
+    return NULL;
+}
+
+/* Snapshot being written (state for snapshot_visit) */
+typedef struct {
+    FILE *fp;
+    time_t now;
+    char *buffer;
+    size_t capacity;
+    long records;
+} snapshot_writer_t;
+
+/*
+ * Helper function: Encode a record at offset in a growable buffer
+ * Returns the record length, 0 if it does not fit the format or out of memory
+ */
+static size_t record_encode(char **buffer, size_t *capacity, size_t offset,
+                            const char *key, size_t key_length, uint64_t digest,
+                            int status_code, const char *content_type,
+                            const char *body, size_t body_length, int64_t expire_unix) {
+    size_t type_length = content_type != NULL ? strlen(content_type) : 0;
+    if (key_length > UINT16_MAX || type_length > UINT16_MAX || body_length > UINT32_MAX ||
+        sizeof(wal_record_t) + key_length + type_length + body_length > WAL_RECORD_MAX) {
+        return 0;
+    }
+
+    size_t length = sizeof(wal_record_t) + key_length + type_length + body_length;
+    if (offset + length > *capacity) {
+        size_t grown_capacity = *capacity > 0 ? *capacity : 4096;
+        while (grown_capacity < offset + length) {
+            grown_capacity *= 2;
+        }
+        char *grown = (char *)realloc(*buffer, grown_capacity);
+        if (grown == NULL) {
+            return 0;
+        }
+        *buffer = grown;
+        *capacity = grown_capacity;
+    }
+
+    wal_record_t header = {
+        .length = (uint32_t)length,
+        .digest = digest,
+        .expire_unix = expire_unix,
+        .body_length = (uint32_t)body_length,
+        .status_code = (uint16_t)status_code,
+        .key_length = (uint16_t)key_length,
+        .content_type_length = (uint16_t)type_length
+    };
+
+    char *record = *buffer + offset;
+    char *p = record + sizeof(header);
+    memcpy(p, key, key_length);
+    p += key_length;
+    memcpy(p, content_type, type_length);
+    p += type_length;
+    if (body_length > 0) {
+        memcpy(p, body, body_length);
+    }
+
+    memcpy(record, &header, sizeof(header));
+    header.checksum = record_checksum(record, length);
+    memcpy(record, &header, sizeof(header));
+    return length;
+}
+
+/*
+ * Helper function: Write one store entry to the snapshot (shard lock held)
+ * Returns 0 to continue, -1 on write error
+ */
+static int snapshot_visit(void *arg, const idempotency_entry_t *entry, int ttl_sec) {
+    snapshot_writer_t *writer = (snapshot_writer_t *)arg;
+    const idempotency_response_t *response = entry->response;
+
+    size_t length = record_encode(&writer->buffer, &writer->capacity, 0, entry->key,
+                                  entry->key_length, entry->digest, response->status_code,
+                                  response->content_type, response->body,
+                                  response->body_length, (int64_t)writer->now + ttl_sec);
+    if (length == 0) {
+        return 0;
+    }
+
+    if (fwrite(writer->buffer, 1, length, writer->fp) != length) {
+        return -1;
+    }
+    writer->records++;
+    return 0;
+}
+
+/*
+ * Helper function: Write snapshot-<generation> from the store
+ * Returns 0 on success, -1 on error
+ */
+static int snapshot_write(wal_t *wal, uint64_t generation) {
+    char path[PATH_MAX];
+    char tmp_path[PATH_MAX];
+    file_path(wal, WAL_FILE_SNAPSHOT, generation, "", path, sizeof(path));
+    file_path(wal, WAL_FILE_SNAPSHOT, generation, ".tmp", tmp_path, sizeof(tmp_path));
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    FILE *fp = fd >= 0 ? fdopen(fd, "wb") : NULL;
+    if (fp == NULL) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        LOG_ERROR(NULL, "Cannot create snapshot %s: %s", tmp_path, strerror(errno));
+        return -1;
+    }
+    setvbuf(fp, NULL, _IOFBF, WAL_SNAPSHOT_BUFFER);
+
+    char header[WAL_HEADER_SIZE];
+    header_init(header);
+    snapshot_writer_t writer = { .fp = fp, .now = time(NULL) };
+
+    int result = fwrite(header, 1, sizeof(header), fp) == sizeof(header) ? 0 : -1;
+    if (result == 0) {
+        result = idempotency_store_visit(wal->store, snapshot_visit, &writer);
+    }
+    if (result == 0 && (fflush(fp) != 0 || fsync(fileno(fp)) != 0)) {
+        result = -1;
+    }
+    if (fclose(fp) != 0) {
+        result = -1;
+    }
+    free(writer.buffer);
+
+    /* Only a complete snapshot gets its final name */
+    if (result != 0 || rename(tmp_path, path) != 0 || sync_dir(wal) != 0) {
+        LOG_ERROR(NULL, "Cannot write snapshot %s: %s", path, strerror(errno));
+        unlink(tmp_path);
+        return -1;
+    }
+
+    LOG_INFO(NULL, "Idempotency log snapshot %s: %ld responses", path, writer.records);
+    return 0;
+}
+
+/*
+ * Helper function: Snapshot thread
+ * Once the interval passes with new records, or the segment grows past
+ * WAL_SNAPSHOT_BYTES: rotate, wait for the old segment's records to reach
+ * the store, dump the store, then drop everything the snapshot replaced
+ */
+static void *snapshotter_thread(void *arg) {
+    wal_t *wal = (wal_t *)arg;
+    uint64_t last_snapshot_ns = metrics_now_ns();
+
+    pthread_mutex_lock(&wal->lock);
+    while (!wal->shutdown) {
+        struct timespec deadline = deadline_after(1000000000ull);
+        pthread_cond_timedwait(&wal->applied, &wal->lock, &deadline);
+
+        uint64_t now = metrics_now_ns();
+        bool due = wal->segment_bytes > 0 &&
+                   now - last_snapshot_ns >= (uint64_t)wal->snapshot_sec * 1000000000ull;
+        if (wal->shutdown || wal->failed || (!due && wal->segment_bytes < WAL_SNAPSHOT_BYTES)) {
+            continue;
+        }
+
+        /* Barrier: every record of the old segment is synced and installed */
+        uint64_t old_generation = wal->generation;
+        wal->rotate = true;
+        pthread_cond_signal(&wal->wake);
+        while (wal->generation == old_generation && !wal->shutdown && !wal->failed) {
+            pthread_cond_wait(&wal->synced, &wal->lock);
+        }
+        while (wal->unapplied[old_generation & 1] > 0 && !wal->shutdown) {
+            pthread_cond_wait(&wal->applied, &wal->lock);
+        }
+        if (wal->shutdown || wal->failed) {
+            continue;
+        }
+        pthread_mutex_unlock(&wal->lock);
+
+        uint64_t generation = old_generation + 1;
+        if (snapshot_write(wal, generation) == 0) {
+            remove_older(wal, generation);
+            wal->snapshot_generation = generation;
+        }
+        last_snapshot_ns = metrics_now_ns();
+
+        pthread_mutex_lock(&wal->lock);
+    }
+    pthread_mutex_unlock(&wal->lock);
+
+    return NULL;
+}
+
+/*
+ * Start a new segment and the log threads
+ * Returns 0 on success, -1 on error
+ */
+int wal_start(wal_t *wal) {
+    if (wal == NULL || wal->dir == NULL || wal->started) {
+        return -1;
+    }
+
+    wal->fd = segment_create(wal, wal->generation);
+    if (wal->fd < 0) {
+        return -1;
+    }
+
+    if (pthread_create(&wal->flusher, NULL, flusher_thread, wal) != 0) {
+        LOG_ERROR(NULL, "Failed to create idempotency log flusher thread");
+        return -1;
+    }
+
+    if (pthread_create(&wal->snapshotter, NULL, snapshotter_thread, wal) != 0) {
+        LOG_ERROR(NULL, "Failed to create idempotency log snapshot thread");
+        pthread_mutex_lock(&wal->lock);
+        wal->shutdown = true;
+        pthread_cond_broadcast(&wal->wake);
+        pthread_mutex_unlock(&wal->lock);
+        pthread_join(wal->flusher, NULL);
+        return -1;
+    }
+
+    wal->started = true;
+    idempotency_store_set_wal(wal->store, wal);
+    LOG_INFO(NULL, "Idempotency log segment %llu: group commit every %dus or %d records",
+             (unsigned long long)wal->generation, wal->commit_us, wal->commit_batch);
+    return 0;
+}
+
+/*
+ * Sync pending records, stop the threads and close the log
+ */
+void wal_close(wal_t *wal) {
+    if (wal == NULL || wal->dir == NULL) {
+        return;
+    }
+
+    if (wal->started) {
+        idempotency_store_set_wal(wal->store, NULL);
+
+        pthread_mutex_lock(&wal->lock);
+        wal->shutdown = true;
+        pthread_cond_broadcast(&wal->wake);
+        pthread_cond_broadcast(&wal->applied);
+        pthread_cond_broadcast(&wal->synced);
+        pthread_mutex_unlock(&wal->lock);
+
+        pthread_join(wal->snapshotter, NULL);
+        pthread_join(wal->flusher, NULL);
+        wal->started = false;
+    }
+
+    if (wal->fd >= 0) {
+        close(wal->fd);
+        wal->fd = -1;
+    }
+
+    pthread_cond_destroy(&wal->applied);
+    pthread_cond_destroy(&wal->synced);
+    pthread_cond_destroy(&wal->wake);
+    pthread_mutex_destroy(&wal->lock);
+
+    free(wal->pending);
+    wal->pending = NULL;
+    free(wal->dir);
+    wal->dir = NULL;
+}
+
+/*
+ * Append one completed response
+ * Returns 0 and fills *ticket on success, -1 if the log has failed
+ */
+int wal_append(wal_t *wal, const char *key, size_t key_length, uint64_t digest,
+               int status_code, const char *content_type, const char *body,
+               size_t body_length, int64_t expire_unix, wal_ticket_t *ticket) {
+    if (wal == NULL || key == NULL || ticket == NULL) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&wal->lock);
+
+    if (wal->failed || wal->shutdown) {
+        pthread_mutex_unlock(&wal->lock);
+        return -1;
+    }
+
+    /* Encode straight into the pending batch */
+    size_t length = record_encode(&wal->pending, &wal->pending_capacity, wal->pending_length,
+                                  key, key_length, digest, status_code, content_type,
+                                  body, body_length, expire_unix);
+    if (length == 0) {
+        pthread_mutex_unlock(&wal->lock);
+        LOG_WARN(NULL, "Idempotency key %.*s not logged (too large or out of memory)",
+                 (int)key_length, key);
+        return -1;
+    }
+
+    wal->pending_length += length;
+    wal->pending_records++;
+    if (wal->pending_records == 1) {
+        wal->first_pending_ns = metrics_now_ns();
+    }
+    ticket->lsn = ++wal->appended_lsn;
+    ticket->generation = wal->generation;
+    wal->unapplied[wal->generation & 1]++;
+
+    /* The flusher sleeps until the first record, then until the batch fills */
+    if (wal->pending_records == 1 || wal->pending_records >= wal->commit_batch) {
+        pthread_cond_signal(&wal->wake);
+    }
+
+    pthread_mutex_unlock(&wal->lock);
+    return 0;
+}
+
+/*
+ * Wait until the record behind ticket is on disk
+ * Returns 0 once durable, -1 if the log failed first
+ */
+int wal_wait(wal_t *wal, const wal_ticket_t *ticket) {
+    if (wal == NULL || ticket == NULL) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&wal->lock);
+    while (wal->durable_lsn < ticket->lsn && !wal->failed) {
+        pthread_cond_wait(&wal->synced, &wal->lock);
+    }
+    int result = wal->durable_lsn >= ticket->lsn ? 0 : -1;
+    pthread_mutex_unlock(&wal->lock);
+
+    return result;
+}
+
+/*
+ * Report that the record behind ticket is installed in the store
+ */
+void wal_applied(wal_t *wal, const wal_ticket_t *ticket) {
+    if (wal == NULL || ticket == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&wal->lock);
+    if (--wal->unapplied[ticket->generation & 1] == 0) {
+        pthread_cond_broadcast(&wal->applied);
+    }
+    pthread_mutex_unlock(&wal->lock);
+}
@@ -136,7 +136,7 @@ fi
 
 # Test 3: HTTP headers check
 run_test "HTTP headers validation"
-HEADERS=$(curl -s -I http://localhost:$PORT/)
+HEADERS=$(curl -s -I http://localhost:$PORT/health)
 if echo "$HEADERS" | grep -q "HTTP/1.1 200 OK"; then
     print_pass "Correct HTTP status line"
 else
@@ -185,6 +185,15 @@ else
     print_fail "Server failed to handle POST"
 fi
 
+# Test 5b: Client values are escaped in JSON bodies
+run_test "Idempotency key with JSON metacharacters"
+RESPONSE=$(curl -s -X POST -H 'X-Idempotency-Key: k"1\x' -d '{}' http://localhost:$PORT/payments)
+if echo "$RESPONSE" | grep -qF '"idempotency_key":"k\"1\\x"'; then
+    print_pass "Idempotency key escaped in the response body"
+else
+    print_fail "Idempotency key not escaped: $RESPONSE"
+fi
+
 # Test 6: PUT request
 run_test "PUT request"
 RESPONSE=$(curl -s -X PUT -d "update=data" http://localhost:$PORT/resource)
@@ -203,6 +212,17 @@ else
     print_fail "Server failed to handle DELETE"
 fi
 
+# Test 7b: Unknown paths and methods are not served
+run_test "Unknown routes get 404, wrong methods 405"
+NOT_FOUND=$(curl -s -o /dev/null -w "%{http_code}" http://localhost:$PORT/no-such-route)
+HEADERS=$(curl -s -i -X PUT -d "x" http://localhost:$PORT/payments)
+if [ "$NOT_FOUND" = "404" ] && echo "$HEADERS" | grep -q "405 Method Not Allowed" && \
+   echo "$HEADERS" | grep -qi "^Allow: POST"; then
+    print_pass "404 for unknown paths, 405 with Allow for wrong methods"
+else
+    print_fail "Unknown path got $NOT_FOUND, PUT /payments: $(echo "$HEADERS" | head -1)"
+fi
+
 echo ""
 echo "=========================================="
 echo "  Edge Case Tests"
@@ -263,13 +283,36 @@ fi
 
 # Test 12: Connection timeout/close behavior
 run_test "Connection close behavior"
-RESPONSE=$(curl -s -v http://localhost:$PORT/ 2>&1)
-if echo "$RESPONSE" | grep -q "Connection.*close"; then
+RESPONSE=$(curl -s -v -H "Connection: close" http://localhost:$PORT/ 2>&1)
+if echo "$RESPONSE" | grep -q "Connection: close"; then
     print_pass "Server properly closes connections"
 else
     print_fail "Connection close behavior unclear"
 fi
 
+# Test 12b: Keep-alive connection reuse
+run_test "Keep-alive connection reuse"
+RESPONSE=$(curl -s -v http://localhost:$PORT/ka1 http://localhost:$PORT/ka2 2>&1)
+if echo "$RESPONSE" | grep -q "Re-using existing connection"; then
+    print_pass "Server keeps HTTP/1.1 connections alive"
+else
+    print_fail "Connection was not reused"
+fi
+
+# Test 12c: HEAD responses carry no body, so the next response on the connection parses
+run_test "HEAD then GET on one connection"
+RESPONSE=$(printf "HEAD /health HTTP/1.1\r\nHost: x\r\n\r\nHEAD /missing HTTP/1.1\r\n\
+Host: x\r\n\r\nGET /health HTTP/1.1\r\nHost: x\r\nConnection: close\r\n\r\n" | \
+    timeout 5 nc localhost $PORT)
+STATUS_LINES=$(echo "$RESPONSE" | grep -c '^HTTP/1.1 ')
+BODIES=$(echo "$RESPONSE" | grep -c '^{')
+if [ "$STATUS_LINES" -eq 3 ] && [ "$BODIES" -eq 1 ] && \
+   echo "$RESPONSE" | tail -1 | grep -q '"status":"ok"'; then
+    print_pass "HEAD responses have headers only"
+else
+    print_fail "HEAD then GET got $STATUS_LINES responses and $BODIES bodies"
+fi
+
 echo ""
 echo "=========================================="
 echo "  Malformed Request Tests"
@@ -303,6 +346,118 @@ else
     print_fail "Server doesn't handle empty request"
 fi
 
+# Requests whose body would be parsed as a second request if its length were misread
+SMUGGLED='GET /smuggled HTTP/1.1\r\nHost: x\r\n\r\n'
+
+# Count status lines sent back for a raw request
+count_responses() {
+    RESPONSE=$(printf "$1" | timeout 5 nc localhost $PORT)
+    STATUS_LINES=$(echo "$RESPONSE" | grep -c '^HTTP/1.1 ')
+}
+
+# Test 16: Non-numeric Content-Length
+run_test "Invalid Content-Length"
+count_responses "POST /pay HTTP/1.1\r\nHost: x\r\nContent-Length: 3x\r\n\r\n$SMUGGLED"
+if [ "$STATUS_LINES" -eq 1 ] && echo "$RESPONSE" | grep -q "400 Bad Request"; then
+    print_pass "Invalid Content-Length rejected with a single 400"
+else
+    print_fail "Invalid Content-Length got $STATUS_LINES responses"
+fi
+
+# Test 17: Conflicting Content-Length headers
+run_test "Conflicting Content-Length headers"
+count_responses "POST /pay HTTP/1.1\r\nHost: x\r\nContent-Length: 5\r\n\
+Content-Length: 0\r\n\r\n$SMUGGLED"
+if [ "$STATUS_LINES" -eq 1 ] && echo "$RESPONSE" | grep -q "400 Bad Request"; then
+    print_pass "Conflicting Content-Length rejected with a single 400"
+else
+    print_fail "Conflicting Content-Length got $STATUS_LINES responses"
+fi
+
+# Test 17b: Repeated idempotency key
+run_test "Repeated X-Idempotency-Key headers"
+count_responses "POST /payments HTTP/1.1\r\nHost: x\r\nX-Idempotency-Key: a\r\n\
+X-Idempotency-Key: b\r\nContent-Length: 0\r\n\r\n"
+if [ "$STATUS_LINES" -eq 1 ] && echo "$RESPONSE" | grep -q "400 Bad Request"; then
+    print_pass "Repeated idempotency key rejected with 400"
+else
+    print_fail "Repeated idempotency key got $STATUS_LINES responses"
+fi
+
+# Test 17c: Header lines proxies read differently (RFC 9112 section 5.1)
+run_test "Whitespace before the colon and lines without one"
+count_responses "POST /payments HTTP/1.1\r\nHost: x\r\nContent-Length : 5\r\n\r\n$SMUGGLED"
+SPACED=$STATUS_LINES
+count_responses "GET /health HTTP/1.1\r\nHost: x\r\nNo-Colon\r\n\r\n"
+if [ "$SPACED" -eq 1 ] && [ "$STATUS_LINES" -eq 1 ] && \
+   echo "$RESPONSE" | grep -q "400 Bad Request"; then
+    print_pass "Malformed header lines rejected with 400"
+else
+    print_fail "Malformed header lines got $SPACED and $STATUS_LINES responses"
+fi
+
+# Test 18: Header value longer than the parser keeps
+run_test "Over-long header value"
+LONG_VALUE=$(head -c 5000 /dev/zero | tr '\0' 'A')
+count_responses "GET / HTTP/1.1\r\nHost: x\r\nX-Long: $LONG_VALUE\r\n\r\n"
+if [ "$STATUS_LINES" -eq 1 ] && echo "$RESPONSE" | grep -q "400 Bad Request"; then
+    print_pass "Over-long header value rejected with 400"
+else
+    print_fail "Over-long header value got $STATUS_LINES responses"
+fi
+
+echo ""
+echo "=========================================="
+echo "  Write-Ahead Log Tests"
+echo "=========================================="
+echo ""
+
+# Test 19: A response the log failed to sync must not be reported or replayed
+run_test "Failed log sync is not acknowledged"
+WAL_PORT=$((PORT + 1))
+WAL_DIR=$(mktemp -d)
+WAL_FAIL=$WAL_DIR/fail-sync
+WAL_SHIM=$WAL_DIR/fail_sync.so
+cat > $WAL_DIR/fail_sync.c <<'SHIM'
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* fdatasync() fails with EIO while the file named by WAL_FAIL_SYNC exists */
+int fdatasync(int fd) {
+    const char *flag = getenv("WAL_FAIL_SYNC");
+    if (flag != NULL && access(flag, F_OK) == 0) {
+        errno = EIO;
+        return -1;
+    }
+    int (*real)(int) = (int (*)(int))dlsym(RTLD_NEXT, "fdatasync");
+    return real(fd);
+}
+SHIM
+if cc -shared -fPIC -o $WAL_SHIM $WAL_DIR/fail_sync.c -ldl 2>/dev/null; then
+    WAL_FAIL_SYNC=$WAL_FAIL LD_PRELOAD=$WAL_SHIM ./bin/c-http-payment-server -p $WAL_PORT \
+        --idempotency-log $WAL_DIR > $WAL_DIR/server.log 2>&1 &
+    WAL_PID=$!
+    sleep 1
+    touch $WAL_FAIL
+    FIRST=$(curl -s -o /dev/null -w "%{http_code}" -X POST -H "X-Idempotency-Key: wal-1" \
+        -d '{"amount":1}' http://localhost:$WAL_PORT/payments)
+    SECOND=$(curl -s -i -X POST -H "X-Idempotency-Key: wal-1" -d '{"amount":1}' \
+        http://localhost:$WAL_PORT/payments)
+    kill -TERM $WAL_PID 2>/dev/null
+    wait $WAL_PID 2>/dev/null
+    if [ "$FIRST" = "503" ] && ! echo "$SECOND" | grep -qi "X-Idempotent-Replayed"; then
+        print_pass "Unsynced response answered 503 and not replayed"
+    else
+        print_fail "Unsynced response got $FIRST, retry: $(echo "$SECOND" | head -1)"
+    fi
+else
+    print_fail "Could not build the fdatasync shim"
+fi
+rm -rf $WAL_DIR
+
 echo ""
 echo "=========================================="
 echo "  Server Logs Analysis"
@@ -0,0 +1,79 @@
+/*
+ * C-HTTP Payment Server - Audit Log Decoder
+ * Prints binary audit records (--audit-log) as text, one line per record
+ *
+ * Records from different threads may appear out of order; pipe through
+ * sort(1) to order them by timestamp
+ *
+ * Usage: log_decode [FILE]    (reads stdin without FILE or with "-")
+ */
+
+#include "audit.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Bytes read per chunk (holds at least one whole record) */
+#define DECODE_CHUNK (64 * 1024)
+
+int main(int argc, char *argv[]) {
+    if (argc > 2) {
+        fprintf(stderr, "Usage: %s [FILE]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    FILE *in = stdin;
+    if (argc == 2 && strcmp(argv[1], "-") != 0) {
+        in = fopen(argv[1], "rb");
+        if (in == NULL) {
+            perror(argv[1]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    uint8_t header[AUDIT_HEADER_SIZE];
+    if (fread(header, 1, sizeof(header), in) != sizeof(header) ||
+        audit_check_header(header, sizeof(header)) < 0) {
+        fprintf(stderr, "Not an audit log (or written by another version/byte order)\n");
+        return EXIT_FAILURE;
+    }
+
+    static uint8_t buffer[DECODE_CHUNK];
+    size_t filled = 0;
+    unsigned long long offset = AUDIT_HEADER_SIZE;
+    char line[2 * AUDIT_RECORD_MAX];
+
+    for (;;) {
+        size_t got = fread(buffer + filled, 1, sizeof(buffer) - filled, in);
+        filled += got;
+
+        size_t pos = 0;
+        int used;
+        while ((used = audit_decode(buffer + pos, filled - pos, line, sizeof(line))) > 0) {
+            puts(line);
+            pos += (size_t)used;
+            offset += (unsigned long long)used;
+        }
+        if (used < 0) {
+            fprintf(stderr, "Malformed record at offset %llu\n", offset);
+            return EXIT_FAILURE;
+        }
+
+        memmove(buffer, buffer + pos, filled - pos);
+        filled -= pos;
+
+        if (got == 0) {
+            break;
+        }
+    }
+
+    if (filled > 0) {
+        fprintf(stderr, "Truncated record at offset %llu (%zu bytes)\n", offset, filled);
+        return EXIT_FAILURE;
+    }
+
+    if (in != stdin) {
+        fclose(in);
+    }
+    return EXIT_SUCCESS;
+}